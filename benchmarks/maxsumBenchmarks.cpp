@@ -0,0 +1,476 @@
+/**
+ * @file maxsumBenchmarks.cpp
+ * Performance benchmarks for the max-sum library, built on Google Benchmark.
+ * Workloads are generated grid graphs, random k-ary factor graphs and graph
+ * colouring problems, with sizes given by their number of edges.
+ *
+ * In addition to the usual Google Benchmark flags, such as
+ * --benchmark_out=results.json --benchmark_out_format=json, this program
+ * accepts --max_edges=N, which sets the size of the largest generated
+ * graph. Sizes run from 10^3 edges up to this limit in powers of 10, and
+ * the default is 10^5 to keep runs short.
+ */
+
+#include "maxsum/common.h"
+#include "maxsum/DiscreteFunction.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/PostOffice.h"
+#include "../tests/testUtils.h"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+using namespace maxsum;
+
+/**
+ * Convenience typedef for a map of factors.
+ */
+typedef MaxSumController::FactorMap FactorMap_m;
+
+/**
+ * Domain size of every variable in the generated graphs.
+ */
+const ValIndex DOMAIN_SIZE_M = 3;
+
+/**
+ * Offset added to the ids of variables used by function benchmarks, so that
+ * they do not clash with graph variables.
+ */
+const VarID FUNCTION_VAR_BASE_M = 1000000000;
+
+/**
+ * Domain size of the variables used by function benchmarks.
+ */
+const ValIndex FUNCTION_DOMAIN_SIZE_M = 4;
+
+/**
+ * Smallest generated graph size, in edges.
+ */
+const long MIN_EDGES_M = 1000;
+
+/**
+ * Default largest generated graph size, in edges.
+ */
+const long DEFAULT_MAX_EDGES_M = 100000;
+
+/**
+ * Number of max-sum iterations timed by each optimise benchmark.
+ */
+const int OPTIMISE_ITERATIONS_M = 10;
+
+/**
+ * Function used to generate a workload with approximately a given number
+ * of edges.
+ */
+typedef void (*Generator_m)(long noEdges, FactorMap_m& factors);
+
+/**
+ * Fills a factor with uniformly random utilities in [0,1).
+ */
+void genRandomUtil_m(DiscreteFunction& factor)
+{
+   for(ValIndex k=0; k<factor.domainSize(); ++k)
+   {
+      factor(k) = static_cast<ValType>(std::rand()) / RAND_MAX;
+   }
+}
+
+/**
+ * Registers the first n graph variables.
+ */
+void registerGraphVars_m(long n)
+{
+   for(long k=0; k<n; ++k)
+   {
+      registerVariable(static_cast<VarID>(k),DOMAIN_SIZE_M);
+   }
+}
+
+/**
+ * Generates a square grid with a pairwise factor between each pair of
+ * horizontally or vertically adjacent variables. Each factor has two
+ * edges, so a w by w grid has about 4w^2 edges.
+ */
+void genGrid_m(long noEdges, FactorMap_m& factors)
+{
+   factors.clear();
+   long width = 2;
+   while(4*width*width < noEdges)
+   {
+      ++width;
+   }
+   registerGraphVars_m(width*width);
+
+   FactorID id = 0;
+   for(long row=0; row<width; ++row)
+   {
+      for(long col=0; col<width; ++col)
+      {
+         const VarID var = static_cast<VarID>(row*width+col);
+         const VarID below = var + static_cast<VarID>(width);
+         VarID vars[2] = { var, var+1 };
+         if(col+1<width)
+         {
+            DiscreteFunction factor(vars,vars+2);
+            genRandomUtil_m(factor);
+            factors[id++] = factor;
+         }
+         vars[1] = below;
+         if(row+1<width)
+         {
+            DiscreteFunction factor(vars,vars+2);
+            genRandomUtil_m(factor);
+            factors[id++] = factor;
+         }
+      }
+   }
+}
+
+/**
+ * Generates factors of arity 3 over random variables, with on average
+ * three factors per variable.
+ */
+void genRandomKary_m(long noEdges, FactorMap_m& factors)
+{
+   const int ARITY = 3;
+   factors.clear();
+   const long noFactors = std::max(1L,noEdges/ARITY);
+   const long noVars = std::max(static_cast<long>(ARITY),noFactors);
+   registerGraphVars_m(noVars);
+
+   std::srand(1);
+   for(long f=0; f<noFactors; ++f)
+   {
+      std::set<VarID> vars;
+      while(static_cast<int>(vars.size())<ARITY)
+      {
+         vars.insert(static_cast<VarID>(std::rand()%noVars));
+      }
+      std::vector<VarID> sorted(vars.begin(),vars.end());
+      DiscreteFunction factor(sorted.begin(),sorted.end());
+      genRandomUtil_m(factor);
+      factors[static_cast<FactorID>(f)] = factor;
+   }
+}
+
+/**
+ * Generates a graph colouring problem on a random graph, with one
+ * pairwise factor per edge of the graph, and on average four neighbours
+ * per variable.
+ */
+void genColouring_m(long noEdges, FactorMap_m& factors)
+{
+   factors.clear();
+   const long noFactors = std::max(1L,noEdges/2);
+   const long noVars = std::max(2L,noFactors/2);
+   registerGraphVars_m(noVars);
+
+   std::srand(2);
+   for(long f=0; f<noFactors; ++f)
+   {
+      VarID vars[2];
+      vars[0] = static_cast<VarID>(std::rand()%noVars);
+      do
+      {
+         vars[1] = static_cast<VarID>(std::rand()%noVars);
+      } while(vars[0]==vars[1]);
+
+      DiscreteFunction factor(vars,vars+2);
+      genColourUtil_m(factor);
+      factors[static_cast<FactorID>(f)] = factor;
+   }
+}
+
+/**
+ * Returns the number of edges in a generated graph.
+ */
+long countEdges_m(const FactorMap_m& factors)
+{
+   long count = 0;
+   for(FactorMap_m::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      count += it->second.noVars();
+   }
+   return count;
+}
+
+/**
+ * Measures the message throughput of MaxSumController::optimise() over a
+ * fixed number of iterations, from zero messages.
+ */
+void benchOptimise_m
+(
+ benchmark::State& state,
+ Generator_m generate,
+ bool compiled
+)
+{
+   FactorMap_m factors;
+   generate(state.range(0),factors);
+
+   MaxSumController base(OPTIMISE_ITERATIONS_M,0);
+   for(FactorMap_m::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      base.setFactor(it->first,it->second);
+   }
+   if(compiled)
+   {
+      base.compile();
+   }
+
+   long msgCount = 0;
+   for(auto _ : state)
+   {
+      state.PauseTiming();
+      MaxSumController controller(base);
+      state.ResumeTiming();
+
+      controller.optimise();
+      msgCount += controller.noRecomputedMsgs();
+   }
+
+   state.counters["edges"] = static_cast<double>(base.noEdges());
+   state.counters["msgs_per_sec"] =
+      benchmark::Counter(static_cast<double>(msgCount),
+            benchmark::Counter::kIsRate);
+}
+
+/**
+ * Measures building a MaxSumController from a map of factors.
+ */
+void benchConstruction_m(benchmark::State& state, Generator_m generate)
+{
+   FactorMap_m factors;
+   generate(state.range(0),factors);
+
+   for(auto _ : state)
+   {
+      MaxSumController controller;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         controller.setFactor(it->first,it->second);
+      }
+      benchmark::DoNotOptimize(controller.noEdges());
+   }
+
+   state.SetItemsProcessed(state.iterations()*countEdges_m(factors));
+}
+
+/**
+ * Returns a function over the first n function benchmark variables.
+ */
+DiscreteFunction functionOver_m(int n)
+{
+   std::vector<VarID> vars;
+   for(int k=0; k<n; ++k)
+   {
+      vars.push_back(FUNCTION_VAR_BASE_M+k);
+      registerVariable(vars.back(),FUNCTION_DOMAIN_SIZE_M);
+   }
+   DiscreteFunction result(vars.begin(),vars.end());
+   genRandomUtil_m(result);
+   return result;
+}
+
+/**
+ * Measures maxMarginal() from a function of state.range(0) variables onto
+ * its middle variable.
+ */
+void BM_MaxMarginal(benchmark::State& state)
+{
+   const int noVars = static_cast<int>(state.range(0));
+   const DiscreteFunction in = functionOver_m(noVars);
+   DiscreteFunction out(FUNCTION_VAR_BASE_M+noVars/2,0);
+
+   for(auto _ : state)
+   {
+      maxMarginal(in,out);
+      benchmark::DoNotOptimize(&out(0));
+   }
+   state.SetItemsProcessed(state.iterations()*in.domainSize());
+}
+
+/**
+ * Measures operator+= where the right hand side depends on a strict subset
+ * of the left hand side's domain.
+ */
+void BM_MixedDomainAdd(benchmark::State& state)
+{
+   const int noVars = static_cast<int>(state.range(0));
+   DiscreteFunction lhs = functionOver_m(noVars);
+   VarID rhsVars[2] = { FUNCTION_VAR_BASE_M, FUNCTION_VAR_BASE_M+noVars-1 };
+   DiscreteFunction rhs(rhsVars,rhsVars+2);
+   genRandomUtil_m(rhs);
+
+   for(auto _ : state)
+   {
+      lhs += rhs;
+      benchmark::DoNotOptimize(&lhs(0));
+   }
+   state.SetItemsProcessed(state.iterations()*lhs.domainSize());
+}
+
+/**
+ * Measures evaluation of a fused expression over three functions, two of
+ * which depend on strict subsets of the result's domain.
+ */
+void BM_MixedDomainExpression(benchmark::State& state)
+{
+   const int noVars = static_cast<int>(state.range(0));
+   const DiscreteFunction a = functionOver_m(noVars);
+   VarID bVars[2] = { FUNCTION_VAR_BASE_M, FUNCTION_VAR_BASE_M+noVars-1 };
+   DiscreteFunction b(bVars,bVars+2);
+   genRandomUtil_m(b);
+   DiscreteFunction c(FUNCTION_VAR_BASE_M+noVars/2,0);
+   genRandomUtil_m(c);
+   DiscreteFunction result(a);
+
+   for(auto _ : state)
+   {
+      result = a + b - c*2;
+      benchmark::DoNotOptimize(&result(0));
+   }
+   state.SetItemsProcessed(state.iterations()*result.domainSize());
+}
+
+/**
+ * Measures PostOffice::addEdge for a bipartite graph with state.range(0)
+ * edges, and three edges per sender.
+ */
+void BM_PostOfficeAddEdge(benchmark::State& state)
+{
+   const long noEdges = state.range(0);
+   registerGraphVars_m(1);
+   const DiscreteFunction msg(static_cast<VarID>(0),0);
+
+   for(auto _ : state)
+   {
+      util::F2VPostOffice office;
+      for(long e=0; e<noEdges; ++e)
+      {
+         office.addEdge(static_cast<FactorID>(e/3),static_cast<VarID>(e),msg);
+      }
+      benchmark::DoNotOptimize(office.numOfEdges());
+   }
+   state.SetItemsProcessed(state.iterations()*noEdges);
+}
+
+/**
+ * Measures PostOffice::swapOutBoxes for every sender in a bipartite graph
+ * with state.range(0) edges, and three edges per sender.
+ */
+void BM_PostOfficeSwapOutBoxes(benchmark::State& state)
+{
+   const long noEdges = state.range(0);
+   registerGraphVars_m(1);
+   const DiscreteFunction msg(static_cast<VarID>(0),0);
+
+   util::F2VPostOffice office;
+   for(long e=0; e<noEdges; ++e)
+   {
+      office.addEdge(static_cast<FactorID>(e/3),static_cast<VarID>(e),msg);
+   }
+   const long noSenders = (noEdges+2)/3;
+
+   for(auto _ : state)
+   {
+      for(long s=0; s<noSenders; ++s)
+      {
+         office.swapOutBoxes(static_cast<FactorID>(s));
+      }
+   }
+   state.SetItemsProcessed(state.iterations()*noSenders);
+}
+
+/**
+ * Parses and removes the --max_edges flag from the command line.
+ * @returns the largest graph size to benchmark.
+ */
+long parseMaxEdges_m(int& argc, char** argv)
+{
+   const char FLAG[] = "--max_edges=";
+   long maxEdges = DEFAULT_MAX_EDGES_M;
+   int out = 1;
+   for(int k=1; k<argc; ++k)
+   {
+      if(0==std::strncmp(argv[k],FLAG,sizeof(FLAG)-1))
+      {
+         maxEdges = std::atol(argv[k]+sizeof(FLAG)-1);
+      }
+      else
+      {
+         argv[out++] = argv[k];
+      }
+   }
+   argc = out;
+   return std::max(MIN_EDGES_M,maxEdges);
+}
+
+int main(int argc, char** argv)
+{
+   const long maxEdges = parseMaxEdges_m(argc,argv);
+
+   //***************************************************************************
+   // Register graph benchmarks for each workload at each size
+   //***************************************************************************
+   struct Workload { const char* name; Generator_m generate; };
+   const Workload workloads[] = {
+      { "Grid", genGrid_m },
+      { "RandomKary", genRandomKary_m },
+      { "Colouring", genColouring_m } };
+
+   for(int w=0; w<3; ++w)
+   {
+      const std::string name = workloads[w].name;
+      const Generator_m generate = workloads[w].generate;
+      for(int compiled=0; compiled<2; ++compiled)
+      {
+         benchmark::RegisterBenchmark(
+               ((compiled ? "BM_OptimiseCompiled/" : "BM_Optimise/")
+                + name).c_str(),
+               [generate,compiled](benchmark::State& state)
+               {
+                  benchOptimise_m(state,generate,0!=compiled);
+               })
+            ->RangeMultiplier(10)->Range(MIN_EDGES_M,maxEdges)
+            ->Unit(benchmark::kMillisecond);
+      }
+
+      benchmark::RegisterBenchmark(("BM_Construction/" + name).c_str(),
+            [generate](benchmark::State& state)
+            {
+               benchConstruction_m(state,generate);
+            })
+         ->RangeMultiplier(10)->Range(MIN_EDGES_M,maxEdges)
+         ->Unit(benchmark::kMillisecond);
+   }
+
+   //***************************************************************************
+   // Register function and post office benchmarks
+   //***************************************************************************
+   benchmark::RegisterBenchmark("BM_MaxMarginal",BM_MaxMarginal)
+      ->DenseRange(3,9,2);
+   benchmark::RegisterBenchmark("BM_MixedDomainAdd",BM_MixedDomainAdd)
+      ->DenseRange(3,9,2);
+   benchmark::RegisterBenchmark("BM_MixedDomainExpression",
+         BM_MixedDomainExpression)->DenseRange(3,9,2);
+   benchmark::RegisterBenchmark("BM_PostOfficeAddEdge",BM_PostOfficeAddEdge)
+      ->RangeMultiplier(10)->Range(MIN_EDGES_M,maxEdges)
+      ->Unit(benchmark::kMillisecond);
+   benchmark::RegisterBenchmark("BM_PostOfficeSwapOutBoxes",
+         BM_PostOfficeSwapOutBoxes)
+      ->RangeMultiplier(10)->Range(MIN_EDGES_M,maxEdges);
+
+   benchmark::Initialize(&argc,argv);
+   if(benchmark::ReportUnrecognizedArguments(argc,argv))
+   {
+      return EXIT_FAILURE;
+   }
+   benchmark::RunSpecifiedBenchmarks();
+   benchmark::Shutdown();
+   return EXIT_SUCCESS;
+
+} // function main
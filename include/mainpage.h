@@ -505,6 +505,31 @@ namespace maxsum {
  * factor values, or the shape of the factor graph can change over time.
  * For further information, see the manual page for MaxSumController. 
  *
+ * @subsection warm_start Incremental Re-optimisation
+ * MaxSumController keeps all of its messages between calls to
+ * MaxSumController::optimise, so each call is warm started from the
+ * result of the last. Only the factors and variables that are notified of a
+ * change have their messages recomputed, and these changes only spread
+ * through the graph while messages change by more than the maxnorm
+ * threshold. This makes it efficient to re-optimise after changing a few
+ * factors, for example in a control loop:
+ * <pre>
+ * controller.optimise(); // initial solution
+ * while(running)
+ * {
+ *    // change a factor's values in place, and tell the controller about it
+ *    DiscreteFunction& f = controller.getUnSafeWritableFactorHandle(id);
+ *    f(0) += 1;
+ *    controller.notifyFactor(id);
+ *
+ *    // or replace a factor entirely (this may also change the graph)
+ *    controller.setFactor(otherId,newFactor);
+ *
+ *    controller.optimise(); // only recomputes affected messages
+ *    std::cout << controller.noRecomputedMsgs() << " messages recomputed\n";
+ * }
+ * </pre>
+ *
  * @section tips Tips on Writing Efficient Code
  * In general, the guidelines for writing efficient C++ code in any context
  * also apply to code written using the maxsum library. In particular, one
@@ -0,0 +1,295 @@
+/**
+ * @file BatchSolver.h
+ * Defines the maxsum::BatchSolver class, which runs max-sum on many
+ * independent factor graphs at once, and the maxsum::solveBatch function.
+ */
+#ifndef MAXSUM_BATCHSOLVER_H
+#define MAXSUM_BATCHSOLVER_H
+
+#include <map>
+#include <vector>
+#include "common.h"
+#include "DiscreteFunction.h"
+#include "FlatFactorGraph.h"
+#include "MaxSumController.h"
+
+namespace maxsum
+{
+   /**
+    * Runs the max-sum algorithm on a batch of independent factor graphs
+    * that share the same structure, but have different factor values.
+    *
+    * This is intended for solving many small problems, for which the cost
+    * of creating a maxsum::MaxSumController for each one would exceed the
+    * cost of solving it. The shared structure is compiled once, and the
+    * factor tables, messages and values of all instances are stored as a
+    * structure of arrays: each value is followed immediately by the
+    * corresponding values of every other instance. A single pass over the
+    * graph therefore updates the messages of every instance, with the
+    * innermost loops running over instances in contiguous memory.
+    *
+    * Messages are computed in exactly the same way as for a compiled
+    * maxsum::MaxSumController, so each instance gets the same result as it
+    * would on its own, provided it converges. However, all instances are
+    * iterated until every one has converged, or the maximum number of
+    * iterations is reached.
+    *
+    * For graphs with different structures, see maxsum::solveBatch().
+    */
+   class BatchSolver
+   {
+   public:
+
+      /**
+       * Type of container used to map factors to their defining functions.
+       */
+      typedef std::map<FactorID,DiscreteFunction> FactorMap;
+
+      /**
+       * Type of container used to map variables to their values.
+       */
+      typedef std::map<VarID,ValIndex> ValueMap;
+
+   private:
+
+      /**
+       * Factors defining the structure of every instance.
+       */
+      FactorMap structure_i;
+
+      /**
+       * Compiled copy of the shared structure.
+       */
+      util::FlatFactorGraph graph_i;
+
+      /**
+       * Number of instances in this batch.
+       */
+      int noInstances_i;
+
+      /**
+       * The maximum number of iterations performed by ::optimise().
+       */
+      int maxIterations_i;
+
+      /**
+       * Maximum change in any message at which we consider the algorithm
+       * to have converged.
+       */
+      ValType maxNormThreshold_i;
+
+      /**
+       * Factor tables of all instances. Value k of factor f for instance i
+       * is stored at <code>(tableOffset(f)+k)*noInstances_i + i</code>.
+       */
+      std::vector<ValType> tables_i;
+
+      /**
+       * Factor to variable messages of all instances, laid out in the same
+       * way as the factor tables.
+       */
+      std::vector<ValType> fac2var_i;
+
+      /**
+       * Variable to factor messages of all instances, laid out in the same
+       * way as the factor tables.
+       */
+      std::vector<ValType> var2fac_i;
+
+      /**
+       * Value of each variable for each instance. The value of variable v
+       * for instance i is stored at <code>v*noInstances_i + i</code>.
+       */
+      std::vector<ValIndex> values_i;
+
+      /**
+       * Scratch space for the total value of a factor for every instance.
+       */
+      std::vector<ValType> totalScratch_i;
+
+      /**
+       * Scratch space for a message, or the sum of messages at a variable,
+       * for every instance.
+       */
+      std::vector<ValType> msgScratch_i;
+
+      /**
+       * Scratch space for one value per instance.
+       */
+      std::vector<ValType> instScratch_i;
+
+      /**
+       * Returns the index of a variable in the compiled graph.
+       * @throws maxsum::NoSuchElementException if the variable is not in
+       * the shared structure.
+       */
+      int varIndex(VarID var) const;
+
+      /**
+       * Throws an exception if an instance index is out of range.
+       * @throws maxsum::OutOfRangeException if <code>instance</code> is not
+       * in [0,::noInstances()).
+       */
+      void checkInstance(int instance) const;
+
+      /**
+       * Counts the instances for which a message has changed by more than
+       * the maxnorm threshold, and sets the message to its new value.
+       * @param[in] newMsg the new message for every instance.
+       * @param[in,out] msg the message to update for every instance.
+       * @param[in] size the number of values in the message.
+       * @returns the number of instances for which the message changed.
+       */
+      int storeMsg(const ValType* newMsg, ValType* msg, ValIndex size);
+
+      /**
+       * Updates the factor to variable messages of every instance.
+       * @returns the number of significantly changed messages.
+       */
+      int updateFac2VarMsgs();
+
+      /**
+       * Updates the variable to factor messages and values of every
+       * instance.
+       * @returns the number of significantly changed messages, plus
+       * the number of changed values.
+       */
+      int updateVar2FacMsgs();
+
+   public:
+
+      /**
+       * Constructs a batch of instances with a shared structure.
+       * @param[in] structure factors defining the structure. Every instance
+       * starts with a copy of these factors' values.
+       * @param[in] noInstances the number of instances in the batch.
+       * @param[in] maxIterations The maximum number of iterations for the
+       * max-sum algorithm.
+       * @param[in] maxnorm The maximum maxnorm allowed between the old and new
+       * values of a message, before it is assumed to have converged.
+       * @throws maxsum::OutOfRangeException if <code>noInstances</code> is
+       * less than 1.
+       */
+      BatchSolver
+      (
+       const FactorMap& structure,
+       int noInstances,
+       int maxIterations=MaxSumController::DEFAULT_MAX_ITERATIONS,
+       ValType maxnorm=MaxSumController::DEFAULT_MAXNORM_THRESHOLD
+      );
+
+      /**
+       * Returns the number of instances in this batch.
+       */
+      int noInstances() const { return noInstances_i; }
+
+      /**
+       * Returns the number of factors in each instance.
+       */
+      int noFactors() const { return graph_i.noFactors(); }
+
+      /**
+       * Returns the number of variables in each instance.
+       */
+      int noVars() const { return graph_i.noVars(); }
+
+      /**
+       * Returns the number of edges in each instance.
+       */
+      int noEdges() const { return graph_i.noEdges(); }
+
+      /**
+       * Returns true if and only if a factor graph has exactly the same
+       * factors and factor domains as the shared structure of this batch.
+       */
+      bool sameStructure(const FactorMap& graph) const
+      {
+         return sameStructure(graph,structure_i);
+      }
+
+      /**
+       * Returns true if and only if two factor graphs have exactly the same
+       * factors and factor domains, and so can be solved in one batch.
+       */
+      static bool sameStructure(const FactorMap& g1, const FactorMap& g2);
+
+      /**
+       * Sets the values of one factor in one instance.
+       * @param[in] instance the index of the instance.
+       * @param[in] id the factor to set.
+       * @param[in] factor the new value of the factor.
+       * @throws maxsum::OutOfRangeException if the instance is out of range.
+       * @throws maxsum::NoSuchElementException if the factor is not in the
+       * shared structure.
+       * @throws maxsum::BadDomainException if the factor's domain differs
+       * from that in the shared structure.
+       */
+      void setFactor(int instance, FactorID id, const DiscreteFunction& factor);
+
+      /**
+       * Sets the values of every factor in one instance.
+       * @param[in] instance the index of the instance.
+       * @param[in] graph the factors of the instance.
+       * @throws maxsum::BadDomainException if the graph does not have the
+       * shared structure of this batch.
+       */
+      void setFactors(int instance, const FactorMap& graph);
+
+      /**
+       * Sets every message of every instance back to zero, so that the next
+       * call to ::optimise() starts from cold.
+       */
+      void resetMessages();
+
+      /**
+       * Runs the max-sum algorithm on every instance, until all have
+       * converged, or the maximum number of iterations is reached. Each call
+       * is warm started from the messages left by the previous one.
+       * @returns the number of iterations performed.
+       */
+      int optimise();
+
+      /**
+       * Returns the value assigned to a variable in one instance.
+       * @param[in] instance the index of the instance.
+       * @param[in] var the variable.
+       * @throws maxsum::OutOfRangeException if the instance is out of range.
+       * @throws maxsum::NoSuchElementException if the variable is not in
+       * the shared structure.
+       */
+      ValIndex getValue(int instance, VarID var) const;
+
+      /**
+       * Populates a map with the value of every variable in one instance.
+       * @param[in] instance the index of the instance.
+       * @param[out] values map in which to store the values.
+       * @post any previous contents of <code>values</code> are destroyed.
+       * @throws maxsum::OutOfRangeException if the instance is out of range.
+       */
+      void getValues(int instance, ValueMap& values) const;
+
+   }; // class BatchSolver
+
+   /**
+    * Solves a collection of independent factor graphs, which may have
+    * different structures. Graphs with the same structure are grouped, and
+    * each group is solved with a single maxsum::BatchSolver.
+    * @param[in] graphs the factor graphs to solve.
+    * @param[out] values the values found for each graph, in the same order.
+    * @param[in] maxIterations The maximum number of iterations for the
+    * max-sum algorithm.
+    * @param[in] maxnorm The maximum maxnorm allowed between the old and new
+    * values of a message, before it is assumed to have converged.
+    * @post any previous contents of <code>values</code> are destroyed.
+    */
+   void solveBatch
+   (
+    const std::vector<BatchSolver::FactorMap>& graphs,
+    std::vector<BatchSolver::ValueMap>& values,
+    int maxIterations=MaxSumController::DEFAULT_MAX_ITERATIONS,
+    ValType maxnorm=MaxSumController::DEFAULT_MAXNORM_THRESHOLD
+   );
+
+} // namespace maxsum
+
+#endif // MAXSUM_BATCHSOLVER_H
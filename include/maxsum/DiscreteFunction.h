@@ -10,12 +10,47 @@
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <utility>
 #include "common.h"
 #include "register.h"
 #include "DomainIterator.h"
+#include "DomainMap.h"
+#include "SmallVector.h"
 
 namespace maxsum
+{
+namespace util
 {
+   /**
+    * Visitor for maxsum::DomainIterator::forEachInd(), which copies the
+    * value at each visited index of one table to the next position in
+    * another.
+    */
+   struct GatherOp
+   {
+      /**
+       * Table from which values are copied.
+       */
+      const ValType* in;
+
+      /**
+       * Position to which the next value is copied.
+       */
+      ValType* out;
+
+      /**
+       * Copies the value at index k.
+       */
+      void operator()(ValIndex k)
+      {
+         *out++ = in[k];
+      }
+   };
+
+} // namespace util
+
+   template<class Derived> class FunctionExpr;
+
    /**
     * Class representing functions of sets of variables with discrete domains.
     * @tparam ValType the scalar type of value returned by this function.
@@ -34,22 +69,48 @@ namespace maxsum
        const DiscreteFunction& fun
       );
 
+   public:
+
+      /**
+       * Maximum number of variables stored without heap allocation.
+       */
+      static const std::size_t INLINE_VARS = 4;
+
+      /**
+       * Maximum number of values stored without heap allocation. This is
+       * large enough for messages over a variable with up to 64 values, or
+       * for small pairwise and ternary factors.
+       */
+      static const std::size_t INLINE_VALUES = 64;
+
    private:
 
       /**
        * Convenience typedef for type used to store variable ids
        */
-      typedef std::vector<VarID> VarVec;
+      typedef util::SmallVector<VarID,INLINE_VARS> VarVec;
 
       /**
        * Convenience typedef for type used to store variable sizes
        */
-      typedef std::vector<ValIndex> SizeVec;
+      typedef util::SmallVector<ValIndex,INLINE_VARS> SizeVec;
 
       /**
        * Convenience typedef for type used to store function values.
        */
-      typedef Eigen::Array<ValType, Eigen::Dynamic, 1> ValVec;
+      typedef util::SmallVector<ValType,INLINE_VALUES> ValVec;
+
+      /**
+       * Eigen view of this function's values, used for vectorised
+       * operations.
+       */
+      typedef Eigen::Map<Eigen::Array<ValType, Eigen::Dynamic, 1> > ValMap;
+
+      /**
+       * Read only Eigen view of this function's values.
+       */
+      typedef Eigen::Map<const Eigen::Array<ValType, Eigen::Dynamic, 1> >
+         ConstValMap;
 
       /**
        * Set of variables on which this function depends.
@@ -64,9 +125,43 @@ namespace maxsum
 
       /**
        * Array containing the values for this function.
+       * Small functions, such as most messages, are stored inline, so
+       * they can be created and copied without touching the heap.
        */
       ValVec values_i;
 
+      /**
+       * Returns an Eigen view of this function's values.
+       */
+      ValMap valueMap()
+      {
+         return ValMap(values_i.data(),values_i.size());
+      }
+
+      /**
+       * Returns a read only Eigen view of this function's values.
+       */
+      ConstValMap valueMap() const
+      {
+         return ConstValMap(values_i.data(),values_i.size());
+      }
+
+      /**
+       * Replaces the domain of this function with a superset of its current
+       * domain, copying its values across the expanded domain.
+       * @param[in] newVars sorted list of variables in the new domain.
+       * @pre newVars includes every variable in the current domain.
+       */
+      void expandDomain(const std::vector<VarID>& newVars);
+
+      /**
+       * Combines this function with an expression, expanding the domain if
+       * necessary.
+       * @tparam Op the operation used to combine each pair of values.
+       * @param[in] expr the expression to combine with this function.
+       */
+      template<class Op, class E> DiscreteFunction& combine(E&& expr);
+
    public:
 
       // Eigen new operator (only required if we use fixed size eigen types.
@@ -79,11 +174,8 @@ namespace maxsum
        * @param[in] val the constant scalar value of this function.
        */
       DiscreteFunction(ValType val=0)
-         : vars_i(0), size_i(0), values_i()
-      {
-         values_i.resize(1);
-         values_i(0) = val;
-      }
+         : vars_i(), size_i(), values_i(1,val)
+      {}
 
       /**
        * Constructs function depending on specified variables.
@@ -114,7 +206,7 @@ namespace maxsum
          // the total capacity required for the data array.
          //*********************************************************************
          ValIndex totalSize = 1;
-         for(int k=0; k<vars_i.size(); k++)
+         for(std::size_t k=0; k<vars_i.size(); k++)
          {
             size_i[k] = getDomainSize(vars_i[k]);
             totalSize *= size_i[k];
@@ -123,10 +215,57 @@ namespace maxsum
          //*********************************************************************
          // Initialise the data array
          //*********************************************************************
-         values_i.resize(totalSize);
-         Eigen::Matrix<ValType,1,1> valWrapper;
-         valWrapper(0) = val;
-         values_i.matrix().rowwise() = valWrapper;
+         values_i.assign(totalSize,val);
+
+      } // DiscreteFunction constructor
+
+      /**
+       * Constructs a function whose values are stored in an array owned by
+       * the caller, such as a memory mapped file. The values are neither
+       * copied nor freed by this function, and changes to the function
+       * are written directly to the array, until its domain is changed.
+       * Assigning a scalar, or a function with a different domain, stops
+       * the borrow without writing to the array. Copies of this function
+       * own their own values as usual.
+       * @param[in] begin Iterator to start of variable list.
+       * @param[in] end  Iterator to end of variable list.
+       * @param[in] pValues array of values, in the same order as returned by
+       * ::operator()(ValIndex).
+       * @param[in] noValues the number of elements in <code>pValues</code>.
+       * @pre the array outlives this function, and any function moved from
+       * it.
+       * @throws UnknownVariableException if any variable in the list specified
+       * by \c begin and \c end is not registered.
+       * @throws BadDomainException if the variables are not unique and sorted,
+       * or <code>noValues</code> does not match their domain size.
+       */
+      template<class VarIt> DiscreteFunction
+      (
+       VarIt begin,
+       VarIt end,
+       ValType* pValues,
+       std::size_t noValues
+      )
+      : vars_i(begin,end), size_i(end-begin), values_i()
+      {
+         std::size_t totalSize = 1;
+         for(std::size_t k=0; k<vars_i.size(); k++)
+         {
+            if( (0<k) && !(vars_i[k-1]<vars_i[k]) )
+            {
+               throw BadDomainException("DiscreteFunction::DiscreteFunction",
+                     "Borrowed function domain must be unique and sorted.");
+            }
+            size_i[k] = getDomainSize(vars_i[k]);
+            totalSize *= size_i[k];
+         }
+
+         if(totalSize!=noValues)
+         {
+            throw BadDomainException("DiscreteFunction::DiscreteFunction",
+                  "Borrowed value array does not match domain size.");
+         }
+         values_i.borrow(pValues,noValues);
 
       } // DiscreteFunction constructor
 
@@ -138,13 +277,9 @@ namespace maxsum
        * @throws UnknownVariableException if \c var is not registered.
        */
       DiscreteFunction(VarID var, ValType val)
-         : vars_i(1,var), size_i(1,getDomainSize(var)), values_i()
-      {
-         values_i.resize(getDomainSize(var));
-         Eigen::Matrix<ValType,1,1> valWrapper;
-         valWrapper(0) = val;
-         values_i.matrix().rowwise() = valWrapper;
-      }
+         : vars_i(1,var), size_i(1,getDomainSize(var)),
+           values_i(size_i[0],val)
+      {}
 
       /**
        * Copy Constructor performs deep copy.
@@ -153,12 +288,53 @@ namespace maxsum
       DiscreteFunction(const DiscreteFunction& val)
          : vars_i(val.vars_i), size_i(val.size_i), values_i(val.values_i) {}
 
+      /**
+       * Move Constructor takes ownership of another function's value table.
+       * If the table is stored on the heap, it is transferred without
+       * copying.
+       * @param[in,out] val the object to move.
+       * @post \c val is left as the constant function 0.
+       */
+      DiscreteFunction(DiscreteFunction&& val)
+         : vars_i(std::move(val.vars_i)), size_i(std::move(val.size_i)),
+           values_i(std::move(val.values_i))
+      {
+         val.values_i.assign(1,ValType(0));
+      }
+
+      /**
+       * Constructs a function by evaluating an expression, such as the
+       * result of an arithmetic operator. The domain of the function is the
+       * union of the domains in the expression.
+       * @param[in] expr the expression to evaluate.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction(const FunctionExpr<E>& expr);
+
+      /**
+       * Constructs a function by evaluating a temporary expression, reusing
+       * the storage of a temporary function in the expression if possible.
+       * @param[in,out] expr the expression to evaluate.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction(FunctionExpr<E>&& expr);
+
       /**
        * Accessor method for the total size this function's domain.
        */
       ValIndex domainSize() const
       {
-         return values_i.size();
+         return static_cast<ValIndex>(values_i.size());
+      }
+
+      /**
+       * Returns true if this function's values are stored in an array owned
+       * by someone else.
+       * @see DiscreteFunction(VarIt,VarIt,ValType*,std::size_t)
+       */
+      bool isBorrowed() const
+      {
+         return values_i.isBorrowed();
       }
       
       /**
@@ -173,7 +349,7 @@ namespace maxsum
        * Type of iterator returned by DiscreteFunction::varBegin() and
        * DiscreteFunction::varEnd() functions.
        */
-      typedef std::vector<VarID>::const_iterator VarIterator;
+      typedef VarVec::const_iterator VarIterator;
 
       /**
        * Returns an iterator to the start of this function's domain variable
@@ -197,7 +373,7 @@ namespace maxsum
        * Type of iterator returned by DiscreteFunction::sizeBegin() and
        * DiscreteFunction::sizeEnd() functions.
        */
-      typedef std::vector<ValIndex>::const_iterator SizeIterator;
+      typedef SizeVec::const_iterator SizeIterator;
 
       /**
        * Returns an iterator to the start of this function's domain variable
@@ -235,7 +411,7 @@ namespace maxsum
        */
       int noVars() const
       {
-         return vars_i.size();
+         return static_cast<int>(vars_i.size());
       }
 
       /**
@@ -254,7 +430,7 @@ namespace maxsum
        */
       DiscreteFunction& assignKeepDomain(ValType val)
       {
-         values_i.setConstant(values_i.size(), val);
+         std::fill(values_i.begin(),values_i.end(),val);
          return *this;
 
       } // assignKeepDomain
@@ -265,12 +441,38 @@ namespace maxsum
        */
       DiscreteFunction& operator=(const DiscreteFunction& val);
 
+      /**
+       * Sets this function to be equal to another, taking ownership of its
+       * value table. If the table is stored on the heap, it is transferred
+       * without copying.
+       * @param[in,out] val the value to move into this function.
+       * @post \c val is left as the constant function 0.
+       */
+      DiscreteFunction& operator=(DiscreteFunction&& val);
+
+      /**
+       * Sets this function to the value of an expression, such as the
+       * result of an arithmetic operator. The expression is evaluated in a
+       * single pass, and its domain becomes the domain of this function.
+       * @param[in] expr the expression to evaluate.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction& operator=(const FunctionExpr<E>& expr);
+
+      /**
+       * Sets this function to the value of a temporary expression, reusing
+       * the storage of a temporary function in the expression if possible.
+       * @param[in,out] expr the expression to evaluate.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction& operator=(FunctionExpr<E>&& expr);
+
       /**
        * Adds a scalar value to this function.
        */
       DiscreteFunction& operator+=(ValType val)
       {
-         values_i += val;
+         valueMap() += val;
          return *this;
       }
 
@@ -279,7 +481,7 @@ namespace maxsum
        */
       DiscreteFunction& operator-=(ValType val)
       {
-         values_i -= val;
+         valueMap() -= val;
          return *this;
       }
 
@@ -288,7 +490,7 @@ namespace maxsum
        */
       DiscreteFunction& operator*=(ValType val)
       {
-         values_i *= val;
+         valueMap() *= val;
          return *this;
       }
 
@@ -297,18 +499,10 @@ namespace maxsum
        */
       DiscreteFunction& operator/=(ValType val)
       {
-         values_i /= val;
+         valueMap() /= val;
          return *this;
       }
 
-      /**
-       * Multiply function by -1
-       */
-      DiscreteFunction operator-() const
-      {
-         return DiscreteFunction(*this) *= -1;
-      }
-
       /**
        * Identity function.
        * @returns a reference to this function.
@@ -348,36 +542,56 @@ namespace maxsum
       DiscreteFunction& operator/=(const DiscreteFunction& rhs);
 
       /**
-       * Subtract function or scalar.
+       * Adds an expression to this function, expanding the domain if
+       * necessary.
+       * @see maxsum::FunctionExpr
        */
-      template<class T> DiscreteFunction operator-(T rhs) const
-      {
-         return DiscreteFunction(*this) -= rhs;
-      }
+      template<class E> DiscreteFunction& operator+=(const FunctionExpr<E>& rhs);
 
       /**
-       * Add function or scalar.
+       * Adds a temporary expression to this function.
+       * @see maxsum::FunctionExpr
        */
-      template<class T> DiscreteFunction operator+(T rhs) const
-      {
-         return DiscreteFunction(*this) += rhs;
-      }
+      template<class E> DiscreteFunction& operator+=(FunctionExpr<E>&& rhs);
 
       /**
-       * Multiply function or scalar.
+       * Subtracts an expression from this function, expanding the domain if
+       * necessary.
+       * @see maxsum::FunctionExpr
        */
-      template<class T> DiscreteFunction operator*(T rhs) const
-      {
-         return DiscreteFunction(*this) *= rhs;
-      }
+      template<class E> DiscreteFunction& operator-=(const FunctionExpr<E>& rhs);
 
       /**
-       * Divide function by function or scalar.
+       * Subtracts a temporary expression from this function.
+       * @see maxsum::FunctionExpr
        */
-      template<class T> DiscreteFunction operator/(T rhs) const
-      {
-         return DiscreteFunction(*this) /= rhs;
-      }
+      template<class E> DiscreteFunction& operator-=(FunctionExpr<E>&& rhs);
+
+      /**
+       * Multiplies this function by an expression, expanding the domain if
+       * necessary.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction& operator*=(const FunctionExpr<E>& rhs);
+
+      /**
+       * Multiplies this function by a temporary expression.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction& operator*=(FunctionExpr<E>&& rhs);
+
+      /**
+       * Divides this function by an expression, expanding the domain if
+       * necessary.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction& operator/=(const FunctionExpr<E>& rhs);
+
+      /**
+       * Divides this function by a temporary expression.
+       * @see maxsum::FunctionExpr
+       */
+      template<class E> DiscreteFunction& operator/=(FunctionExpr<E>&& rhs);
 
       /**
        * Adds a list of Functions to this one, expanding the domain if
@@ -819,7 +1033,7 @@ namespace maxsum
          // Construct the union of the specified variables with this
          // functions current domain
          //*********************************************************************
-         std::vector<VarID> newVar = vars_i;
+         std::vector<VarID> newVar(vars_i.begin(),vars_i.end());
          int maxSize = (end - begin) + vars_i.size();
          newVar.reserve(maxSize);
          newVar.insert(newVar.end(),begin,end);
@@ -840,23 +1054,9 @@ namespace maxsum
          }
 
          //*********************************************************************
-         // Otherwise, create a temporary function to hold this functions new
-         // value.
+         // Otherwise, copy our values across the expanded domain.
          //*********************************************************************
-         DiscreteFunction result(newVar.begin(),newVar.end());
-
-         //*********************************************************************
-         // Copy old values to new values across the expanded domain
-         //*********************************************************************
-         for(DomainIterator k(result); k.hasNext(); ++k)
-         { 
-            result(k.getInd()) = (*this)(newVar,k.getSubInd());
-         }
-
-         //*********************************************************************
-         // Assign the new values to this one.
-         //*********************************************************************
-         result.swap(*this);
+         expandDomain(newVar);
 
       } // expand method
 
@@ -932,14 +1132,13 @@ namespace maxsum
 
          //*********************************************************************
          // Create a temporary function to hold the result, and copy in the
-         // conditioned values.
+         // conditioned values. The iterator visits the free variables in the
+         // same order as the result's value table, so these are simply copied
+         // to consecutive positions.
          //*********************************************************************
          DiscreteFunction result(freeVars.begin(),freeVars.end());
-         while(it.hasNext())
-         {
-            result(it.getVars(),it.getSubInd()) = this->at(it.getInd());
-            ++it;
-         }
+         util::GatherOp gather = { &(this->at(0)), &result(0) };
+         it.forEachInd(gather);
 
          //*********************************************************************
          // Finally, swap the result values into this function
@@ -1189,54 +1388,6 @@ namespace maxsum
       return f >= v;
    }
 
-   /**
-    * Peforms element-wise division of a scalar by a function.
-    */
-   inline DiscreteFunction operator/
-   (
-    const ValType f1, 
-    const DiscreteFunction& f2 
-   )
-   {
-      return DiscreteFunction(f1) / f2;
-   }
-
-   /**
-    * Peforms element-wise multiplication of a scalar by a function.
-    */
-   inline DiscreteFunction operator*
-   (
-    const ValType f1, 
-    const DiscreteFunction& f2 
-   )
-   {
-      return f2 * f1;
-   }
-
-   /**
-    * Peforms element-wise addition of a scalar by a function.
-    */
-   inline DiscreteFunction operator+
-   (
-    const ValType f1, 
-    const DiscreteFunction& f2 
-   )
-   {
-      return f2 + f1;
-   }
-
-   /**
-    * Peforms element-wise subtraction of a function from a scalar.
-    */
-   inline DiscreteFunction operator-
-   (
-    const ValType f1, 
-    const DiscreteFunction& f2 
-   )
-   {
-      return DiscreteFunction(f1) - f2;
-   }
-
    /**
     * Condition function on specified variable values.
     * Changes a function so that it does not depend on any of the
@@ -1296,14 +1447,13 @@ namespace maxsum
 
       //*********************************************************************
       // Create a temporary function to hold the result, and copy in the
-      // conditioned values.
+      // conditioned values. The iterator visits the free variables in the
+      // same order as the result's value table, so these are simply copied
+      // to consecutive positions.
       //*********************************************************************
       DiscreteFunction result(freeVars.begin(),freeVars.end());
-      while(it.hasNext())
-      {
-         result(it.getVars(),it.getSubInd()) = inFun(it.getInd());
-         ++it;
-      }
+      util::GatherOp gather = { &inFun(0), &result(0) };
+      it.forEachInd(gather);
 
       //*********************************************************************
       // Finally, swap the result values into the output function
@@ -1364,14 +1514,13 @@ namespace maxsum
 
       //*********************************************************************
       // Create a temporary function to hold the result, and copy in the
-      // conditioned values.
+      // conditioned values. The iterator visits the free variables in the
+      // same order as the result's value table, so these are simply copied
+      // to consecutive positions.
       //*********************************************************************
       DiscreteFunction result(freeVars.begin(),freeVars.end());
-      while(it.hasNext())
-      {
-         result(it.getVars(),it.getSubInd()) = inFun(it.getInd());
-         ++it;
-      }
+      util::GatherOp gather = { &inFun(0), &result(0) };
+      it.forEachInd(gather);
 
       //*********************************************************************
       // Finally, swap the result values into the output function
@@ -1442,43 +1591,45 @@ namespace maxsum
 
       //************************************************************************
       // Calculate and store the result for each value in the output function.
-      // Notice, we need to get the first element outside the loop, so that we
-      // have at least two values with which to call the aggregate function.
-      // If there is only one value, then that becomes its own aggregate.
+      // Each result is initialised to the first corresponding value in the
+      // input function, so that things like max and min will work properly
+      // as aggregate functions, because they already have something to work
+      // with. If there is only one value, then that becomes its own
+      // aggregate.
       //************************************************************************
-      for(DomainIterator outIt(outFun); outIt.hasNext(); ++outIt)
-      {
-         //*********************************************************************
-         // Initialise the result to the first corresponding value in the input
-         // function. This ensures that things like max and min will work
-         // properly as aggregate functions, because they already have
-         // something to work with.
-         //*********************************************************************
-         DomainIterator inIt(inFun);
-         inIt.condition(outIt);
-         ValType result = inFun(inIt.getInd());
-         ++inIt;
-
-         //*********************************************************************
-         // Update the result by aggregating with any remaining values in the
-         // free part of the input function domain.
-         //*********************************************************************
-         while(inIt.hasNext())
-         {
-            result = aggregate(result,inFun(inIt.getInd()));
-            ++inIt;
-         }
-
-         //*********************************************************************
-         // Store the current aggregate value in the current position of the
-         // output function.
-         //*********************************************************************
-         outFun(outIt.getInd()) = result;
-
-      } // for loop
+      DomainMap map(inFun,outFun);
+      map.marginal(&inFun(0),aggregate,&outFun(0));
 
    } // function marginal
 
+   /**
+    * Marginalise a maxsum::DiscreteFunction using a precomputed
+    * maxsum::DomainMap. This is equivalent to
+    * maxsum::marginal(inFun,aggregate,outFun), but avoids recalculating the
+    * mapping between domains, which is useful when the same shaped
+    * functions are marginalised repeatedly.
+    * @pre <code>map.matches(inFun,outFun)</code> is true.
+    * @post previous content of outFun is overwritten.
+    * @tparam F type of parameter aggregate.
+    * @param[in] inFun function to marginalise
+    * @param[in] aggregate functor or function pointer used to aggregate
+    * results.
+    * @param[out] outFun maxsum::DiscreteFunction in which to store result.
+    * @param[in] map mapping from the domain of inFun to that of outFun.
+    * @see maxsum::marginal()
+    */
+   template<typename F> void marginal
+   (
+    const DiscreteFunction& inFun,
+    F aggregate,
+    DiscreteFunction& outFun,
+    const DomainMap& map
+   )
+   {
+      assert(map.matches(inFun,outFun));
+      map.marginal(&inFun(0),aggregate,&outFun(0));
+   }
+
    /**
     * Marginalise a maxsum::DiscreteFunction by maximisation.
     * This function reduces the domain of inFun to that of outFun by
@@ -1497,6 +1648,23 @@ namespace maxsum
     */
    void maxMarginal(const DiscreteFunction& inFun, DiscreteFunction& outFun);
 
+   /**
+    * Marginalise a maxsum::DiscreteFunction by maximisation using a
+    * precomputed maxsum::DomainMap.
+    * @pre <code>map.matches(inFun,outFun)</code> is true.
+    * @post previous content of outFun is overwritten.
+    * @param[in] inFun function to marginalise
+    * @param[out] outFun maxsum::DiscreteFunction in which to store result.
+    * @param[in] map mapping from the domain of inFun to that of outFun.
+    * @see maxsum::maxMarginal()
+    */
+   void maxMarginal
+   (
+    const DiscreteFunction& inFun,
+    DiscreteFunction& outFun,
+    const DomainMap& map
+   );
+
    /**
     * Marginalise a maxsum::DiscreteFunction by minimisation.
     * This function reduces the domain of inFun to that of outFun by
@@ -1542,60 +1710,6 @@ namespace maxsum
     */
    typedef ValType(*DualScalarOp)(const ValType, const ValType);
 
-   /**
-    * Template used to generate operations that apply some function to each
-    * of a DiscreteFunction's values.
-    */
-   template<UnaryScalarOp OP> DiscreteFunction elementWiseOp
-   (
-    const DiscreteFunction& inFcn
-   )
-   {
-      //************************************************************************
-      // Create a function to hold the result
-      //************************************************************************
-      DiscreteFunction result(inFcn.varBegin(),inFcn.varEnd());
-
-      //************************************************************************
-      // Apply the specified operation elementwise to the input function
-      //************************************************************************
-      for(int k=0; k<inFcn.domainSize(); ++k)
-      {
-         result(k) = OP(inFcn(k));
-      }
-
-      return result;
-
-   } // elementWiseOp
-
-   /**
-    * Template used to generate operations that apply some operation to a pair
-    * of DiscreteFunctions.
-    */
-   template<DualScalarOp OP> DiscreteFunction elementWiseOp
-   (
-    const DiscreteFunction& inFcn1,
-    const DiscreteFunction& inFcn2
-   )
-   {
-      //************************************************************************
-      // Create a function to hold the result
-      //************************************************************************
-      DiscreteFunction result(inFcn1.varBegin(),inFcn1.varEnd());
-      result.expand(inFcn2);
-
-      //************************************************************************
-      // Apply the specified operation elementwise to the input function
-      //************************************************************************
-      for(DomainIterator it(result); it.hasNext(); ++it)
-      {
-         result(it.getInd()) = OP(inFcn1(it),inFcn2(it));
-      }
-
-      return result;
-
-   } // elementWiseOp
-
 } // namespace maxsum
 
 namespace std
@@ -1609,100 +1723,12 @@ namespace std
    template<> class numeric_limits<maxsum::DiscreteFunction>
       : public numeric_limits<maxsum::ValType> {};
 
-   /**
-    * Returns the elementwise log of a function.
-    */
-   inline maxsum::DiscreteFunction log(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<log>(fcn);
-   }
-
-   /**
-    * Returns the elementwise cosine value of a function.
-    */
-   inline maxsum::DiscreteFunction cos(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<cos>(fcn);
-   }
-
-   /**
-    * Returns the elementwise sine value of a function.
-    */
-   inline maxsum::DiscreteFunction sin(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<sin>(fcn);
-   }
-
-   /**
-    * Returns the elementwise tangent value of a function.
-    */
-   inline maxsum::DiscreteFunction tan(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<tan>(fcn);
-   }
-
-   /**
-    * Returns the elementwise absolute value of a function.
-    */
-   inline maxsum::DiscreteFunction fabs(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<fabs>(fcn);
-   }
-
-   /**
-    * Returns the elementwise absolute value of a function.
-    */
-   inline maxsum::DiscreteFunction abs(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<abs>(fcn);
-   }
-
-   /**
-    * Returns the elementwise exponent of a function.
-    */
-   inline maxsum::DiscreteFunction exp(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<exp>(fcn);
-   }
-
-   /**
-    * Returns the elementwise square root of a function.
-    */
-   inline maxsum::DiscreteFunction sqrt(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<sqrt>(fcn);
-   }
-
-   /**
-    * Returns the elementwise ceil value of a function.
-    */
-   inline maxsum::DiscreteFunction ceil(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<ceil>(fcn);
-   }
-
-   /**
-    * Returns the elementwise floor value of a function.
-    */
-   inline maxsum::DiscreteFunction floor(const maxsum::DiscreteFunction& fcn)
-   {
-      return maxsum::elementWiseOp<floor>(fcn);
-   }
-
-   /**
-    * Takes one function to the power of another.
-    * The result is <code>base</code> raised to the power of <code>exp</code>.
-    */
-   inline maxsum::DiscreteFunction pow
-   (
-    const maxsum::DiscreteFunction& base,
-    const maxsum::DiscreteFunction& exp 
-   )
-   {
-      return maxsum::elementWiseOp<pow>(base,exp);
-   }
-
 } // namespace std
 
+//******************************************************************************
+// Arithmetic operators and element-wise functions are defined as expression
+// templates, which need the complete DiscreteFunction class.
+//******************************************************************************
+#include "FunctionExpr.h"
 
 #endif // MAX_SUM_DISCRETE_FUNCTION_H
@@ -80,12 +80,41 @@ namespace maxsum
        */
       IndList sizes_i;
 
+      /**
+       * Stride of each variable in the linear index, which is the product
+       * of the domain sizes of all preceding variables.
+       */
+      IndList strides_i;
+
+      /**
+       * Positions of the free (unconditioned) variables in vars_i, in
+       * ascending order. Only these are visited by
+       * DomainIterator::operator++().
+       */
+      std::vector<int> free_i;
+
       /**
        * This flag is set to finished when we have iterated over the last
        * element.
        */
       bool finished_i;
 
+      /**
+       * Recalculates the strides, free variable list and linear index from
+       * the current variables, sizes, sub indices and conditions.
+       */
+      void initStrides();
+
+      /**
+       * Increments the free variables, starting from free_i[first], and
+       * updates the linear index incrementally.
+       * @param[in] first position in free_i of the least significant
+       * variable to increment.
+       * @returns false if every incremented variable wrapped back to 0, in
+       * which case there are no elements left.
+       */
+      bool advance(int first);
+
    public:
 
       /**
@@ -96,7 +125,7 @@ namespace maxsum
        * DomainIterator::operator++() will throw an exception.
        */
       DomainIterator() : vars_i(), subInd_i(), ind_i(0), fixed_i(),
-                         sizes_i(), finished_i(false) {}
+                         sizes_i(), strides_i(), free_i(), finished_i(false) {}
 
       /**
        * Construct Domain iterator with initial list of variables.
@@ -110,6 +139,8 @@ namespace maxsum
            ind_i(0),                 // set linear index to zero
            fixed_i(end-begin,false), // all variables are initially free
            sizes_i(end-begin,0),     // allocate space for variable sizes
+           strides_i(),              // strides are set below
+           free_i(),                 // free variables are set below
            finished_i(false)         // iterator is not done yet
       {
          //*********************************************************************
@@ -125,6 +156,7 @@ namespace maxsum
          {
             sizes_i[k] = getDomainSize(vars_i[k]);
          }
+         initStrides();
 
       } // constructor
 
@@ -253,13 +285,6 @@ namespace maxsum
 
          } // for loop
 
-         //*********************************************************************
-         // Set the linear index to its appropriate value based on the
-         // updated subindices and sizes.
-         //*********************************************************************
-         ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                         subInd_i.begin(), subInd_i.end() );
-
          //*********************************************************************
          // Since we've returned to the first element in the free part of the
          // domain, DomainIterator::hasNext() should return true.
@@ -267,12 +292,15 @@ namespace maxsum
          finished_i = false;
 
          //*********************************************************************
-         // Finally, we swap in the new variable list.
+         // Swap in the new variable list, and set the strides and linear index
+         // to their appropriate values based on the updated subindices and
+         // sizes.
          //*********************************************************************
          vars_i.swap(newVars);
          sizes_i.swap(newSizes);
          subInd_i.swap(newSubInd);
          fixed_i.swap(newFixed);
+         initStrides();
 
       } // function addVars
 
@@ -297,6 +325,64 @@ namespace maxsum
          return copy;
       }
 
+      /**
+       * Calls <code>visit(ind)</code> with the linear index of each element
+       * from the current element to the end of the domain, in the same order
+       * as DomainIterator::operator++(). This is equivalent to
+       * <pre>
+       * for(; it.hasNext(); ++it)
+       * {
+       *    visit(it.getInd());
+       * }
+       * </pre>
+       * but steps through the least significant free variable in a tight
+       * loop, so is much faster for large domains.
+       * @tparam Visitor functor or function pointer with signature
+       * <code>void visit(maxsum::ValIndex ind)</code>.
+       * @param[in,out] visit functor called for each element.
+       * @post DomainIterator::hasNext() returns false.
+       */
+      template<class Visitor> void forEachInd(Visitor& visit)
+      {
+         if(finished_i)
+         {
+            return;
+         }
+
+         //*********************************************************************
+         // With no free variables, there is exactly one element left.
+         //*********************************************************************
+         if(free_i.empty())
+         {
+            visit(ind_i);
+            finished_i = true;
+            return;
+         }
+
+         //*********************************************************************
+         // Visit each run of the least significant free variable directly,
+         // then step the remaining free variables like an odometer.
+         //*********************************************************************
+         const int k0 = free_i[0];
+         const ValIndex stride = strides_i[k0];
+         const ValIndex size = sizes_i[k0];
+         do
+         {
+            ValIndex ind = ind_i;
+            for(ValIndex x=subInd_i[k0]; x<size; ++x)
+            {
+               visit(ind);
+               ind += stride;
+            }
+            ind_i -= subInd_i[k0]*stride;
+            subInd_i[k0] = 0;
+
+         } while(advance(1));
+
+         finished_i = true;
+
+      } // function forEachInd
+
       /**
        * Condition domain on specified variable values.
        * Changes this iterator so that the specified set of variables have fixed
@@ -377,11 +463,10 @@ namespace maxsum
          finished_i = false;
 
          //*********************************************************************
-         // Set the linear index to its apropriate value, based on the
-         // conditioned variables.
+         // Set the free variable list and linear index to their apropriate
+         // values, based on the conditioned variables.
          //*********************************************************************
-         ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                         subInd_i.begin(), subInd_i.end() );
+         initStrides();
 
       } // function condition
 
@@ -447,11 +532,10 @@ namespace maxsum
          finished_i = false;
 
          //*********************************************************************
-         // Set the linear index to its apropriate value, based on the
-         // conditioned variables.
+         // Set the free variable list and linear index to their apropriate
+         // values, based on the conditioned variables.
          //*********************************************************************
-         ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                         subInd_i.begin(), subInd_i.end() );
+         initStrides();
 
       } // function condition
 
@@ -0,0 +1,479 @@
+/**
+ * @file DomainMap.h
+ * This file defines the maxsum::DomainMap class.
+ * The maxsum::DomainMap class caches the mapping between the linear indices
+ * of a domain and those of one of its subdomains, so that operations between
+ * functions with different domains can be performed as tight strided loops.
+ */
+#ifndef MAXSUM_DOMAIN_MAP_H
+#define MAXSUM_DOMAIN_MAP_H
+
+#include <algorithm>
+#include <vector>
+#include "common.h"
+
+namespace maxsum
+{
+   // This declaration is required for constructor declaration.
+   // Can't simply include DiscreteFunction.h due to circular reference.
+   class DiscreteFunction;
+
+   /**
+    * Precomputed mapping between an outer domain and an inner domain, whose
+    * variables are a subset of the outer domain's variables.
+    * For each variable in the outer domain, a DomainMap stores its stride in
+    * the outer and inner value tables (the inner stride being 0 for variables
+    * that are not in the inner domain). Adjacent variables whose strides
+    * are contiguous in both tables are merged, so that, for example, mapping
+    * a domain to itself reduces to a single linear loop.
+    *
+    * The stride tables depend only on the two domains, so the same DomainMap
+    * can be reused for any pair of functions with these domains, such as the
+    * messages sent along an edge in each iteration of max-sum. Construction
+    * allocates memory, but none of the mapping operations do (unless the
+    * outer domain has more than DomainMap::MAX_LOCAL_DIMS dimensions after
+    * merging).
+    *
+    * All operations work directly on the value tables of the functions
+    * involved, which are assumed to be stored in the same order as
+    * maxsum::DiscreteFunction, with the first variable changing fastest.
+    * @see maxsum::DiscreteFunction
+    */
+   class DomainMap
+   {
+   public:
+
+      /**
+       * Maximum number of merged dimensions for which mapping operations
+       * keep their loop counters on the stack.
+       */
+      static const int MAX_LOCAL_DIMS = 32;
+
+   private:
+
+      /**
+       * Describes one dimension of the loop over the outer domain.
+       */
+      struct Dim
+      {
+         /**
+          * Number of values in this dimension.
+          */
+         ValIndex size;
+
+         /**
+          * Stride of this dimension in the outer value table.
+          */
+         ValIndex outerStride;
+
+         /**
+          * Stride of this dimension in the inner value table, or 0 if
+          * this dimension is not part of the inner domain.
+          */
+         ValIndex innerStride;
+      };
+
+      /**
+       * Variables in the outer domain.
+       */
+      std::vector<VarID> outerVars_i;
+
+      /**
+       * Variables in the inner domain.
+       */
+      std::vector<VarID> innerVars_i;
+
+      /**
+       * Total size of the outer domain.
+       */
+      ValIndex outerSize_i;
+
+      /**
+       * Total size of the inner domain.
+       */
+      ValIndex innerSize_i;
+
+      /**
+       * Dimensions of the outer domain, in order of their outer stride.
+       */
+      std::vector<Dim> dims_i;
+
+      /**
+       * Dimensions of the outer domain, with the dimensions that are not
+       * in the inner domain ordered first. This ensures that all elements
+       * of the outer domain that map to the same inner element are
+       * visited consecutively.
+       */
+      std::vector<Dim> margDims_i;
+
+      /**
+       * Appends a dimension to a list, merging it with the previous
+       * dimension if their strides are contiguous.
+       * @param[in,out] dims the list of dimensions.
+       * @param[in] dim the dimension to append.
+       */
+      static void appendDim(std::vector<Dim>& dims, const Dim& dim);
+
+      /**
+       * Calls <code>op(outerInd,innerInd)</code> for each element of the
+       * outer domain, in the order specified by a list of dimensions.
+       * @param[in] dims the dimensions to loop over.
+       * @param[in,out] op functor called for each element.
+       */
+      template<class Op> static void walk(const std::vector<Dim>& dims, Op& op)
+      {
+         //*********************************************************************
+         // A function of no variables has exactly one element.
+         //*********************************************************************
+         const int noDims = static_cast<int>(dims.size());
+         if(0==noDims)
+         {
+            op(0,0);
+            return;
+         }
+
+         //*********************************************************************
+         // Initialise the loop counters for every dimension but the first.
+         //*********************************************************************
+         ValIndex localCount[MAX_LOCAL_DIMS];
+         std::vector<ValIndex> heapCount;
+         ValIndex* count = localCount;
+         if(MAX_LOCAL_DIMS<noDims)
+         {
+            heapCount.resize(noDims);
+            count = &heapCount[0];
+         }
+         std::fill(count,count+noDims,0);
+
+         //*********************************************************************
+         // Loop over the first dimension directly, and step the remaining
+         // dimensions like an odometer, adjusting the offsets incrementally.
+         //*********************************************************************
+         const Dim& first = dims[0];
+         ValIndex outerOffset = 0;
+         ValIndex innerOffset = 0;
+         while(true)
+         {
+            ValIndex outerInd = outerOffset;
+            ValIndex innerInd = innerOffset;
+            for(ValIndex k=0; k<first.size; ++k)
+            {
+               op(outerInd,innerInd);
+               outerInd += first.outerStride;
+               innerInd += first.innerStride;
+            }
+
+            int d = 1;
+            for(; d<noDims; ++d)
+            {
+               const Dim& cur = dims[d];
+               outerOffset += cur.outerStride;
+               innerOffset += cur.innerStride;
+               if(++count[d] < cur.size)
+               {
+                  break;
+               }
+               outerOffset -= cur.outerStride * cur.size;
+               innerOffset -= cur.innerStride * cur.size;
+               count[d] = 0;
+            }
+
+            if(noDims==d)
+            {
+               return;
+            }
+
+         } // while loop
+
+      } // function walk
+
+      /**
+       * Functor that combines each outer value with its inner value.
+       */
+      template<class BinaryOp> struct TransformOp
+      {
+         ValType* outer;
+         const ValType* inner;
+         BinaryOp binOp;
+
+         void operator()(ValIndex o, ValIndex i)
+         {
+            outer[o] = binOp(outer[o],inner[i]);
+         }
+      };
+
+      /**
+       * Functor that copies each inner value to its outer positions.
+       */
+      struct ExpandOp
+      {
+         const ValType* inner;
+         ValType* outer;
+
+         void operator()(ValIndex o, ValIndex i)
+         {
+            outer[o] = inner[i];
+         }
+      };
+
+      /**
+       * Functor that aggregates consecutive blocks of outer values into
+       * their inner value.
+       */
+      template<class F> struct MarginalOp
+      {
+         const ValType* outer;
+         ValType* inner;
+         F aggregate;
+         ValIndex blockSize;
+         ValIndex count;
+
+         void operator()(ValIndex o, ValIndex i)
+         {
+            if(0==count)
+            {
+               inner[i] = outer[o];
+            }
+            else
+            {
+               inner[i] = aggregate(inner[i],outer[o]);
+            }
+
+            if(blockSize == ++count)
+            {
+               count = 0;
+            }
+         }
+      };
+
+   public:
+
+      /**
+       * Max marginalises a 3-D table onto its middle axis. That is,
+       * <code>out[j] = max(in[i+n0*(j+n1*k)])</code> over all i and k.
+       * Reductions over two-dimensional slices are vectorised using Eigen's
+       * partial reductions: contiguous column reductions if n0 > 1, and
+       * lane parallel row reductions otherwise. This covers marginalising a
+       * function onto any single variable, by setting n0 to the stride of
+       * the variable and n2 to the number of repeats of each run.
+       * @param[in] in the table to marginalise, of size n0*n1*n2.
+       * @param[in] n0 the size of the first axis.
+       * @param[in] n1 the size of the middle axis.
+       * @param[in] n2 the size of the last axis.
+       * @param[out] out array of size n1 in which to store the result.
+       */
+      static void maxOntoAxis
+      (
+       const ValType* in,
+       ValIndex n0,
+       ValIndex n1,
+       ValIndex n2,
+       ValType* out
+      );
+
+      /**
+       * Max marginalises the middle axis out of a 3-D table. That is,
+       * <code>out[i+n0*k] = max(in[i+n0*(j+n1*k)])</code> over all j.
+       * Each slice is reduced using a vectorised lane parallel row
+       * reduction.
+       * @param[in] in the table to marginalise, of size n0*n1*n2.
+       * @param[in] n0 the size of the first axis.
+       * @param[in] n1 the size of the middle axis.
+       * @param[in] n2 the size of the last axis.
+       * @param[out] out array of size n0*n2 in which to store the result.
+       */
+      static void maxOverAxis
+      (
+       const ValType* in,
+       ValIndex n0,
+       ValIndex n1,
+       ValIndex n2,
+       ValType* out
+      );
+
+      /**
+       * Default constructor maps the domain of a constant function to itself.
+       */
+      DomainMap();
+
+      /**
+       * Constructs a map between the domains of two functions.
+       * @param[in] outer function whose domain is the outer domain.
+       * @param[in] inner function whose domain is the inner domain.
+       * @throws maxsum::BadDomainException if the domain of inner is not a
+       * subset of that of outer.
+       */
+      DomainMap(const DiscreteFunction& outer, const DiscreteFunction& inner);
+
+      /**
+       * Constructs a map between two domains.
+       * @param[in] outerBegin iterator to the first outer variable.
+       * @param[in] outerEnd iterator to the end of the outer variables.
+       * @param[in] sizeBegin iterator to the domain size of the first outer
+       * variable.
+       * @param[in] innerBegin iterator to the first inner variable.
+       * @param[in] innerEnd iterator to the end of the inner variables.
+       * @pre both variable lists must be sorted.
+       * @throws maxsum::BadDomainException if the inner variables are not a
+       * subset of the outer variables.
+       */
+      template<class VarIt, class SizeIt> DomainMap
+      (
+       VarIt outerBegin,
+       VarIt outerEnd,
+       SizeIt sizeBegin,
+       VarIt innerBegin,
+       VarIt innerEnd
+      )
+      : outerVars_i(), innerVars_i(), outerSize_i(1), innerSize_i(1),
+        dims_i(), margDims_i()
+      {
+         std::vector<VarID> outerVars(outerBegin,outerEnd);
+         std::vector<ValIndex> sizes(sizeBegin,sizeBegin+outerVars.size());
+         std::vector<VarID> innerVars(innerBegin,innerEnd);
+         reset(outerVars,sizes,innerVars);
+      }
+
+      /**
+       * Recalculates this map for a new pair of domains.
+       * @param[in] outerVars sorted list of variables in the outer domain.
+       * @param[in] outerSizes domain size of each variable in outerVars.
+       * @param[in] innerVars sorted list of variables in the inner domain.
+       * @throws maxsum::BadDomainException if the inner variables are not a
+       * subset of the outer variables.
+       */
+      void reset
+      (
+       const std::vector<VarID>& outerVars,
+       const std::vector<ValIndex>& outerSizes,
+       const std::vector<VarID>& innerVars
+      );
+
+      /**
+       * Recalculates this map for the domains of a new pair of functions.
+       * @param[in] outer function whose domain is the outer domain.
+       * @param[in] inner function whose domain is the inner domain.
+       * @throws maxsum::BadDomainException if the domain of inner is not a
+       * subset of that of outer.
+       */
+      void reset(const DiscreteFunction& outer, const DiscreteFunction& inner);
+
+      /**
+       * Returns true if this map is valid for the domains of two functions.
+       * @param[in] outer function whose domain should be the outer domain.
+       * @param[in] inner function whose domain should be the inner domain.
+       */
+      bool matches
+      (
+       const DiscreteFunction& outer,
+       const DiscreteFunction& inner
+      ) const;
+
+      /**
+       * Returns the total size of the outer domain.
+       */
+      ValIndex outerSize() const { return outerSize_i; }
+
+      /**
+       * Returns the total size of the inner domain.
+       */
+      ValIndex innerSize() const { return innerSize_i; }
+
+      /**
+       * Returns the number of loop dimensions remaining after merging
+       * contiguous variables.
+       */
+      int noDims() const { return static_cast<int>(dims_i.size()); }
+
+      /**
+       * Calls <code>op(outerInd,innerInd)</code> for every linear index
+       * <code>outerInd</code> in the outer domain, in ascending order, where
+       * <code>innerInd</code> is the corresponding index in the inner domain.
+       * @param[in,out] op functor called for each element.
+       */
+      template<class Op> void forEach(Op& op) const
+      {
+         walk(dims_i,op);
+      }
+
+      /**
+       * Applies a binary operation to each outer value, and its
+       * corresponding inner value. That is
+       * <code>outer[k] = binOp(outer[k],inner[map(k)])</code> for all k.
+       * @param[in,out] outer the outer value table.
+       * @param[in] inner the inner value table.
+       * @param[in] binOp the operation to apply.
+       */
+      template<class BinaryOp> void transform
+      (
+       ValType* outer,
+       const ValType* inner,
+       BinaryOp binOp
+      ) const
+      {
+         TransformOp<BinaryOp> op = {outer, inner, binOp};
+         walk(dims_i,op);
+      }
+
+      /**
+       * Adds each inner value to its corresponding outer values.
+       * @param[in,out] outer the outer value table.
+       * @param[in] inner the inner value table.
+       */
+      void add(ValType* outer, const ValType* inner) const;
+
+      /**
+       * Subtracts each inner value from its corresponding outer values.
+       * @param[in,out] outer the outer value table.
+       * @param[in] inner the inner value table.
+       */
+      void subtract(ValType* outer, const ValType* inner) const;
+
+      /**
+       * Copies each inner value to all its corresponding outer values, so
+       * that the outer table holds the inner function expanded to the
+       * outer domain.
+       * @param[in] inner the inner value table.
+       * @param[out] outer the outer value table.
+       */
+      void expand(const ValType* inner, ValType* outer) const;
+
+      /**
+       * Marginalises the outer values onto the inner domain.
+       * For each inner value, the corresponding outer values are combined
+       * using <code>result = aggregate(result,nextValue)</code>, starting
+       * from the first corresponding outer value.
+       * @param[in] outer the outer value table.
+       * @param[in] aggregate functor used to combine values.
+       * @param[out] inner the inner value table in which to store the result.
+       * @see maxsum::marginal()
+       */
+      template<class F> void marginal
+      (
+       const ValType* outer,
+       F aggregate,
+       ValType* inner
+      ) const
+      {
+         MarginalOp<F> op = {outer, inner, aggregate,
+            outerSize_i/innerSize_i, 0};
+         walk(margDims_i,op);
+      }
+
+      /**
+       * Marginalises the outer values onto the inner domain by maximisation.
+       * After merging contiguous variables, every mapping with at most three
+       * dimensions is handled by DomainMap::maxOntoAxis or
+       * DomainMap::maxOverAxis. This includes marginalising any pairwise or
+       * ternary factor onto one of its variables.
+       * @param[in] outer the outer value table.
+       * @param[out] inner the inner value table in which to store the result.
+       * @see maxsum::maxMarginal()
+       */
+      void maxMarginal(const ValType* outer, ValType* inner) const;
+
+   }; // class DomainMap
+
+} // namespace maxsum
+
+#endif // MAXSUM_DOMAIN_MAP_H
@@ -6,6 +6,10 @@
 #ifndef EIGEN_ITERATOR_PLUGIN_H
 #define EIGEN_ITERATOR_PLUGIN_H
 
+// Eigen 3.4 and later provide their own STL style iterators, in which case
+// we use those in preference to our own.
+#if !EIGEN_VERSION_AT_LEAST(3,3,90)
+
 typedef Scalar value_type;
 
 typedef max_sum::ConstEigenIterator<DenseBase<Derived> > const_iterator;
@@ -20,6 +24,8 @@ const_iterator end() const
     return const_iterator(size(),*this);
 }
 
+#endif
+
 const_iterator find(int index) const
 {
     index = (0>index) ? 0 : index;
@@ -0,0 +1,600 @@
+/**
+ * @file FlatFactorGraph.h
+ * Defines the maxsum::util::FlatFactorGraph class, which stores a frozen
+ * copy of a factor graph in contiguous arrays, so that the max-sum algorithm
+ * can be run without any map lookups or pointer chasing.
+ * @see maxsum::MaxSumController::compile
+ */
+#ifndef MAXSUM_UTIL_FLATFACTORGRAPH_H
+#define MAXSUM_UTIL_FLATFACTORGRAPH_H
+
+#include <map>
+#include <vector>
+#include "common.h"
+#include "DiscreteFunction.h"
+#include "exceptions.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Compiled representation of a factor graph.
+    * The graph structure is stored in compressed sparse row (CSR) form:
+    * each factor owns a contiguous range of edges, each edge references the
+    * index of the variable at its other end, and each variable owns a
+    * contiguous range of references back to its edges. Factor tables, factor
+    * to variable messages, and variable to factor messages are each stored
+    * in a single contiguous buffer, addressed by offsets.
+    *
+    * Factors and variables are indexed from 0 in ascending order of their
+    * maxsum::FactorID and maxsum::VarID respectively, while the edges of each
+    * factor are ordered in the same way as the factor's domain. This means
+    * that the kth edge of a factor corresponds to the kth variable returned
+    * by maxsum::DiscreteFunction::varBegin.
+    *
+    * Optionally, values that can never be part of an optimal assignment may
+    * be pruned from each variable's domain when the graph is built. Tables
+    * and messages then only cover the remaining values, which are indexed
+    * from 0 in ascending order, and ::keptValue() maps them back to values
+    * in the variable's full domain.
+    *
+    * @attention This class is used as part of the implementation of
+    * maxsum::MaxSumController, and so does not need to be referenced directly
+    * by calling libraries.
+    */
+   class FlatFactorGraph
+   {
+   public:
+
+      /**
+       * Type of map from which factor graphs are compiled.
+       */
+      typedef std::map<FactorID,DiscreteFunction> FactorMap;
+
+   private:
+
+      /**
+       * Ids of each factor, in ascending order.
+       */
+      std::vector<FactorID> factorIds_i;
+
+      /**
+       * Offset of each factor's first edge. Edges for factor f are in the
+       * range [factorEdges_i[f], factorEdges_i[f+1]).
+       */
+      std::vector<int> factorEdges_i;
+
+      /**
+       * Offset of each factor's value table in tables_i.
+       */
+      std::vector<int> tableOffsets_i;
+
+      /**
+       * Size of each factor's value table.
+       */
+      std::vector<ValIndex> tableSizes_i;
+
+      /**
+       * Values for all factor tables, stored contiguously.
+       */
+      std::vector<ValType> tables_i;
+
+      /**
+       * Ids of each variable, in ascending order.
+       */
+      std::vector<VarID> varIds_i;
+
+      /**
+       * Domain size of each variable, after any pruning.
+       */
+      std::vector<ValIndex> varSizes_i;
+
+      /**
+       * Offset of each variable's kept values in keptValues_i. Kept values
+       * for variable v are in the range [keptBegin_i[v], keptBegin_i[v+1]).
+       * This is empty if no values were pruned.
+       */
+      std::vector<int> keptBegin_i;
+
+      /**
+       * The values kept in each variable's full domain, in ascending order.
+       */
+      std::vector<ValIndex> keptValues_i;
+
+      /**
+       * Stride of each edge's variable within its factor's full, unpruned,
+       * domain. This is empty if no values were pruned.
+       */
+      std::vector<ValIndex> fullStrides_i;
+
+      /**
+       * Size of each factor's full, unpruned, domain. This is empty if no
+       * values were pruned.
+       */
+      std::vector<ValIndex> fullTableSizes_i;
+
+      /**
+       * Offset of each variables's first edge reference. References for
+       * variable v are in the range [varEdges_i[v], varEdges_i[v+1]).
+       */
+      std::vector<int> varEdges_i;
+
+      /**
+       * The edge indices referenced by each variable.
+       */
+      std::vector<int> varEdgeList_i;
+
+      /**
+       * Currently assigned value of each variable.
+       */
+      std::vector<ValIndex> values_i;
+
+      /**
+       * Variable index at the end of each edge.
+       */
+      std::vector<int> edgeVars_i;
+
+      /**
+       * Stride of each edge's variable within its factor's value table.
+       */
+      std::vector<ValIndex> edgeStrides_i;
+
+      /**
+       * Offset of each edge's messages in the message buffer.
+       */
+      std::vector<int> msgOffsets_i;
+
+      /**
+       * Total number of message values for each direction.
+       */
+      int msgSize_i;
+
+      /**
+       * Single buffer holding all messages. The first msgSize_i values hold
+       * factor to variable messages, and the remainder hold variable to factor
+       * messages.
+       */
+      std::vector<ValType> messages_i;
+
+      /**
+       * Size of the largest factor table.
+       */
+      ValIndex maxTableSize_i;
+
+      /**
+       * Size of the largest variable domain.
+       */
+      ValIndex maxVarSize_i;
+
+      /**
+       * Scratch space for factor totals, with space for the largest table
+       * for each thread.
+       */
+      std::vector<ValType> totalScratch_i;
+
+      /**
+       * Scratch space for single messages, with space for the largest
+       * variable domain for each thread.
+       */
+      std::vector<ValType> msgScratch_i;
+
+      /**
+       * Scratch space for summing messages at a variable, with space for
+       * the largest variable domain for each thread.
+       */
+      std::vector<ValType> sumScratch_i;
+
+      /**
+       * Largest message change seen by each thread since ::resetStats().
+       * Only maintained if statistics are enabled.
+       */
+      std::vector<ValType> residuals_i;
+
+      /**
+       * Number of value changes seen by each thread since ::resetStats().
+       * Only maintained if statistics are enabled.
+       */
+      std::vector<int> valueChanges_i;
+
+      /**
+       * Weight given to the previous value of each factor to variable
+       * message when it is updated.
+       */
+      ValType damping_i;
+
+      /**
+       * Number of flips after which a variable is frozen, or 0 if variables
+       * are never frozen.
+       */
+      int freezeAfter_i;
+
+      /**
+       * Value held by each variable before its current value, or -1 if its
+       * value has not changed since ::setFreezeAfter() was last called.
+       */
+      std::vector<ValIndex> lastValues_i;
+
+      /**
+       * Number of times each variable's value has flipped back to its last
+       * value since ::setFreezeAfter() was last called.
+       */
+      std::vector<int> flips_i;
+
+      /**
+       * Pool of threads used to update messages in parallel.
+       */
+      ThreadPool pool_i;
+
+      /**
+       * Task used to run updateFactors() on the thread pool.
+       */
+      struct Fac2VarTask;
+
+      /**
+       * Task used to run updateVars() on the thread pool.
+       */
+      struct Var2FacTask;
+
+      /**
+       * Allocates scratch space for the current number of threads.
+       */
+      void allocScratch();
+
+      /**
+       * Copies the values of a factor into its table, skipping any pruned
+       * values.
+       * @param[in] f the index of the factor.
+       * @param[in] fun the factor's values over its full domain.
+       */
+      void packTable(int f, const DiscreteFunction& fun);
+
+      /**
+       * Calculates the total value (factor plus sum of all input messages)
+       * for a specified factor.
+       * @param[in] f the index of the factor.
+       * @param[out] total array with space for the factor's table.
+       */
+      void calcTotal(int f, ValType* total) const;
+
+      /**
+       * Updates the factor to variable messages for factors in the range
+       * [begin,end). This only writes to the output messages of these
+       * factors, so different ranges may be updated concurrently.
+       * @param[in] begin index of the first factor to update.
+       * @param[in] end index after the last factor to update.
+       * @param[in] thread index of the scratch space to use.
+       * @param[in] threshold maxnorm change above which a message is counted
+       * as updated.
+       * @returns the number of significantly changed messages.
+       */
+      int updateFactors(int begin, int end, int thread, ValType threshold);
+
+      /**
+       * Updates the variable to factor messages and values for variables
+       * in the range [begin,end). This only writes to the output messages
+       * and values of these variables, so different ranges may be updated
+       * concurrently.
+       * @param[in] begin index of the first variable to update.
+       * @param[in] end index after the last variable to update.
+       * @param[in] thread index of the scratch space to use.
+       * @param[in] threshold maxnorm change above which a message is counted
+       * as updated.
+       * @returns the number of significantly changed messages, plus the
+       * number of variables whose value changed.
+       */
+      int updateVars(int begin, int end, int thread, ValType threshold);
+
+   public:
+
+      /**
+       * Constructs an empty graph, with no factors or variables.
+       */
+      FlatFactorGraph();
+
+      /**
+       * Compiles a flat graph from a map of factors.
+       * All messages are initialised to zero, and all variable values to 0.
+       * @param[in] factors the factors from which to build this graph.
+       * @param[in] prune true if dominated values should be pruned from
+       * each variable's domain.
+       * @post any previous contents of this graph are destroyed.
+       */
+      void build(const FactorMap& factors, bool prune=false);
+
+      /**
+       * Returns true if any values were pruned when this graph was built.
+       */
+      bool isPruned() const { return !keptValues_i.empty(); }
+
+      /**
+       * Returns the number of values pruned from all variable domains.
+       */
+      int noPrunedValues() const;
+
+      /**
+       * Returns the value in a variable's full domain that corresponds to
+       * a value in its compiled domain.
+       * @param[in] v the index of the variable.
+       * @param[in] k the value in the compiled domain.
+       */
+      ValIndex keptValue(int v, ValIndex k) const
+      {
+         return isPruned() ? keptValues_i[keptBegin_i[v]+k] : k;
+      }
+
+      /**
+       * Removes all factors, variables and edges from this graph.
+       * @post the number of threads is unchanged.
+       */
+      void clear();
+
+      /**
+       * Returns the number of threads used to update messages.
+       */
+      int noThreads() const { return pool_i.noThreads(); }
+
+      /**
+       * Sets the number of threads used to update messages.
+       * Results do not depend on the number of threads.
+       * @param[in] noThreads the number of threads, which must be positive.
+       */
+      void setNoThreads(int noThreads);
+
+      /**
+       * Returns the number of factors in this graph.
+       */
+      int noFactors() const { return factorIds_i.size(); }
+
+      /**
+       * Returns the number of variables in this graph.
+       */
+      int noVars() const { return varIds_i.size(); }
+
+      /**
+       * Returns the number of edges in this graph.
+       */
+      int noEdges() const { return edgeVars_i.size(); }
+
+      /**
+       * Returns the maxsum::FactorID for a specified factor index.
+       */
+      FactorID factorId(int f) const { return factorIds_i[f]; }
+
+      /**
+       * Returns the index of a specified factor, or -1 if it is not in this
+       * graph.
+       */
+      int factorIndex(FactorID id) const;
+
+      /**
+       * Returns the index of the first edge for a specified factor.
+       */
+      int edgeBegin(int f) const { return factorEdges_i[f]; }
+
+      /**
+       * Returns the index after the last edge for a specified factor.
+       */
+      int edgeEnd(int f) const { return factorEdges_i[f+1]; }
+
+      /**
+       * Returns the maxsum::VarID for a specified variable index.
+       */
+      VarID varId(int v) const { return varIds_i[v]; }
+
+      /**
+       * Returns the index of a specified variable, or -1 if it is not in
+       * this graph.
+       */
+      int varIndex(VarID id) const;
+
+      /**
+       * Returns the variable index at the end of a specified edge.
+       */
+      int edgeVar(int e) const { return edgeVars_i[e]; }
+
+      /**
+       * Returns the number of values in each message sent along an edge.
+       */
+      ValIndex edgeSize(int e) const { return varSizes_i[edgeVars_i[e]]; }
+
+      /**
+       * Returns the stride of an edge's variable within its factor's table.
+       */
+      ValIndex edgeStride(int e) const { return edgeStrides_i[e]; }
+
+      /**
+       * Returns the offset of an edge's messages within each direction of
+       * the message buffer.
+       */
+      int msgOffset(int e) const { return msgOffsets_i[e]; }
+
+      /**
+       * Returns the total number of message values in each direction.
+       */
+      int msgSize() const { return msgSize_i; }
+
+      /**
+       * Returns the size of a specified factor's value table.
+       */
+      ValIndex tableSize(int f) const { return tableSizes_i[f]; }
+
+      /**
+       * Returns the offset of a specified factor's value table.
+       */
+      int tableOffset(int f) const { return tableOffsets_i[f]; }
+
+      /**
+       * Returns the total number of values in all factor tables.
+       */
+      int tablesSize() const { return tables_i.size(); }
+
+      /**
+       * Returns the size of the largest factor table.
+       */
+      ValIndex maxTableSize() const { return maxTableSize_i; }
+
+      /**
+       * Returns the size of the largest variable domain.
+       */
+      ValIndex maxVarSize() const { return maxVarSize_i; }
+
+      /**
+       * Returns the domain size of a specified variable.
+       */
+      ValIndex varSize(int v) const { return varSizes_i[v]; }
+
+      /**
+       * Returns the position of a variable's first edge reference, which
+       * can be passed to ::varEdge().
+       */
+      int varEdgeBegin(int v) const { return varEdges_i[v]; }
+
+      /**
+       * Returns the position after a variable's last edge reference.
+       */
+      int varEdgeEnd(int v) const { return varEdges_i[v+1]; }
+
+      /**
+       * Returns the edge referenced at a specified position, in the range
+       * [::varEdgeBegin(v), ::varEdgeEnd(v)) for some variable v.
+       */
+      int varEdge(int k) const { return varEdgeList_i[k]; }
+
+      /**
+       * Returns the current value assigned to a specified variable, in its
+       * full domain.
+       */
+      ValIndex getValue(int v) const { return keptValue(v,values_i[v]); }
+
+      /**
+       * Sets the current value assigned to a specified variable.
+       * @param[in] v the index of the variable.
+       * @param[in] val the value in the variable's full domain. If this
+       * value was pruned, the variable is set to its first kept value.
+       */
+      void setValue(int v, ValIndex val);
+
+      /**
+       * Returns the factor to variable message for a specified edge.
+       */
+      ValType* fac2varMsg(int e) { return &messages_i[msgOffsets_i[e]]; }
+
+      /**
+       * Returns the factor to variable message for a specified edge.
+       */
+      const ValType* fac2varMsg(int e) const
+      {
+         return &messages_i[msgOffsets_i[e]];
+      }
+
+      /**
+       * Returns the variable to factor message for a specified edge.
+       */
+      ValType* var2facMsg(int e)
+      {
+         return &messages_i[msgSize_i+msgOffsets_i[e]];
+      }
+
+      /**
+       * Returns the variable to factor message for a specified edge.
+       */
+      const ValType* var2facMsg(int e) const
+      {
+         return &messages_i[msgSize_i+msgOffsets_i[e]];
+      }
+
+      /**
+       * Replaces the values of a factor's table.
+       * @param[in] f the index of the factor to update.
+       * @param[in] fun the new value of the factor.
+       * @pre <code>fun</code> must have the same domain as the factor used
+       * to compile this graph.
+       * @attention If values were pruned, they were only dominated for the
+       * factor values used to build this graph, so new values may require
+       * the graph to be rebuilt.
+       */
+      void setFactorValues(int f, const DiscreteFunction& fun);
+
+      /**
+       * Calculates the total value for a specified factor, which is
+       * the factor plus the sum of all its input messages.
+       * @param[in] f the index of the factor.
+       * @param[in,out] out function in which to store the result.
+       * @pre <code>out</code> must have the same domain as the factor's
+       * compiled table.
+       */
+      void getTotalValue(int f, DiscreteFunction& out) const;
+
+      /**
+       * Updates the factor to variable messages for every factor.
+       * Factors are divided between all available threads.
+       * @param[in] threshold maxnorm change above which a message is counted
+       * as updated.
+       * @returns the number of significantly changed messages.
+       */
+      int updateFac2VarMsgs(ValType threshold);
+
+      /**
+       * Updates the variable to factor messages and values for every
+       * variable. Variables are divided between all available threads.
+       * @param[in] threshold maxnorm change above which a message is counted
+       * as updated.
+       * @returns the number of significantly changed messages, plus the
+       * number of variables whose value changed.
+       */
+      int updateVar2FacMsgs(ValType threshold);
+
+      /**
+       * Runs the max-sum algorithm on this graph until convergence, or
+       * until a maximum number of iterations.
+       * @param[in] maxIterations maximum number of iterations to perform.
+       * @param[in] threshold maxnorm change below which messages are taken
+       * to have converged.
+       * @returns the number of iterations performed.
+       */
+      int optimise(int maxIterations, ValType threshold);
+
+      /**
+       * Sets the weight given to the previous value of each factor to
+       * variable message when it is updated.
+       * @param[in] damping the weight, in [0,1). Zero means no damping.
+       */
+      void setDamping(ValType damping) { damping_i = damping; }
+
+      /**
+       * Sets the number of times a variable's value may flip back to its
+       * previous value before the variable is frozen. Frozen variables keep
+       * their value and output messages until this is next called, which
+       * unfreezes all variables.
+       * @param[in] freezeAfter the number of flips, or 0 to never freeze
+       * variables.
+       */
+      void setFreezeAfter(int freezeAfter);
+
+      /**
+       * Resets the statistics returned by ::maxResidual() and
+       * ::noValueChanges().
+       */
+      void resetStats();
+
+      /**
+       * Returns the largest maxnorm change in any message since the last
+       * call to ::resetStats(). Always 0 unless statistics are enabled.
+       */
+      ValType maxResidual() const;
+
+      /**
+       * Returns the number of variable value changes since the last call to
+       * ::resetStats(). Always 0 unless statistics are enabled.
+       */
+      int noValueChanges() const;
+
+   }; // class FlatFactorGraph
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_FLATFACTORGRAPH_H
@@ -0,0 +1,1370 @@
+/**
+ * @file FunctionExpr.h
+ * Defines the expression templates used for arithmetic on
+ * maxsum::DiscreteFunction objects.
+ *
+ * The arithmetic operators and element-wise functions defined here do not
+ * compute their results immediately. Instead, they return lightweight
+ * expression objects that record the operation and its operands. When an
+ * expression is assigned to a maxsum::DiscreteFunction, the union of its
+ * operands' domains is computed once, and the whole expression is evaluated
+ * in a single pass over the result, without creating a temporary function
+ * for each intermediate result. For example, in
+ * <pre>
+ * DiscreteFunction f = a + b - c*2;
+ * </pre>
+ * each element of f is computed directly from the corresponding elements of
+ * a, b and c.
+ *
+ * Expressions store references to the functions they are built from, so
+ * they should be evaluated before those functions are changed or destroyed.
+ * Temporary functions are moved into the expression, and if one of them
+ * already has the result's domain, its storage is reused for the result.
+ *
+ * This file is included by DiscreteFunction.h, and should not be included
+ * directly.
+ */
+#ifndef MAXSUM_FUNCTION_EXPR_H
+#define MAXSUM_FUNCTION_EXPR_H
+
+#include <type_traits>
+#include "DiscreteFunction.h"
+
+namespace maxsum
+{
+   /**
+    * Base class for expressions over maxsum::DiscreteFunction objects.
+    * Each expression type passes itself as the template parameter, so that
+    * functions accepting a FunctionExpr can recover the full expression
+    * type without any virtual calls.
+    *
+    * As well as being copyable, every expression type provides the
+    * following const member functions, which are used by
+    * maxsum::DiscreteFunction to evaluate it.
+    * - <code>void addVars(util::ExprVarVec& vars)</code> appends the
+    * domain of each function in the expression to vars.
+    * - <code>void prepare()</code> is called before any values are read.
+    * - <code>bool hasDomain(const DiscreteFunction& dest)</code> returns
+    * true if every function in the expression has the same domain as dest.
+    * - <code>ValType at(ValIndex k)</code> returns the kth value of the
+    * expression, provided hasDomain() is true for the result.
+    * - <code>void bind(const DiscreteFunction& dest)</code> prepares the
+    * expression to be visited in the order of dest's domain, which must
+    * include the domain of every function in the expression.
+    * - <code>ValType row(ValIndex x)</code> returns the value of the
+    * expression when the first variable in dest's domain has value x, and
+    * the other variables have their current values.
+    * - <code>void advance(int d)</code> moves to the next value of the
+    * other variables, where d > 0 is the index in dest's domain of the
+    * slowest variable whose value has changed.
+    *
+    * In addition, the non-const member function
+    * <code>DiscreteFunction* reusable(const util::ExprVarVec& vars)</code>
+    * returns a temporary function owned by the expression whose domain is
+    * vars, or NULL if there is none.
+    */
+   template<class Derived> class FunctionExpr
+   {
+   public:
+
+      /**
+       * Returns this expression as its derived type.
+       */
+      const Derived& derived() const
+      {
+         return static_cast<const Derived&>(*this);
+      }
+
+      /**
+       * Returns this expression as its derived type.
+       */
+      Derived& derived()
+      {
+         return static_cast<Derived&>(*this);
+      }
+
+   }; // class FunctionExpr
+
+namespace util
+{
+   /**
+    * Type used to collect the domain of an expression.
+    */
+   typedef SmallVector<VarID,2*DiscreteFunction::INLINE_VARS> ExprVarVec;
+
+   /**
+    * Returns true if a function's domain is exactly the specified list of
+    * sorted variables.
+    */
+   template<class VarVec> bool hasVars
+   (
+    const DiscreteFunction& fun,
+    const VarVec& vars
+   )
+   {
+      return (fun.noVars()==static_cast<int>(vars.size())) &&
+         std::equal(vars.begin(),vars.end(),fun.varBegin());
+   }
+
+   /**
+    * Returns true if two functions have the same domain.
+    */
+   inline bool hasVars
+   (
+    const DiscreteFunction& fun,
+    const DiscreteFunction& dest
+   )
+   {
+      return (fun.noVars()==dest.noVars()) &&
+         std::equal(dest.varBegin(),dest.varEnd(),fun.varBegin());
+   }
+
+   /**
+    * Position of one function's values during the evaluation of an
+    * expression. Expressions are evaluated through const references, so
+    * this state is mutable.
+    */
+   class ExprCursor
+   {
+   private:
+
+      /**
+       * The function's value table.
+       */
+      mutable const ValType* data_i;
+
+      /**
+       * Index in data_i of the current row's first value.
+       */
+      mutable ValIndex pos_i;
+
+      /**
+       * Stride in data_i of the first variable in the result's domain, or
+       * 0 if the function does not depend on it.
+       */
+      mutable ValIndex rowStride_i;
+
+      /**
+       * Amount added to pos_i by advance(d) for each dimension d > 0 of the
+       * result's domain.
+       */
+      mutable SmallVector<ValIndex,2*DiscreteFunction::INLINE_VARS> delta_i;
+
+   public:
+
+      /**
+       * Constructs a cursor that is not yet attached to a function.
+       */
+      ExprCursor() : data_i(0), pos_i(0), rowStride_i(0), delta_i() {}
+
+      /**
+       * Attaches this cursor to the start of a function's value table.
+       */
+      void prepare(const DiscreteFunction& fun) const
+      {
+         data_i = &fun(0);
+         pos_i = 0;
+      }
+
+      /**
+       * Returns the kth value of the function.
+       */
+      ValType at(ValIndex k) const
+      {
+         return data_i[k];
+      }
+
+      /**
+       * Returns the xth value of the current row.
+       */
+      ValType row(ValIndex x) const
+      {
+         return data_i[pos_i+x*rowStride_i];
+      }
+
+      /**
+       * Moves to the next row of the result's domain.
+       * @see maxsum::FunctionExpr
+       */
+      void advance(int d) const
+      {
+         pos_i += delta_i[d];
+      }
+
+      /**
+       * Calculates the stride of each dimension of the result's domain in
+       * the function. When a dimension changes, every faster dimension
+       * except the first wraps around to zero, so the step taken by
+       * advance() is the dimension's stride, less the strides already
+       * taken in those dimensions.
+       * @param[in] fun the function to which this cursor is attached.
+       * @param[in] dest the result, whose domain includes that of fun.
+       */
+      void bind(const DiscreteFunction& fun, const DiscreteFunction& dest) const
+      {
+         const int noDims = dest.noVars();
+         delta_i.resize(noDims);
+
+         DiscreteFunction::VarIterator var = fun.varBegin();
+         DiscreteFunction::SizeIterator size = fun.sizeBegin();
+         DiscreteFunction::VarIterator destVar = dest.varBegin();
+         DiscreteFunction::SizeIterator destSize = dest.sizeBegin();
+         ValIndex stride = 1;
+         ValIndex wrapped = 0;
+         for(int d=0; d<noDims; ++d)
+         {
+            ValIndex dimStride = 0;
+            if( (fun.varEnd()!=var) && (*var==destVar[d]) )
+            {
+               dimStride = stride;
+               stride *= *size;
+               ++var;
+               ++size;
+            }
+            if(0==d)
+            {
+               rowStride_i = dimStride;
+               continue;
+            }
+            delta_i[d] = dimStride - wrapped;
+            wrapped += (destSize[d]-1) * dimStride;
+         }
+      }
+
+   }; // class ExprCursor
+
+} // namespace util
+
+   /**
+    * Expression that refers to an existing maxsum::DiscreteFunction.
+    */
+   class FunctionRefExpr : public FunctionExpr<FunctionRefExpr>
+   {
+   private:
+
+      /**
+       * The function to which this expression refers.
+       */
+      const DiscreteFunction* fun_i;
+
+      /**
+       * Current position in the function's values.
+       */
+      util::ExprCursor cursor_i;
+
+   public:
+
+      /**
+       * Constructs an expression that refers to the specified function.
+       */
+      FunctionRefExpr(const DiscreteFunction& fun)
+         : fun_i(&fun), cursor_i() {}
+
+      /** @see maxsum::FunctionExpr */
+      void addVars(util::ExprVarVec& vars) const
+      {
+         for(DiscreteFunction::VarIterator it=fun_i->varBegin();
+               it!=fun_i->varEnd(); ++it)
+         {
+            vars.push_back(*it);
+         }
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void prepare() const
+      {
+         cursor_i.prepare(*fun_i);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      bool hasDomain(const DiscreteFunction& dest) const
+      {
+         return util::hasVars(*fun_i,dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType at(ValIndex k) const
+      {
+         return cursor_i.at(k);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void bind(const DiscreteFunction& dest) const
+      {
+         cursor_i.bind(*fun_i,dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType row(ValIndex x) const
+      {
+         return cursor_i.row(x);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void advance(int d) const
+      {
+         cursor_i.advance(d);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      DiscreteFunction* reusable(const util::ExprVarVec&)
+      {
+         return 0;
+      }
+
+   }; // class FunctionRefExpr
+
+   /**
+    * Expression that owns a temporary maxsum::DiscreteFunction, so that
+    * the temporary outlives the expression, and its storage can be reused
+    * for the result.
+    */
+   class FunctionTempExpr : public FunctionExpr<FunctionTempExpr>
+   {
+   private:
+
+      /**
+       * The function owned by this expression.
+       */
+      DiscreteFunction fun_i;
+
+      /**
+       * Current position in the function's values.
+       */
+      util::ExprCursor cursor_i;
+
+   public:
+
+      /**
+       * Constructs an expression that takes ownership of a temporary
+       * function.
+       */
+      FunctionTempExpr(DiscreteFunction&& fun)
+         : fun_i(std::move(fun)), cursor_i() {}
+
+      /**
+       * Constructs an expression that owns a copy of a function.
+       */
+      FunctionTempExpr(const DiscreteFunction& fun)
+         : fun_i(fun), cursor_i() {}
+
+      /** @see maxsum::FunctionExpr */
+      void addVars(util::ExprVarVec& vars) const
+      {
+         for(DiscreteFunction::VarIterator it=fun_i.varBegin();
+               it!=fun_i.varEnd(); ++it)
+         {
+            vars.push_back(*it);
+         }
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void prepare() const
+      {
+         cursor_i.prepare(fun_i);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      bool hasDomain(const DiscreteFunction& dest) const
+      {
+         return util::hasVars(fun_i,dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType at(ValIndex k) const
+      {
+         return cursor_i.at(k);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void bind(const DiscreteFunction& dest) const
+      {
+         cursor_i.bind(fun_i,dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType row(ValIndex x) const
+      {
+         return cursor_i.row(x);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void advance(int d) const
+      {
+         cursor_i.advance(d);
+      }
+
+      /**
+       * Returns the owned function if it has the specified domain. Borrowed
+       * tables are never reused, because they belong to someone else.
+       * @see maxsum::FunctionExpr
+       */
+      DiscreteFunction* reusable(const util::ExprVarVec& vars)
+      {
+         if(fun_i.isBorrowed() || !util::hasVars(fun_i,vars))
+         {
+            return 0;
+         }
+         return &fun_i;
+      }
+
+   }; // class FunctionTempExpr
+
+   /**
+    * Expression for a constant scalar value.
+    */
+   class ScalarExpr : public FunctionExpr<ScalarExpr>
+   {
+   private:
+
+      /**
+       * The value of this expression.
+       */
+      ValType val_i;
+
+   public:
+
+      /**
+       * Constructs an expression with the specified value.
+       */
+      ScalarExpr(ValType val) : val_i(val) {}
+
+      /** @see maxsum::FunctionExpr */
+      void addVars(util::ExprVarVec&) const {}
+
+      /** @see maxsum::FunctionExpr */
+      void prepare() const {}
+
+      /** @see maxsum::FunctionExpr */
+      bool hasDomain(const DiscreteFunction&) const
+      {
+         return true;
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType at(ValIndex) const
+      {
+         return val_i;
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void bind(const DiscreteFunction&) const {}
+
+      /** @see maxsum::FunctionExpr */
+      ValType row(ValIndex) const
+      {
+         return val_i;
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void advance(int) const {}
+
+      /** @see maxsum::FunctionExpr */
+      DiscreteFunction* reusable(const util::ExprVarVec&)
+      {
+         return 0;
+      }
+
+   }; // class ScalarExpr
+
+   /**
+    * Expression that applies an operation to the values of two other
+    * expressions.
+    * @tparam Op type with a static <code>apply(ValType,ValType)</code>
+    * function that performs the operation.
+    * @tparam L type of the left hand operand.
+    * @tparam R type of the right hand operand.
+    */
+   template<class Op, class L, class R> class BinaryFunctionExpr
+      : public FunctionExpr<BinaryFunctionExpr<Op,L,R> >
+   {
+   private:
+
+      /**
+       * The left hand operand.
+       */
+      L lhs_i;
+
+      /**
+       * The right hand operand.
+       */
+      R rhs_i;
+
+   public:
+
+      /**
+       * Constructs an expression from its two operands.
+       */
+      template<class LArg, class RArg> BinaryFunctionExpr
+      (
+       LArg&& lhs,
+       RArg&& rhs
+      )
+      : lhs_i(std::forward<LArg>(lhs)), rhs_i(std::forward<RArg>(rhs)) {}
+
+      /** @see maxsum::FunctionExpr */
+      void addVars(util::ExprVarVec& vars) const
+      {
+         lhs_i.addVars(vars);
+         rhs_i.addVars(vars);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void prepare() const
+      {
+         lhs_i.prepare();
+         rhs_i.prepare();
+      }
+
+      /** @see maxsum::FunctionExpr */
+      bool hasDomain(const DiscreteFunction& dest) const
+      {
+         return lhs_i.hasDomain(dest) && rhs_i.hasDomain(dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType at(ValIndex k) const
+      {
+         return Op::apply(lhs_i.at(k),rhs_i.at(k));
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void bind(const DiscreteFunction& dest) const
+      {
+         lhs_i.bind(dest);
+         rhs_i.bind(dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType row(ValIndex x) const
+      {
+         return Op::apply(lhs_i.row(x),rhs_i.row(x));
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void advance(int d) const
+      {
+         lhs_i.advance(d);
+         rhs_i.advance(d);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      DiscreteFunction* reusable(const util::ExprVarVec& vars)
+      {
+         DiscreteFunction* result = lhs_i.reusable(vars);
+         return 0!=result ? result : rhs_i.reusable(vars);
+      }
+
+   }; // class BinaryFunctionExpr
+
+   /**
+    * Expression that applies an operation to the values of another
+    * expression.
+    * @tparam Op type with a static <code>apply(ValType)</code> function
+    * that performs the operation.
+    * @tparam E type of the operand.
+    */
+   template<class Op, class E> class UnaryFunctionExpr
+      : public FunctionExpr<UnaryFunctionExpr<Op,E> >
+   {
+   private:
+
+      /**
+       * The operand.
+       */
+      E arg_i;
+
+   public:
+
+      /**
+       * Constructs an expression from its operand.
+       */
+      template<class Arg> explicit UnaryFunctionExpr(Arg&& arg)
+         : arg_i(std::forward<Arg>(arg)) {}
+
+      /** @see maxsum::FunctionExpr */
+      void addVars(util::ExprVarVec& vars) const
+      {
+         arg_i.addVars(vars);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void prepare() const
+      {
+         arg_i.prepare();
+      }
+
+      /** @see maxsum::FunctionExpr */
+      bool hasDomain(const DiscreteFunction& dest) const
+      {
+         return arg_i.hasDomain(dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType at(ValIndex k) const
+      {
+         return Op::apply(arg_i.at(k));
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void bind(const DiscreteFunction& dest) const
+      {
+         arg_i.bind(dest);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      ValType row(ValIndex x) const
+      {
+         return Op::apply(arg_i.row(x));
+      }
+
+      /** @see maxsum::FunctionExpr */
+      void advance(int d) const
+      {
+         arg_i.advance(d);
+      }
+
+      /** @see maxsum::FunctionExpr */
+      DiscreteFunction* reusable(const util::ExprVarVec& vars)
+      {
+         return arg_i.reusable(vars);
+      }
+
+   }; // class UnaryFunctionExpr
+
+namespace util
+{
+   /**
+    * Addition of two values.
+    */
+   struct AddOp
+   {
+      static ValType apply(ValType a, ValType b) { return a + b; }
+   };
+
+   /**
+    * Subtraction of two values.
+    */
+   struct SubtractOp
+   {
+      static ValType apply(ValType a, ValType b) { return a - b; }
+   };
+
+   /**
+    * Multiplication of two values.
+    */
+   struct MultiplyOp
+   {
+      static ValType apply(ValType a, ValType b) { return a * b; }
+   };
+
+   /**
+    * Division of two values.
+    */
+   struct DivideOp
+   {
+      static ValType apply(ValType a, ValType b) { return a / b; }
+   };
+
+   /**
+    * Negation of a value.
+    */
+   struct NegateOp
+   {
+      static ValType apply(ValType a) { return -a; }
+   };
+
+   /**
+    * Applies a scalar function to a value.
+    */
+   template<UnaryScalarOp OP> struct UnaryScalarFunctionOp
+   {
+      static ValType apply(ValType a) { return OP(a); }
+   };
+
+   /**
+    * Applies a scalar function to a pair of values.
+    */
+   template<DualScalarOp OP> struct DualScalarFunctionOp
+   {
+      static ValType apply(ValType a, ValType b) { return OP(a,b); }
+   };
+
+   /**
+    * Maps the type of an argument passed to an arithmetic operator onto the
+    * expression type used to store it. Lvalue functions are stored by
+    * reference, temporary functions and expressions are stored by value,
+    * and arithmetic types are stored as maxsum::ScalarExpr. For any other
+    * type, there is no member <code>type</code>, so the operators are not
+    * considered.
+    * @tparam T the argument type, as deduced for a forwarding reference.
+    */
+   template<class T, class D=typename std::decay<T>::type, class Enable=void>
+      struct ExprOperand {};
+
+   /**
+    * Specialisation for maxsum::DiscreteFunction arguments.
+    */
+   template<class T> struct ExprOperand<T,DiscreteFunction,void>
+   {
+      typedef typename std::conditional<std::is_lvalue_reference<T>::value,
+         FunctionRefExpr, FunctionTempExpr>::type type;
+      static const bool isScalar = false;
+   };
+
+   /**
+    * Specialisation for expression arguments.
+    */
+   template<class T, class D> struct ExprOperand<T,D,
+      typename std::enable_if<std::is_base_of<FunctionExpr<D>,D>::value>::type>
+   {
+      typedef D type;
+      static const bool isScalar = false;
+   };
+
+   /**
+    * Specialisation for arithmetic arguments.
+    */
+   template<class T, class D> struct ExprOperand<T,D,
+      typename std::enable_if<std::is_arithmetic<D>::value>::type>
+   {
+      typedef ScalarExpr type;
+      static const bool isScalar = true;
+   };
+
+   /**
+    * Result type of a binary operation, which is only defined if both
+    * arguments are valid operands, and at least one is not a scalar.
+    */
+   template<class Op, class L, class R, class Enable=void>
+      struct BinaryExprResult {};
+
+   /**
+    * Specialisation for valid operands.
+    */
+   template<class Op, class L, class R> struct BinaryExprResult<Op,L,R,
+      typename std::enable_if<
+         !(ExprOperand<L>::isScalar && ExprOperand<R>::isScalar)>::type>
+   {
+      typedef BinaryFunctionExpr<Op,typename ExprOperand<L>::type,
+         typename ExprOperand<R>::type> type;
+   };
+
+   /**
+    * Result type of a unary operation, which is only defined if the
+    * argument is a valid operand, and is not a scalar.
+    */
+   template<class Op, class T, class Enable=void> struct UnaryExprResult {};
+
+   /**
+    * Specialisation for valid operands.
+    */
+   template<class Op, class T> struct UnaryExprResult<Op,T,
+      typename std::enable_if<!ExprOperand<T>::isScalar>::type>
+   {
+      typedef UnaryFunctionExpr<Op,typename ExprOperand<T>::type> type;
+   };
+
+   /**
+    * Evaluates an expression into a value table.
+    * If every function in the expression has the result's domain, each
+    * element is computed from the elements with the same index. Otherwise,
+    * the result's domain is traversed like an odometer, and the position
+    * in each function is updated incrementally, without any division or
+    * modulus operations.
+    * @param[in] expr the expression to evaluate.
+    * @param[in] dest function whose domain is the union of the domains in
+    * the expression.
+    * @param[out] out array in which to store the values, which may be the
+    * value table of dest, or of any function in the expression with the
+    * same domain as dest.
+    */
+   template<class E> void evalExpr
+   (
+    const E& expr,
+    const DiscreteFunction& dest,
+    ValType* out
+   )
+   {
+      expr.prepare();
+      const ValIndex total = dest.domainSize();
+
+      //************************************************************************
+      // If the domains are all the same, evaluate the elements in order.
+      //************************************************************************
+      if(expr.hasDomain(dest))
+      {
+         for(ValIndex k=0; k<total; ++k)
+         {
+            out[k] = expr.at(k);
+         }
+         return;
+      }
+
+      //************************************************************************
+      // Otherwise, evaluate one row of the fastest dimension at a time, and
+      // step the remaining dimensions like an odometer.
+      //************************************************************************
+      expr.bind(dest);
+      const int noDims = dest.noVars();
+      DiscreteFunction::SizeIterator sizes = dest.sizeBegin();
+      SmallVector<ValIndex,2*DiscreteFunction::INLINE_VARS> count(noDims,0);
+      ValIndex k = 0;
+      while(true)
+      {
+         const ValIndex rowSize = sizes[0];
+         ValType* pRow = out+k;
+         for(ValIndex x=0; x<rowSize; ++x)
+         {
+            pRow[x] = expr.row(x);
+         }
+         k += rowSize;
+
+         if(total<=k)
+         {
+            break;
+         }
+
+         int d = 1;
+         while(sizes[d]==++count[d])
+         {
+            count[d] = 0;
+            ++d;
+         }
+         expr.advance(d);
+      }
+
+   } // function evalExpr
+
+} // namespace util
+
+   /**
+    * Evaluates an expression into this function.
+    * @see maxsum::FunctionExpr
+    */
+   template<class E> DiscreteFunction::DiscreteFunction
+   (
+    const FunctionExpr<E>& expr
+   )
+   : vars_i(), size_i(), values_i(1,ValType(0))
+   {
+      *this = expr;
+   }
+
+   /**
+    * Evaluates a temporary expression into this function, reusing the
+    * storage of a temporary function in the expression if possible.
+    * @see maxsum::FunctionExpr
+    */
+   template<class E> DiscreteFunction::DiscreteFunction
+   (
+    FunctionExpr<E>&& expr
+   )
+   : vars_i(), size_i(), values_i(1,ValType(0))
+   {
+      *this = std::move(expr);
+   }
+
+   /**
+    * Sets this function to the value of an expression. If this function
+    * already has the expression's domain, it is evaluated in place, which
+    * is safe even if this function appears in the expression, because
+    * each element only depends on the operands' elements at the same index.
+    * @see maxsum::FunctionExpr
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator=
+   (
+    const FunctionExpr<E>& expr
+   )
+   {
+      util::ExprVarVec vars;
+      expr.derived().addVars(vars);
+      std::sort(vars.begin(),vars.end());
+      vars.resize(std::unique(vars.begin(),vars.end())-vars.begin());
+
+      if(util::hasVars(*this,vars))
+      {
+         util::evalExpr(expr.derived(),*this,values_i.data());
+         return *this;
+      }
+
+      DiscreteFunction result(vars.begin(),vars.end());
+      util::evalExpr(expr.derived(),result,result.values_i.data());
+      return *this = std::move(result);
+
+   } // operator=
+
+   /**
+    * Sets this function to the value of a temporary expression. If a
+    * temporary function in the expression has the expression's domain, the
+    * result is evaluated into its storage, which is then moved into this
+    * function.
+    * @see maxsum::FunctionExpr
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator=
+   (
+    FunctionExpr<E>&& expr
+   )
+   {
+      util::ExprVarVec vars;
+      expr.derived().addVars(vars);
+      std::sort(vars.begin(),vars.end());
+      vars.resize(std::unique(vars.begin(),vars.end())-vars.begin());
+
+      DiscreteFunction* pTemp = expr.derived().reusable(vars);
+      if( (0==pTemp) || util::hasVars(*this,vars) )
+      {
+         return *this = static_cast<const FunctionExpr<E>&>(expr);
+      }
+
+      util::evalExpr(expr.derived(),*pTemp,pTemp->values_i.data());
+      return *this = std::move(*pTemp);
+
+   } // operator=
+
+   /**
+    * Combines this function with an expression, expanding the domain if
+    * necessary.
+    * @tparam Op the operation used to combine each pair of values.
+    * @param[in] expr the expression, which is moved into the combined
+    * expression if it is a temporary.
+    */
+   template<class Op, class E> DiscreteFunction& DiscreteFunction::combine
+   (
+    E&& expr
+   )
+   {
+      return *this = BinaryFunctionExpr<Op,FunctionRefExpr,
+         typename std::decay<E>::type>(*this,std::forward<E>(expr));
+   }
+
+   /**
+    * Adds an expression to this function, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator+=
+   (
+    const FunctionExpr<E>& expr
+   )
+   {
+      return combine<util::AddOp>(expr.derived());
+   }
+
+   /**
+    * Adds an expression to this function, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator+=
+   (
+    FunctionExpr<E>&& expr
+   )
+   {
+      return combine<util::AddOp>(std::move(expr.derived()));
+   }
+
+   /**
+    * Subtracts an expression from this function, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator-=
+   (
+    const FunctionExpr<E>& expr
+   )
+   {
+      return combine<util::SubtractOp>(expr.derived());
+   }
+
+   /**
+    * Subtracts an expression from this function, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator-=
+   (
+    FunctionExpr<E>&& expr
+   )
+   {
+      return combine<util::SubtractOp>(std::move(expr.derived()));
+   }
+
+   /**
+    * Multiplies this function by an expression, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator*=
+   (
+    const FunctionExpr<E>& expr
+   )
+   {
+      return combine<util::MultiplyOp>(expr.derived());
+   }
+
+   /**
+    * Multiplies this function by an expression, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator*=
+   (
+    FunctionExpr<E>&& expr
+   )
+   {
+      return combine<util::MultiplyOp>(std::move(expr.derived()));
+   }
+
+   /**
+    * Divides this function by an expression, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator/=
+   (
+    const FunctionExpr<E>& expr
+   )
+   {
+      return combine<util::DivideOp>(expr.derived());
+   }
+
+   /**
+    * Divides this function by an expression, expanding the domain if necessary.
+    */
+   template<class E> DiscreteFunction& DiscreteFunction::operator/=
+   (
+    FunctionExpr<E>&& expr
+   )
+   {
+      return combine<util::DivideOp>(std::move(expr.derived()));
+   }
+
+   /**
+    * Element-wise addition of functions, expressions or scalars.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<class L, class R>
+      typename util::BinaryExprResult<util::AddOp,L,R>::type operator+
+   (
+    L&& lhs,
+    R&& rhs
+   )
+   {
+      return typename util::BinaryExprResult<util::AddOp,L,R>::type
+         (std::forward<L>(lhs),std::forward<R>(rhs));
+   }
+
+   /**
+    * Element-wise subtraction of functions, expressions or scalars.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<class L, class R>
+      typename util::BinaryExprResult<util::SubtractOp,L,R>::type operator-
+   (
+    L&& lhs,
+    R&& rhs
+   )
+   {
+      return typename util::BinaryExprResult<util::SubtractOp,L,R>::type
+         (std::forward<L>(lhs),std::forward<R>(rhs));
+   }
+
+   /**
+    * Element-wise multiplication of functions, expressions or scalars.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<class L, class R>
+      typename util::BinaryExprResult<util::MultiplyOp,L,R>::type operator*
+   (
+    L&& lhs,
+    R&& rhs
+   )
+   {
+      return typename util::BinaryExprResult<util::MultiplyOp,L,R>::type
+         (std::forward<L>(lhs),std::forward<R>(rhs));
+   }
+
+   /**
+    * Element-wise division of functions, expressions or scalars.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<class L, class R>
+      typename util::BinaryExprResult<util::DivideOp,L,R>::type operator/
+   (
+    L&& lhs,
+    R&& rhs
+   )
+   {
+      return typename util::BinaryExprResult<util::DivideOp,L,R>::type
+         (std::forward<L>(lhs),std::forward<R>(rhs));
+   }
+
+   /**
+    * Multiplies a function or expression by -1.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<class T>
+      typename util::UnaryExprResult<util::NegateOp,T>::type operator-
+   (
+    T&& arg
+   )
+   {
+      return typename util::UnaryExprResult<util::NegateOp,T>::type
+         (std::forward<T>(arg));
+   }
+
+   /**
+    * Template used to generate operations that apply some function to each
+    * of a DiscreteFunction's values. The argument may be a function or an
+    * expression.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<UnaryScalarOp OP, class T> typename
+      util::UnaryExprResult<util::UnaryScalarFunctionOp<OP>,T>::type
+   elementWiseOp
+   (
+    T&& inFcn
+   )
+   {
+      return typename
+         util::UnaryExprResult<util::UnaryScalarFunctionOp<OP>,T>::type
+         (std::forward<T>(inFcn));
+
+   } // elementWiseOp
+
+   /**
+    * Template used to generate operations that apply some operation to a pair
+    * of DiscreteFunctions. Either argument may be a function, an expression
+    * or a scalar, and the result has the union of their domains.
+    * @returns an expression that is evaluated when it is assigned to a
+    * maxsum::DiscreteFunction.
+    */
+   template<DualScalarOp OP, class T1, class T2> typename
+      util::BinaryExprResult<util::DualScalarFunctionOp<OP>,T1,T2>::type
+   elementWiseOp
+   (
+    T1&& inFcn1,
+    T2&& inFcn2
+   )
+   {
+      return typename
+         util::BinaryExprResult<util::DualScalarFunctionOp<OP>,T1,T2>::type
+         (std::forward<T1>(inFcn1),std::forward<T2>(inFcn2));
+
+   } // elementWiseOp
+
+} // namespace maxsum
+
+namespace std
+{
+   //***************************************************************************
+   // Each function has an overload for plain functions, so that its address
+   // can be taken with a fixed signature, and a template that builds an
+   // expression, so that it can be fused with the surrounding arithmetic.
+   //***************************************************************************
+
+   /**
+    * Returns the elementwise log of a function.
+    */
+   inline maxsum::DiscreteFunction log(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<log>(fcn);
+   }
+
+   /**
+    * Returns the elementwise log of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<log>,T>::type log(T&& fcn)
+   {
+      return maxsum::elementWiseOp<log>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise cosine value of a function.
+    */
+   inline maxsum::DiscreteFunction cos(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<cos>(fcn);
+   }
+
+   /**
+    * Returns the elementwise cosine value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<cos>,T>::type cos(T&& fcn)
+   {
+      return maxsum::elementWiseOp<cos>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise sine value of a function.
+    */
+   inline maxsum::DiscreteFunction sin(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<sin>(fcn);
+   }
+
+   /**
+    * Returns the elementwise sine value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<sin>,T>::type sin(T&& fcn)
+   {
+      return maxsum::elementWiseOp<sin>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise tangent value of a function.
+    */
+   inline maxsum::DiscreteFunction tan(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<tan>(fcn);
+   }
+
+   /**
+    * Returns the elementwise tangent value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<tan>,T>::type tan(T&& fcn)
+   {
+      return maxsum::elementWiseOp<tan>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise absolute value of a function.
+    */
+   inline maxsum::DiscreteFunction fabs(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<fabs>(fcn);
+   }
+
+   /**
+    * Returns the elementwise absolute value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<fabs>,T>::type fabs(T&& fcn)
+   {
+      return maxsum::elementWiseOp<fabs>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise absolute value of a function.
+    */
+   inline maxsum::DiscreteFunction abs(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<abs>(fcn);
+   }
+
+   /**
+    * Returns the elementwise absolute value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<abs>,T>::type abs(T&& fcn)
+   {
+      return maxsum::elementWiseOp<abs>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise exponent of a function.
+    */
+   inline maxsum::DiscreteFunction exp(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<exp>(fcn);
+   }
+
+   /**
+    * Returns the elementwise exponent of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<exp>,T>::type exp(T&& fcn)
+   {
+      return maxsum::elementWiseOp<exp>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise square root of a function.
+    */
+   inline maxsum::DiscreteFunction sqrt(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<sqrt>(fcn);
+   }
+
+   /**
+    * Returns the elementwise square root of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<sqrt>,T>::type sqrt(T&& fcn)
+   {
+      return maxsum::elementWiseOp<sqrt>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise ceil value of a function.
+    */
+   inline maxsum::DiscreteFunction ceil(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<ceil>(fcn);
+   }
+
+   /**
+    * Returns the elementwise ceil value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<ceil>,T>::type ceil(T&& fcn)
+   {
+      return maxsum::elementWiseOp<ceil>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Returns the elementwise floor value of a function.
+    */
+   inline maxsum::DiscreteFunction floor(const maxsum::DiscreteFunction& fcn)
+   {
+      return maxsum::elementWiseOp<floor>(fcn);
+   }
+
+   /**
+    * Returns the elementwise floor value of a function or expression, as an
+    * expression.
+    */
+   template<class T> typename maxsum::util::UnaryExprResult
+      <maxsum::util::UnaryScalarFunctionOp<floor>,T>::type floor(T&& fcn)
+   {
+      return maxsum::elementWiseOp<floor>(std::forward<T>(fcn));
+   }
+
+   /**
+    * Takes one function to the power of another.
+    * The result is <code>base</code> raised to the power of <code>exp</code>.
+    */
+   inline maxsum::DiscreteFunction pow
+   (
+    const maxsum::DiscreteFunction& base,
+    const maxsum::DiscreteFunction& exp 
+   )
+   {
+      return maxsum::elementWiseOp<pow>(base,exp);
+   }
+
+   /**
+    * Takes one function or expression to the power of another, as an
+    * expression.
+    * The result is <code>base</code> raised to the power of <code>exp</code>.
+    */
+   template<class B, class E> typename maxsum::util::BinaryExprResult
+      <maxsum::util::DualScalarFunctionOp<pow>,B,E>::type pow
+   (
+    B&& base,
+    E&& exp
+   )
+   {
+      return maxsum::elementWiseOp<pow>(std::forward<B>(base),
+            std::forward<E>(exp));
+   }
+
+} // namespace std
+
+#endif // MAXSUM_FUNCTION_EXPR_H
@@ -0,0 +1,176 @@
+/**
+ * @file GraphFile.h
+ * Defines functions for saving factor graphs in a compact binary format,
+ * and the maxsum::MappedGraph class, which loads them through a memory
+ * mapping without parsing or copying the factor tables.
+ */
+#ifndef MAXSUM_GRAPHFILE_H
+#define MAXSUM_GRAPHFILE_H
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include "common.h"
+#include "DiscreteFunction.h"
+#include "MaxSumController.h"
+
+namespace maxsum
+{
+   /**
+    * Writes the factor graph of a controller to a stream in binary format.
+    * The file contains the domain size of every variable in the graph, and
+    * the domain and value table of every factor, followed optionally by the
+    * current factor to variable and variable to factor messages. Loading a
+    * file with messages, via maxsum::MappedGraph::load, warm starts the
+    * controller from the point at which it was saved. Structured factors
+    * are written as dense tables, and so are loaded as ordinary factors.
+    *
+    * Numbers are written in the byte order and maxsum::ValType of the
+    * machine that writes them, and files can only be read by a library
+    * built with the same configuration. Each factor table is aligned so that
+    * it can be used in place when the file is memory mapped.
+    * @param[out] out the stream to write to, which should be binary.
+    * @param[in] controller the controller whose factor graph is written.
+    * @param[in] withMessages true if the current messages should be saved.
+    * @throws maxsum::FileFormatException if the stream cannot be written.
+    */
+   void saveGraph
+   (
+    std::ostream& out,
+    MaxSumController& controller,
+    bool withMessages=false
+   );
+
+   /**
+    * Writes the factor graph of a controller to a file in binary format.
+    * @param[in] path the name of the file to write.
+    * @param[in] controller the controller whose factor graph is written.
+    * @param[in] withMessages true if the current messages should be saved.
+    * @throws maxsum::FileFormatException if the file cannot be written.
+    * @see saveGraph(std::ostream&,MaxSumController&,bool)
+    */
+   void saveGraph
+   (
+    const std::string& path,
+    MaxSumController& controller,
+    bool withMessages=false
+   );
+
+   /**
+    * Read only view of a factor graph file written by maxsum::saveGraph.
+    * The file is memory mapped when this object is constructed, which only
+    * checks that its header and record tables are consistent. Factors
+    * returned by ::factor() borrow their value tables from the mapping, so
+    * loading a graph costs one record lookup per factor, and pages of the
+    * file are only read when their values are first used.
+    *
+    * The mapping is private, so changes made to borrowed factors are never
+    * written back to the file.
+    * @attention A MappedGraph must outlive every maxsum::DiscreteFunction
+    * that borrows its values, including any moved into a
+    * maxsum::MaxSumController by ::load().
+    */
+   class MappedGraph
+   {
+   private:
+
+      /**
+       * Start of the mapped file.
+       */
+      char* pData_i;
+
+      /**
+       * Size of the mapped file in bytes.
+       */
+      std::size_t size_i;
+
+      /**
+       * Copying is not allowed, because factors refer to the mapping.
+       */
+      MappedGraph(const MappedGraph&);
+
+      /**
+       * Copying is not allowed, because factors refer to the mapping.
+       */
+      MappedGraph& operator=(const MappedGraph&);
+
+      /**
+       * Returns a pointer to a checked position in the file.
+       * @param[in] offset the byte offset from the start of the file.
+       * @param[in] noBytes the number of bytes that must follow it.
+       * @throws maxsum::FileFormatException if this range is not in the file.
+       */
+      char* at(unsigned long long offset, unsigned long long noBytes) const;
+
+   public:
+
+      /**
+       * Maps a factor graph file into memory.
+       * @param[in] path the name of the file.
+       * @throws maxsum::FileFormatException if the file cannot be mapped, or
+       * was not written by a compatible version of maxsum::saveGraph.
+       */
+      explicit MappedGraph(const std::string& path);
+
+      /**
+       * Unmaps the file.
+       */
+      ~MappedGraph();
+
+      /**
+       * Returns the number of variables in the file.
+       */
+      std::size_t noVars() const;
+
+      /**
+       * Returns the number of factors in the file.
+       */
+      std::size_t noFactors() const;
+
+      /**
+       * Returns true if the file contains messages.
+       */
+      bool hasMessages() const;
+
+      /**
+       * Registers the domain size of every variable in the file.
+       * @throws maxsum::InconsistentDomainException if any variable is
+       * already registered with a different domain size.
+       */
+      void registerVariables() const;
+
+      /**
+       * Returns the id of the kth factor in the file.
+       * @param[in] k the position of the factor, in the range [0,noFactors()).
+       * @throws maxsum::OutOfRangeException if k is out of range.
+       */
+      FactorID factorID(std::size_t k) const;
+
+      /**
+       * Returns the kth factor in the file, whose values are borrowed from
+       * the mapping.
+       * @param[in] k the position of the factor, in the range [0,noFactors()).
+       * @pre ::registerVariables() has been called.
+       * @throws maxsum::OutOfRangeException if k is out of range.
+       * @throws maxsum::FileFormatException if the factor record is invalid.
+       */
+      DiscreteFunction factor(std::size_t k) const;
+
+      /**
+       * Registers every variable, and moves every factor into a controller,
+       * without copying their value tables. If the file contains messages,
+       * they are copied into the controller, so that the next call to
+       * maxsum::MaxSumController::optimise() continues from where the saved
+       * controller left off.
+       * @param[in,out] controller the controller to load into. This need not
+       * be empty, but any factor with the same id as one in the file is
+       * replaced.
+       * @throws maxsum::FileFormatException if the file is invalid.
+       */
+      void load(MaxSumController& controller) const;
+
+   }; // class MappedGraph
+
+} // namespace maxsum
+
+#endif // MAXSUM_GRAPHFILE_H
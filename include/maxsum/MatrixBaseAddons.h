@@ -91,18 +91,15 @@ Index argmax2(Index mxInd) const
    // Setup arrays to store the max and argmax for the head and tail of this
    // array (excluding the maximum at mxInd).
    //**************************************************************************
-   Array<Scalar,2,1> maxVals;
-   maxVals << at(0), at(0);
-
-   Array<Index,2,1> maxInds;
-   maxInds << 0, 0;
+   Scalar maxVals[2] = { at(0), at(0) };
+   Index maxInds[2] = { 0, 0 };
 
    //**************************************************************************
    // Find the argmax for head
    //**************************************************************************
    if(0<mxInd)
    {
-      maxVals(0) = head(mxInd).array().maxCoeff(&maxInds(0));
+      maxVals[0] = this->head(mxInd).array().maxCoeff(&maxInds[0]);
    }
 
    //**************************************************************************
@@ -110,19 +107,19 @@ Index argmax2(Index mxInd) const
    //**************************************************************************
    if( (mxInd+1) < size() )
    {
-      maxVals(1) = tail(size()-mxInd).array().maxCoeff(&maxInds(1));
+      maxVals[1] = this->tail(size()-mxInd).array().maxCoeff(&maxInds[1]);
    }
 
    //**************************************************************************
    // Return which ever is the maximum
    //**************************************************************************
-   if(maxVals(0)>maxVals(1))
+   if(maxVals[0]>maxVals[1])
    {
-      return maxInds(0);
+      return maxInds[0];
    }
    else
    {
-      return mxInd+1+maxInds(1);
+      return mxInd+1+maxInds[1];
    }
    
 } // argmx2
@@ -6,12 +6,20 @@
 #ifndef MAXSUM_MAXSUMCONTROLLER_H
 #define MAXSUM_MAXSUMCONTROLLER_H
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <stack>
 #include "common.h"
 #include "DiscreteFunction.h"
 #include "PostOffice.h"
+#include "FlatFactorGraph.h"
+#include "Scheduler.h"
+#include "Stats.h"
+#include "StructuredFactor.h"
 
 /**
  * Namespace for all public types and functions defined by the Max-Sum library.
@@ -34,6 +42,37 @@ namespace maxsum
        * Type of container used to map factor's to their defining functions.
        */
       typedef std::map<FactorID,DiscreteFunction> FactorMap;
+
+      /**
+       * Type of container used to map factors to structured factors.
+       * Structured factors are immutable, so copies of a controller share
+       * them.
+       */
+      typedef std::map<FactorID,std::shared_ptr<const StructuredFactor> >
+         StructuredMap;
+
+      /**
+       * Immutable factor table that may be shared by many factors.
+       * @see ::setFactor(FactorID,const SharedTable&,VarIt,VarIt)
+       */
+      typedef std::shared_ptr<const DiscreteFunction> SharedTable;
+
+      /**
+       * Clock used to measure deadlines for ::optimise(const Deadline&).
+       */
+      typedef std::chrono::steady_clock Clock;
+
+      /**
+       * Type of deadline passed to ::optimise(const Deadline&).
+       */
+      typedef Clock::time_point Deadline;
+
+      /**
+       * Immutable copy of the value assigned to each variable, shared
+       * between threads.
+       * @see ::getValueSnapshot()
+       */
+      typedef std::shared_ptr<const std::map<VarID,ValIndex> > ValueSnapshot;
       
    private:
 
@@ -44,19 +83,75 @@ namespace maxsum
       friend std::ostream& operator<<(std::ostream& out,
             MaxSumController& controller);
 
+      /**
+       * Reads the messages of a controller to save them in a file.
+       */
+      friend void saveGraph(std::ostream& out, MaxSumController& controller,
+            bool withMessages);
+
+      /**
+       * Restores the messages of a controller from a file.
+       */
+      friend class MappedGraph;
+
       /**
        * Map storing the functions associated with each factor under the
        * control of this object.
        */
       FactorMap factors_i;
 
+      /**
+       * Type of container used to hold factor tables shared with forks, or
+       * with other factors.
+       */
+      typedef std::map<FactorID,SharedTable> SharedTableMap;
+
+      /**
+       * Tables shared with other factors, or between this controller and
+       * its forks. Each factor in factors_i with an entry here borrows its
+       * values from this table, possibly over different variables, and
+       * must be given its own copy by ::unshareFactor() before it is
+       * modified.
+       */
+      SharedTableMap sharedTables_i;
+
+      /**
+       * Identifies a shared table with its variables reordered, by the
+       * address of the original table, and the position in the original of
+       * each variable in the reordered table.
+       */
+      typedef std::pair<const DiscreteFunction*,std::vector<int> >
+         PermutationKey;
+
+      /**
+       * Type of container used to find reordered copies of shared tables.
+       */
+      typedef std::map<PermutationKey,std::weak_ptr<const DiscreteFunction> >
+         PermutedTableMap;
+
+      /**
+       * Reordered copies of shared tables, made by ::setSharedFactor() for
+       * factors whose variables are not bound in ascending order, so that
+       * all such factors can share a single copy. Each copy keeps its
+       * original alive, so that the original's address is not reused while
+       * its entry here is current.
+       */
+      PermutedTableMap permutedTables_i;
+
+      /**
+       * Map storing the structured factors under the control of this
+       * object. These do not appear in factors_i.
+       */
+      StructuredMap structured_i;
+
       /**
        * Map storing the total value for each factor (the factor + the sum of
        * all its input messages. This is used if we need to calculate
        * additional things, such as the second best joint action for each
-       * factor (for VPI).
+       * factor (for VPI). Entries are only computed when requested by
+       * ::getTotalValue(), so message updates need not maintain them.
        */
-      FactorMap factorTotalValue_i;
+      mutable FactorMap factorTotalValue_i;
 
       /**
        * Type of container used to map (action) variables to their currently
@@ -92,6 +187,197 @@ namespace maxsum
        */
       ValType maxNormThreshold_i;
 
+      /**
+       * Weight given to the previous value of each factor to variable
+       * message when it is updated. Zero means no damping.
+       */
+      ValType damping_i;
+
+      /**
+       * Number of times a variable's value may flip back to its previous
+       * value during a call to ::optimise() before the variable is frozen.
+       * Zero means variables are never frozen.
+       */
+      int freezeAfter_i;
+
+      /**
+       * Records recent value changes of a variable, used to detect
+       * oscillation.
+       */
+      struct ValueHistory
+      {
+         /**
+          * The value held before the current value, or -1 if the value
+          * has not changed.
+          */
+         ValIndex lastValue;
+
+         /**
+          * Number of times the value has flipped back to lastValue.
+          */
+         int flips;
+
+         /**
+          * Constructs an empty history.
+          */
+         ValueHistory() : lastValue(-1), flips(0) {}
+      };
+
+      /**
+       * Value history of each variable whose value has changed during the
+       * current call to ::optimise(). Only maintained if freezeAfter_i is
+       * positive.
+       */
+      std::map<VarID,ValueHistory> history_i;
+
+      /**
+       * Number of messages recomputed during the last call to ::optimise().
+       */
+      int msgCount_i;
+
+      /**
+       * Scratch space used to sum the input messages for each variable, so
+       * that message updates do not need to allocate any memory.
+       */
+      std::vector<ValType> sumScratch_i;
+
+      /**
+       * Scratch space used to sum a factor and its input messages, which is
+       * shared by all factors, so that each factor's table is only stored
+       * once.
+       */
+      std::vector<ValType> totalScratch_i;
+
+      /**
+       * Scratch space used to pass input messages to a structured factor.
+       */
+      std::vector<const ValType*> inScratch_i;
+
+      /**
+       * Scratch space used to pass output messages to a structured factor.
+       */
+      std::vector<ValType*> outScratch_i;
+
+      /**
+       * Compiled copy of the factor graph, used by ::optimise() if
+       * ::compile() has been called since the graph was last changed.
+       */
+      util::FlatFactorGraph flatGraph_i;
+
+      /**
+       * True if and only if flatGraph_i is an up to date copy of the
+       * factor graph.
+       */
+      bool compiled_i;
+
+      /**
+       * True if a factor of a pruned compiled graph has changed since it
+       * was compiled, so that it must be recompiled before it is next
+       * optimised.
+       */
+      bool recompile_i;
+
+      /**
+       * True if dominated values should be pruned from the compiled graph.
+       */
+      bool pruneDomains_i;
+
+      /**
+       * Policy used to order message updates, or null for the default
+       * schedule. This is owned by this controller.
+       */
+      Scheduler* scheduler_i;
+
+      /**
+       * True if acyclic components of the factor graph should be solved
+       * exactly by ::optimiseTrees().
+       */
+      bool treeSchedule_i;
+
+      /**
+       * True if and only if treeOrder_i and treeBounds_i are up to date
+       * with the factor graph.
+       */
+      bool treeOrderValid_i;
+
+      /**
+       * Nodes of every acyclic component of the factor graph. The nodes of
+       * each component are stored contiguously, in breadth first order from
+       * an arbitrary root, so every node comes after its parent.
+       */
+      std::vector<Scheduler::Node> treeOrder_i;
+
+      /**
+       * Start of each component in treeOrder_i, followed by the size of
+       * treeOrder_i.
+       */
+      std::vector<int> treeBounds_i;
+
+      /**
+       * Set by ::cancel() to stop the current optimisation.
+       */
+      std::atomic<bool> cancelled_i;
+
+      /**
+       * Variable values published after each iteration by timed and
+       * asynchronous optimisation. Only accessed atomically.
+       */
+      ValueSnapshot snapshot_i;
+
+      /**
+       * Receives statistics after each iteration, or null. This is not
+       * owned by this controller.
+       */
+      StatsObserver* pObserver_i;
+
+      /**
+       * Statistics for the current iteration. Only maintained if
+       * statistics are enabled.
+       */
+      IterationStats stats_i;
+
+      /**
+       * Starts collecting statistics for a new iteration.
+       * @param[in] iteration the iteration number.
+       */
+      void beginStats(int iteration);
+
+      /**
+       * Reports the statistics for the current iteration to the observer,
+       * if there is one.
+       */
+      void endStats();
+
+      /**
+       * Gives a factor its own copy of its table, if it is shared with
+       * other factors, a fork of this controller, or a controller it was
+       * forked from.
+       * @param[in,out] pos the position of the factor in factors_i, which
+       * is updated if the factor is replaced.
+       */
+      void unshareFactor(FactorMap::iterator& pos);
+
+      /**
+       * Sets a factor that borrows its values from a shared table.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] table the shared table.
+       * @param[in] vars the variable bound to each variable of the table.
+       * @see ::setFactor(FactorID,const SharedTable&,VarIt,VarIt)
+       */
+      void setSharedFactor(FactorID id, const SharedTable& table,
+            const std::vector<VarID>& vars);
+
+      /**
+       * Runs the max-sum algorithm on the compiled factor graph, and
+       * copies the results back into the values, messages and total values
+       * maintained by this controller.
+       * @param[in] deadline time after which no further iterations start.
+       * @param[in] publish true if the values should be published after each
+       * iteration.
+       * @returns the number of max-sum iterations performed.
+       */
+      int optimiseCompiled(const Deadline& deadline, bool publish);
+
       /**
        * Updates factor to variable messages.
        * This function only needs to update messages that have changed
@@ -112,11 +398,90 @@ namespace maxsum
        */
       int updateVar2FacMsgs();
 
+      /**
+       * Updates all output messages of a single factor.
+       * @param[in] fac the factor to update.
+       * @param[in] pScheduler if not null, each variable whose input message
+       * has changed is pushed onto this scheduler. Otherwise, it is notified
+       * through the factor to variable post office.
+       */
+      void updateFactor(FactorID fac, Scheduler* pScheduler);
+
+      /**
+       * Updates all output messages of a single variable, and its value.
+       * @param[in] var the variable to update.
+       * @param[in] pScheduler if not null, each factor whose input message
+       * has changed is pushed onto this scheduler. Otherwise, it is notified
+       * through the variable to factor post office.
+       */
+      void updateVariable(VarID var, Scheduler* pScheduler);
+
+      /**
+       * Runs the max-sum algorithm on the uncompiled factor graph, in the
+       * order chosen by scheduler_i.
+       * @returns the number of node updates performed, divided by the
+       * number of nodes and rounded up.
+       */
+      int optimiseScheduled(const Deadline& deadline, bool publish);
+
+      /**
+       * Finds the acyclic components of the factor graph, and stores them
+       * in treeOrder_i and treeBounds_i.
+       */
+      void buildTreeOrder();
+
+      /**
+       * Solves every acyclic component of the factor graph that has new
+       * mail, by updating its nodes once from the leaves to the root, and
+       * once from the root to the leaves. Afterwards, only nodes in loopy
+       * components have new mail.
+       * @returns the number of components updated.
+       */
+      int optimiseTrees();
+
+      /**
+       * Runs the max-sum algorithm until convergence, the maximum number of
+       * iterations, the deadline, or cancellation.
+       * @param[in] deadline time after which no further iterations start.
+       * @param[in] publish true if the values should be published after each
+       * iteration.
+       * @returns the number of max-sum iterations performed.
+       */
+      int runOptimise(const Deadline& deadline, bool publish);
+
+      /**
+       * Publishes a copy of a set of variable values for
+       * ::getValueSnapshot().
+       */
+      void publishValues(const ValueMap& values);
+
+      /**
+       * Returns true if the current optimisation has been cancelled, or its
+       * deadline has passed.
+       */
+      bool stopRequested(const Deadline& deadline) const;
+
       /**
        * Infer the factor graph from the given factor domains.
        */
       void inferGraph();
 
+      /**
+       * Updates the edges of the factor graph for a new factor domain.
+       * Edges to variables that are no longer in the factor's domain are
+       * removed, and edges to new variables are added.
+       * @param[in] id the factor whose domain is changing.
+       * @param[in] begin start of the new sorted domain.
+       * @param[in] end end of the new sorted domain.
+       */
+      void setFactorDomain(FactorID id, const VarID* begin, const VarID* end);
+
+      /**
+       * Adds a dense copy of every structured factor to a factor map.
+       * @param[in,out] factors the map to add to.
+       */
+      void expandStructured(FactorMap& factors) const;
+
    public:
 
       /**
@@ -142,62 +507,163 @@ namespace maxsum
 
       /**
        * Construct a new maxsum::MaxSumController.
+       *
+       * On loopy factor graphs, max-sum may oscillate rather than converge.
+       * Two options help with this. With damping, each factor to variable
+       * message is set to <code>(1-damping)*new + damping*prev</code>, where
+       * <code>new</code> is the recomputed message, and <code>prev</code> its
+       * previous value. With freezing, a variable whose value flips back to
+       * its previous value <code>freezeAfter</code> times during a call to
+       * ::optimise() keeps its current value and stops sending new messages
+       * for the rest of the call, so that its neighbours can settle.
        * @param[in] maxIterations The maximum number of iterations for the
        * max-sum algorithm.
        * @param[in] maxnorm The maximum maxnorm allowed between the old and new
        * values of a message, before it is assumed to have converged.
+       * @param[in] damping weight in [0,1) given to the previous value of
+       * each factor to variable message. By default, messages are not damped.
+       * @param[in] freezeAfter number of flips after which a variable is
+       * frozen, or 0 to never freeze variables.
+       * @throws maxsum::OutOfRangeException if <code>damping</code> is not in
+       * [0,1), or <code>freezeAfter</code> is negative.
        */
       MaxSumController
       (
        int maxIterations=DEFAULT_MAX_ITERATIONS,
-       ValType maxnorm=DEFAULT_MAXNORM_THRESHOLD
+       ValType maxnorm=DEFAULT_MAXNORM_THRESHOLD,
+       ValType damping=0,
+       int freezeAfter=0
       )
       : maxIterations_i(maxIterations),
-        maxNormThreshold_i(maxnorm) {}
+        maxNormThreshold_i(maxnorm), damping_i(damping),
+        freezeAfter_i(freezeAfter), history_i(), msgCount_i(0),
+        sumScratch_i(), totalScratch_i(), inScratch_i(), outScratch_i(),
+        flatGraph_i(),
+        compiled_i(false), recompile_i(false), pruneDomains_i(false),
+        scheduler_i(0), treeSchedule_i(false),
+        treeOrderValid_i(false), treeOrder_i(), treeBounds_i(),
+        cancelled_i(false), snapshot_i(), pObserver_i(0), stats_i()
+      {
+         if( !(0<=damping && damping<1) || (0>freezeAfter) )
+         {
+            throw OutOfRangeException("MaxSumController",
+                  "Damping must be in [0,1) and freezeAfter non-negative.");
+         }
+      }
 
       /**
        * Copy constructor.
        */
       MaxSumController(const MaxSumController& rhs)
-      : factors_i(rhs.factors_i), factorTotalValue_i(rhs.factorTotalValue_i),
+      : factors_i(rhs.factors_i), sharedTables_i(), permutedTables_i(),
+        structured_i(rhs.structured_i),
+        factorTotalValue_i(rhs.factorTotalValue_i),
         values_i(rhs.values_i), fac2varMsgs_i(rhs.fac2varMsgs_i),
         var2facMsgs_i(rhs.var2facMsgs_i), maxIterations_i(rhs.maxIterations_i),
-        maxNormThreshold_i(rhs.maxNormThreshold_i)
+        maxNormThreshold_i(rhs.maxNormThreshold_i),
+        damping_i(rhs.damping_i), freezeAfter_i(rhs.freezeAfter_i),
+        history_i(rhs.history_i), msgCount_i(rhs.msgCount_i),
+        sumScratch_i(rhs.sumScratch_i), totalScratch_i(), inScratch_i(),
+        outScratch_i(),
+        flatGraph_i(rhs.flatGraph_i), compiled_i(rhs.compiled_i),
+        recompile_i(rhs.recompile_i), pruneDomains_i(rhs.pruneDomains_i),
+        scheduler_i(0 == rhs.scheduler_i ? 0 : rhs.scheduler_i->clone()),
+        treeSchedule_i(rhs.treeSchedule_i),
+        treeOrderValid_i(rhs.treeOrderValid_i), treeOrder_i(rhs.treeOrder_i),
+        treeBounds_i(rhs.treeBounds_i),
+        cancelled_i(false), snapshot_i(rhs.getValueSnapshot()),
+        pObserver_i(rhs.pObserver_i), stats_i()
       {}
 
+      /**
+       * Destructor.
+       */
+      ~MaxSumController()
+      {
+         delete scheduler_i;
+      }
+
       /**
        * Copy assignment.
        */
       MaxSumController& operator=(const MaxSumController& rhs)
       {
-         factors_i = rhs.factors_i;
+         FactorMap factors(rhs.factors_i); // copies own their tables
+         factors_i.swap(factors);
+         sharedTables_i.clear();
+         permutedTables_i.clear();
+         structured_i = rhs.structured_i;
          factorTotalValue_i = rhs.factorTotalValue_i;
          values_i = rhs.values_i;
          fac2varMsgs_i = rhs.fac2varMsgs_i;
          var2facMsgs_i = rhs.var2facMsgs_i;
          maxIterations_i = rhs.maxIterations_i;
          maxNormThreshold_i = rhs.maxNormThreshold_i;
+         damping_i = rhs.damping_i;
+         freezeAfter_i = rhs.freezeAfter_i;
+         history_i = rhs.history_i;
+         msgCount_i = rhs.msgCount_i;
+         sumScratch_i = rhs.sumScratch_i;
+         flatGraph_i = rhs.flatGraph_i;
+         compiled_i = rhs.compiled_i;
+         recompile_i = rhs.recompile_i;
+         pruneDomains_i = rhs.pruneDomains_i;
+         treeSchedule_i = rhs.treeSchedule_i;
+         treeOrderValid_i = rhs.treeOrderValid_i;
+         treeOrder_i = rhs.treeOrder_i;
+         treeBounds_i = rhs.treeBounds_i;
+         pObserver_i = rhs.pObserver_i;
+         if(this!=&rhs)
+         {
+            clearScheduler();
+            if(0!=rhs.scheduler_i)
+            {
+               scheduler_i = rhs.scheduler_i->clone();
+            }
+            std::atomic_store(&snapshot_i,rhs.getValueSnapshot());
+         }
          return *this;
       }
 
+      /**
+       * Returns a new copy of this controller, which is owned by the caller,
+       * and shares its factor tables and messages with this controller
+       * until either of them modifies them.
+       *
+       * This is intended for exploring changes to a factor graph, for
+       * example by trying several alternative values for a few factors.
+       * Unlike the copy constructor, no factor table larger than
+       * DiscreteFunction::INLINE_VALUES, and no message, is copied when the
+       * fork is made. Instead, each table is copied the first time it is
+       * accessed with ::getUnSafeWritableFactorHandle() by either
+       * controller, and each node's output messages are copied the first
+       * time it sends new messages. Forking still takes time linear in the
+       * size of the factor graph, to copy the maps that describe its
+       * structure.
+       *
+       * The fork is not compiled, even if this controller is, and its cached
+       * total values are computed afresh.
+       * @post This controller and the fork may be modified and optimised
+       * independently, including in different threads, but this controller
+       * must not be forked or copied while a fork of it is being modified.
+       */
+      MaxSumController* fork();
+
       /**
        * Returns the total value for a specified factor.
-       * The total value is the factor plus the sum of all its received messages.
-       * @pre the optimise method must be called first to properly initialise
-       * this value.
-       * @returns the total value for this factor.
+       * The total value is the factor plus the sum of all its received
+       * messages. It is calculated from the current messages when this
+       * function is called, rather than during ::optimise(), so factors whose
+       * total value is never requested cost no extra time or memory.
+       * @pre the optimise method must be called first, for the received
+       * messages to be meaningful.
+       * @returns the total value for this factor, which is only valid until
+       * this function is next called for the same factor, or this controller
+       * is modified.
+       * @throws maxsum::NoSuchElementException if the specified factor is not
+       * a (dense) factor known to this maxsum::MaxSumController.
        */
-      const DiscreteFunction& getTotalValue(FactorID fac) const
-      {
-         FactorMap::const_iterator pos = factorTotalValue_i.find(fac);
-         if(factorTotalValue_i.end()==pos)
-         {
-            throw new NoSuchElementException
-               ("MaxSumController::getTotalValue()",
-                "No such factor in factor graph.");
-         }
-         return pos->second;
-      }
+      const DiscreteFunction& getTotalValue(FactorID fac) const;
       
       /**
        * Populates a map with the total value for each factor in the factor
@@ -210,10 +676,10 @@ namespace maxsum
       template<class Map> void getTotalValues(Map& factorMap) const
       {         
          factorMap.clear();
-         for(FactorMap::const_iterator it = factorTotalValue_i.begin();
-             it != factorTotalValue_i.end(); ++it)
+         for(FactorMap::const_iterator it = factors_i.begin();
+             it != factors_i.end(); ++it)
          {
-            factorMap[it->first] = it->second;
+            factorMap[it->first] = getTotalValue(it->first);
          }
          
       } // getTotalValues
@@ -230,6 +696,105 @@ namespace maxsum
        */
       void setFactor(FactorID id, const DiscreteFunction& factor);
 
+      /**
+       * Accessor method for factor function, which takes ownership of the
+       * factor's value table rather than copying it. This avoids a deep
+       * copy when a factor is constructed only to be passed to this
+       * controller, which matters for factors with large domains.
+       * @param[in] id the unique identifier of the desired factor.
+       * @param[in,out] factor the function representing this factor.
+       * @post <code>factor</code> is moved into this
+       * maxsum::MaxSumController and used to form part of a factor graph,
+       * and is left as the constant function 0.
+       * @post Any previous value of the specified factor is overwritten.
+       */
+      void setFactor(FactorID id, DiscreteFunction&& factor);
+
+      /**
+       * Sets a factor whose values are read from an immutable table that
+       * may be shared by any number of factors, over different variables.
+       * This is intended for graphs in which the same constraint is applied
+       * to many sets of variables: only one copy of the table is stored,
+       * and every factor that uses it reads the same memory.
+       *
+       * The kth variable in <code>[varBegin,varEnd)</code> is bound to the
+       * kth variable in the table's (sorted) domain, and must have the same
+       * domain size. If the bound variables are in ascending order, the
+       * factor reads the table directly. Otherwise, the factor reads a copy
+       * of the table with its variables reordered, which is shared by all
+       * factors of this controller that bind the table in the same order.
+       *
+       * Shared factors are returned by ::getFactor(), like any other
+       * factor. A factor is given its own copy of its values if it is
+       * requested with ::getUnSafeWritableFactorHandle(), but the shared
+       * table is never modified. Each factor's total value depends on its
+       * own messages, so is not shared.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] table the shared table, which must not be modified
+       * while any factor uses it.
+       * @param[in] varBegin the variable bound to the table's first
+       * variable.
+       * @param[in] varEnd the end of the bound variables.
+       * @throws maxsum::BadDomainException if the bound variables are not
+       * distinct, or do not match the table's domain.
+       * @post Any previous value of the specified factor is overwritten.
+       */
+      template<class VarIt> void setFactor
+      (
+       FactorID id,
+       const SharedTable& table,
+       VarIt varBegin,
+       VarIt varEnd
+      )
+      {
+         setSharedFactor(id,table,std::vector<VarID>(varBegin,varEnd));
+      }
+
+      /**
+       * Sets a factor that is defined by its structure, rather than a dense
+       * table. Its output messages are computed by
+       * maxsum::StructuredFactor::maxMarginals(), so the memory and time
+       * used by the factor depend on its structure, rather than its domain
+       * size.
+       *
+       * Structured factors can be retrieved with ::getStructuredFactor(),
+       * but are not returned by ::getFactor(), ::factorBegin() or
+       * ::factorEnd(), and have no total value. If the graph is compiled,
+       * or saved to a file, they are expanded into dense tables.
+       * @param[in] id the unique identifier of the desired factor.
+       * @param[in] factor the structured factor. This controller keeps its
+       * own copy.
+       * @post Any previous value of the specified factor is overwritten.
+       * @see maxsum::PottsFactor
+       * @see maxsum::SparseFactor
+       */
+      void setFactor(FactorID id, const StructuredFactor& factor);
+
+      /**
+       * Sets many factors at once. This has the same result as calling
+       * ::setFactor() for each factor, but the edges for new factors are
+       * added to the factor graph in one pass, and each affected node is
+       * notified once, so it is much faster for building large graphs.
+       * @param[in] factors the factors to set, indexed by their unique
+       * identifiers.
+       * @post A copy of each factor is stored internally by this
+       * maxsum::MaxSumController and used to form part of a factor graph.
+       * @post Any previous value of each specified factor is overwritten.
+       */
+      void setFactors(const FactorMap& factors);
+
+      /**
+       * Sets many factors at once, taking ownership of their value tables
+       * rather than copying them.
+       * @param[in,out] factors the factors to set, indexed by their unique
+       * identifiers.
+       * @post Each factor is moved into this maxsum::MaxSumController, and
+       * is left as the constant function 0.
+       * @post Any previous value of each specified factor is overwritten.
+       * @see ::setFactors(const FactorMap&)
+       */
+      void setFactors(FactorMap&& factors);
+
       /**
        * Removes the specified factor from this controller's factor graph.
        * In addition, any variables that were previously only connected to this
@@ -263,7 +828,7 @@ namespace maxsum
        */
       bool hasFactor(FactorID id) const
       {
-         return 0!=factors_i.count(id);;
+         return (0!=factors_i.count(id)) || (0!=structured_i.count(id));
       }
 
       /**
@@ -286,7 +851,44 @@ namespace maxsum
        */
       int noFactors() const
       {
-         return factors_i.size();
+         return factors_i.size() + structured_i.size();
+      }
+
+      /**
+       * Returns the number of structured factors in this factor graph.
+       */
+      int noStructuredFactors() const
+      {
+         return structured_i.size();
+      }
+
+      /**
+       * Returns true if and only if the specified factor is a structured
+       * factor managed by this maxsum::MaxSumController.
+       */
+      bool isStructured(FactorID id) const
+      {
+         return 0!=structured_i.count(id);
+      }
+
+      /**
+       * Accessor method for structured factors.
+       * @param[in] id the unique identifier of the desired factor.
+       * @returns a reference to the structured factor with unique identifier
+       * <code>id</code>.
+       * @throws maxsum::NoSuchElementException if the specified factor is
+       * not a structured factor known to this maxsum::MaxSumController.
+       */
+      const StructuredFactor& getStructuredFactor(FactorID id) const
+      {
+         StructuredMap::const_iterator pos = structured_i.find(id);
+         if(structured_i.end()==pos)
+         {
+            throw new NoSuchElementException
+               ("MaxSumController::getStructuredFactor()",
+                "No such structured factor in factor graph.");
+         }
+         return *pos->second;
       }
       
       /**
@@ -394,19 +996,55 @@ namespace maxsum
             throw new NoSuchElementException("MaxSumController::getFactor()",
                   "No such factor in factor graph.");
          }
+         unshareFactor(pos);
          return pos->second;
       }
 
+      /**
+       * Returns the current message sent from a factor to a variable.
+       * This is the message computed by the most recent call to
+       * ::optimise(), or a zero message if it has not been computed yet.
+       * @param[in] fac the sending factor.
+       * @param[in] var the receiving variable.
+       * @returns a reference to the message, which is only valid until
+       * this controller is next optimised or modified.
+       * @throws maxsum::UnknownAddressException if the factor is not known
+       * to this maxsum::MaxSumController.
+       * @throws maxsum::NoSuchElementException if the variable is not in
+       * the factor's domain.
+       */
+      const DiscreteFunction& getFac2VarMsg(FactorID fac, VarID var)
+      {
+         const util::F2VPostOffice& fac2varMsgs = fac2varMsgs_i;
+         return *fac2varMsgs.curOutMsgs(fac)[var];
+      }
+
       /**
        * Function used to notify this MaxSumController of any changes made
        * to a factor without its knowledge.
        * This function should be called after any change to a factor
        * made using MaxSumController::getUnSafeWritableFactorHandle
+       * If the compiled graph has pruned values, it is recompiled once, at
+       * the start of the next call to ::optimise(), however many factors
+       * have changed.
        * @param id the id of the changed factor
        */
       void notifyFactor(FactorID id)
       {
          var2facMsgs_i.notify(id);
+
+         if(compiled_i && flatGraph_i.isPruned())
+         {
+            recompile_i = true;
+         }
+         else if(compiled_i && (0!=factors_i.count(id)))
+         {
+            int f = flatGraph_i.factorIndex(id);
+            if(0<=f)
+            {
+               flatGraph_i.setFactorValues(f,factors_i[id]);
+            }
+         }
       }
 
       /**
@@ -444,19 +1082,325 @@ namespace maxsum
 
       /**
        * Runs the max-sum algorithm to optimise the values for each variable.
+       *
+       * Each call is warm started from the messages left by the previous
+       * call, and only recomputes messages for factors and variables that
+       * have been notified of a change. After changing a few factors via
+       * ::setFactor(), or via ::getUnSafeWritableFactorHandle() followed
+       * by ::notifyFactor(), only those factors and their neighbours are
+       * updated at first, and further updates spread only as far as messages
+       * change by more than the maxnorm threshold. The cost of re-optimising
+       * thus depends on the size of the change, rather than the size of the
+       * factor graph. Use ::noRecomputedMsgs() to see how many messages
+       * were actually recomputed.
+       *
+       * If the graph is compiled, every message is recomputed in every
+       * iteration, although messages are still warm started.
        * @post ::getValue(VarID id) will return the optimal value for the
        * the variable with unique identifier <code>id</code>.
        * @returns the number of max-sum iterations performed.
+       * @see ::compile()
        */
       int optimise();
 
-   }; // MaxSumController class
+      /**
+       * Runs the max-sum algorithm with a time budget.
+       * This behaves like ::optimise(), except that no new iteration is
+       * started once the deadline has passed, or ::cancel() has been called.
+       * Since the deadline is only checked between iterations, the call may
+       * overrun it by up to one iteration. After each iteration, the current
+       * variable values are published atomically, so other threads can read
+       * them with ::getValueSnapshot() while the algorithm is still running.
+       * Any messages left unconverged are picked up by the next call.
+       * @param[in] deadline time after which no further iterations are
+       * started, e.g. <code>MaxSumController::Clock::now() +
+       * std::chrono::milliseconds(20)</code>.
+       * @returns the number of max-sum iterations performed.
+       */
+      int optimise(const Deadline& deadline);
 
-   /**
-    * Default maximum maxnorm allowed between the old and new values
-    * of a message, before it is assumed to have converged.
-    */
-   const ValType MaxSumController::DEFAULT_MAXNORM_THRESHOLD=0.0000001;
+      /**
+       * Runs ::optimise(const Deadline&) on a new thread.
+       * Until the returned future is ready, the only members that may be
+       * called on this controller are ::cancel() and ::getValueSnapshot().
+       * The controller must not be destroyed before the future is ready.
+       * @param[in] deadline time after which no further iterations are
+       * started. By default, there is no deadline.
+       * @returns a future holding the number of max-sum iterations performed.
+       */
+      std::future<int> optimiseAsync(const Deadline& deadline=Deadline::max());
+
+      /**
+       * Asks the optimisation that is currently running to stop after its
+       * current iteration. This may be called from any thread.
+       */
+      void cancel()
+      {
+         cancelled_i.store(true);
+      }
+
+      /**
+       * Returns the variable values published at the end of the most recent
+       * iteration of ::optimise(const Deadline&) or ::optimiseAsync().
+       * This may be called from any thread while they are running. The
+       * snapshot is empty (null) if neither has been called, and is not
+       * updated by ::optimise().
+       */
+      ValueSnapshot getValueSnapshot() const
+      {
+         return std::atomic_load(&snapshot_i);
+      }
+
+      /**
+       * Returns the number of factor to variable and variable to factor
+       * messages that were recomputed during the last call to ::optimise().
+       */
+      int noRecomputedMsgs() const
+      {
+         return msgCount_i;
+      }
+
+      /**
+       * Freezes the current factor graph into a compiled form, which is
+       * stored in contiguous arrays rather than node based maps. Once
+       * compiled, ::optimise() runs max-sum directly on these arrays, which
+       * avoids map lookups and temporary objects during message passing,
+       * and so is typically much faster for large, static graphs.
+       *
+       * Results are reported through ::getValue(), ::valBegin() and
+       * ::getTotalValue() in exactly the same way as for an uncompiled
+       * graph. Any messages and values from previous calls to ::optimise()
+       * are carried over into the compiled graph.
+       *
+       * If ::setPruneDomains() is enabled, values that can never be part of
+       * an optimal assignment are pruned from the compiled graph, which then
+       * only stores the tables and messages of the remaining values. The
+       * messages for pruned values are not updated, and keep whatever they
+       * were when the graph was compiled, so ::getTotalValue() is then only
+       * meaningful for assignments of values that were kept.
+       *
+       * Changes to factor values reported via ::notifyFactor() are applied
+       * to the compiled graph directly, or cause it to be recompiled by the
+       * next call to ::optimise() if values were pruned. However, any call to ::setFactor(),
+       * ::removeFactor() or ::clear() discards the compiled graph, after which
+       * ::optimise() reverts to the uncompiled algorithm until ::compile() is
+       * called again.
+       * @post ::isCompiled() returns true.
+       */
+      void compile();
+
+      /**
+       * Sets the policy used by ::optimise() to order message updates.
+       * By default, each iteration updates every factor with new mail,
+       * followed by every variable with new mail. With a scheduler, nodes
+       * are instead updated one at a time in the order that it chooses,
+       * such as largest residual first with maxsum::ResidualScheduler.
+       * The maximum number of iterations then limits the total number of
+       * node updates to the same number a flooding schedule could perform.
+       * Schedulers only apply to the uncompiled factor graph, so they are
+       * ignored while this controller is compiled, or uses more than one
+       * thread.
+       * @param[in] scheduler the policy to use. This controller keeps its
+       * own copy.
+       * @see maxsum::Scheduler
+       */
+      void setScheduler(const Scheduler& scheduler)
+      {
+         Scheduler* pCopy = scheduler.clone();
+         delete scheduler_i;
+         scheduler_i = pCopy;
+      }
+
+      /**
+       * Reverts ::optimise() to the default schedule.
+       */
+      void clearScheduler()
+      {
+         delete scheduler_i;
+         scheduler_i = 0;
+      }
+
+      /**
+       * Sets whether ::optimise() solves acyclic components of the factor
+       * graph exactly, rather than iterating until their messages converge.
+       *
+       * If enabled, each connected component of the factor graph that is a
+       * tree, and has new mail, is solved in two passes: every node is
+       * updated once in order from the leaves to an arbitrary root, and
+       * once in order from the root back to the leaves. As each node sends
+       * its messages only after receiving the messages they depend on, this
+       * gives the same result as a converged flooding schedule, but without
+       * needing one iteration for each step along the tree's diameter.
+       * These passes count as one iteration. Loopy components are then
+       * optimised as usual.
+       *
+       * Damping is not applied during the passes, because damped messages
+       * are not exact. Like schedulers, this only applies to the uncompiled
+       * factor graph. The acyclic components are found when ::optimise() is
+       * first called after the graph changes.
+       * @param[in] enabled true to solve acyclic components exactly.
+       */
+      void setTreeSchedule(bool enabled)
+      {
+         treeSchedule_i = enabled;
+      }
+
+      /**
+       * Returns true if and only if ::optimise() solves acyclic components
+       * of the factor graph exactly.
+       * @see ::setTreeSchedule()
+       */
+      bool treeSchedule() const
+      {
+         return treeSchedule_i;
+      }
+
+      /**
+       * Returns true if and only if ::optimise() orders message updates
+       * using a maxsum::Scheduler.
+       */
+      bool hasScheduler() const
+      {
+         return 0!=scheduler_i;
+      }
+
+      /**
+       * Sets an observer to receive statistics after each iteration of
+       * ::optimise(), on the thread running the algorithm. Observing a
+       * compiled controller makes it check for convergence after every
+       * iteration, rather than leaving this to the compiled graph.
+       * @param[in] pObserver the observer, or null to stop observing. This
+       * is not owned by this controller, and must outlive it, or be removed
+       * before it is destroyed. Copies of this controller share the same
+       * observer.
+       * @attention Statistics are only collected if the library is built
+       * with the CMake option MAXSUM_ENABLE_STATS. Otherwise, the observer
+       * is never called.
+       * @see maxsum::IterationStats
+       */
+      void setObserver(StatsObserver* pObserver)
+      {
+         pObserver_i = pObserver;
+      }
+
+      /**
+       * Returns the current statistics observer, or null if there is none.
+       */
+      StatsObserver* getObserver() const
+      {
+         return pObserver_i;
+      }
+
+      /**
+       * Returns the weight given to the previous value of each factor to
+       * variable message when it is updated.
+       */
+      ValType damping() const
+      {
+         return damping_i;
+      }
+
+      /**
+       * Returns the number of flips after which a variable is frozen, or 0
+       * if variables are never frozen.
+       */
+      int freezeAfter() const
+      {
+         return freezeAfter_i;
+      }
+
+      /**
+       * Sets whether ::compile() prunes dominated values from each
+       * variable's domain.
+       *
+       * A value x of a variable is dominated if, summing over the variable's
+       * factors, the largest factor value for any assignment with x is less
+       * than the smallest for some other value. Changing the variable from
+       * x to that value then improves every assignment, so x can never be
+       * optimal. Once values are pruned, the bounds of neighbouring
+       * variables are recomputed without them, until no more can be pruned.
+       * The compiled factor tables and messages only cover the values that
+       * remain, which speeds up every message update, while values reported
+       * by ::getValue() are always in the full domain. Messages are not
+       * updated for pruned values, so neither are the entries of
+       * ::getTotalValue() for any assignment that includes one.
+       *
+       * Pruning is done each time the graph is compiled, and so applies
+       * after every change to the graph once it is recompiled. It does not
+       * apply to the uncompiled algorithm, and is disabled by default.
+       * @param[in] prune true if dominated values should be pruned.
+       * @post if the graph is compiled, it is recompiled with the new
+       * setting.
+       */
+      void setPruneDomains(bool prune)
+      {
+         const bool changed = (prune!=pruneDomains_i);
+         pruneDomains_i = prune;
+         if(compiled_i && changed)
+         {
+            compile();
+         }
+      }
+
+      /**
+       * Returns true if ::compile() prunes dominated values.
+       * @see ::setPruneDomains()
+       */
+      bool pruneDomains() const
+      {
+         return pruneDomains_i;
+      }
+
+      /**
+       * Returns the number of values pruned from all variable domains by
+       * the last call to ::compile(), or 0 if the graph is not compiled.
+       * @see ::setPruneDomains()
+       */
+      int noPrunedValues() const
+      {
+         return compiled_i ? flatGraph_i.noPrunedValues() : 0;
+      }
+
+      /**
+       * Returns true if and only if ::optimise() will run on a compiled copy
+       * of the factor graph.
+       * @see ::compile()
+       */
+      bool isCompiled() const
+      {
+         return compiled_i;
+      }
+
+      /**
+       * Sets the number of threads used by ::optimise().
+       * With more than one thread, each iteration first updates all factor
+       * to variable messages in parallel, and then, once all threads have
+       * finished, updates all variable to factor messages in parallel.
+       * Each factor or variable is updated by exactly one thread, and only
+       * writes its own output messages, so results are deterministic, and
+       * identical to those produced by a single thread with a compiled graph.
+       *
+       * Parallel updates run on the compiled factor graph, so if the graph is
+       * not already compiled, ::optimise() will call ::compile() first.
+       * @param[in] noThreads the number of threads to use.
+       * @throws maxsum::OutOfRangeException if <code>noThreads</code> is less
+       * than 1.
+       * @see ::compile()
+       */
+      void setNoThreads(int noThreads)
+      {
+         flatGraph_i.setNoThreads(noThreads);
+      }
+
+      /**
+       * Returns the number of threads used by ::optimise().
+       */
+      int noThreads() const
+      {
+         return flatGraph_i.noThreads();
+      }
+
+   }; // MaxSumController class
 
    /**
     * Utility function used to dump the current state of this controller
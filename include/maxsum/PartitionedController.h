@@ -0,0 +1,325 @@
+/**
+ * @file PartitionedController.h
+ * Defines the maxsum::MaxSumShard and maxsum::PartitionedController classes,
+ * which run the max-sum algorithm on a factor graph that is split into
+ * several shards.
+ */
+#ifndef MAXSUM_PARTITIONEDCONTROLLER_H
+#define MAXSUM_PARTITIONEDCONTROLLER_H
+
+#include <map>
+#include <vector>
+#include "common.h"
+#include "DiscreteFunction.h"
+#include "MaxSumController.h"
+#include "Transport.h"
+
+namespace maxsum
+{
+   /**
+    * Assigns each factor in a factor graph to one of a number of shards.
+    * Factors are visited in breadth first order through their shared
+    * variables, and split into contiguous blocks of equal size, so that
+    * neighbouring factors tend to share a shard. This keeps the number of
+    * variables shared between shards small for graphs with local structure.
+    * @param[in] factors the factor graph to partition.
+    * @param[in] noShards the number of shards.
+    * @param[out] partition map in which to store the shard of each factor.
+    * @post any previous contents of <code>partition</code> are destroyed.
+    */
+   void partitionFactors
+   (
+    const MaxSumController::FactorMap& factors,
+    int noShards,
+    std::map<FactorID,int>& partition
+   );
+
+   /**
+    * One shard of a partitioned factor graph.
+    * Each shard owns a subset of the factors, and runs the usual max-sum
+    * updates on them with its own maxsum::MaxSumController. Variables that
+    * are also connected to factors in other shards are called boundary
+    * variables. For each boundary variable, the shard adds a unary proxy
+    * factor to its controller, whose value is the sum of the messages sent
+    * to the variable by factors in all other shards. After each round of
+    * local updates, shards exchange these message sums through a
+    * maxsum::Transport, so only boundary messages cross between shards.
+    *
+    * Proxy factors are given ids counting down from the largest
+    * maxsum::FactorID, which must not be used by any other factor.
+    *
+    * To run shards in separate processes, construct one MaxSumShard in each
+    * with its own factors and boundary variables, and call ::iterate()
+    * until every shard returns false in the same round, e.g. by combining
+    * the results with MPI_Allreduce.
+    */
+   class MaxSumShard
+   {
+   private:
+
+      /**
+       * Information about a single boundary variable.
+       */
+      struct Boundary
+      {
+         VarID var; ///< the boundary variable
+         FactorID proxy; ///< id of the proxy factor for this variable
+         std::vector<int> remotes; ///< other shards sharing this variable
+         std::vector<FactorID> locals; ///< local factors sharing it
+         DiscreteFunction received; ///< sum of messages from other shards
+         DiscreteFunction sent; ///< sum of local messages to other shards
+      };
+
+      /**
+       * The index of this shard.
+       */
+      int shard_i;
+
+      /**
+       * Controller for local factors and proxies.
+       */
+      MaxSumController controller_i;
+
+      /**
+       * Change in a proxy factor above which it is updated.
+       */
+      ValType maxNormThreshold_i;
+
+      /**
+       * Boundary variables, sorted by id.
+       */
+      std::vector<Boundary> boundary_i;
+
+      /**
+       * Other shards sharing at least one boundary variable, in order.
+       */
+      std::vector<int> neighbours_i;
+
+      /**
+       * Id of the next proxy factor.
+       */
+      FactorID nextProxy_i;
+
+      /**
+       * True if Boundary::locals needs to be recalculated.
+       */
+      bool localsDirty_i;
+
+      /**
+       * Scratch space for serialised messages.
+       */
+      Transport::Batch batch_i;
+
+      /**
+       * Returns the boundary information for a variable, or null if it is
+       * not a boundary variable.
+       */
+      Boundary* findBoundary(VarID var);
+
+      /**
+       * Recalculates the local factors connected to each boundary variable.
+       */
+      void updateLocals();
+
+   public:
+
+      /**
+       * Constructs an empty shard.
+       * @param[in] shard the index of this shard.
+       * @param[in] localIterations number of local max-sum iterations to run
+       * in each round, before exchanging boundary messages.
+       * @param[in] maxnorm the maximum maxnorm change in a message, or proxy
+       * factor, before it is assumed to have converged.
+       */
+      explicit MaxSumShard
+      (
+       int shard=0,
+       int localIterations=1,
+       ValType maxnorm=MaxSumController::DEFAULT_MAXNORM_THRESHOLD
+      );
+
+      /**
+       * Returns the index of this shard.
+       */
+      int shard() const { return shard_i; }
+
+      /**
+       * Adds or replaces a local factor.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] factor the function representing the factor.
+       * @throws maxsum::OutOfRangeException if <code>id</code> is reserved
+       * for a proxy factor.
+       */
+      void setFactor(FactorID id, const DiscreteFunction& factor);
+
+      /**
+       * Declares that a variable is shared with another shard.
+       * @param[in] var the boundary variable.
+       * @param[in] remote the other shard.
+       * @throws maxsum::UnknownVariableException if <code>var</code> is not
+       * registered.
+       * @throws maxsum::OutOfRangeException if the proxy factor id for
+       * <code>var</code> is already used by a local factor.
+       */
+      void addBoundary(VarID var, int remote);
+
+      /**
+       * Returns the number of boundary variables in this shard.
+       */
+      int noBoundaryVars() const
+      {
+         return static_cast<int>(boundary_i.size());
+      }
+
+      /**
+       * Runs the local max-sum iterations for one round.
+       * @returns the number of messages recomputed.
+       */
+      int optimiseLocal();
+
+      /**
+       * Sends the sum of local messages for each boundary variable to the
+       * other shards that share it. Exactly one batch is sent to each
+       * neighbouring shard, even if it is empty.
+       * @param[in] transport this shard's transport.
+       */
+      void sendBoundary(Transport& transport);
+
+      /**
+       * Receives one batch from each neighbouring shard, and updates the
+       * proxy factors.
+       * @param[in] transport this shard's transport.
+       * @returns true if any proxy factor changed by more than the maxnorm
+       * threshold.
+       * @throws maxsum::BadDomainException if a received message does not
+       * belong to a boundary variable, has the wrong size, or is truncated.
+       */
+      bool receiveBoundary(Transport& transport);
+
+      /**
+       * Runs one complete round: local iterations, followed by sending and
+       * receiving boundary messages.
+       * @param[in] transport this shard's transport.
+       * @returns true if this shard has not converged, i.e. if any local
+       * messages were recomputed, or any proxy factor changed.
+       */
+      bool iterate(Transport& transport);
+
+      /**
+       * Returns the controller used for this shard's factors, which also
+       * contains its proxy factors.
+       */
+      const MaxSumController& controller() const { return controller_i; }
+
+   }; // class MaxSumShard
+
+   /**
+    * Runs max-sum on a factor graph partitioned into several shards in the
+    * same process, using maxsum::partitionFactors to assign factors to
+    * shards, and a maxsum::LocalTransport to exchange boundary messages.
+    * This has the same interface and, on acyclic graphs, gives the same
+    * results as maxsum::MaxSumController, and so can be used to test a
+    * partitioning before distributing it.
+    */
+   class PartitionedController
+   {
+   private:
+
+      /**
+       * Number of shards.
+       */
+      int noShards_i;
+
+      /**
+       * Maximum number of rounds.
+       */
+      int maxIterations_i;
+
+      /**
+       * Convergence threshold for messages and proxy factors.
+       */
+      ValType maxNormThreshold_i;
+
+      /**
+       * All factors in the graph.
+       */
+      MaxSumController::FactorMap factors_i;
+
+      /**
+       * Shard of each factor.
+       */
+      std::map<FactorID,int> partition_i;
+
+      /**
+       * The shards, or empty if they need to be rebuilt.
+       */
+      std::vector<MaxSumShard> shards_i;
+
+      /**
+       * Splits the factor graph into shards.
+       */
+      void build();
+
+   public:
+
+      /**
+       * Constructs an empty controller.
+       * @param[in] noShards the number of shards.
+       * @param[in] maxIterations the maximum number of rounds.
+       * @param[in] maxnorm the maximum maxnorm change in a message before
+       * it is assumed to have converged.
+       */
+      explicit PartitionedController
+      (
+       int noShards,
+       int maxIterations=MaxSumController::DEFAULT_MAX_ITERATIONS,
+       ValType maxnorm=MaxSumController::DEFAULT_MAXNORM_THRESHOLD
+      );
+
+      /**
+       * Adds or replaces a factor. Changing the graph means that it is
+       * partitioned again when it is next optimised, and so discards any
+       * previous messages.
+       * @param[in] id the unique identifier of the factor.
+       * @param[in] factor the function representing the factor.
+       */
+      void setFactor(FactorID id, const DiscreteFunction& factor);
+
+      /**
+       * Runs max-sum until every shard has converged, or the maximum number
+       * of rounds. Each round runs one local iteration in every shard,
+       * followed by an exchange of boundary messages.
+       * @returns the number of rounds performed.
+       */
+      int optimise();
+
+      /**
+       * Returns the current value of a variable.
+       * @throws maxsum::NoSuchElementException if the variable is not in
+       * the domain of any factor, or the graph has not been optimised.
+       */
+      ValIndex getValue(VarID var) const;
+
+      /**
+       * Returns the shard of a factor, as chosen by the most recent call to
+       * ::optimise().
+       * @throws maxsum::NoSuchElementException if the factor is unknown.
+       */
+      int shardOf(FactorID id) const;
+
+      /**
+       * Returns the total number of boundary variables over all shards.
+       * A variable shared by n shards is counted n times.
+       */
+      int noBoundaryVars() const;
+
+      /**
+       * Returns the number of shards.
+       */
+      int noShards() const { return noShards_i; }
+
+   }; // class PartitionedController
+
+} // namespace maxsum
+
+#endif // MAXSUM_PARTITIONEDCONTROLLER_H
@@ -8,7 +8,10 @@
 #ifndef MAXSUM_UTIL_POSTOFFICE_H
 #define MAXSUM_UTIL_POSTOFFICE_H
 
-#include <queue>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
 #include "DiscreteFunction.h"
 #include "util_containers.h"
 
@@ -18,6 +21,14 @@ namespace util
 {
    /**
     * Class used to store and manage messages sent between factor graph nodes.
+    * All messages are allocated from a single util::MessagePool owned by
+    * each PostOffice, so adding, removing and copying edges only requires
+    * a few large allocations, and removed messages are reused.
+    *
+    * PostOffice::fork copies a PostOffice without copying its messages.
+    * Instead, the messages are frozen and shared by both post offices, and
+    * each sender is given its own copy of its messages the first time they
+    * are modified through PostOffice::curOutMsgs or PostOffice::prevOutMsgs.
     * @tparam Sender Type used to uniquely identify message senders, e.g.
     * maxsum::FactorID or maxsum::VarID
     * @tparam Receiver Type used to uniquely identify message receivers, e.g.
@@ -82,6 +93,40 @@ namespace util
        */
       typedef MAXSUM_DEFAULT_MAP<Receiver,PrivInMsgMap> InboxMap;
 
+      /**
+       * Direct link to the current and previous inbox entries for a single
+       * edge, used to swap inbox pointers without searching for them.
+       */
+      struct InboxLink
+      {
+         Message** pCur;  ///< current inbox entry for this edge
+         Message** pPrev; ///< previous inbox entry for this edge
+      };
+
+      /**
+       * Convenience typedef for inboxLinks_i map type.
+       */
+      typedef MAXSUM_DEFAULT_MAP<Sender,std::vector<InboxLink> > InboxLinkMap;
+
+      /**
+       * A new edge and its messages, used by PostOffice::addEdges.
+       */
+      struct NewEdge
+      {
+         Sender s;        ///< the edge's sender
+         Receiver r;      ///< the edge's receiver
+         Message* pCur;   ///< current message for this edge
+         Message* pPrev;  ///< previous message for this edge
+
+         /**
+          * Orders edges by receiver, and then by sender.
+          */
+         static bool byReceiver(const NewEdge& a, const NewEdge& b)
+         {
+            return (a.r<b.r) || ( !(b.r<a.r) && (a.s<b.s) );
+         }
+      };
+
    public:
 
       /**
@@ -137,9 +182,339 @@ namespace util
       util::KeySet<InboxMap> receivers_i; 
 
       /**
-       * Queue of receivers who currently have new mail.
+       * Queue of receivers who currently have new mail. This is stored as a
+       * vector, with notices_i[noticeHead_i] at the front of the queue, so
+       * that once it has grown to its working size, queueing notices
+       * never needs to allocate memory. Each receiver appears in the queue
+       * at most once, unless it is removed and re-added while notified,
+       * in which case any stale entries are skipped by PostOffice::popNotice.
+       */
+      std::vector<Receiver> notices_i;
+
+      /**
+       * Position of the front of the notice queue.
+       */
+      std::size_t noticeHead_i;
+
+      /**
+       * Map of receivers to flags indicating whether they are currently
+       * in the notice queue. This contains an entry for every registered
+       * receiver, so updating a flag never allocates memory.
+       */
+      MAXSUM_DEFAULT_MAP<Receiver,bool> pending_i;
+
+      /**
+       * Number of registered receivers that are currently notified.
+       */
+      int noticeCount_i;
+
+      /**
+       * Links to the inbox entries for the edges of each sender. This lets
+       * PostOffice::swapOutBoxes touch only the edges of the sender being
+       * swapped. Links point directly into the inbox maps, and so are
+       * rebuilt whenever the edges change.
+       */
+      InboxLinkMap inboxLinks_i;
+
+      /**
+       * True if inboxLinks_i is consistent with the current inbox maps.
+       */
+      bool linksValid_i;
+
+      /**
+       * Rebuilds inboxLinks_i from the current inbox maps.
+       */
+      void rebuildLinks()
+      {
+         inboxLinks_i.clear();
+         for(typename InboxMap::iterator curIt=curInboxes_i.begin();
+               curIt!=curInboxes_i.end(); ++curIt)
+         {
+            PrivInMsgMap& prevInMsgs = prevInboxes_i[curIt->first];
+            for(PrivInMsgIt msgIt=curIt->second.begin();
+                  msgIt!=curIt->second.end(); ++msgIt)
+            {
+               PrivInMsgIt prevPos = prevInMsgs.find(msgIt->first);
+               assert(prevInMsgs.end()!=prevPos); // should never happen.
+               InboxLink link;
+               link.pCur = &(msgIt->second);
+               link.pPrev = &(prevPos->second);
+               inboxLinks_i[msgIt->first].push_back(link);
+            }
+         }
+         linksValid_i = true;
+
+      } // function rebuildLinks
+
+      /**
+       * Pool from which all messages are allocated.
+       */
+      util::MessagePool<Message> pool_i;
+
+      /**
+       * Messages frozen by PostOffice::fork, which may be read by several
+       * post offices, but never modified. The messages are destroyed once
+       * every post office that shares them has released them.
+       */
+      struct SharedMessages
+      {
+         util::MessagePool<Message> pool; ///< pool holding the messages
+         std::vector<Message*> msgs;      ///< every message in the pool
+
+         /**
+          * Destroys every shared message.
+          */
+         ~SharedMessages()
+         {
+            for(std::size_t k=0; k<msgs.size(); ++k)
+            {
+               pool.destroy(msgs[k]);
+            }
+         }
+      };
+
+      /**
+       * Frozen messages that may still be read by this post office.
+       */
+      std::vector<std::shared_ptr<const SharedMessages> > frozen_i;
+
+      /**
+       * Flags each sender whose messages were frozen by the last call to
+       * PostOffice::fork. A sender's flag is cleared once it has been given
+       * its own copy of its messages. Empty if no senders are shared.
+       */
+      MAXSUM_DEFAULT_MAP<Sender,bool> shared_i;
+
+      /**
+       * Number of senders whose flag in shared_i is set.
+       */
+      int noShared_i;
+
+      /**
+       * Returns true if a sender's messages are frozen, and so must not be
+       * modified or destroyed by this post office.
+       */
+      bool isShared(Sender s) const
+      {
+         if(0==noShared_i)
+         {
+            return false;
+         }
+         typename MAXSUM_DEFAULT_MAP<Sender,bool>::const_iterator pos =
+            shared_i.find(s);
+         return (shared_i.end()!=pos) && pos->second;
+      }
+
+      /**
+       * Forgets that a sender's messages were frozen, and releases the frozen
+       * messages once no senders are shared.
+       */
+      void releaseShared(Sender s)
+      {
+         typename MAXSUM_DEFAULT_MAP<Sender,bool>::iterator pos =
+            shared_i.find(s);
+         if( (shared_i.end()==pos) || !pos->second )
+         {
+            return;
+         }
+         pos->second = false;
+         if(0==--noShared_i)
+         {
+            shared_i.clear();
+            frozen_i.clear();
+         }
+      }
+
+      /**
+       * Forgets every frozen message. This should only be called once the
+       * box maps no longer refer to them.
        */
-      std::queue<Receiver> notices_i;
+      void releaseAllShared()
+      {
+         shared_i.clear();
+         noShared_i = 0;
+         frozen_i.clear();
+      }
+
+      /**
+       * Gives a sender its own copy of its messages, if they are frozen.
+       * Inbox entries are updated in place, so inbox links remain valid.
+       */
+      void unshare(Sender s)
+      {
+         if(!isShared(s))
+         {
+            return;
+         }
+
+         PrivOutMsgMap& curOutMsgs = curOutboxes_i[s];
+         for(PrivOutMsgIt msgIt=curOutMsgs.begin();
+               msgIt!=curOutMsgs.end(); ++msgIt)
+         {
+            msgIt->second = pool_i.create(*(msgIt->second));
+            curInboxes_i[msgIt->first][s] = msgIt->second;
+         }
+
+         PrivOutMsgMap& prevOutMsgs = prevOutboxes_i[s];
+         for(PrivOutMsgIt msgIt=prevOutMsgs.begin();
+               msgIt!=prevOutMsgs.end(); ++msgIt)
+         {
+            msgIt->second = pool_i.create(*(msgIt->second));
+            prevInboxes_i[msgIt->first][s] = msgIt->second;
+         }
+
+         releaseShared(s);
+
+      } // function unshare
+
+      /**
+       * Returns all messages to the message pool, without updating any
+       * message maps, and releases any frozen messages. This should only be
+       * called immediately before the maps are cleared or overwritten.
+       */
+      void freeMessages()
+      {
+         for(typename OutboxMap::iterator boxIt=curOutboxes_i.begin();
+               boxIt!=curOutboxes_i.end(); ++boxIt)
+         {
+            if(isShared(boxIt->first))
+            {
+               continue;
+            }
+            for(PrivOutMsgIt msgIt=boxIt->second.begin();
+                  msgIt!=boxIt->second.end(); ++msgIt)
+            {
+               pool_i.destroy(msgIt->second);
+            }
+         }
+
+         for(typename OutboxMap::iterator boxIt=prevOutboxes_i.begin();
+               boxIt!=prevOutboxes_i.end(); ++boxIt)
+         {
+            if(isShared(boxIt->first))
+            {
+               continue;
+            }
+            for(PrivOutMsgIt msgIt=boxIt->second.begin();
+                  msgIt!=boxIt->second.end(); ++msgIt)
+            {
+               pool_i.destroy(msgIt->second);
+            }
+         }
+         releaseAllShared();
+
+      } // function freeMessages
+
+      /**
+       * Merges sorted entries into a map, by rebuilding the map from the
+       * merged sequence. This takes time linear in the combined size for
+       * both std::map and flat maps, whereas inserting each entry separately
+       * into a flat map takes quadratic time.
+       * @param[in,out] map the map to merge into.
+       * @param[in,out] entries entries sorted by key, none of which are
+       * already in the map. Their values are moved into the map.
+       */
+      template<class Map> static void mergeSorted
+      (
+       Map& map,
+       std::vector<std::pair<typename Map::key_type,
+          typename Map::mapped_type> >& entries
+      )
+      {
+         typedef typename std::vector<std::pair<typename Map::key_type,
+            typename Map::mapped_type> >::iterator EntryIt;
+
+         if(entries.empty())
+         {
+            return;
+         }
+
+         Map merged;
+         typename Map::iterator oldIt = map.begin();
+         EntryIt newIt = entries.begin();
+         while( (map.end()!=oldIt) || (entries.end()!=newIt) )
+         {
+            if( (entries.end()==newIt) ||
+                ( (map.end()!=oldIt) && (oldIt->first < newIt->first) ) )
+            {
+               merged.insert(merged.end(),std::move(*oldIt));
+               ++oldIt;
+            }
+            else
+            {
+               merged.insert(merged.end(),std::move(*newIt));
+               ++newIt;
+            }
+         }
+         map.swap(merged);
+
+      } // function mergeSorted
+
+      /**
+       * Adds new edges to a pair of current and previous box maps.
+       * @param[in,out] curBoxes the current outboxes or inboxes.
+       * @param[in,out] prevBoxes the previous outboxes or inboxes.
+       * @param[in] edges the new edges, sorted by pKey and then by pEntry.
+       * @param[in] pKey the member identifying the edge's box owner.
+       * @param[in] pEntry the member identifying the edge within a box.
+       */
+      template<class BoxMap, class Key, class Entry> static void insertBoxes
+      (
+       BoxMap& curBoxes,
+       BoxMap& prevBoxes,
+       const std::vector<NewEdge>& edges,
+       Key NewEdge::* pKey,
+       Entry NewEdge::* pEntry
+      )
+      {
+         typedef typename BoxMap::mapped_type MsgMap;
+
+         //*********************************************************************
+         // Add an empty box for each owner that does not have one yet.
+         //*********************************************************************
+         std::vector<std::pair<Key,MsgMap> > newBoxes;
+         for(std::size_t k=0; k<edges.size(); ++k)
+         {
+            const Key& key = edges[k].*pKey;
+            if( (0<k) && !(edges[k-1].*pKey < key) )
+            {
+               continue;
+            }
+            if(curBoxes.end()==curBoxes.find(key))
+            {
+               newBoxes.push_back(std::make_pair(key,MsgMap()));
+            }
+         }
+         std::vector<std::pair<Key,MsgMap> > newPrevBoxes(newBoxes);
+         mergeSorted(curBoxes,newBoxes);
+         mergeSorted(prevBoxes,newPrevBoxes);
+
+         //*********************************************************************
+         // Merge each owner's new messages into its boxes in one go.
+         //*********************************************************************
+         std::vector<std::pair<Entry,Message*> > curMsgs;
+         std::vector<std::pair<Entry,Message*> > prevMsgs;
+         std::size_t first = 0;
+         while(first<edges.size())
+         {
+            curMsgs.clear();
+            prevMsgs.clear();
+            std::size_t last = first;
+            while( (last<edges.size()) &&
+                   !(edges[first].*pKey < edges[last].*pKey) )
+            {
+               curMsgs.push_back(std::make_pair(edges[last].*pEntry,
+                        edges[last].pCur));
+               prevMsgs.push_back(std::make_pair(edges[last].*pEntry,
+                        edges[last].pPrev));
+               ++last;
+            }
+            mergeSorted(curBoxes[edges[first].*pKey],curMsgs);
+            mergeSorted(prevBoxes[edges[first].*pKey],prevMsgs);
+            first = last;
+         }
+
+      } // function insertBoxes
       
       /**
        * Utility function used for deep copy construction and assignment.
@@ -149,6 +524,12 @@ namespace util
        */
       void deepCopyMembers()
       {
+         //*********************************************************************
+         // Make sure we have space for all messages up front, so that they
+         // are copied into as few slabs as possible.
+         //*********************************************************************
+         pool_i.reserve(2*numOfEdges());
+
          //*********************************************************************
          // Deep copy current messages and update both inbox and outbox
          // references.
@@ -165,7 +546,7 @@ namespace util
                // Copy outbox message
                //***************************************************************
                Receiver r = msgIt->first;
-               Message* pMsgCopy = new Message(*(msgIt->second));
+               Message* pMsgCopy = pool_i.create(*(msgIt->second));
                msgIt->second = pMsgCopy;
                
                //***************************************************************
@@ -193,7 +574,7 @@ namespace util
                // Copy outbox message
                //***************************************************************
                Receiver r = msgIt->first;
-               Message* pMsgCopy = new Message(*(msgIt->second));
+               Message* pMsgCopy = pool_i.create(*(msgIt->second));
                msgIt->second = pMsgCopy;
                
                //***************************************************************
@@ -209,6 +590,12 @@ namespace util
          //*********************************************************************
          senders_i.setMap(&curOutboxes_i);
          receivers_i.setMap(&curInboxes_i);
+
+         //*********************************************************************
+         // Links must point into our own inbox maps, so rebuild them later.
+         //*********************************************************************
+         inboxLinks_i.clear();
+         linksValid_i = false;
          
       } // function deepCopyMembers()
 
@@ -221,7 +608,9 @@ namespace util
          : curOutboxes_i(), prevOutboxes_i(),
            curInboxes_i(), prevInboxes_i(),
            senders_i(&curOutboxes_i), receivers_i(&curInboxes_i),
-           notices_i()
+           notices_i(), noticeHead_i(0), pending_i(), noticeCount_i(0),
+           inboxLinks_i(), linksValid_i(false), pool_i(), frozen_i(),
+           shared_i(), noShared_i(0)
       {}
       
       /**
@@ -234,7 +623,16 @@ namespace util
          prevInboxes_i(rhs.prevInboxes_i),
          senders_i(&curOutboxes_i),
          receivers_i(&curInboxes_i),
-         notices_i(rhs.notices_i)
+         notices_i(rhs.notices_i),
+         noticeHead_i(rhs.noticeHead_i),
+         pending_i(rhs.pending_i),
+         noticeCount_i(rhs.noticeCount_i),
+         inboxLinks_i(),
+         linksValid_i(false),
+         pool_i(),
+         frozen_i(),
+         shared_i(),
+         noShared_i(0)
       {
          deepCopyMembers();
       }
@@ -244,6 +642,11 @@ namespace util
        */
       PostOffice& operator=(const PostOffice& rhs)
       {
+         if(this==&rhs)
+         {
+            return *this;
+         }
+         freeMessages();
          curOutboxes_i = rhs.curOutboxes_i;
          prevOutboxes_i = rhs.prevOutboxes_i;
          curInboxes_i = rhs.curInboxes_i;
@@ -251,27 +654,148 @@ namespace util
          senders_i.setMap(&curOutboxes_i);
          receivers_i.setMap(&curInboxes_i);
          notices_i = rhs.notices_i;
+         noticeHead_i = rhs.noticeHead_i;
+         pending_i = rhs.pending_i;
+         noticeCount_i = rhs.noticeCount_i;
          deepCopyMembers();
          return *this;
       }
 
+      /**
+       * Makes another post office into a copy of this one, without copying
+       * any messages. Instead, the messages of both post offices are frozen
+       * and shared between them, until each sender is given its own copy of
+       * its messages by PostOffice::curOutMsgs or PostOffice::prevOutMsgs.
+       * This takes time linear in the number of edges, but only copies
+       * message pointers.
+       * @param[out] copy the post office to overwrite.
+       * @post Frozen messages must only be modified through the non-const
+       * outbox accessors, or after calling PostOffice::unshareAll, and not
+       * through inboxes.
+       */
+      void fork(PostOffice& copy)
+      {
+         if(this==&copy)
+         {
+            return;
+         }
+
+         //*********************************************************************
+         // Freeze the messages that are not already frozen, by moving the
+         // pool that holds them. They are listed so that they can be
+         // destroyed once no post office shares them.
+         //*********************************************************************
+         std::shared_ptr<SharedMessages> pFrozen(new SharedMessages);
+         pFrozen->pool.swap(pool_i);
+         pFrozen->msgs.reserve(pFrozen->pool.size());
+         for(typename OutboxMap::iterator boxIt=curOutboxes_i.begin();
+               boxIt!=curOutboxes_i.end(); ++boxIt)
+         {
+            if(isShared(boxIt->first))
+            {
+               continue;
+            }
+            PrivOutMsgMap& prevOutMsgs = prevOutboxes_i[boxIt->first];
+            for(PrivOutMsgIt msgIt=boxIt->second.begin();
+                  msgIt!=boxIt->second.end(); ++msgIt)
+            {
+               pFrozen->msgs.push_back(msgIt->second);
+               pFrozen->msgs.push_back(prevOutMsgs[msgIt->first]);
+            }
+         }
+         assert(pFrozen->msgs.size()==std::size_t(pFrozen->pool.size()));
+         if(!pFrozen->msgs.empty())
+         {
+            frozen_i.push_back(pFrozen);
+         }
+         else
+         {
+            pFrozen->pool.swap(pool_i);
+         }
+
+         //*********************************************************************
+         // Every sender is now shared.
+         //*********************************************************************
+         shared_i.clear();
+         for(typename OutboxMap::iterator boxIt=curOutboxes_i.begin();
+               boxIt!=curOutboxes_i.end(); ++boxIt)
+         {
+            shared_i.insert(shared_i.end(),std::make_pair(boxIt->first,true));
+         }
+         noShared_i = shared_i.size();
+         if(0==noShared_i)
+         {
+            frozen_i.clear();
+         }
+
+         //*********************************************************************
+         // Copy everything except the messages.
+         //*********************************************************************
+         copy.freeMessages();
+         copy.curOutboxes_i = curOutboxes_i;
+         copy.prevOutboxes_i = prevOutboxes_i;
+         copy.curInboxes_i = curInboxes_i;
+         copy.prevInboxes_i = prevInboxes_i;
+         copy.senders_i.setMap(&copy.curOutboxes_i);
+         copy.receivers_i.setMap(&copy.curInboxes_i);
+         copy.notices_i = notices_i;
+         copy.noticeHead_i = noticeHead_i;
+         copy.pending_i = pending_i;
+         copy.noticeCount_i = noticeCount_i;
+         copy.inboxLinks_i.clear();
+         copy.linksValid_i = false;
+         copy.frozen_i = frozen_i;
+         copy.shared_i = shared_i;
+         copy.noShared_i = noShared_i;
+
+      } // function fork
+
+      /**
+       * Gives this post office its own copy of every message frozen by
+       * PostOffice::fork, so that messages may be modified through inboxes.
+       */
+      void unshareAll()
+      {
+         for(typename OutboxMap::iterator boxIt=curOutboxes_i.begin();
+               (0<noShared_i) && (boxIt!=curOutboxes_i.end()); ++boxIt)
+         {
+            unshare(boxIt->first);
+         }
+      }
+
+      /**
+       * Returns the number of senders whose messages are still shared with
+       * a fork of this post office.
+       * @see PostOffice::fork
+       */
+      int numOfSharedSenders() const
+      {
+         return noShared_i;
+      }
+
       /**
        * Removes all messages and edges from this postoffice.
        */
       void clear()
       {
+         freeMessages();
          curOutboxes_i.clear();
          prevOutboxes_i.clear();
          curInboxes_i.clear();
          prevInboxes_i.clear();
-         while(!notices_i.empty())
-         {
-            notices_i.pop();
-         }
+         inboxLinks_i.clear();
+         linksValid_i = false;
+         notices_i.clear();
+         noticeHead_i = 0;
+         pending_i.clear();
+         noticeCount_i = 0;
       }
 
       /**
        * Returns the current set of output messages for a given sender.
+       * If the sender's messages are shared with a fork, it is first given
+       * its own copy of them, so pointers to its messages that were obtained
+       * earlier, including from inboxes, no longer refer to them.
        * @throws maxsum::UnknownAddressException if sender is not registered.
        */
       OutMsgMap curOutMsgs(Sender s)
@@ -281,11 +805,30 @@ namespace util
          {
             throw UnknownAddressException("curOutMsgs","Unknown sender.");
          }
+         unshare(s);
+         return OutMsgMap(pos->second);
+      }
+
+      /**
+       * Returns the current set of output messages for a given sender,
+       * which may be read but not modified.
+       * @throws maxsum::UnknownAddressException if sender is not registered.
+       */
+      OutMsgMap curOutMsgs(Sender s) const
+      {
+         typename OutboxMap::const_iterator pos = curOutboxes_i.find(s);
+         if(curOutboxes_i.end()==pos)
+         {
+            throw UnknownAddressException("curOutMsgs","Unknown sender.");
+         }
          return OutMsgMap(pos->second);
       }
 
       /**
        * Returns the previous set of output messages for a given sender.
+       * If the sender's messages are shared with a fork, it is first given
+       * its own copy of them, so pointers to its messages that were obtained
+       * earlier, including from inboxes, no longer refer to them.
        * @throws maxsum::UnknownAddressException if sender is not registered.
        */
       OutMsgMap prevOutMsgs(Sender s)
@@ -295,6 +838,7 @@ namespace util
          {
             throw UnknownAddressException("prevOutMsgs","Unknown sender.");
          }
+         unshare(s);
          return OutMsgMap(pos->second);
       }
 
@@ -312,6 +856,21 @@ namespace util
          return InMsgMap(pos->second);
       }
 
+      /**
+       * Returns the current set of input messages for a given receiver,
+       * which may be read but not modified.
+       * @throws maxsum::UnknownAddressException if receiver is not registered.
+       */
+      InMsgMap curInMsgs(Receiver r) const
+      {
+         typename InboxMap::const_iterator pos = curInboxes_i.find(r);
+         if(curInboxes_i.end()==pos)
+         {
+            throw UnknownAddressException("curInMsgs","Unknown receiver.");
+         }
+         return InMsgMap(pos->second);
+      }
+
       /**
        * Returns the previous set of input messages for a given receiver.
        * @throws maxsum::UnknownAddressException if receiver is not registered.
@@ -329,28 +888,45 @@ namespace util
       /**
        * Returns true if any receivers have new mail.
        */
-      bool newMail() const { return !notices_i.empty(); }
+      bool newMail() const { return 0 < noticeCount_i; }
 
       /**
        * Notifies a receiver that they have new mail.
+       * Notifying a receiver that is already notified has no effect, so that
+       * each receiver only needs to check its mail once. Likewise, notifying
+       * an unregistered receiver has no effect.
        * @param[in] r the receiver to notify
        */
-      void notify(Receiver r) { notices_i.push(r); }
+      void notify(Receiver r)
+      {
+         typename MAXSUM_DEFAULT_MAP<Receiver,bool>::iterator pos =
+            pending_i.find(r);
+
+         if( (pending_i.end()==pos) || pos->second )
+         {
+            return;
+         }
+
+         pos->second = true;
+         notices_i.push_back(r);
+         ++noticeCount_i;
+      }
 
       /**
        * Notifies all receivers that they have new mail.
        */
       void notifyAll()
       {
-         while(!notices_i.empty())
-         {
-            notices_i.pop();
-         }
+         notices_i.clear();
+         noticeHead_i = 0;
+         noticeCount_i = 0;
 
-         typedef typename util::KeySet<InboxMap>::const_iterator Iterator;
-         for(Iterator it=receivers_i.begin(); it!=receivers_i.end(); ++it)
+         typedef typename MAXSUM_DEFAULT_MAP<Receiver,bool>::iterator Iterator;
+         for(Iterator it=pending_i.begin(); it!=pending_i.end(); ++it)
          {
-            notify(*it);
+            it->second = true;
+            notices_i.push_back(it->first);
+            ++noticeCount_i;
          }
       }
 
@@ -360,7 +936,7 @@ namespace util
        */
       int noticeCount() const
       {
-         return notices_i.size();
+         return noticeCount_i;
       }
 
       /**
@@ -374,13 +950,37 @@ namespace util
        */
       Receiver popNotice()
       {
-         if(notices_i.empty())
+         if(!newMail())
          {
             throw EmptyNoticeException("popNotice()",
                   "Tried to pop from empty notice queue.");
          }
-         Receiver result = notices_i.front();
-         notices_i.pop();
+
+         //*********************************************************************
+         // Skip any stale entries for receivers that were removed after
+         // being notified.
+         //*********************************************************************
+         typename MAXSUM_DEFAULT_MAP<Receiver,bool>::iterator pos;
+         Receiver result;
+         do
+         {
+            result = notices_i[noticeHead_i++];
+            pos = pending_i.find(result);
+         }
+         while( (pending_i.end()==pos) || !pos->second );
+
+         pos->second = false;
+         --noticeCount_i;
+
+         //*********************************************************************
+         // Once the queue is empty, we can start again from the beginning,
+         // keeping the vector's capacity for future notices.
+         //*********************************************************************
+         if(0==noticeCount_i)
+         {
+            notices_i.clear();
+            noticeHead_i = 0;
+         }
          return result;
       }
 
@@ -406,32 +1006,28 @@ namespace util
          prevOutboxes_i[s].swap(curOutPos->second);
 
          //*********************************************************************
-         // Inbox pointers need the be swapped individually
+         // Inbox pointers need the be swapped individually, using the direct
+         // links to this sender's inbox entries.
          //*********************************************************************
-         for(typename InboxMap::iterator curIt=curInboxes_i.begin();
-               curIt!=curInboxes_i.end(); ++curIt)
+         if(!linksValid_i)
          {
-            //******************************************************************
-            // If the current receiver is not related to this sender, continue
-            // to the next receiver.
-            //******************************************************************
-            PrivInMsgIt curMsgPos = curIt->second.find(s);
-            if(curIt->second.end()==curMsgPos)
-            {
-               continue;
-            }
-
-            //******************************************************************
-            // Otherwise swap the current and previous in message pointers.
-            //******************************************************************
-            Message*& prevPtr = prevInboxes_i[curIt->first][s];
-            Message*&  curPtr = curMsgPos->second;
-            Message*   tmpPtr = prevPtr;
+            rebuildLinks();
+         }
 
-            prevPtr = curPtr;
-             curPtr = tmpPtr;
+         typename InboxLinkMap::iterator linkPos = inboxLinks_i.find(s);
+         if(inboxLinks_i.end()==linkPos)
+         {
+            return;
+         }
 
-         } // for loop
+         std::vector<InboxLink>& links = linkPos->second;
+         for(typename std::vector<InboxLink>::iterator it=links.begin();
+               it!=links.end(); ++it)
+         {
+            Message* tmpPtr = *(it->pPrev);
+            *(it->pPrev) = *(it->pCur);
+            *(it->pCur) = tmpPtr;
+         }
 
       } // swapOutBoxes
 
@@ -471,6 +1067,17 @@ namespace util
             return;
          }
 
+         //*********************************************************************
+         // A shared sender needs its own messages before we add to them.
+         //*********************************************************************
+         if(isShared(s))
+         {
+            curOutMsgs.erase(r);
+            unshare(s);
+            addEdge(s,r,msgVal);
+            return;
+         }
+
          //*********************************************************************
          // Retrieve all other message pointers for this sender-receiver pair.
          //*********************************************************************
@@ -495,13 +1102,105 @@ namespace util
          // Otherwise create new current and previous messages and stick
          // then in the relevent lists.
          //*********************************************************************
-         pCurOutMsg = new Message(msgVal);
-         pPrevOutMsg = new Message(msgVal);
+         pCurOutMsg = pool_i.create(msgVal);
+         pPrevOutMsg = pool_i.create(msgVal);
          pCurInMsg = pCurOutMsg;
          pPrevInMsg = pPrevOutMsg;
+         linksValid_i = false;
+
+         //*********************************************************************
+         // Make sure the receiver has a notification flag.
+         //*********************************************************************
+         pending_i.insert(std::make_pair(r,false));
 
       } // addEdge
 
+      /**
+       * Adds many edges at once. This gives the same result as calling
+       * PostOffice::addEdge for each edge, but each box map is rebuilt at
+       * most once, rather than once per edge, so building a large graph
+       * takes time linear in its size for flat maps.
+       * @param[in] edges the sender and receiver of each edge. Duplicates,
+       * and edges that already exist, are ignored.
+       * @param[in] msgSource functor called as <code>msgSource(s,r)</code>
+       * to provide the initial value of the messages for each new edge.
+       * @post Messages can now be sent along every edge via this
+       * maxsum::PostOffice.
+       * @post Maps and references previously returned by this PostOffice may
+       * be invalidated.
+       */
+      template<class MsgSource> void addEdges
+      (
+       std::vector<std::pair<Sender,Receiver> > edges,
+       const MsgSource& msgSource
+      )
+      {
+         typedef typename std::vector<std::pair<Sender,Receiver> >::
+            const_iterator EdgeIt;
+
+         //*********************************************************************
+         // Put the edges in sender order, and create messages for each edge
+         // that does not already exist.
+         //*********************************************************************
+         std::sort(edges.begin(),edges.end());
+         edges.erase(std::unique(edges.begin(),edges.end()),edges.end());
+
+         std::vector<NewEdge> newEdges;
+         newEdges.reserve(edges.size());
+         for(EdgeIt it=edges.begin(); it!=edges.end(); ++it)
+         {
+            typename OutboxMap::const_iterator boxPos =
+               curOutboxes_i.find(it->first);
+            if( (curOutboxes_i.end()!=boxPos) &&
+                (boxPos->second.end()!=boxPos->second.find(it->second)) )
+            {
+               continue;
+            }
+
+            unshare(it->first);
+            const Message& msgVal = msgSource(it->first,it->second);
+            NewEdge edge;
+            edge.s = it->first;
+            edge.r = it->second;
+            edge.pCur = pool_i.create(msgVal);
+            edge.pPrev = pool_i.create(msgVal);
+            newEdges.push_back(edge);
+         }
+
+         if(newEdges.empty())
+         {
+            return;
+         }
+
+         //*********************************************************************
+         // Add the outbox entries in sender order, then the inbox entries
+         // and notification flags in receiver order.
+         //*********************************************************************
+         insertBoxes(curOutboxes_i,prevOutboxes_i,newEdges,
+               &NewEdge::s,&NewEdge::r);
+
+         std::sort(newEdges.begin(),newEdges.end(),&NewEdge::byReceiver);
+         insertBoxes(curInboxes_i,prevInboxes_i,newEdges,
+               &NewEdge::r,&NewEdge::s);
+
+         std::vector<std::pair<Receiver,bool> > newFlags;
+         for(std::size_t k=0; k<newEdges.size(); ++k)
+         {
+            const Receiver& r = newEdges[k].r;
+            if( (0<k) && !(newEdges[k-1].r < r) )
+            {
+               continue;
+            }
+            if(pending_i.end()==pending_i.find(r))
+            {
+               newFlags.push_back(std::make_pair(r,false));
+            }
+         }
+         mergeSorted(pending_i,newFlags);
+         linksValid_i = false;
+
+      } // addEdges
+
       /**
        * Removes an edge between a specified sender and receiver.
        * @param[in] s the sender's id
@@ -544,8 +1243,11 @@ namespace util
          PrivOutMsgIt prevOutMsgPos = prevOutMsgs.find(r);
          assert(prevOutMsgs.end()!=prevOutMsgPos); // should never happen.
          Message*& pPrevOutMsg = prevOutMsgPos->second;
-         delete pCurOutMsg;
-         delete pPrevOutMsg;
+         if(!isShared(s))
+         {
+            pool_i.destroy(pCurOutMsg);
+            pool_i.destroy(pPrevOutMsg);
+         }
          pCurOutMsg=0;
          pPrevOutMsg=0;
 
@@ -558,6 +1260,7 @@ namespace util
          prevOutMsgs.erase(prevOutMsgPos);
          curInboxes_i[r].erase(s);
          prevInboxes_i[r].erase(s);
+         linksValid_i = false;
 
          //*********************************************************************
          // If the sender no longer has any edges, delete it.
@@ -565,6 +1268,7 @@ namespace util
          if(curOutboxes_i[s].empty())
          {
             curOutboxes_i.erase(s);
+            releaseShared(s);
          }
 
          //*********************************************************************
@@ -573,6 +1277,14 @@ namespace util
          if(curInboxes_i[r].empty())
          {
             curInboxes_i.erase(r);
+
+            typename MAXSUM_DEFAULT_MAP<Receiver,bool>::iterator pendingPos =
+               pending_i.find(r);
+            if(pendingPos->second)
+            {
+               --noticeCount_i;
+            }
+            pending_i.erase(pendingPos);
          }
 
       } // removeEdge
@@ -754,36 +1466,12 @@ namespace util
       virtual ~PostOffice()
       {
          //********************************************************************
-         // Free all current messages by iterating through the outboxes.
+         // Return all messages to the pool by iterating through the outboxes.
          // We do not need to free inboxes, because these point to the same
-         // messages, which should only be freed once.
+         // messages, which should only be freed once. The pool's own
+         // destructor then frees the underlying memory.
          //********************************************************************
-         for(typename OutboxMap::iterator boxIt=curOutboxes_i.begin();
-               boxIt!=curOutboxes_i.end(); ++boxIt)
-         {
-            for(PrivOutMsgIt msgIt=boxIt->second.begin();
-                  msgIt!=boxIt->second.end(); ++msgIt)
-            {
-               delete msgIt->second;
-            }
-
-         } // outer for loop
-
-         //********************************************************************
-         // Free all previous messages by iterating through the outboxes.
-         // We do not need to free inboxes, because these point to the same
-         // messages, which should only be freed once.
-         //********************************************************************
-         for(typename OutboxMap::iterator boxIt=prevOutboxes_i.begin();
-               boxIt!=prevOutboxes_i.end(); ++boxIt)
-         {
-            for(PrivOutMsgIt msgIt=boxIt->second.begin();
-                  msgIt!=boxIt->second.end(); ++msgIt)
-            {
-               delete msgIt->second;
-            }
-
-         } // outer for loop
+         freeMessages();
 
       } // destructor
 
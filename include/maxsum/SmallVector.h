@@ -0,0 +1,444 @@
+/**
+ * @file SmallVector.h
+ * Defines the maxsum::util::SmallVector class, which is a dynamic array that
+ * stores a small number of elements without any heap allocation.
+ */
+#ifndef MAXSUM_UTIL_SMALLVECTOR_H
+#define MAXSUM_UTIL_SMALLVECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include "Stats.h"
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Dynamic array with inline storage for up to N elements.
+    * While its size is at most N, a SmallVector keeps its elements in a
+    * buffer inside the object itself, so construction and copying do not
+    * touch the heap, and the elements share a cache line with the rest of
+    * the object. Larger arrays are moved to the heap, and stay there until
+    * the SmallVector is destroyed or cleared. In either case, elements are
+    * stored contiguously, and can be accessed via SmallVector::data().
+    *
+    * A SmallVector can also borrow an array owned by someone else, such as
+    * a memory mapped file, using SmallVector::borrow(). Borrowed elements are
+    * read and written in place while the size of the array is unchanged.
+    * Any operation that changes its size first moves the elements it keeps
+    * to storage owned by the SmallVector, so the borrowed array is never
+    * written by a resize, an assignment of a different size, or a swap.
+    *
+    * Only the subset of the std::vector interface used by this library is
+    * provided. Elements are copied by assignment, so T should be a simple
+    * value type, such as a number.
+    *
+    * @tparam T the element type.
+    * @tparam N the number of elements stored inline.
+    * @attention This class is used as part of the implementation of
+    * maxsum::DiscreteFunction, and so does not need to be referenced directly
+    * by calling libraries.
+    */
+   template<class T, std::size_t N> class SmallVector
+   {
+   public:
+
+      /**
+       * Type of each element.
+       */
+      typedef T value_type;
+
+      /**
+       * Type used for sizes and indices.
+       */
+      typedef std::size_t size_type;
+
+      /**
+       * Mutable iterator type.
+       */
+      typedef T* iterator;
+
+      /**
+       * Read only iterator type.
+       */
+      typedef const T* const_iterator;
+
+   private:
+
+      /**
+       * Pointer to the current elements, either buffer_i or heap storage.
+       */
+      T* data_i;
+
+      /**
+       * Number of elements.
+       */
+      size_type size_i;
+
+      /**
+       * Number of elements that fit in the current storage.
+       */
+      size_type capacity_i;
+
+      /**
+       * True if data_i points to a borrowed array, which must not be freed.
+       */
+      bool borrowed_i;
+
+      /**
+       * Inline storage.
+       */
+      T buffer_i[N];
+
+      /**
+       * Ensures that the storage can hold at least n elements, keeping the
+       * current elements.
+       */
+      void grow(size_type n)
+      {
+         if(n <= capacity_i)
+         {
+            return;
+         }
+
+         const size_type newCapacity = std::max(n,2*capacity_i);
+         T* newData = new T[newCapacity];
+         MAXSUM_STATS_ONLY(countAllocation();)
+         std::copy(data_i,data_i+size_i,newData);
+         release();
+         data_i = newData;
+         capacity_i = newCapacity;
+         borrowed_i = false;
+      }
+
+      /**
+       * Stops borrowing the current array, if it is borrowed and is about
+       * to change size.
+       * @param[in] n the new size of this array.
+       * @param[in] keep the number of current elements to copy to the new
+       * storage.
+       */
+      void unborrow(size_type n, size_type keep)
+      {
+         if(!borrowed_i || (n==size_i))
+         {
+            return;
+         }
+
+         T* borrowed = data_i;
+         data_i = buffer_i;
+         capacity_i = N;
+         borrowed_i = false;
+         if(N < n)
+         {
+            data_i = new T[n];
+            MAXSUM_STATS_ONLY(countAllocation();)
+            capacity_i = n;
+         }
+         std::copy(borrowed,borrowed+std::min(keep,n),data_i);
+      }
+
+      /**
+       * Frees any heap storage, without resetting data_i, capacity_i or
+       * borrowed_i.
+       */
+      void release()
+      {
+         if(!isInline() && !borrowed_i)
+         {
+            delete[] data_i;
+         }
+      }
+
+   public:
+
+      /**
+       * Constructs an empty array.
+       */
+      SmallVector() : data_i(buffer_i), size_i(0), capacity_i(N), borrowed_i(false) {}
+
+      /**
+       * Constructs an array with n copies of a specified value.
+       * @param[in] n the number of elements.
+       * @param[in] val the value of each element.
+       */
+      explicit SmallVector(size_type n, const T& val=T())
+         : data_i(buffer_i), size_i(0), capacity_i(N), borrowed_i(false)
+      {
+         assign(n,val);
+      }
+
+      /**
+       * Constructs an array with a copy of a range of elements.
+       * @param[in] begin iterator to the first element.
+       * @param[in] end iterator to the end of the range.
+       */
+      template<class It> SmallVector
+      (
+       It begin,
+       It end,
+       typename std::enable_if<!std::is_integral<It>::value>::type* = 0
+      )
+         : data_i(buffer_i), size_i(0), capacity_i(N), borrowed_i(false)
+      {
+         assign(begin,end);
+      }
+
+      /**
+       * Copy constructor.
+       */
+      SmallVector(const SmallVector& rhs)
+         : data_i(buffer_i), size_i(0), capacity_i(N), borrowed_i(false)
+      {
+         assign(rhs.begin(),rhs.end());
+      }
+
+      /**
+       * Move constructor. If rhs is on the heap, its storage is transferred
+       * to this array, otherwise its elements are copied.
+       * @post rhs is empty.
+       */
+      SmallVector(SmallVector&& rhs)
+         : data_i(buffer_i), size_i(0), capacity_i(N), borrowed_i(false)
+      {
+         *this = std::move(rhs);
+      }
+
+      /**
+       * Frees any heap storage.
+       */
+      ~SmallVector()
+      {
+         release();
+      }
+
+      /**
+       * Copy assignment. Existing storage is reused if large enough.
+       */
+      SmallVector& operator=(const SmallVector& rhs)
+      {
+         if(this!=&rhs)
+         {
+            assign(rhs.begin(),rhs.end());
+         }
+         return *this;
+      }
+
+      /**
+       * Move assignment. If rhs is on the heap or borrowed, its storage is
+       * transferred to this array, otherwise its elements are copied.
+       * @post rhs is empty.
+       */
+      SmallVector& operator=(SmallVector&& rhs)
+      {
+         if(this==&rhs)
+         {
+            return *this;
+         }
+
+         if(rhs.isInline())
+         {
+            assign(rhs.begin(),rhs.end());
+         }
+         else
+         {
+            release();
+            data_i = rhs.data_i;
+            size_i = rhs.size_i;
+            capacity_i = rhs.capacity_i;
+            borrowed_i = rhs.borrowed_i;
+            rhs.data_i = rhs.buffer_i;
+            rhs.capacity_i = N;
+            rhs.borrowed_i = false;
+         }
+         rhs.size_i = 0;
+         return *this;
+      }
+
+      /**
+       * Replaces the contents of this array with n copies of a value.
+       */
+      void assign(size_type n, const T& val)
+      {
+         unborrow(n,0);
+         grow(n);
+         std::fill(data_i,data_i+n,val);
+         size_i = n;
+      }
+
+      /**
+       * Replaces the contents of this array with a range of elements.
+       */
+      template<class It> void assign(It begin, It end)
+      {
+         const size_type n = std::distance(begin,end);
+         unborrow(n,0);
+         grow(n);
+         std::copy(begin,end,data_i);
+         size_i = n;
+      }
+
+      /**
+       * Swaps the contents of this array with another. If neither array is
+       * inline, this just swaps pointers. Otherwise, the arrays are swapped
+       * by moves, so that a borrowed array moves by pointer, rather than
+       * having the other array's elements written into it.
+       */
+      void swap(SmallVector& rhs)
+      {
+         if(!isInline() && !rhs.isInline())
+         {
+            std::swap(data_i,rhs.data_i);
+            std::swap(size_i,rhs.size_i);
+            std::swap(capacity_i,rhs.capacity_i);
+            std::swap(borrowed_i,rhs.borrowed_i);
+            return;
+         }
+
+         SmallVector tmp(std::move(*this));
+         *this = std::move(rhs);
+         rhs = std::move(tmp);
+      }
+
+      /**
+       * Resizes this array, keeping existing elements. New elements are
+       * value initialised.
+       */
+      void resize(size_type n)
+      {
+         unborrow(n,size_i);
+         grow(n);
+         if(n > size_i)
+         {
+            std::fill(data_i+size_i,data_i+n,T());
+         }
+         size_i = n;
+      }
+
+      /**
+       * Ensures that this array can hold n elements without reallocation.
+       */
+      void reserve(size_type n)
+      {
+         grow(n);
+      }
+
+      /**
+       * Appends an element to the end of this array.
+       */
+      void push_back(const T& val)
+      {
+         if(size_i==capacity_i)
+         {
+            const T copy = val; // val may refer to one of our own elements
+            grow(size_i+1);
+            data_i[size_i++] = copy;
+            return;
+         }
+         data_i[size_i++] = val;
+      }
+
+      /**
+       * Removes all elements, and returns to inline storage.
+       */
+      void clear()
+      {
+         release();
+         data_i = buffer_i;
+         size_i = 0;
+         capacity_i = N;
+         borrowed_i = false;
+      }
+
+      /**
+       * Replaces the contents of this array with an array owned by the
+       * caller, without copying it.
+       * @param[in] data the first element of the borrowed array.
+       * @param[in] n the number of elements in the borrowed array.
+       * @pre the borrowed array outlives this SmallVector, or remains valid
+       * until this SmallVector changes size or is cleared.
+       */
+      void borrow(T* data, size_type n)
+      {
+         release();
+         data_i = data;
+         size_i = n;
+         capacity_i = n;
+         borrowed_i = true;
+      }
+
+      /**
+       * Returns true if the elements are stored in a borrowed array.
+       */
+      bool isBorrowed() const { return borrowed_i; }
+
+      /**
+       * Returns the number of elements.
+       */
+      size_type size() const { return size_i; }
+
+      /**
+       * Returns true if this array is empty.
+       */
+      bool empty() const { return 0==size_i; }
+
+      /**
+       * Returns the number of elements that fit in the current storage.
+       */
+      size_type capacity() const { return capacity_i; }
+
+      /**
+       * Returns true if the elements are stored inline.
+       */
+      bool isInline() const { return buffer_i==data_i; }
+
+      /**
+       * Returns a pointer to the first element.
+       */
+      T* data() { return data_i; }
+
+      /**
+       * Returns a pointer to the first element.
+       */
+      const T* data() const { return data_i; }
+
+      /**
+       * Returns an iterator to the first element.
+       */
+      iterator begin() { return data_i; }
+
+      /**
+       * Returns an iterator to the end of this array.
+       */
+      iterator end() { return data_i+size_i; }
+
+      /**
+       * Returns an iterator to the first element.
+       */
+      const_iterator begin() const { return data_i; }
+
+      /**
+       * Returns an iterator to the end of this array.
+       */
+      const_iterator end() const { return data_i+size_i; }
+
+      /**
+       * Returns the element at a specified position.
+       */
+      T& operator[](size_type k) { return data_i[k]; }
+
+      /**
+       * Returns the element at a specified position.
+       */
+      const T& operator[](size_type k) const { return data_i[k]; }
+
+   }; // class SmallVector
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_SMALLVECTOR_H
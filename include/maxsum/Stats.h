@@ -0,0 +1,124 @@
+/**
+ * @file Stats.h
+ * Defines the maxsum::IterationStats structure and maxsum::StatsObserver
+ * interface, used to monitor the progress of max-sum iterations.
+ * Statistics are only collected if the library is built with the CMake
+ * option MAXSUM_ENABLE_STATS, which defines MAXSUM_STATS. Otherwise, all
+ * instrumentation is compiled out, and observers are never called.
+ */
+#ifndef MAXSUM_STATS_H
+#define MAXSUM_STATS_H
+
+#include "common.h"
+
+/**
+ * Expands to its argument if statistics are enabled, or to nothing
+ * otherwise. Used to mark instrumentation code in the library.
+ */
+#ifdef MAXSUM_STATS
+#define MAXSUM_STATS_ONLY(code) code
+#else
+#define MAXSUM_STATS_ONLY(code)
+#endif
+
+namespace maxsum
+{
+   /**
+    * Statistics describing a single max-sum iteration.
+    * For schedules that do not work in iterations, such as
+    * maxsum::ResidualScheduler, each block of updates equal in number to
+    * the nodes in the factor graph is counted as one iteration.
+    */
+   struct IterationStats
+   {
+      /**
+       * The iteration number, starting from 1 in each call to optimise.
+       */
+      int iteration;
+
+      /**
+       * Number of factor to variable messages recomputed.
+       */
+      int fac2varUpdates;
+
+      /**
+       * Number of variable to factor messages recomputed.
+       */
+      int var2facUpdates;
+
+      /**
+       * Largest maxnorm change in any recomputed message.
+       */
+      ValType maxResidual;
+
+      /**
+       * Number of times a variable's value changed.
+       */
+      int valueChanges;
+
+      /**
+       * Wall clock time spent updating factor to variable messages.
+       */
+      double fac2varSeconds;
+
+      /**
+       * Wall clock time spent updating variable to factor messages.
+       */
+      double var2facSeconds;
+
+      /**
+       * Number of heap allocations made for maxsum::DiscreteFunction
+       * storage, by any thread, during the iteration.
+       */
+      long allocations;
+
+      /**
+       * Constructs statistics with every count set to zero.
+       */
+      IterationStats()
+         : iteration(0), fac2varUpdates(0), var2facUpdates(0),
+           maxResidual(0), valueChanges(0), fac2varSeconds(0),
+           var2facSeconds(0), allocations(0) {}
+
+   }; // struct IterationStats
+
+   /**
+    * Interface for objects that receive statistics after each max-sum
+    * iteration.
+    * @see maxsum::MaxSumController::setObserver
+    */
+   class StatsObserver
+   {
+   public:
+
+      /**
+       * Called after each iteration, on the thread running the algorithm.
+       * @param[in] stats statistics for the iteration just performed.
+       */
+      virtual void iterationDone(const IterationStats& stats)=0;
+
+      /**
+       * Virtual destructor.
+       */
+      virtual ~StatsObserver() {}
+
+   }; // class StatsObserver
+
+namespace util
+{
+   /**
+    * Records one heap allocation for maxsum::DiscreteFunction storage.
+    * Only called if statistics are enabled.
+    */
+   void countAllocation();
+
+   /**
+    * Returns the total number of allocations recorded by countAllocation().
+    */
+   long allocationCount();
+
+} // namespace util
+
+} // namespace maxsum
+
+#endif // MAXSUM_STATS_H
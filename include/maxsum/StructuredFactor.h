@@ -0,0 +1,384 @@
+/**
+ * @file StructuredFactor.h
+ * Defines the maxsum::StructuredFactor interface, for factors whose values
+ * are not stored as a dense table, and the maxsum::PottsFactor and
+ * maxsum::SparseFactor classes that implement it.
+ */
+#ifndef MAXSUM_STRUCTUREDFACTOR_H
+#define MAXSUM_STRUCTUREDFACTOR_H
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "common.h"
+#include "register.h"
+#include "DiscreteFunction.h"
+
+namespace maxsum
+{
+   /**
+    * Interface for factors that are defined implicitly, rather than by a
+    * dense table of values over their entire domain.
+    *
+    * A maxsum::DiscreteFunction stores one value for every joint assignment
+    * to its variables, so its memory, and the cost of max marginalising it,
+    * grow with the product of their domain sizes. Many factors have far more
+    * structure than this, and can compute their max-sum messages directly
+    * from that structure. Such factors may be passed to
+    * maxsum::MaxSumController::setFactor(FactorID,const StructuredFactor&),
+    * which then uses ::maxMarginals() to compute their output messages.
+    *
+    * Like maxsum::DiscreteFunction, the domain of a structured factor is
+    * kept sorted by variable id, and its joint assignments are indexed with
+    * the first variable changing fastest.
+    * @see maxsum::PottsFactor
+    * @see maxsum::SparseFactor
+    */
+   class StructuredFactor
+   {
+   public:
+
+      /**
+       * Type of iterator returned by ::varBegin() and ::varEnd().
+       */
+      typedef const VarID* VarIterator;
+
+      /**
+       * Virtual destructor.
+       */
+      virtual ~StructuredFactor() {}
+
+      /**
+       * Returns a new copy of this factor, which is owned by the caller.
+       */
+      virtual StructuredFactor* clone() const=0;
+
+      /**
+       * Computes the output messages of this factor.
+       * For each variable k in this factor's domain, and each value x of
+       * that variable, this sets <code>out[k][x]</code> to the maximum, over
+       * all joint assignments y with <code>y[k]==x</code>, of the factor's
+       * value at y plus <code>in[j][y[j]]</code> for every other variable j.
+       * @param[in] in the input message from each variable, in the same
+       * order as the domain.
+       * @param[out] out arrays in which to store the output message for each
+       * variable, in the same order as the domain.
+       */
+      virtual void maxMarginals
+      (
+       const std::vector<const ValType*>& in,
+       const std::vector<ValType*>& out
+      ) const=0;
+
+      /**
+       * Expands this factor into a dense table.
+       * @param[out] out function in which to store the factor's values.
+       * @post <code>out</code> has the same domain as this factor, and
+       * any previous contents are destroyed.
+       */
+      virtual void expand(DiscreteFunction& out) const=0;
+
+      /**
+       * Returns the number of variables in this factor's domain.
+       */
+      int noVars() const
+      {
+         return vars_i.size();
+      }
+
+      /**
+       * Returns an iterator to the start of this factor's sorted domain.
+       */
+      VarIterator varBegin() const
+      {
+         return vars_i.data();
+      }
+
+      /**
+       * Returns an iterator to the end of this factor's sorted domain.
+       */
+      VarIterator varEnd() const
+      {
+         return vars_i.data()+vars_i.size();
+      }
+
+      /**
+       * Returns the domain size of the kth variable in this factor's domain.
+       */
+      ValIndex varSize(int k) const
+      {
+         return size_i[k];
+      }
+
+   protected:
+
+      /**
+       * Sorted list of variables in this factor's domain.
+       */
+      std::vector<VarID> vars_i;
+
+      /**
+       * Cached domain size of each variable in vars_i.
+       */
+      std::vector<ValIndex> size_i;
+
+      /**
+       * Constructs a factor that depends on the specified variables.
+       * Duplicate variables are ignored, and the list need not be sorted.
+       * @param[in] begin Iterator to start of variable list.
+       * @param[in] end  Iterator to end of variable list.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      template<class VarIt> StructuredFactor(VarIt begin, VarIt end)
+         : vars_i(begin,end), size_i()
+      {
+         std::sort(vars_i.begin(),vars_i.end());
+         vars_i.erase(std::unique(vars_i.begin(),vars_i.end()),vars_i.end());
+         for(std::size_t k=0; k<vars_i.size(); ++k)
+         {
+            size_i.push_back(getDomainSize(vars_i[k]));
+         }
+      }
+
+      /**
+       * Creates an empty function with the same domain as this factor.
+       * @param[out] out function to initialise.
+       * @param[in] val the initial value of every element.
+       */
+      void initDomain(DiscreteFunction& out, ValType val) const
+      {
+         out = DiscreteFunction(vars_i.begin(),vars_i.end(),val);
+      }
+
+   }; // class StructuredFactor
+
+   /**
+    * Potts factor, which takes one value if all of its variables have the
+    * same value, and zero otherwise. All variables must have the same domain
+    * size. With a negative weight, this penalises agreement, as in graph
+    * colouring, and with a positive weight, it rewards it.
+    *
+    * The output messages are computed in O(nd) time, for n variables each
+    * with d values, rather than the O(d^n) time needed for a dense table.
+    */
+   class PottsFactor : public StructuredFactor
+   {
+   private:
+
+      /**
+       * Value of this factor when all its variables are equal.
+       */
+      ValType weight_i;
+
+   public:
+
+      /**
+       * Constructs a Potts factor over the specified variables.
+       * @param[in] begin Iterator to start of variable list.
+       * @param[in] end  Iterator to end of variable list.
+       * @param[in] weight value of the factor when all variables are equal.
+       * @throws UnknownVariableException if any variable is not registered.
+       * @throws BadDomainException if the list is empty, or the variables
+       * do not all have the same domain size.
+       */
+      template<class VarIt> PottsFactor(VarIt begin, VarIt end, ValType weight)
+         : StructuredFactor(begin,end), weight_i(weight)
+      {
+         checkDomain();
+      }
+
+      /**
+       * Returns the value of this factor when all its variables are equal.
+       */
+      ValType weight() const
+      {
+         return weight_i;
+      }
+
+      /**
+       * Returns a new copy of this factor, which is owned by the caller.
+       */
+      virtual StructuredFactor* clone() const
+      {
+         return new PottsFactor(*this);
+      }
+
+      /**
+       * Computes the output messages of this factor.
+       * @see StructuredFactor::maxMarginals()
+       */
+      virtual void maxMarginals
+      (
+       const std::vector<const ValType*>& in,
+       const std::vector<ValType*>& out
+      ) const;
+
+      /**
+       * Expands this factor into a dense table.
+       * @see StructuredFactor::expand()
+       */
+      virtual void expand(DiscreteFunction& out) const;
+
+   private:
+
+      /**
+       * Checks that this factor's domain is valid.
+       * @throws BadDomainException if the domain is empty, or the variables
+       * do not all have the same domain size.
+       */
+      void checkDomain() const;
+
+   }; // class PottsFactor
+
+   /**
+    * Sparse factor, which takes a default value everywhere except at a
+    * small number of joint assignments, which are stored explicitly.
+    *
+    * The output messages are computed in O(m log m + nd) time, for m stored
+    * values and n variables each with d values. If some stored value is less
+    * than the default, this holds unless a stored assignment is also the
+    * best assignment for the default value; in that case, the affected
+    * message values are found by scanning the relevant slice of the domain.
+    */
+   class SparseFactor : public StructuredFactor
+   {
+   public:
+
+      /**
+       * Type of container used to map linear indices to stored values.
+       */
+      typedef std::map<ValIndex,ValType> EntryMap;
+
+   private:
+
+      /**
+       * Value of this factor at every assignment not in entries_i.
+       */
+      ValType default_i;
+
+      /**
+       * Stored values, indexed in the same order as
+       * maxsum::DiscreteFunction::operator()(ValIndex).
+       */
+      EntryMap entries_i;
+
+      /**
+       * Number of joint assignments in this factor's domain.
+       */
+      ValIndex domainSize_i;
+
+   public:
+
+      /**
+       * Constructs a sparse factor over the specified variables.
+       * @param[in] begin Iterator to start of variable list.
+       * @param[in] end  Iterator to end of variable list.
+       * @param[in] defaultValue value of the factor at every assignment that
+       * is not set explicitly.
+       * @throws UnknownVariableException if any variable is not registered.
+       */
+      template<class VarIt> SparseFactor
+      (
+       VarIt begin,
+       VarIt end,
+       ValType defaultValue
+      )
+      : StructuredFactor(begin,end), default_i(defaultValue), entries_i(),
+        domainSize_i(1)
+      {
+         for(std::size_t k=0; k<size_i.size(); ++k)
+         {
+            domainSize_i *= size_i[k];
+         }
+      }
+
+      /**
+       * Returns the value of this factor at every assignment that is not set
+       * explicitly.
+       */
+      ValType defaultValue() const
+      {
+         return default_i;
+      }
+
+      /**
+       * Returns the number of joint assignments in this factor's domain.
+       */
+      ValIndex domainSize() const
+      {
+         return domainSize_i;
+      }
+
+      /**
+       * Returns the number of values that are set explicitly.
+       */
+      int noEntries() const
+      {
+         return entries_i.size();
+      }
+
+      /**
+       * Returns the values that are set explicitly.
+       */
+      const EntryMap& entries() const
+      {
+         return entries_i;
+      }
+
+      /**
+       * Sets the value of this factor at one joint assignment.
+       * @param[in] ind linear index of the assignment, in the same order as
+       * maxsum::DiscreteFunction::operator()(ValIndex).
+       * @param[in] val the new value.
+       * @throws OutOfRangeException if <code>ind</code> is not in the domain.
+       */
+      void set(ValIndex ind, ValType val);
+
+      /**
+       * Sets the value of this factor at one joint assignment.
+       * @param[in] subInd the value of each variable, in domain order.
+       * @param[in] val the new value.
+       * @throws OutOfRangeException if <code>subInd</code> is not in the
+       * domain.
+       */
+      void set(const std::vector<ValIndex>& subInd, ValType val);
+
+      /**
+       * Returns the value of this factor at one joint assignment.
+       * @param[in] ind linear index of the assignment.
+       */
+      ValType operator()(ValIndex ind) const
+      {
+         EntryMap::const_iterator pos = entries_i.find(ind);
+         return entries_i.end()==pos ? default_i : pos->second;
+      }
+
+      /**
+       * Returns a new copy of this factor, which is owned by the caller.
+       */
+      virtual StructuredFactor* clone() const
+      {
+         return new SparseFactor(*this);
+      }
+
+      /**
+       * Computes the output messages of this factor.
+       * @see StructuredFactor::maxMarginals()
+       */
+      virtual void maxMarginals
+      (
+       const std::vector<const ValType*>& in,
+       const std::vector<ValType*>& out
+      ) const;
+
+      /**
+       * Expands this factor into a dense table.
+       * @see StructuredFactor::expand()
+       */
+      virtual void expand(DiscreteFunction& out) const;
+
+   }; // class SparseFactor
+
+} // namespace maxsum
+
+#endif // MAXSUM_STRUCTUREDFACTOR_H
@@ -0,0 +1,191 @@
+/**
+ * @file ThreadPool.h
+ * Defines the maxsum::util::ThreadPool class, which runs data parallel
+ * tasks over a fixed set of worker threads.
+ */
+#ifndef MAXSUM_UTIL_THREADPOOL_H
+#define MAXSUM_UTIL_THREADPOOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace maxsum
+{
+namespace util
+{
+   /**
+    * Simple pool of worker threads used to run a task over a range of
+    * items in parallel. Each call to ThreadPool::run splits the range into
+    * one contiguous block per thread, such that the same item is always
+    * processed by the same thread for a given range size and thread count.
+    * The calling thread processes the first block itself, and does not
+    * return until every block has been processed, so each call acts as
+    * a barrier.
+    *
+    * Copies of a ThreadPool start their own worker threads, so that a
+    * ThreadPool can be stored by value in a copyable class.
+    *
+    * @attention This class is used as part of the implementation of
+    * maxsum::MaxSumController, and so does not need to be referenced directly
+    * by calling libraries.
+    */
+   class ThreadPool
+   {
+   public:
+
+      /**
+       * Interface for tasks that can be run by a ThreadPool.
+       */
+      class Task
+      {
+      public:
+
+         /**
+          * Process all items in the range [begin,end).
+          * @param[in] begin the first item to process.
+          * @param[in] end one past the last item to process.
+          * @param[in] thread index of the calling thread, in the range
+          * [0,ThreadPool::noThreads()).
+          */
+         virtual void run(int begin, int end, int thread)=0;
+
+         /**
+          * Virtual destructor.
+          */
+         virtual ~Task() {}
+
+      }; // class Task
+
+   private:
+
+      /**
+       * Total number of threads, including the calling thread.
+       */
+      int noThreads_i;
+
+      /**
+       * Worker threads, excluding the calling thread.
+       */
+      std::vector<std::thread> workers_i;
+
+      /**
+       * Mutex protecting all of the following members.
+       */
+      std::mutex mutex_i;
+
+      /**
+       * Used to signal workers that a new task is available.
+       */
+      std::condition_variable start_i;
+
+      /**
+       * Used to signal the calling thread that all workers are finished.
+       */
+      std::condition_variable done_i;
+
+      /**
+       * Incremented each time a new task is started.
+       */
+      unsigned long generation_i;
+
+      /**
+       * Number of workers that have not yet finished the current task.
+       */
+      int pending_i;
+
+      /**
+       * True if the workers should exit.
+       */
+      bool stop_i;
+
+      /**
+       * The current task.
+       */
+      Task* task_i;
+
+      /**
+       * Number of items in the current task.
+       */
+      int noItems_i;
+
+      /**
+       * Main loop for each worker thread.
+       * @param[in] thread index of the worker thread.
+       * @param[in] seen the generation of the last task started before this
+       * thread was created.
+       */
+      void workerLoop(int thread, unsigned long seen);
+
+      /**
+       * Starts the worker threads.
+       */
+      void startWorkers();
+
+      /**
+       * Stops and joins all worker threads.
+       */
+      void stopWorkers();
+
+   public:
+
+      /**
+       * Constructs a new pool with the specified number of threads.
+       * @param[in] noThreads total number of threads, including the calling
+       * thread. If less than 1, a single thread is used.
+       */
+      explicit ThreadPool(int noThreads=1);
+
+      /**
+       * Copy constructor starts a new pool of the same size.
+       */
+      ThreadPool(const ThreadPool& rhs);
+
+      /**
+       * Copy assignment restarts this pool with the same size as another.
+       */
+      ThreadPool& operator=(const ThreadPool& rhs);
+
+      /**
+       * Stops all worker threads.
+       */
+      ~ThreadPool();
+
+      /**
+       * Returns the total number of threads used by this pool, including
+       * the calling thread.
+       */
+      int noThreads() const { return noThreads_i; }
+
+      /**
+       * Changes the number of threads used by this pool.
+       * @param[in] noThreads total number of threads, including the calling
+       * thread. If less than 1, a single thread is used.
+       */
+      void setNoThreads(int noThreads);
+
+      /**
+       * Returns the first item in the block processed by a given thread.
+       * @param[in] noItems the total number of items.
+       * @param[in] thread the index of the thread.
+       */
+      int blockBegin(int noItems, int thread) const
+      {
+         return static_cast<int>
+            ((static_cast<long long>(noItems)*thread) / noThreads_i);
+      }
+
+      /**
+       * Runs a task over the items [0,noItems), and waits for it to finish.
+       * @param[in] noItems the number of items to process.
+       * @param[in] task the task to run.
+       */
+      void run(int noItems, Task& task);
+
+   }; // class ThreadPool
+
+} // namespace util
+} // namespace maxsum
+
+#endif // MAXSUM_UTIL_THREADPOOL_H
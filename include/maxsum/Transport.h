@@ -0,0 +1,177 @@
+/**
+ * @file Transport.h
+ * Defines the maxsum::Transport interface, used by maxsum::MaxSumShard to
+ * exchange messages between the shards of a partitioned factor graph, and
+ * maxsum::LocalTransport, which implements it for shards in one process.
+ */
+#ifndef MAXSUM_TRANSPORT_H
+#define MAXSUM_TRANSPORT_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace maxsum
+{
+   /**
+    * Interface for sending batches of serialised messages between the shards
+    * of a partitioned factor graph. Each shard uses its own Transport, which
+    * knows the identity of the shard it belongs to, so that shards can run
+    * in separate processes. For example, an MPI implementation would map
+    * shard numbers to ranks, and implement Transport::send and
+    * Transport::receive with MPI_Send and MPI_Recv.
+    *
+    * Batches from one shard to another must be received in the order they
+    * were sent.
+    * @see maxsum::MaxSumShard
+    */
+   class Transport
+   {
+   public:
+
+      /**
+       * Type used to store a serialised batch of messages.
+       */
+      typedef std::vector<char> Batch;
+
+      /**
+       * Sends a batch to another shard. This should not wait for the batch
+       * to be received.
+       * @param[in] dest the shard to send to.
+       * @param[in] batch the batch to send.
+       */
+      virtual void send(int dest, const Batch& batch)=0;
+
+      /**
+       * Receives the next batch sent by another shard, waiting until one is
+       * available.
+       * @param[in] source the shard to receive from.
+       * @param[out] batch the received batch.
+       */
+      virtual void receive(int source, Batch& batch)=0;
+
+      /**
+       * Virtual destructor.
+       */
+      virtual ~Transport() {}
+
+   }; // class Transport
+
+   /**
+    * Transport between shards in the same process, which may run on
+    * different threads. A LocalTransport provides one endpoint for each
+    * shard, each of which implements maxsum::Transport on its behalf.
+    */
+   class LocalTransport
+   {
+   private:
+
+      /**
+       * Queue of batches sent from one shard to another.
+       */
+      struct Channel
+      {
+         std::deque<Transport::Batch> batches; ///< batches not yet received
+      };
+
+      /**
+       * Transport for a single shard.
+       */
+      class Endpoint : public Transport
+      {
+      private:
+
+         /**
+          * The transport that this endpoint belongs to.
+          */
+         LocalTransport* pOwner_i;
+
+         /**
+          * The shard that this endpoint sends for.
+          */
+         int shard_i;
+
+      public:
+
+         /**
+          * Constructs an endpoint for a specified shard.
+          */
+         Endpoint(LocalTransport* pOwner, int shard)
+            : pOwner_i(pOwner), shard_i(shard) {}
+
+         /**
+          * Sends a batch to another shard.
+          */
+         virtual void send(int dest, const Batch& batch);
+
+         /**
+          * Receives the next batch from another shard.
+          */
+         virtual void receive(int source, Batch& batch);
+
+      }; // class Endpoint
+
+      /**
+       * Number of shards.
+       */
+      int noShards_i;
+
+      /**
+       * Channel from each shard to each other, indexed by
+       * <code>source*noShards_i+dest</code>.
+       */
+      std::vector<Channel> channels_i;
+
+      /**
+       * Endpoint for each shard.
+       */
+      std::vector<Endpoint> endpoints_i;
+
+      /**
+       * Mutex protecting all channels.
+       */
+      std::mutex mutex_i;
+
+      /**
+       * Used to signal that a batch has been sent.
+       */
+      std::condition_variable sent_i;
+
+      /**
+       * Copying is not allowed, because endpoints refer to their owner.
+       */
+      LocalTransport(const LocalTransport&);
+
+      /**
+       * Copying is not allowed, because endpoints refer to their owner.
+       */
+      LocalTransport& operator=(const LocalTransport&);
+
+   public:
+
+      /**
+       * Constructs a transport between a specified number of shards.
+       * @param[in] noShards the number of shards.
+       */
+      explicit LocalTransport(int noShards);
+
+      /**
+       * Returns the number of shards connected by this transport.
+       */
+      int noShards() const { return noShards_i; }
+
+      /**
+       * Returns the endpoint used by a specified shard.
+       * @param[in] shard the shard, in the range [0,noShards()).
+       */
+      Transport& endpoint(int shard)
+      {
+         return endpoints_i[shard];
+      }
+
+   }; // class LocalTransport
+
+} // namespace maxsum
+
+#endif // MAXSUM_TRANSPORT_H
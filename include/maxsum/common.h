@@ -14,6 +14,7 @@
 #include <string>
 #include <vector>
 #include "exceptions.h"
+#include "maxsum/config.h"
 
 /**
  * Namespace for all public types and functions defined by the Max-Sum library.
@@ -24,19 +25,31 @@ namespace maxsum
     * Type of values stored by maxsum::DiscreteFunction objects.
     * This is, this type is used to represent the codomain of
     * mathematical functions represented by maxsum::DiscreteFunction objects.
+    * By default this is double, but single precision can be selected at
+    * build time by configuring with <code>cmake -DMAXSUM_VALTYPE=float</code>,
+    * which defines MAXSUM_FLOAT_VALUES in the generated maxsum/config.h.
+    * This halves the memory used by every factor and message, which can
+    * speed up large problems that are limited by memory bandwidth.
     * @see maxsum::DiscreteFunction
     */
+#ifdef MAXSUM_FLOAT_VALUES
+   typedef float ValType;
+#else
    typedef double ValType;
+#endif
 
    /**
     * Default tolerance used for comparing values of type maxsum::ValType.
     * This is the default value used by the maxsum::equalWithinTolerance
     * function, when comparing to maxsum::DiscreteFunction objects for equality.
-    * Note, if ValType is ever redefined, then this value should be changed
-    * appropriately also.
+    * Its value depends on the precision of maxsum::ValType.
     * @see maxsum::equalWithinTolerance
     */
+#ifdef MAXSUM_FLOAT_VALUES
+   const ValType DEFAULT_VALUE_TOLERANCE = FLT_EPSILON * 1000.0f;
+#else
    const ValType DEFAULT_VALUE_TOLERANCE = DBL_EPSILON * 1000.0;
+#endif
 
    /**
     * Type used for uniquely identifying variables.
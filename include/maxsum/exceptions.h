@@ -416,6 +416,59 @@ namespace maxsum
 
    }; // InconsistentDomainException
 
+   /**
+    * Exception thrown when a factor graph file cannot be read or written,
+    * or is not in the expected format.
+    */
+   class FileFormatException : public std::exception
+   {
+   protected:
+
+      /**
+       * String identifying the source code location where this exception
+       * was generated.
+       */
+      const std::string where;
+
+      /**
+       * Message describing the cause of this exception.
+       */
+      const std::string mesg;
+
+   public:
+
+      /**
+       * Creates a new exception of this type.
+       * @param[in] where_ the position in the source code where this was
+       * generated.
+       * @param[in] mesg_ message describing the cause of this exception.
+       */
+      FileFormatException
+      (
+       const std::string where_,
+       const std::string mesg_
+      )
+      throw(): where(where_), mesg(mesg_) {}
+
+      /**
+       * Returns a message describing the cause of this exception, and
+       * the location it was thrown.
+       * @returns a message describing the cause of this exception, and
+       * the location it was thrown.
+       */
+      const char* what() const throw()
+      {
+         return std::string("FileFormatException: " + mesg +
+               "\t[ in "+where +" ]").c_str();
+      }
+
+      /**
+       * Destroys this exception and free's its allocated resources.
+       */
+      virtual ~FileFormatException() throw() {}
+
+   }; // FileFormatException
+
 } // namespace maxsum
 
 #endif // MAXSUM_EXCEPTIONS_H
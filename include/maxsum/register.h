@@ -10,6 +10,11 @@
  * Variables can be registered multiple times, but in each case the domain size
  * must not change. Variables must always be registered before they are
  * referenced by any function.
+ *
+ * All functions in this file are thread safe, so factors may be constructed
+ * on several threads at once. Looking up a variable never takes a lock, and
+ * is a simple array access for ids below 2^24, so densely numbered variables
+ * are the fastest to look up.
  * 
  */
 #ifndef MAX_SUM_REGISTER_H
@@ -11,6 +11,8 @@
 
 #include <cassert>
 #include <map>
+#include <new>
+#include <vector>
 
 #include <boost/version.hpp>
 #if BOOST_VERSION >= 104800
@@ -462,6 +464,168 @@ namespace util
 
    }; // class RefMap
 
+   /**
+    * Pool allocator for messages, or any other copy constructible type.
+    * Objects are constructed in-place within large slabs of raw memory,
+    * and destroyed objects are kept on a free list for reuse, so that
+    * creating many objects only requires a few large allocations. Slabs
+    * grow geometrically, and are only released when the pool is
+    * destroyed.
+    * @tparam T the type of object stored in this pool.
+    */
+   template<class T> class MessagePool
+   {
+   private:
+
+      /**
+       * Minimum number of objects allocated in each slab.
+       */
+      static const int MIN_SLAB_SIZE = 64;
+
+      /**
+       * Raw memory for each allocated slab.
+       */
+      std::vector<void*> slabs_i;
+
+      /**
+       * Free slots available for new objects. This always has enough
+       * capacity for every slot in every slab, so that destroying an object
+       * never needs to allocate.
+       */
+      std::vector<T*> free_i;
+
+      /**
+       * Total number of slots in all slabs.
+       */
+      int capacity_i;
+
+      /**
+       * Number of currently constructed objects.
+       */
+      int size_i;
+
+      /**
+       * Allocates a new slab and adds its slots to the free list.
+       * @param[in] n the number of slots in the new slab.
+       */
+      void addSlab(int n)
+      {
+         T* slab = static_cast<T*>(::operator new(n*sizeof(T)));
+         slabs_i.push_back(slab);
+         free_i.reserve(capacity_i+n);
+         for(int k=n-1; k>=0; --k)
+         {
+            free_i.push_back(slab+k);
+         }
+         capacity_i += n;
+      }
+
+      /**
+       * Pools are not copyable, because their owners must update all
+       * references to stored objects anyway.
+       */
+      MessagePool(const MessagePool&);
+
+      /**
+       * Pools are not assignable.
+       */
+      MessagePool& operator=(const MessagePool&);
+
+   public:
+
+      /**
+       * Constructs an empty pool, without allocating any memory.
+       */
+      MessagePool() : slabs_i(), free_i(), capacity_i(0), size_i(0) {}
+
+      /**
+       * Frees all slabs allocated by this pool.
+       * @pre every object created by this pool must already have been
+       * destroyed using MessagePool::destroy.
+       */
+      ~MessagePool()
+      {
+         assert(0==size_i);
+         for(std::vector<void*>::iterator it=slabs_i.begin();
+               it!=slabs_i.end(); ++it)
+         {
+            ::operator delete(*it);
+         }
+      }
+
+      /**
+       * Creates a new object in this pool.
+       * @param[in] val the value to copy into the new object.
+       * @returns a pointer to the new object, which remains valid until
+       * it is passed to MessagePool::destroy.
+       */
+      T* create(const T& val)
+      {
+         if(free_i.empty())
+         {
+            addSlab(capacity_i < MIN_SLAB_SIZE ? MIN_SLAB_SIZE : capacity_i);
+         }
+         T* pObj = new(free_i.back()) T(val);
+         free_i.pop_back();
+         ++size_i;
+         return pObj;
+      }
+
+      /**
+       * Destroys an object and returns its memory to this pool.
+       * @param[in] pObj an object previously returned by MessagePool::create.
+       */
+      void destroy(T* pObj)
+      {
+         pObj->~T();
+         free_i.push_back(pObj);
+         --size_i;
+      }
+
+      /**
+       * Ensures that at least <code>n</code> more objects can be created
+       * without allocating a new slab.
+       */
+      void reserve(int n)
+      {
+         const int available = free_i.size();
+         if(available < n)
+         {
+            const int extra = n - available;
+            addSlab(extra < MIN_SLAB_SIZE ? MIN_SLAB_SIZE : extra);
+         }
+      }
+
+      /**
+       * Swaps the contents of this pool with another. Objects created
+       * by either pool must afterwards be destroyed by the other.
+       */
+      void swap(MessagePool& rhs)
+      {
+         slabs_i.swap(rhs.slabs_i);
+         free_i.swap(rhs.free_i);
+         std::swap(capacity_i,rhs.capacity_i);
+         std::swap(size_i,rhs.size_i);
+      }
+
+      /**
+       * Returns the number of objects currently stored in this pool.
+       */
+      int size() const { return size_i; }
+
+      /**
+       * Returns the number of objects that can be stored in this pool
+       * without allocating more memory.
+       */
+      int capacity() const { return capacity_i; }
+
+      /**
+       * Returns the number of slabs allocated by this pool.
+       */
+      int noSlabs() const { return slabs_i.size(); }
+
+   }; // class MessagePool
+
 } // namespace util
 } // namespace maxsum
 
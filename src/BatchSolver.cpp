@@ -0,0 +1,534 @@
+/**
+ * @file BatchSolver.cpp
+ * Implements the maxsum::BatchSolver class and maxsum::solveBatch function.
+ * @see BatchSolver.h
+ */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <maxsum/BatchSolver.h>
+
+using namespace maxsum;
+
+/**
+ * Constructs a batch of instances with a shared structure.
+ * @param[in] structure factors defining the structure. Every instance
+ * starts with a copy of these factors' values.
+ * @param[in] noInstances the number of instances in the batch.
+ * @param[in] maxIterations The maximum number of iterations for the
+ * max-sum algorithm.
+ * @param[in] maxnorm The maximum maxnorm allowed between the old and new
+ * values of a message, before it is assumed to have converged.
+ * @throws maxsum::OutOfRangeException if <code>noInstances</code> is less
+ * than 1.
+ */
+BatchSolver::BatchSolver
+(
+ const FactorMap& structure,
+ int noInstances,
+ int maxIterations,
+ ValType maxnorm
+)
+: structure_i(structure), graph_i(), noInstances_i(noInstances),
+  maxIterations_i(maxIterations), maxNormThreshold_i(maxnorm), tables_i(),
+  fac2var_i(), var2fac_i(), values_i(), totalScratch_i(), msgScratch_i(),
+  instScratch_i()
+{
+   if(1>noInstances)
+   {
+      throw OutOfRangeException("BatchSolver",
+            "A batch must have at least one instance.");
+   }
+
+   //***************************************************************************
+   // Compile the shared structure, and allocate space for every instance.
+   //***************************************************************************
+   graph_i.build(structure_i);
+   const int I = noInstances_i;
+   tables_i.resize(graph_i.tablesSize()*I);
+   fac2var_i.assign(graph_i.msgSize()*I,0);
+   var2fac_i.assign(graph_i.msgSize()*I,0);
+   values_i.assign(graph_i.noVars()*I,0);
+   totalScratch_i.resize(graph_i.maxTableSize()*I);
+   msgScratch_i.resize(graph_i.maxVarSize()*I);
+   instScratch_i.resize(I);
+
+   //***************************************************************************
+   // Every instance starts with the structure's own factor values.
+   //***************************************************************************
+   for(int i=0; i<I; ++i)
+   {
+      setFactors(i,structure_i);
+   }
+
+} // constructor
+
+/**
+ * Returns the index of a variable in the compiled graph.
+ * @throws maxsum::NoSuchElementException if the variable is not in the
+ * shared structure.
+ */
+int BatchSolver::varIndex(VarID var) const
+{
+   const int v = graph_i.varIndex(var);
+   if(0>v)
+   {
+      throw NoSuchElementException("BatchSolver::varIndex",
+            "No such variable in factor graph.");
+   }
+   return v;
+
+} // function varIndex
+
+/**
+ * Throws an exception if an instance index is out of range.
+ * @throws maxsum::OutOfRangeException if <code>instance</code> is not in
+ * [0,::noInstances()).
+ */
+void BatchSolver::checkInstance(int instance) const
+{
+   if( (0>instance) || (noInstances_i<=instance) )
+   {
+      throw OutOfRangeException("BatchSolver","No such instance in batch.");
+   }
+
+} // function checkInstance
+
+/**
+ * Returns true if and only if two factor graphs have exactly the same
+ * factors and factor domains, and so can be solved in one batch.
+ */
+bool BatchSolver::sameStructure(const FactorMap& g1, const FactorMap& g2)
+{
+   if(g1.size()!=g2.size())
+   {
+      return false;
+   }
+
+   FactorMap::const_iterator it2 = g2.begin();
+   for(FactorMap::const_iterator it1=g1.begin(); it1!=g1.end();
+         ++it1, ++it2)
+   {
+      if( (it1->first!=it2->first) || !sameDomain(it1->second,it2->second) )
+      {
+         return false;
+      }
+   }
+   return true;
+
+} // function sameStructure
+
+/**
+ * Sets the values of one factor in one instance.
+ * @param[in] instance the index of the instance.
+ * @param[in] id the factor to set.
+ * @param[in] factor the new value of the factor.
+ * @throws maxsum::OutOfRangeException if the instance is out of range.
+ * @throws maxsum::NoSuchElementException if the factor is not in the
+ * shared structure.
+ * @throws maxsum::BadDomainException if the factor's domain differs from
+ * that in the shared structure.
+ */
+void BatchSolver::setFactor
+(
+ int instance,
+ FactorID id,
+ const DiscreteFunction& factor
+)
+{
+   checkInstance(instance);
+   const int f = graph_i.factorIndex(id);
+   if(0>f)
+   {
+      throw NoSuchElementException("BatchSolver::setFactor",
+            "No such factor in factor graph.");
+   }
+
+   if(!sameDomain(factor,structure_i.find(id)->second))
+   {
+      throw BadDomainException("BatchSolver::setFactor",
+            "Factor domain does not match batch structure.");
+   }
+
+   //***************************************************************************
+   // Scatter the factor's values into this instance's slots.
+   //***************************************************************************
+   const int I = noInstances_i;
+   ValType* pTable = &tables_i[graph_i.tableOffset(f)*I + instance];
+   const ValType* pIn = &factor(0);
+   for(ValIndex k=0; k<graph_i.tableSize(f); ++k)
+   {
+      pTable[k*I] = pIn[k];
+   }
+
+} // function setFactor
+
+/**
+ * Sets the values of every factor in one instance.
+ * @param[in] instance the index of the instance.
+ * @param[in] graph the factors of the instance.
+ * @throws maxsum::BadDomainException if the graph does not have the
+ * shared structure of this batch.
+ */
+void BatchSolver::setFactors(int instance, const FactorMap& graph)
+{
+   if(!sameStructure(graph))
+   {
+      throw BadDomainException("BatchSolver::setFactors",
+            "Factor graph does not match batch structure.");
+   }
+
+   for(FactorMap::const_iterator it=graph.begin(); it!=graph.end(); ++it)
+   {
+      setFactor(instance,it->first,it->second);
+   }
+
+} // function setFactors
+
+/**
+ * Sets every message of every instance back to zero.
+ */
+void BatchSolver::resetMessages()
+{
+   std::fill(fac2var_i.begin(),fac2var_i.end(),ValType(0));
+   std::fill(var2fac_i.begin(),var2fac_i.end(),ValType(0));
+   std::fill(values_i.begin(),values_i.end(),0);
+
+} // function resetMessages
+
+/**
+ * Counts the instances for which a message has changed by more than the
+ * maxnorm threshold, and sets the message to its new value.
+ * @param[in] newMsg the new message for every instance.
+ * @param[in,out] msg the message to update for every instance.
+ * @param[in] size the number of values in the message.
+ * @returns the number of instances for which the message changed.
+ */
+int BatchSolver::storeMsg(const ValType* newMsg, ValType* msg, ValIndex size)
+{
+   const int I = noInstances_i;
+   ValType* diff = instScratch_i.data();
+   std::fill(diff,diff+I,ValType(0));
+   for(ValIndex x=0; x<size; ++x)
+   {
+      const ValType* pNew = newMsg + x*I;
+      ValType* pMsg = msg + x*I;
+      for(int i=0; i<I; ++i)
+      {
+         diff[i] = std::max(diff[i],ValType(std::fabs(pNew[i]-pMsg[i])));
+         pMsg[i] = pNew[i];
+      }
+   }
+
+   int count = 0;
+   for(int i=0; i<I; ++i)
+   {
+      if(diff[i] > maxNormThreshold_i)
+      {
+         ++count;
+      }
+   }
+   return count;
+
+} // function storeMsg
+
+/**
+ * Updates the factor to variable messages of every instance.
+ * For each factor, this is the same calculation as
+ * maxsum::util::FlatFactorGraph performs, but with an extra inner loop over
+ * instances.
+ * @returns the number of significantly changed messages.
+ */
+int BatchSolver::updateFac2VarMsgs()
+{
+   const int I = noInstances_i;
+   ValType* total = totalScratch_i.data();
+   ValType* newMsg = msgScratch_i.data();
+   int updateCount = 0;
+
+   for(int f=0; f<graph_i.noFactors(); ++f)
+   {
+      //************************************************************************
+      // Calculate the sum of the factor and all its input messages. Each
+      // message value applies to a run of stride consecutive elements,
+      // which repeats every stride*size elements.
+      //************************************************************************
+      const ValIndex N = graph_i.tableSize(f);
+      const ValType* table = &tables_i[graph_i.tableOffset(f)*I];
+      std::copy(table,table+N*I,total);
+
+      for(int e=graph_i.edgeBegin(f); e<graph_i.edgeEnd(f); ++e)
+      {
+         const ValType* inMsg = &var2fac_i[graph_i.msgOffset(e)*I];
+         const ValIndex stride = graph_i.edgeStride(e);
+         const ValIndex size = graph_i.edgeSize(e);
+         for(ValIndex base=0; base<N; base+=stride*size)
+         {
+            for(ValIndex x=0; x<size; ++x)
+            {
+               const ValType* pIn = inMsg + x*I;
+               ValType* pTotal = total + (base+x*stride)*I;
+               for(ValIndex t=0; t<stride*I; ++t)
+               {
+                  pTotal[t] += pIn[t%I];
+               }
+            }
+         }
+      }
+
+      //************************************************************************
+      // For each neighbour, max marginalise the total onto its variable, and
+      // subtract the neighbour's own input message.
+      //************************************************************************
+      for(int e=graph_i.edgeBegin(f); e<graph_i.edgeEnd(f); ++e)
+      {
+         const ValIndex stride = graph_i.edgeStride(e);
+         const ValIndex size = graph_i.edgeSize(e);
+         std::fill(newMsg,newMsg+size*I,-std::numeric_limits<ValType>::max());
+         for(ValIndex base=0; base<N; base+=stride*size)
+         {
+            for(ValIndex x=0; x<size; ++x)
+            {
+               ValType* pOut = newMsg + x*I;
+               const ValType* pTotal = total + (base+x*stride)*I;
+               for(ValIndex t=0; t<stride; ++t, pTotal+=I)
+               {
+                  for(int i=0; i<I; ++i)
+                  {
+                     pOut[i] = std::max(pOut[i],pTotal[i]);
+                  }
+               }
+            }
+         }
+
+         const ValType* inMsg = &var2fac_i[graph_i.msgOffset(e)*I];
+         for(ValIndex j=0; j<size*I; ++j)
+         {
+            newMsg[j] -= inMsg[j];
+         }
+         updateCount +=
+            storeMsg(newMsg,&fac2var_i[graph_i.msgOffset(e)*I],size);
+
+      } // for loop
+
+   } // for loop
+
+   return updateCount;
+
+} // function updateFac2VarMsgs
+
+/**
+ * Updates the variable to factor messages and values of every instance.
+ * @returns the number of significantly changed messages, plus the number
+ * of changed values.
+ * @post Each message is normalised so that the sum of its values is 0.
+ */
+int BatchSolver::updateVar2FacMsgs()
+{
+   const int I = noInstances_i;
+   ValType* sum = totalScratch_i.data();
+   ValType* newMsg = msgScratch_i.data();
+   ValType* mean = instScratch_i.data();
+   int updateCount = 0;
+
+   for(int v=0; v<graph_i.noVars(); ++v)
+   {
+      //************************************************************************
+      // Calculate the total sum of all input messages
+      //************************************************************************
+      const ValIndex size = graph_i.varSize(v);
+      std::fill(sum,sum+size*I,ValType(0));
+      for(int k=graph_i.varEdgeBegin(v); k<graph_i.varEdgeEnd(v); ++k)
+      {
+         const ValType* inMsg = &fac2var_i[graph_i.msgOffset(graph_i.varEdge(k))*I];
+         for(ValIndex j=0; j<size*I; ++j)
+         {
+            sum[j] += inMsg[j];
+         }
+      }
+
+      //************************************************************************
+      // Update the normalised output message for each connected neighbour
+      // by subtracting the neighbour's own message from the sum.
+      //************************************************************************
+      for(int k=graph_i.varEdgeBegin(v); k<graph_i.varEdgeEnd(v); ++k)
+      {
+         const int offset = graph_i.msgOffset(graph_i.varEdge(k))*I;
+         const ValType* inMsg = &fac2var_i[offset];
+
+         std::fill(mean,mean+I,ValType(0));
+         for(ValIndex j=0; j<size*I; ++j)
+         {
+            mean[j%I] += (sum[j] - inMsg[j]) / size;
+         }
+         for(ValIndex j=0; j<size*I; ++j)
+         {
+            newMsg[j] = sum[j] - inMsg[j] - mean[j%I];
+         }
+         updateCount += storeMsg(newMsg,&var2fac_i[offset],size);
+      }
+
+      //************************************************************************
+      // If the optimal value for this variable has changed in any instance,
+      // update its value.
+      //************************************************************************
+      ValIndex* values = &values_i[v*I];
+      for(int i=0; i<I; ++i)
+      {
+         ValIndex bestValue = 0;
+         for(ValIndex x=1; x<size; ++x)
+         {
+            if(sum[x*I+i] > sum[bestValue*I+i])
+            {
+               bestValue = x;
+            }
+         }
+
+         if(bestValue != values[i])
+         {
+            values[i] = bestValue;
+            ++updateCount;
+         }
+      }
+
+   } // for loop
+
+   return updateCount;
+
+} // function updateVar2FacMsgs
+
+/**
+ * Runs the max-sum algorithm on every instance, until all have converged,
+ * or the maximum number of iterations is reached.
+ * @returns the number of iterations performed.
+ */
+int BatchSolver::optimise()
+{
+   //***************************************************************************
+   // A graph with no factors has no messages to pass.
+   //***************************************************************************
+   if(0==noFactors())
+   {
+      return 0;
+   }
+
+   int iterationCount = 0;
+   while(iterationCount<maxIterations_i)
+   {
+      ++iterationCount;
+
+      //************************************************************************
+      // Update all messages. If nothing has changed significantly in any
+      // instance, then we've converged, so we can stop.
+      //************************************************************************
+      int numOfUpdates = updateFac2VarMsgs();
+      numOfUpdates += updateVar2FacMsgs();
+
+      if(0==numOfUpdates)
+      {
+         break;
+      }
+
+   } // while loop
+
+   return iterationCount;
+
+} // function optimise
+
+/**
+ * Returns the value assigned to a variable in one instance.
+ * @param[in] instance the index of the instance.
+ * @param[in] var the variable.
+ * @throws maxsum::OutOfRangeException if the instance is out of range.
+ * @throws maxsum::NoSuchElementException if the variable is not in the
+ * shared structure.
+ */
+ValIndex BatchSolver::getValue(int instance, VarID var) const
+{
+   checkInstance(instance);
+   return values_i[varIndex(var)*noInstances_i + instance];
+
+} // function getValue
+
+/**
+ * Populates a map with the value of every variable in one instance.
+ * @param[in] instance the index of the instance.
+ * @param[out] values map in which to store the values.
+ * @throws maxsum::OutOfRangeException if the instance is out of range.
+ */
+void BatchSolver::getValues(int instance, ValueMap& values) const
+{
+   checkInstance(instance);
+   values.clear();
+   for(int v=0; v<graph_i.noVars(); ++v)
+   {
+      values.insert(values.end(),std::make_pair(graph_i.varId(v),
+               values_i[v*noInstances_i + instance]));
+   }
+
+} // function getValues
+
+/**
+ * Solves a collection of independent factor graphs, which may have
+ * different structures. Graphs with the same structure are grouped, and
+ * each group is solved with a single maxsum::BatchSolver.
+ * @param[in] graphs the factor graphs to solve.
+ * @param[out] values the values found for each graph, in the same order.
+ * @param[in] maxIterations The maximum number of iterations for the
+ * max-sum algorithm.
+ * @param[in] maxnorm The maximum maxnorm allowed between the old and new
+ * values of a message, before it is assumed to have converged.
+ */
+void maxsum::solveBatch
+(
+ const std::vector<BatchSolver::FactorMap>& graphs,
+ std::vector<BatchSolver::ValueMap>& values,
+ int maxIterations,
+ ValType maxnorm
+)
+{
+   values.assign(graphs.size(),BatchSolver::ValueMap());
+
+   //***************************************************************************
+   // Group the graphs by structure, using the first graph of each group as
+   // its representative. Small problems typically come in only a few
+   // shapes, so a linear search through the groups is enough.
+   //***************************************************************************
+   std::vector<std::vector<int> > groups;
+   for(int g=0; g<static_cast<int>(graphs.size()); ++g)
+   {
+      std::size_t k = 0;
+      while( (k<groups.size()) &&
+             !BatchSolver::sameStructure(graphs[groups[k].front()],graphs[g]) )
+      {
+         ++k;
+      }
+
+      if(groups.size()==k)
+      {
+         groups.push_back(std::vector<int>());
+      }
+      groups[k].push_back(g);
+   }
+
+   //***************************************************************************
+   // Solve each group as a single batch.
+   //***************************************************************************
+   for(std::size_t k=0; k<groups.size(); ++k)
+   {
+      const std::vector<int>& group = groups[k];
+      BatchSolver batch(graphs[group.front()],group.size(),maxIterations,
+            maxnorm);
+      for(std::size_t i=1; i<group.size(); ++i)
+      {
+         batch.setFactors(i,graphs[group[i]]);
+      }
+
+      batch.optimise();
+      for(std::size_t i=0; i<group.size(); ++i)
+      {
+         batch.getValues(i,values[group[i]]);
+      }
+   }
+
+} // function solveBatch
@@ -6,6 +6,7 @@
 #include <vector>
 #include <cstdarg>
 #include <algorithm>
+#include <functional>
 #include <iostream>
 #include <maxsum/DiscreteFunction.h>
 #include <maxsum/DomainIterator.h>
@@ -61,6 +62,32 @@ void DiscreteFunction::expand(const DiscreteFunction& fun)
    this->expand(fun.varBegin(),fun.varEnd());
 }
 
+/**
+ * Replaces the domain of this function with a superset of its current
+ * domain, copying its values across the expanded domain.
+ * @param[in] newVars sorted list of variables in the new domain.
+ * @pre newVars includes every variable in the current domain.
+ */
+void DiscreteFunction::expandDomain(const std::vector<VarID>& newVars)
+{
+   //***************************************************************************
+   // Create a temporary function to hold this function's new value.
+   //***************************************************************************
+   DiscreteFunction result(newVars.begin(),newVars.end());
+
+   //***************************************************************************
+   // Copy old values to new values across the expanded domain
+   //***************************************************************************
+   DomainMap map(result,*this);
+   map.expand(values_i.data(),result.values_i.data());
+
+   //***************************************************************************
+   // Assign the new values to this one.
+   //***************************************************************************
+   result.swap(*this);
+
+} // function expandDomain
+
 /**
  * Expand the domain of this function to include a named variable.
  * @param[in] var the id of the variable to add to this function's domain.
@@ -81,7 +108,7 @@ void DiscreteFunction::expand(const VarID var)
  */
 bool DiscreteFunction::dependsOn(VarID var) const
 {
-   return varEnd()!=find(varBegin(),varEnd(),var);
+   return varEnd()!=std::find(varBegin(),varEnd(),var);
 }
 
 /**
@@ -132,7 +159,7 @@ ValType& DiscreteFunction::operator()(ValIndex ind1, ValIndex ind2, ...)
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -168,7 +195,7 @@ const ValType& DiscreteFunction::operator()
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -213,7 +240,7 @@ ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...)
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -258,7 +285,7 @@ const ValType& DiscreteFunction::at(ValIndex ind1, ValIndex ind2, ...) const
    //***************************************************************************
    va_list args;
    va_start ( args, ind2 );
-   for(int k=0; k<vars_i.size()-2; ++k)
+   for(int k=0; k<noVars()-2; ++k)
    {
       indices.push_back(va_arg(args,ValIndex));
    }
@@ -292,10 +319,16 @@ void DiscreteFunction::swap(DiscreteFunction& fun)
  */
 DiscreteFunction& DiscreteFunction::operator=(ValType val)
 {
+   //***************************************************************************
+   // Borrowed values are only written in place if the domain is unchanged.
+   //***************************************************************************
+   if(isBorrowed() && !vars_i.empty())
+   {
+      values_i.clear();
+   }
    vars_i.clear();
    size_i.clear();
-   values_i.resize(1);
-   values_i(0) = val; 
+   values_i.assign(1,val);
    return *this;
 }
 
@@ -305,12 +338,41 @@ DiscreteFunction& DiscreteFunction::operator=(ValType val)
  */
 DiscreteFunction& DiscreteFunction::operator=(const DiscreteFunction& val)
 {
+   //***************************************************************************
+   // Borrowed values are only written in place if the domain is unchanged.
+   //***************************************************************************
+   if(isBorrowed() && !sameDomain(*this,val))
+   {
+      values_i.clear();
+   }
    vars_i = val.vars_i;
    size_i = val.size_i;
    values_i = val.values_i;
    return *this;
 }
 
+/**
+ * Sets this function to be equal to another, taking ownership of its
+ * value table.
+ * @param[in,out] val the value to move into this function.
+ * @post \c val is left as the constant function 0.
+ */
+DiscreteFunction& DiscreteFunction::operator=(DiscreteFunction&& val)
+{
+   if(this!=&val)
+   {
+      if(isBorrowed() && !sameDomain(*this,val))
+      {
+         values_i.clear();
+      }
+      vars_i = std::move(val.vars_i);
+      size_i = std::move(val.size_i);
+      values_i = std::move(val.values_i);
+      val.values_i.assign(1,ValType(0));
+   }
+   return *this;
+}
+
 /**
  * Adds a function to this one, expanding the domain if necessary.
  */
@@ -321,7 +383,7 @@ DiscreteFunction& DiscreteFunction::operator+=(const DiscreteFunction& rhs)
    //***************************************************************************
    if(sameDomain(*this,rhs))
    {
-      values_i += rhs.values_i;
+      valueMap() += rhs.valueMap();
       return *this;
    }
 
@@ -334,10 +396,8 @@ DiscreteFunction& DiscreteFunction::operator+=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Add corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) += rhs(it);
-   }
+   DomainMap map(*this,rhs);
+   map.add(values_i.data(),rhs.values_i.data());
    
    return *this;
 }
@@ -352,7 +412,7 @@ DiscreteFunction& DiscreteFunction::operator-=(const DiscreteFunction& rhs)
    //***************************************************************************
    if(sameDomain(*this,rhs))
    {
-      values_i -= rhs.values_i;
+      valueMap() -= rhs.valueMap();
       return *this;
    }
 
@@ -365,10 +425,8 @@ DiscreteFunction& DiscreteFunction::operator-=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Subtract corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) -= rhs(it);
-   }
+   DomainMap map(*this,rhs);
+   map.subtract(values_i.data(),rhs.values_i.data());
    
    return *this;
 }
@@ -383,7 +441,7 @@ DiscreteFunction& DiscreteFunction::operator*=(const DiscreteFunction& rhs)
    //***************************************************************************
    if(sameDomain(*this,rhs))
    {
-      values_i *= rhs.values_i;
+      valueMap() *= rhs.valueMap();
       return *this;
    }
 
@@ -396,10 +454,8 @@ DiscreteFunction& DiscreteFunction::operator*=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Multiply corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) *= rhs(it);
-   }
+   DomainMap map(*this,rhs);
+   map.transform(values_i.data(),rhs.values_i.data(),std::multiplies<ValType>());
    
    return *this;
 }
@@ -414,7 +470,7 @@ DiscreteFunction& DiscreteFunction::operator/=(const DiscreteFunction& rhs)
    //***************************************************************************
    if(sameDomain(*this,rhs))
    {
-      values_i /= rhs.values_i;
+      valueMap() /= rhs.valueMap();
       return *this;
    }
 
@@ -427,10 +483,8 @@ DiscreteFunction& DiscreteFunction::operator/=(const DiscreteFunction& rhs)
    //***************************************************************************
    // Multiply corresponding elements of input function to this one.
    //***************************************************************************
-   for(DomainIterator it(*this); it.hasNext(); ++it)
-   {
-      this->at(it.getInd()) /= rhs(it);
-   }
+   DomainMap map(*this,rhs);
+   map.transform(values_i.data(),rhs.values_i.data(),std::divides<ValType>());
    
    return *this;
 }
@@ -446,7 +500,8 @@ void DiscreteFunction::max(const ValType s, DiscreteFunction& result)
 
 // If possible use eigen array op
 #if ((EIGEN_WORLD_VERSION == 3) && (EIGEN_MAJOR_VERSION >= 1)) || (EIGEN_WORLD_VERSION > 3)
-   result.values_i = this->values_i.max(s);
+   result.values_i = this->values_i;
+   result.valueMap() = this->valueMap().max(s);
 
 // Otherwise use basic implementation
 #else
@@ -466,7 +521,7 @@ void DiscreteFunction::max(const ValType s, DiscreteFunction& result)
  */
 ValType DiscreteFunction::max() const
 {
-   return values_i.maxCoeff();
+   return valueMap().maxCoeff();
 }
 
 /**
@@ -474,7 +529,7 @@ ValType DiscreteFunction::max() const
  */
 ValType DiscreteFunction::min() const
 {
-   return values_i.minCoeff();
+   return valueMap().minCoeff();
 }
 
 /**
@@ -483,7 +538,7 @@ ValType DiscreteFunction::min() const
 ValIndex DiscreteFunction::argmax() const
 {
    ValIndex row;
-   values_i.maxCoeff(&row);
+   valueMap().maxCoeff(&row);
    return row;
 }
 
@@ -727,8 +782,39 @@ void maxsum::maxMarginal
  DiscreteFunction& outFun
 )
 {
-   const ValType& (*pMax)(const ValType&, const ValType&) = std::max<ValType>;
-   marginal(inFun,pMax,outFun);
+   //***************************************************************************
+   // Ensure that the domain of outFun is a subset of inFun
+   //***************************************************************************
+   if(!std::includes(inFun.varBegin(),inFun.varEnd(),
+            outFun.varBegin(),outFun.varEnd()))
+   {
+      throw BadDomainException("maxMarginal(DiscreteFunction,DiscreteFunction)",
+            "Out domain is not subset of in domain.");
+   }
+
+   DomainMap map(inFun,outFun);
+   map.maxMarginal(&inFun(0),&outFun(0));
+}
+
+/**
+ * Marginalise a maxsum::DiscreteFunction by maximisation using a
+ * precomputed maxsum::DomainMap.
+ * @pre <code>map.matches(inFun,outFun)</code> is true.
+ * @post previous content of outFun is overwritten.
+ * @param[in] inFun function to marginalise
+ * @param[out] outFun maxsum::DiscreteFunction in which to store result.
+ * @param[in] map mapping from the domain of inFun to that of outFun.
+ * @see maxsum::maxMarginal()
+ */
+void maxsum::maxMarginal
+(
+ const DiscreteFunction& inFun,
+ DiscreteFunction& outFun,
+ const DomainMap& map
+)
+{
+   assert(map.matches(inFun,outFun));
+   map.maxMarginal(&inFun(0),&outFun(0));
 }
 
 /**
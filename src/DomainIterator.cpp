@@ -70,8 +70,12 @@ DomainIterator::DomainIterator(const DiscreteFunction& fun)
      ind_i(0),                               // set linear index to zero
      fixed_i(fun.noVars(),false),            // all variables are initially free
      sizes_i(fun.sizeBegin(),fun.sizeEnd()), // copy variable sizes
+     strides_i(),                            // strides are set below
+     free_i(),                               // free variables are set below
      finished_i(false)                       // iterator is not done yet
-   {}                   // nothing left to do in constructor body
+{
+   initStrides();
+}
 
 /**
  * Copy constructor.
@@ -82,6 +86,8 @@ DomainIterator::DomainIterator(const DomainIterator& it)
      ind_i(it.ind_i),
      fixed_i(it.fixed_i.begin(),it.fixed_i.end()),
      sizes_i(it.sizes_i.begin(),it.sizes_i.end()),
+     strides_i(it.strides_i.begin(),it.strides_i.end()),
+     free_i(it.free_i.begin(),it.free_i.end()),
      finished_i(it.finished_i)
    {}                   // nothing left to do in constructor body
 
@@ -95,68 +101,85 @@ DomainIterator& DomainIterator::operator=(const DomainIterator& it)
    ind_i = it.ind_i;
    fixed_i = it.fixed_i;
    sizes_i = it.sizes_i;
+   strides_i = it.strides_i;
+   free_i = it.free_i;
    finished_i = it.finished_i;
    return *this;
 
 } // operator=
 
 /**
- * Increment this iterator to the next element in the domain.
- * This is the prefix version: increment first, then return.
- * @throws maxsum::OutOfRangeException if we are already at the last element.
- * @returns iterator to next element
+ * Recalculates the strides, free variable list and linear index from
+ * the current variables, sizes, sub indices and conditions.
  */
-DomainIterator& DomainIterator::operator++()
+void DomainIterator::initStrides()
 {
-   //***************************************************************************
-   // Until proven otherwise, we assume that, by incrementing this iterator,
-   // we will run out of elements.
-   //***************************************************************************
-   finished_i = true;
-
-   //***************************************************************************
-   // Iterator through all subindices least significant first order.
-   // As in Matlab, we consider the first index to be least significant,
-   // and the last to be most significant.
-   //***************************************************************************
-   for(int k=0; k<vars_i.size(); ++k)
+   strides_i.resize(sizes_i.size());
+   free_i.clear();
+   ind_i = 0;
+   ValIndex stride = 1;
+   for(int k=0; k<sizes_i.size(); ++k)
    {
-      //************************************************************************
-      // Ignore conditioned variables
-      //************************************************************************
-      if(fixed_i[k])
+      strides_i[k] = stride;
+      ind_i += subInd_i[k]*stride;
+      stride *= sizes_i[k];
+      if(!fixed_i[k])
       {
-         continue;
+         free_i.push_back(k);
       }
+   }
 
-      //************************************************************************
-      // Increment current variable to its next value.
-      //************************************************************************
-      subInd_i[k] = (subInd_i[k]+1) % sizes_i[k];
+} // function initStrides
 
+/**
+ * Increments the free variables, starting from free_i[first], and updates
+ * the linear index incrementally. As in Matlab, we consider the first
+ * index to be least significant, and the last to be most significant.
+ * @param[in] first position in free_i of the least significant variable
+ * to increment.
+ * @returns false if every incremented variable wrapped back to 0, in which
+ * case there are no elements left.
+ */
+bool DomainIterator::advance(int first)
+{
+   for(int f=first; f<free_i.size(); ++f)
+   {
       //************************************************************************
-      // If the new value is non-zero, then we've completed this incremenet,
-      // and we've still got values yet to visit.
+      // Increment the current variable to its next value. If it does not
+      // wrap around, then we've completed this increment.
       //************************************************************************
-      if(0 < subInd_i[k])
+      const int k = free_i[f];
+      if(++subInd_i[k] < sizes_i[k])
       {
-         finished_i = false;
-         break;
+         ind_i += strides_i[k];
+         return true;
       }
 
+      //************************************************************************
+      // Otherwise, return it to 0, and carry on to the next variable.
+      //************************************************************************
+      ind_i -= (sizes_i[k]-1)*strides_i[k];
+      subInd_i[k] = 0;
+
    } // for loop
 
-   //***************************************************************************
-   // Update linear index to be consistent with current subindices.
-   //***************************************************************************
-   ind_i = sub2ind( sizes_i.begin(),  sizes_i.end(),
-                   subInd_i.begin(), subInd_i.end() );
+   return false;
 
+} // function advance
+
+/**
+ * Increment this iterator to the next element in the domain.
+ * This is the prefix version: increment first, then return.
+ * @throws maxsum::OutOfRangeException if we are already at the last element.
+ * @returns iterator to next element
+ */
+DomainIterator& DomainIterator::operator++()
+{
    //***************************************************************************
-   // Return reference to this iterator
+   // If incrementing wraps every free variable back to 0, then we have run
+   // out of elements.
    //***************************************************************************
+   finished_i = !advance(0);
    return *this;
 
 } // prefix ++
-
-
@@ -0,0 +1,379 @@
+/**
+ * @file DomainMap.cpp
+ * This file implements the maxsum::DomainMap class.
+ * @see DomainMap.h
+ */
+#include <functional>
+#include <maxsum/EigenWithPlugin.h>
+#include <maxsum/DomainMap.h>
+#include <maxsum/DiscreteFunction.h>
+
+using namespace maxsum;
+
+namespace
+{
+   /**
+    * Binary functor returning the maximum of its two arguments.
+    */
+   struct Max_m
+   {
+      ValType operator()(ValType x, ValType y) const
+      {
+         return x<y ? y : x;
+      }
+   };
+
+   /**
+    * Read only view of a value table as an Eigen array.
+    */
+   typedef Eigen::Map<const Eigen::Array<ValType,Eigen::Dynamic,Eigen::Dynamic>
+      > ConstTable_m;
+
+   /**
+    * Writable view of a value table as an Eigen column.
+    */
+   typedef Eigen::Map<Eigen::Array<ValType,Eigen::Dynamic,1> > Column_m;
+
+} // module namespace
+
+/**
+ * Max marginalises a 3-D table onto its middle axis.
+ * @param[in] in the table to marginalise, of size n0*n1*n2.
+ * @param[in] n0 the size of the first axis.
+ * @param[in] n1 the size of the middle axis.
+ * @param[in] n2 the size of the last axis.
+ * @param[out] out array of size n1 in which to store the result.
+ */
+void DomainMap::maxOntoAxis
+(
+ const ValType* in,
+ ValIndex n0,
+ ValIndex n1,
+ ValIndex n2,
+ ValType* out
+)
+{
+   Column_m result(out,n1);
+
+   //***************************************************************************
+   // If the first axis is trivial, this is a 2-D table, which we reduce
+   // across its columns. For column major storage, this takes the maximum
+   // of n2 consecutive columns lane by lane.
+   //***************************************************************************
+   if(1==n0)
+   {
+      result = ConstTable_m(in,n1,n2).rowwise().maxCoeff();
+      return;
+   }
+
+   //***************************************************************************
+   // Otherwise reduce each contiguous column of each slice, and take the
+   // maximum over all slices.
+   //***************************************************************************
+   const ValIndex sliceSize = n0*n1;
+   result = ConstTable_m(in,n0,n1).colwise().maxCoeff().transpose();
+   for(ValIndex k=1; k<n2; ++k)
+   {
+      result = result.max(ConstTable_m(in+k*sliceSize,n0,n1)
+            .colwise().maxCoeff().transpose());
+   }
+
+} // function maxOntoAxis
+
+/**
+ * Max marginalises the middle axis out of a 3-D table.
+ * @param[in] in the table to marginalise, of size n0*n1*n2.
+ * @param[in] n0 the size of the first axis.
+ * @param[in] n1 the size of the middle axis.
+ * @param[in] n2 the size of the last axis.
+ * @param[out] out array of size n0*n2 in which to store the result.
+ */
+void DomainMap::maxOverAxis
+(
+ const ValType* in,
+ ValIndex n0,
+ ValIndex n1,
+ ValIndex n2,
+ ValType* out
+)
+{
+   const ValIndex sliceSize = n0*n1;
+   for(ValIndex k=0; k<n2; ++k)
+   {
+      Column_m(out+k*n0,n0) =
+         ConstTable_m(in+k*sliceSize,n0,n1).rowwise().maxCoeff();
+   }
+
+} // function maxOverAxis
+
+/**
+ * Default constructor maps the domain of a constant function to itself.
+ */
+DomainMap::DomainMap()
+   : outerVars_i(), innerVars_i(), outerSize_i(1), innerSize_i(1),
+     dims_i(), margDims_i()
+{}
+
+/**
+ * Constructs a map between the domains of two functions.
+ * @param[in] outer function whose domain is the outer domain.
+ * @param[in] inner function whose domain is the inner domain.
+ * @throws maxsum::BadDomainException if the domain of inner is not a
+ * subset of that of outer.
+ */
+DomainMap::DomainMap
+(
+ const DiscreteFunction& outer,
+ const DiscreteFunction& inner
+)
+   : outerVars_i(), innerVars_i(), outerSize_i(1), innerSize_i(1),
+     dims_i(), margDims_i()
+{
+   reset(outer,inner);
+}
+
+/**
+ * Appends a dimension to a list, merging it with the previous
+ * dimension if their strides are contiguous.
+ * @param[in,out] dims the list of dimensions.
+ * @param[in] dim the dimension to append.
+ */
+void DomainMap::appendDim(std::vector<Dim>& dims, const Dim& dim)
+{
+   if(!dims.empty())
+   {
+      Dim& last = dims.back();
+      if( (last.outerStride*last.size == dim.outerStride) &&
+          (last.innerStride*last.size == dim.innerStride) )
+      {
+         last.size *= dim.size;
+         return;
+      }
+   }
+   dims.push_back(dim);
+
+} // function appendDim
+
+/**
+ * Recalculates this map for a new pair of domains.
+ * @param[in] outerVars sorted list of variables in the outer domain.
+ * @param[in] outerSizes domain size of each variable in outerVars.
+ * @param[in] innerVars sorted list of variables in the inner domain.
+ * @throws maxsum::BadDomainException if the inner variables are not a
+ * subset of the outer variables.
+ */
+void DomainMap::reset
+(
+ const std::vector<VarID>& outerVars,
+ const std::vector<ValIndex>& outerSizes,
+ const std::vector<VarID>& innerVars
+)
+{
+   //***************************************************************************
+   // Ensure that the inner domain is a subset of the outer domain
+   //***************************************************************************
+   if(!std::includes(outerVars.begin(),outerVars.end(),
+            innerVars.begin(),innerVars.end()))
+   {
+      throw BadDomainException("DomainMap::reset",
+            "Inner domain is not subset of outer domain.");
+   }
+
+   outerVars_i = outerVars;
+   innerVars_i = innerVars;
+   dims_i.clear();
+   margDims_i.clear();
+
+   //***************************************************************************
+   // Calculate the outer and inner stride of each outer variable. Since
+   // both lists are sorted, we can walk through the inner variables in step.
+   //***************************************************************************
+   std::vector<Dim> natural;
+   natural.reserve(outerVars.size());
+   outerSize_i = 1;
+   innerSize_i = 1;
+   std::vector<VarID>::const_iterator innerIt = innerVars.begin();
+   for(std::size_t k=0; k<outerVars.size(); ++k)
+   {
+      Dim dim;
+      dim.size = outerSizes[k];
+      dim.outerStride = outerSize_i;
+      dim.innerStride = 0;
+
+      if( (innerVars.end()!=innerIt) && (*innerIt==outerVars[k]) )
+      {
+         dim.innerStride = innerSize_i;
+         innerSize_i *= dim.size;
+         ++innerIt;
+      }
+
+      outerSize_i *= dim.size;
+      natural.push_back(dim);
+   }
+
+   //***************************************************************************
+   // Merge contiguous dimensions in their natural order, and separately with
+   // all the dimensions that are free in the inner domain ordered first.
+   //***************************************************************************
+   for(std::vector<Dim>::const_iterator it=natural.begin();
+         it!=natural.end(); ++it)
+   {
+      appendDim(dims_i,*it);
+      if(0==it->innerStride)
+      {
+         appendDim(margDims_i,*it);
+      }
+   }
+
+   for(std::vector<Dim>::const_iterator it=natural.begin();
+         it!=natural.end(); ++it)
+   {
+      if(0!=it->innerStride)
+      {
+         appendDim(margDims_i,*it);
+      }
+   }
+
+} // function reset
+
+/**
+ * Recalculates this map for the domains of a new pair of functions.
+ * @param[in] outer function whose domain is the outer domain.
+ * @param[in] inner function whose domain is the inner domain.
+ * @throws maxsum::BadDomainException if the domain of inner is not a
+ * subset of that of outer.
+ */
+void DomainMap::reset(const DiscreteFunction& outer, const DiscreteFunction& inner)
+{
+   std::vector<VarID> outerVars(outer.varBegin(),outer.varEnd());
+   std::vector<ValIndex> outerSizes(outer.sizeBegin(),outer.sizeEnd());
+   std::vector<VarID> innerVars(inner.varBegin(),inner.varEnd());
+   reset(outerVars,outerSizes,innerVars);
+}
+
+/**
+ * Returns true if this map is valid for the domains of two functions.
+ * @param[in] outer function whose domain should be the outer domain.
+ * @param[in] inner function whose domain should be the inner domain.
+ */
+bool DomainMap::matches
+(
+ const DiscreteFunction& outer,
+ const DiscreteFunction& inner
+) const
+{
+   return (outer.noVars()==static_cast<int>(outerVars_i.size())) &&
+      (inner.noVars()==static_cast<int>(innerVars_i.size())) &&
+      std::equal(outerVars_i.begin(),outerVars_i.end(),outer.varBegin()) &&
+      std::equal(innerVars_i.begin(),innerVars_i.end(),inner.varBegin());
+}
+
+/**
+ * Adds each inner value to its corresponding outer values.
+ * @param[in,out] outer the outer value table.
+ * @param[in] inner the inner value table.
+ */
+void DomainMap::add(ValType* outer, const ValType* inner) const
+{
+   transform(outer,inner,std::plus<ValType>());
+}
+
+/**
+ * Subtracts each inner value from its corresponding outer values.
+ * @param[in,out] outer the outer value table.
+ * @param[in] inner the inner value table.
+ */
+void DomainMap::subtract(ValType* outer, const ValType* inner) const
+{
+   transform(outer,inner,std::minus<ValType>());
+}
+
+/**
+ * Copies each inner value to all its corresponding outer values.
+ * @param[in] inner the inner value table.
+ * @param[out] outer the outer value table.
+ */
+void DomainMap::expand(const ValType* inner, ValType* outer) const
+{
+   ExpandOp op = {inner, outer};
+   walk(dims_i,op);
+}
+
+/**
+ * Marginalises the outer values onto the inner domain by maximisation.
+ * @param[in] outer the outer value table.
+ * @param[out] inner the inner value table in which to store the result.
+ */
+void DomainMap::maxMarginal(const ValType* outer, ValType* inner) const
+{
+   //***************************************************************************
+   // After merging, consecutive dimensions alternate between those that are
+   // in the inner domain (kept) and those that are not (free), so we can
+   // identify the shape of the operation by the number of dimensions, and
+   // whether the first is kept.
+   //***************************************************************************
+   const int noDims = static_cast<int>(dims_i.size());
+   const bool firstKept = (0<noDims) && (0!=dims_i[0].innerStride);
+
+   switch(noDims)
+   {
+      //************************************************************************
+      // Constant function
+      //************************************************************************
+      case 0:
+         inner[0] = outer[0];
+         return;
+
+      //************************************************************************
+      // Either a copy, or a reduction over everything
+      //************************************************************************
+      case 1:
+         if(firstKept)
+         {
+            std::copy(outer,outer+outerSize_i,inner);
+         }
+         else
+         {
+            maxOntoAxis(outer,dims_i[0].size,1,1,inner);
+         }
+         return;
+
+      //************************************************************************
+      // 2-D table marginalised onto either axis
+      //************************************************************************
+      case 2:
+         if(firstKept)
+         {
+            maxOntoAxis(outer,1,dims_i[0].size,dims_i[1].size,inner);
+         }
+         else
+         {
+            maxOntoAxis(outer,dims_i[0].size,dims_i[1].size,1,inner);
+         }
+         return;
+
+      //************************************************************************
+      // 3-D table marginalised onto its middle axis, or its outer axes
+      //************************************************************************
+      case 3:
+         if(firstKept)
+         {
+            maxOverAxis(outer,dims_i[0].size,dims_i[1].size,dims_i[2].size,
+                  inner);
+         }
+         else
+         {
+            maxOntoAxis(outer,dims_i[0].size,dims_i[1].size,dims_i[2].size,
+                  inner);
+         }
+         return;
+
+      //************************************************************************
+      // Anything else is handled by the general case
+      //************************************************************************
+      default:
+         marginal(outer,Max_m(),inner);
+
+   } // switch
+
+} // function maxMarginal
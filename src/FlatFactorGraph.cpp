@@ -0,0 +1,980 @@
+/**
+ * @file FlatFactorGraph.cpp
+ * Implementation of the maxsum::util::FlatFactorGraph class.
+ * @see FlatFactorGraph.h
+ */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <maxsum/FlatFactorGraph.h>
+
+using namespace maxsum;
+using namespace maxsum::util;
+
+namespace
+{
+   /**
+    * Advances a list of sub-indices to the next joint assignment, with the
+    * first index changing fastest.
+    * @param[in,out] sub the sub-indices to advance.
+    * @param[in] sizes the domain size for each sub-index.
+    */
+   void nextSubInd_m
+   (
+    std::vector<ValIndex>& sub,
+    const std::vector<ValIndex>& sizes
+   )
+   {
+      for(std::size_t i=0; i<sub.size(); ++i)
+      {
+         if(++sub[i] < sizes[i])
+         {
+            return;
+         }
+         sub[i] = 0;
+      }
+
+   } // function nextSubInd_m
+
+   /**
+    * Finds values that can never be part of an optimal joint assignment.
+    *
+    * For each value x of a variable, the sum of the maximum of each of its
+    * factors over assignments with that value is an upper bound on the total
+    * value of any assignment with x, and similarly for the minimum. If the
+    * upper bound for x is less than the lower bound for another value, then
+    * changing x to that value improves every such assignment, so x is
+    * dominated. Removing dominated values can tighten the bounds of other
+    * variables, so this is repeated until no more values are removed.
+    * @param[in] factors the factor graph.
+    * @param[in] varIds the sorted id of every variable in the graph.
+    * @param[in,out] kept a flag for each value of each variable, which is
+    * cleared if the value is dominated.
+    * @returns the number of values pruned.
+    */
+   int pruneDominated_m
+   (
+    const FlatFactorGraph::FactorMap& factors,
+    const std::vector<VarID>& varIds,
+    std::vector<std::vector<char> >& kept
+   )
+   {
+      typedef FlatFactorGraph::FactorMap::const_iterator FactorIt;
+      const ValType lowest = -std::numeric_limits<ValType>::max();
+      const ValType highest = std::numeric_limits<ValType>::max();
+
+      std::vector<std::vector<ValType> > upper(kept.size());
+      std::vector<std::vector<ValType> > lower(kept.size());
+      std::vector<std::vector<ValType> > facMax;
+      std::vector<std::vector<ValType> > facMin;
+      std::vector<int> vars;
+      std::vector<ValIndex> sizes;
+      std::vector<ValIndex> sub;
+
+      int noPruned = 0;
+      bool changed = true;
+      while(changed)
+      {
+         changed = false;
+         for(std::size_t v=0; v<kept.size(); ++v)
+         {
+            upper[v].assign(kept[v].size(),0);
+            lower[v].assign(kept[v].size(),0);
+         }
+
+         //*********************************************************************
+         // Bound each factor over the kept assignments with each value of
+         // each of its variables.
+         //*********************************************************************
+         for(FactorIt it=factors.begin(); it!=factors.end(); ++it)
+         {
+            const DiscreteFunction& fun = it->second;
+            const int n = fun.noVars();
+            vars.resize(n);
+            sizes.assign(fun.sizeBegin(),fun.sizeEnd());
+            sub.assign(n,0);
+            facMax.resize(n);
+            facMin.resize(n);
+            for(int i=0; i<n; ++i)
+            {
+               vars[i] = std::lower_bound(varIds.begin(),varIds.end(),
+                     fun.varBegin()[i]) - varIds.begin();
+               facMax[i].assign(sizes[i],lowest);
+               facMin[i].assign(sizes[i],highest);
+            }
+
+            for(ValIndex k=0; k<fun.domainSize(); ++k, nextSubInd_m(sub,sizes))
+            {
+               bool isKept = true;
+               for(int i=0; isKept && i<n; ++i)
+               {
+                  isKept = kept[vars[i]][sub[i]];
+               }
+               if(!isKept)
+               {
+                  continue;
+               }
+
+               const ValType val = fun(k);
+               for(int i=0; i<n; ++i)
+               {
+                  facMax[i][sub[i]] = std::max(facMax[i][sub[i]],val);
+                  facMin[i][sub[i]] = std::min(facMin[i][sub[i]],val);
+               }
+            }
+
+            for(int i=0; i<n; ++i)
+            {
+               for(ValIndex x=0; x<sizes[i]; ++x)
+               {
+                  if(kept[vars[i]][x])
+                  {
+                     upper[vars[i]][x] += facMax[i][x];
+                     lower[vars[i]][x] += facMin[i][x];
+                  }
+               }
+            }
+
+         } // for loop
+
+         //*********************************************************************
+         // Prune every kept value whose upper bound is below the best lower
+         // bound. The value with the best lower bound is never pruned, so
+         // every variable keeps at least one value.
+         //*********************************************************************
+         for(std::size_t v=0; v<kept.size(); ++v)
+         {
+            ValType bestLower = lowest;
+            for(std::size_t x=0; x<kept[v].size(); ++x)
+            {
+               if(kept[v][x])
+               {
+                  bestLower = std::max(bestLower,lower[v][x]);
+               }
+            }
+
+            for(std::size_t x=0; x<kept[v].size(); ++x)
+            {
+               if(kept[v][x] && (upper[v][x] < bestLower))
+               {
+                  kept[v][x] = 0;
+                  ++noPruned;
+                  changed = true;
+               }
+            }
+         }
+
+      } // while loop
+
+      return noPruned;
+
+   } // function pruneDominated_m
+
+} // module namespace
+
+/**
+ * Constructs an empty graph, with no factors or variables.
+ */
+FlatFactorGraph::FlatFactorGraph()
+   : factorIds_i(), factorEdges_i(1,0), tableOffsets_i(), tableSizes_i(),
+     tables_i(), varIds_i(), varSizes_i(), keptBegin_i(), keptValues_i(),
+     fullStrides_i(), fullTableSizes_i(), varEdges_i(1,0), varEdgeList_i(),
+     values_i(), edgeVars_i(), edgeStrides_i(), msgOffsets_i(), msgSize_i(0),
+     messages_i(), maxTableSize_i(1), maxVarSize_i(1), totalScratch_i(),
+     msgScratch_i(), sumScratch_i(), residuals_i(), valueChanges_i(),
+     damping_i(0), freezeAfter_i(0), lastValues_i(), flips_i(), pool_i()
+{}
+
+/**
+ * Task used to run updateFactors() on the thread pool.
+ */
+struct FlatFactorGraph::Fac2VarTask : public ThreadPool::Task
+{
+   FlatFactorGraph& graph;
+   ValType threshold;
+   std::vector<int> counts;
+
+   Fac2VarTask(FlatFactorGraph& g, ValType t)
+      : graph(g), threshold(t), counts(g.noThreads(),0) {}
+
+   void run(int begin, int end, int thread)
+   {
+      counts[thread] = graph.updateFactors(begin,end,thread,threshold);
+   }
+};
+
+/**
+ * Task used to run updateVars() on the thread pool.
+ */
+struct FlatFactorGraph::Var2FacTask : public ThreadPool::Task
+{
+   FlatFactorGraph& graph;
+   ValType threshold;
+   std::vector<int> counts;
+
+   Var2FacTask(FlatFactorGraph& g, ValType t)
+      : graph(g), threshold(t), counts(g.noThreads(),0) {}
+
+   void run(int begin, int end, int thread)
+   {
+      counts[thread] = graph.updateVars(begin,end,thread,threshold);
+   }
+};
+
+/**
+ * Removes all factors, variables and edges from this graph.
+ */
+void FlatFactorGraph::clear()
+{
+   factorIds_i.clear();
+   factorEdges_i.assign(1,0);
+   tableOffsets_i.clear();
+   tableSizes_i.clear();
+   tables_i.clear();
+   varIds_i.clear();
+   varSizes_i.clear();
+   keptBegin_i.clear();
+   keptValues_i.clear();
+   fullStrides_i.clear();
+   fullTableSizes_i.clear();
+   varEdges_i.assign(1,0);
+   varEdgeList_i.clear();
+   values_i.clear();
+   edgeVars_i.clear();
+   edgeStrides_i.clear();
+   msgOffsets_i.clear();
+   msgSize_i = 0;
+   messages_i.clear();
+   maxTableSize_i = 1;
+   maxVarSize_i = 1;
+   totalScratch_i.clear();
+   msgScratch_i.clear();
+   sumScratch_i.clear();
+   lastValues_i.clear();
+   flips_i.clear();
+
+} // function clear
+
+/**
+ * Sets the number of threads used to update messages.
+ * @param[in] noThreads the number of threads, which must be positive.
+ * @throws maxsum::OutOfRangeException if noThreads is less than 1.
+ */
+void FlatFactorGraph::setNoThreads(int noThreads)
+{
+   if(noThreads<1)
+   {
+      throw OutOfRangeException("FlatFactorGraph::setNoThreads",
+            "Number of threads must be positive.");
+   }
+   pool_i.setNoThreads(noThreads);
+   allocScratch();
+}
+
+/**
+ * Allocates scratch space for the current number of threads.
+ */
+void FlatFactorGraph::allocScratch()
+{
+   totalScratch_i.assign(maxTableSize_i*noThreads(),0);
+   msgScratch_i.assign(maxVarSize_i*noThreads(),0);
+   sumScratch_i.assign(maxVarSize_i*noThreads(),0);
+   residuals_i.assign(noThreads(),0);
+   valueChanges_i.assign(noThreads(),0);
+}
+
+/**
+ * Compiles a flat graph from a map of factors.
+ * All messages are initialised to zero, and all variable values to 0.
+ * @param[in] factors the factors from which to build this graph.
+ * @param[in] prune true if dominated values should be pruned from each
+ * variable's domain.
+ * @post any previous contents of this graph are destroyed.
+ */
+void FlatFactorGraph::build(const FactorMap& factors, bool prune)
+{
+   clear();
+
+   //***************************************************************************
+   // Collect the sorted set of variables, so that we can map each variable
+   // to its index. We also count the total number of edges and table values
+   // to reserve space in advance.
+   //***************************************************************************
+   int edgeCount = 0;
+   int tableCount = 0;
+   for(FactorMap::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      edgeCount += it->second.noVars();
+      tableCount += it->second.domainSize();
+   }
+
+   std::vector<VarID> allVars;
+   allVars.reserve(edgeCount);
+   for(FactorMap::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      allVars.insert(allVars.end(),it->second.varBegin(),it->second.varEnd());
+   }
+   std::sort(allVars.begin(),allVars.end());
+   allVars.erase(std::unique(allVars.begin(),allVars.end()),allVars.end());
+   varIds_i.swap(allVars);
+
+   const int noV = varIds_i.size();
+   varSizes_i.assign(noV,0);
+   for(int v=0; v<noV; ++v)
+   {
+      varSizes_i[v] = getDomainSize(varIds_i[v]);
+   }
+
+   //***************************************************************************
+   // If requested, prune dominated values, and list the values kept for
+   // each variable. If nothing is pruned, the graph is built as normal.
+   //***************************************************************************
+   if(prune)
+   {
+      std::vector<std::vector<char> > kept(noV);
+      for(int v=0; v<noV; ++v)
+      {
+         kept[v].assign(varSizes_i[v],1);
+      }
+
+      if(0<pruneDominated_m(factors,varIds_i,kept))
+      {
+         keptBegin_i.reserve(noV+1);
+         for(int v=0; v<noV; ++v)
+         {
+            keptBegin_i.push_back(keptValues_i.size());
+            for(ValIndex x=0; x<varSizes_i[v]; ++x)
+            {
+               if(kept[v][x])
+               {
+                  keptValues_i.push_back(x);
+               }
+            }
+            varSizes_i[v] = keptValues_i.size() - keptBegin_i[v];
+         }
+         keptBegin_i.push_back(keptValues_i.size());
+         fullStrides_i.reserve(edgeCount);
+         fullTableSizes_i.reserve(factors.size());
+      }
+   }
+
+   //***************************************************************************
+   // Lay out factor tables and edges in factor order
+   //***************************************************************************
+   factorIds_i.reserve(factors.size());
+   factorEdges_i.reserve(factors.size()+1);
+   tableOffsets_i.reserve(factors.size());
+   tableSizes_i.reserve(factors.size());
+   tables_i.reserve(tableCount);
+   edgeVars_i.reserve(edgeCount);
+   edgeStrides_i.reserve(edgeCount);
+
+   int f = 0;
+   for(FactorMap::const_iterator it=factors.begin(); it!=factors.end();
+         ++it, ++f)
+   {
+      const DiscreteFunction& fun = it->second;
+      factorIds_i.push_back(it->first);
+
+      //************************************************************************
+      // Each variable's stride is the product of the sizes of all variables
+      // that precede it in the factor's domain.
+      //************************************************************************
+      ValIndex stride = 1;
+      ValIndex fullStride = 1;
+      DiscreteFunction::SizeIterator sIt = fun.sizeBegin();
+      for(DiscreteFunction::VarIterator vIt=fun.varBegin();
+            vIt!=fun.varEnd(); ++vIt, ++sIt)
+      {
+         int v = std::lower_bound(varIds_i.begin(),varIds_i.end(),*vIt)
+            - varIds_i.begin();
+         edgeVars_i.push_back(v);
+         edgeStrides_i.push_back(stride);
+         stride *= varSizes_i[v];
+         if(isPruned())
+         {
+            fullStrides_i.push_back(fullStride);
+            fullStride *= *sIt;
+         }
+      }
+      factorEdges_i.push_back(edgeVars_i.size());
+
+      //************************************************************************
+      // Copy the factor's table, which may be smaller than its domain if
+      // values have been pruned.
+      //************************************************************************
+      if(isPruned())
+      {
+         fullTableSizes_i.push_back(fun.domainSize());
+      }
+      tableOffsets_i.push_back(tables_i.size());
+      tableSizes_i.push_back(stride);
+      maxTableSize_i = std::max(maxTableSize_i,stride);
+      tables_i.resize(tables_i.size()+stride);
+      packTable(f,fun);
+
+   } // for loop
+
+   //***************************************************************************
+   // Build the variable to edge references, using counting sort so that the
+   // edges of each variable remain in ascending order.
+   //***************************************************************************
+   varEdges_i.assign(noV+1,0);
+   for(int e=0; e<noEdges(); ++e)
+   {
+      ++varEdges_i[edgeVars_i[e]+1];
+   }
+   for(int v=0; v<noV; ++v)
+   {
+      varEdges_i[v+1] += varEdges_i[v];
+   }
+   varEdgeList_i.assign(noEdges(),0);
+   std::vector<int> nextPos(varEdges_i.begin(),varEdges_i.end()-1);
+   for(int e=0; e<noEdges(); ++e)
+   {
+      varEdgeList_i[nextPos[edgeVars_i[e]]++] = e;
+   }
+
+   //***************************************************************************
+   // Lay out messages in edge order, and allocate all remaining storage.
+   //***************************************************************************
+   msgOffsets_i.reserve(noEdges());
+   for(int e=0; e<noEdges(); ++e)
+   {
+      msgOffsets_i.push_back(msgSize_i);
+      msgSize_i += varSizes_i[edgeVars_i[e]];
+      maxVarSize_i = std::max(maxVarSize_i,varSizes_i[edgeVars_i[e]]);
+   }
+   messages_i.assign(2*msgSize_i,0);
+   values_i.assign(noV,0);
+   lastValues_i.assign(noV,-1);
+   flips_i.assign(noV,0);
+   allocScratch();
+
+} // function build
+
+/**
+ * Sets the number of times a variable's value may flip back to its
+ * previous value before the variable is frozen, and unfreezes all
+ * variables.
+ * @param[in] freezeAfter the number of flips, or 0 to never freeze variables.
+ */
+void FlatFactorGraph::setFreezeAfter(int freezeAfter)
+{
+   freezeAfter_i = freezeAfter;
+   lastValues_i.assign(noVars(),-1);
+   flips_i.assign(noVars(),0);
+}
+
+/**
+ * Returns the index of a specified factor, or -1 if it is not in this
+ * graph.
+ */
+int FlatFactorGraph::factorIndex(FactorID id) const
+{
+   std::vector<FactorID>::const_iterator pos =
+      std::lower_bound(factorIds_i.begin(),factorIds_i.end(),id);
+
+   if( (factorIds_i.end()==pos) || (*pos!=id) )
+   {
+      return -1;
+   }
+   return pos - factorIds_i.begin();
+}
+
+/**
+ * Returns the index of a specified variable, or -1 if it is not in this
+ * graph.
+ */
+int FlatFactorGraph::varIndex(VarID id) const
+{
+   std::vector<VarID>::const_iterator pos =
+      std::lower_bound(varIds_i.begin(),varIds_i.end(),id);
+
+   if( (varIds_i.end()==pos) || (*pos!=id) )
+   {
+      return -1;
+   }
+   return pos - varIds_i.begin();
+}
+
+/**
+ * Replaces the values of a factor's table.
+ * @param[in] f the index of the factor to update.
+ * @param[in] fun the new value of the factor.
+ * @throws maxsum::BadDomainException if the size of <code>fun</code>'s
+ * domain does not match that of the compiled factor.
+ */
+void FlatFactorGraph::setFactorValues(int f, const DiscreteFunction& fun)
+{
+   const ValIndex fullSize = isPruned() ? fullTableSizes_i[f] : tableSizes_i[f];
+   if(fun.domainSize() != fullSize)
+   {
+      throw BadDomainException("FlatFactorGraph::setFactorValues",
+            "Factor domain does not match compiled graph.");
+   }
+   packTable(f,fun);
+}
+
+/**
+ * Copies the values of a factor into its table, skipping any pruned
+ * values.
+ * @param[in] f the index of the factor.
+ * @param[in] fun the factor's values over its full domain.
+ */
+void FlatFactorGraph::packTable(int f, const DiscreteFunction& fun)
+{
+   ValType* table = &tables_i[tableOffsets_i[f]];
+   if(!isPruned())
+   {
+      for(ValIndex k=0; k<tableSizes_i[f]; ++k)
+      {
+         table[k] = fun(k);
+      }
+      return;
+   }
+
+   //***************************************************************************
+   // Step through the compiled table, keeping track of the corresponding
+   // index into the full domain.
+   //***************************************************************************
+   const int first = factorEdges_i[f];
+   const int n = factorEdges_i[f+1] - first;
+   std::vector<ValIndex> sub(n,0);
+   std::vector<ValIndex> sizes(n);
+   ValIndex fullInd = 0;
+   for(int i=0; i<n; ++i)
+   {
+      const int v = edgeVars_i[first+i];
+      sizes[i] = varSizes_i[v];
+      fullInd += keptValue(v,0)*fullStrides_i[first+i];
+   }
+
+   for(ValIndex k=0; k<tableSizes_i[f]; ++k)
+   {
+      table[k] = fun(fullInd);
+      for(int i=0; i<n; ++i)
+      {
+         const int e = first+i;
+         const int v = edgeVars_i[e];
+         fullInd -= keptValue(v,sub[i])*fullStrides_i[e];
+         if(++sub[i] < sizes[i])
+         {
+            fullInd += keptValue(v,sub[i])*fullStrides_i[e];
+            break;
+         }
+         sub[i] = 0;
+         fullInd += keptValue(v,0)*fullStrides_i[e];
+      }
+   }
+
+} // function packTable
+
+/**
+ * Returns the number of values pruned from all variable domains.
+ */
+int FlatFactorGraph::noPrunedValues() const
+{
+   int count = 0;
+   if(isPruned())
+   {
+      for(int v=0; v<noVars(); ++v)
+      {
+         count += getDomainSize(varIds_i[v]) - varSizes_i[v];
+      }
+   }
+   return count;
+}
+
+/**
+ * Sets the current value assigned to a specified variable.
+ * @param[in] v the index of the variable.
+ * @param[in] val the value in the variable's full domain. If this value was
+ * pruned, the variable is set to its first kept value.
+ */
+void FlatFactorGraph::setValue(int v, ValIndex val)
+{
+   if(!isPruned())
+   {
+      values_i[v] = val;
+      return;
+   }
+
+   std::vector<ValIndex>::const_iterator begin =
+      keptValues_i.begin() + keptBegin_i[v];
+   std::vector<ValIndex>::const_iterator end =
+      keptValues_i.begin() + keptBegin_i[v+1];
+   std::vector<ValIndex>::const_iterator pos =
+      std::lower_bound(begin,end,val);
+   values_i[v] = ( (end!=pos) && (*pos==val) ) ? pos-begin : 0;
+}
+
+/**
+ * Calculates the total value (factor plus sum of all input messages)
+ * for a specified factor.
+ * @param[in] f the index of the factor.
+ * @param[out] total array with space for the factor's table.
+ */
+void FlatFactorGraph::calcTotal(int f, ValType* total) const
+{
+   //***************************************************************************
+   // Start with a copy of the factor's own values
+   //***************************************************************************
+   const ValIndex N = tableSizes_i[f];
+   const ValType* table = &tables_i[tableOffsets_i[f]];
+   std::copy(table,table+N,total);
+
+   //***************************************************************************
+   // Add each input message along its variable's stride. Each message value
+   // applies to a run of <code>stride</code> consecutive elements, which
+   // repeats every <code>stride*size</code> elements.
+   //***************************************************************************
+   for(int e=factorEdges_i[f]; e<factorEdges_i[f+1]; ++e)
+   {
+      const ValType* inMsg = var2facMsg(e);
+      const ValIndex stride = edgeStrides_i[e];
+      const ValIndex size = edgeSize(e);
+      const ValIndex block = stride*size;
+
+      for(ValIndex base=0; base<N; base+=block)
+      {
+         for(ValIndex x=0; x<size; ++x)
+         {
+            const ValType val = inMsg[x];
+            ValType* pTotal = total + base + x*stride;
+            for(ValIndex t=0; t<stride; ++t)
+            {
+               pTotal[t] += val;
+            }
+         }
+      }
+
+   } // for loop
+
+} // function calcTotal
+
+/**
+ * Calculates the total value for a specified factor, which is
+ * the factor plus the sum of all its input messages.
+ * @param[in] f the index of the factor.
+ * @param[in,out] out function in which to store the result.
+ * @throws maxsum::BadDomainException if the size of <code>out</code>'s
+ * domain does not match that of the compiled factor.
+ */
+void FlatFactorGraph::getTotalValue(int f, DiscreteFunction& out) const
+{
+   if(out.domainSize() != tableSizes_i[f])
+   {
+      throw BadDomainException("FlatFactorGraph::getTotalValue",
+            "Output domain does not match compiled graph.");
+   }
+   calcTotal(f,&out(0));
+}
+
+/**
+ * Updates the factor to variable messages for every factor.
+ * Factors are divided between all available threads.
+ * @param[in] threshold maxnorm change above which a message is counted
+ * as updated.
+ * @returns the number of significantly changed messages.
+ */
+int FlatFactorGraph::updateFac2VarMsgs(ValType threshold)
+{
+   Fac2VarTask task(*this,threshold);
+   pool_i.run(noFactors(),task);
+
+   int updateCount = 0;
+   for(int t=0; t<noThreads(); ++t)
+   {
+      updateCount += task.counts[t];
+   }
+   return updateCount;
+}
+
+/**
+ * Updates the factor to variable messages for factors in the range
+ * [begin,end). This only writes to the output messages of these
+ * factors, so different ranges may be updated concurrently.
+ * @param[in] begin index of the first factor to update.
+ * @param[in] end index after the last factor to update.
+ * @param[in] thread index of the scratch space to use.
+ * @param[in] threshold maxnorm change above which a message is counted
+ * as updated.
+ * @returns the number of significantly changed messages.
+ */
+int FlatFactorGraph::updateFactors
+(
+ int begin,
+ int end,
+ int thread,
+ ValType threshold
+)
+{
+   int updateCount = 0;
+   ValType* total = &totalScratch_i[thread*maxTableSize_i];
+   ValType* newMsg = &msgScratch_i[thread*maxVarSize_i];
+
+   //***************************************************************************
+   // For each factor in range
+   //***************************************************************************
+   for(int f=begin; f<end; ++f)
+   {
+      //************************************************************************
+      // Calculate the sum of the factor and all its input messages
+      //************************************************************************
+      const ValIndex N = tableSizes_i[f];
+      calcTotal(f,total);
+
+      //************************************************************************
+      // For each neighbour, max marginalise the total onto its variable, and
+      // subtract the neighbour's own input message. This is equivalent to
+      // max marginalising the sum of all other inputs, because the input
+      // message is constant across each marginalised slice.
+      //************************************************************************
+      for(int e=factorEdges_i[f]; e<factorEdges_i[f+1]; ++e)
+      {
+         const ValIndex stride = edgeStrides_i[e];
+         const ValIndex size = edgeSize(e);
+         DomainMap::maxOntoAxis(total,stride,size,N/(stride*size),newMsg);
+
+         //*********************************************************************
+         // Store the new message, recording whether it changed significantly
+         //*********************************************************************
+         const ValType* inMsg = var2facMsg(e);
+         ValType* outMsg = fac2varMsg(e);
+         ValType diff = 0;
+         for(ValIndex x=0; x<size; ++x)
+         {
+            ValType val = newMsg[x] - inMsg[x];
+            if(0<damping_i)
+            {
+               val = (1-damping_i)*val + damping_i*outMsg[x];
+            }
+            diff = std::max(diff,ValType(std::fabs(val-outMsg[x])));
+            outMsg[x] = val;
+         }
+
+         if(diff > threshold)
+         {
+            ++updateCount;
+         }
+         MAXSUM_STATS_ONLY
+         (
+            residuals_i[thread] = std::max(residuals_i[thread],diff);
+         )
+
+      } // for loop
+
+   } // for loop
+
+   return updateCount;
+
+} // function updateFactors
+
+/**
+ * Updates the variable to factor messages and values for every
+ * variable. Variables are divided between all available threads.
+ * @param[in] threshold maxnorm change above which a message is counted
+ * as updated.
+ * @returns the number of significantly changed messages, plus the
+ * number of variables whose value changed.
+ * @post Each message is normalised so that the sum of its values is 0.
+ */
+int FlatFactorGraph::updateVar2FacMsgs(ValType threshold)
+{
+   Var2FacTask task(*this,threshold);
+   pool_i.run(noVars(),task);
+
+   int updateCount = 0;
+   for(int t=0; t<noThreads(); ++t)
+   {
+      updateCount += task.counts[t];
+   }
+   return updateCount;
+}
+
+/**
+ * Updates the variable to factor messages and values for variables
+ * in the range [begin,end). This only writes to the output messages
+ * and values of these variables, so different ranges may be updated
+ * concurrently.
+ * @param[in] begin index of the first variable to update.
+ * @param[in] end index after the last variable to update.
+ * @param[in] thread index of the scratch space to use.
+ * @param[in] threshold maxnorm change above which a message is counted
+ * as updated.
+ * @returns the number of significantly changed messages, plus the
+ * number of variables whose value changed.
+ */
+int FlatFactorGraph::updateVars
+(
+ int begin,
+ int end,
+ int thread,
+ ValType threshold
+)
+{
+   int updateCount = 0;
+   ValType* sum = &sumScratch_i[thread*maxVarSize_i];
+
+   //***************************************************************************
+   // For each variable in range
+   //***************************************************************************
+   for(int v=begin; v<end; ++v)
+   {
+      //************************************************************************
+      // Frozen variables keep their current value and output messages.
+      //************************************************************************
+      if( (0<freezeAfter_i) && (freezeAfter_i<=flips_i[v]) )
+      {
+         continue;
+      }
+
+      //************************************************************************
+      // Calculate the total sum of all input messages
+      //************************************************************************
+      const ValIndex size = varSizes_i[v];
+      std::fill(sum,sum+size,ValType(0));
+      for(int k=varEdges_i[v]; k<varEdges_i[v+1]; ++k)
+      {
+         const ValType* inMsg = fac2varMsg(varEdgeList_i[k]);
+         for(ValIndex x=0; x<size; ++x)
+         {
+            sum[x] += inMsg[x];
+         }
+      }
+
+      //************************************************************************
+      // Update the normalised output message for each connected neighbour
+      // by subtracting the neighbour's own message from the sum.
+      //************************************************************************
+      for(int k=varEdges_i[v]; k<varEdges_i[v+1]; ++k)
+      {
+         const int e = varEdgeList_i[k];
+         const ValType* inMsg = fac2varMsg(e);
+         ValType* outMsg = var2facMsg(e);
+
+         ValType mean = 0;
+         for(ValIndex x=0; x<size; ++x)
+         {
+            mean += (sum[x] - inMsg[x]) / size;
+         }
+
+         ValType diff = 0;
+         for(ValIndex x=0; x<size; ++x)
+         {
+            const ValType val = sum[x] - inMsg[x] - mean;
+            diff = std::max(diff,ValType(std::fabs(val-outMsg[x])));
+            outMsg[x] = val;
+         }
+
+         if(diff > threshold)
+         {
+            ++updateCount;
+         }
+         MAXSUM_STATS_ONLY
+         (
+            residuals_i[thread] = std::max(residuals_i[thread],diff);
+         )
+
+      } // for loop
+
+      //************************************************************************
+      // If the optimal value for this variable has changed, update its value.
+      //************************************************************************
+      ValIndex bestValue = 0;
+      for(ValIndex x=1; x<size; ++x)
+      {
+         if(sum[x] > sum[bestValue])
+         {
+            bestValue = x;
+         }
+      }
+
+      if(bestValue != values_i[v])
+      {
+         if(bestValue==lastValues_i[v])
+         {
+            ++flips_i[v];
+         }
+         lastValues_i[v] = values_i[v];
+         values_i[v] = bestValue;
+         ++updateCount;
+         MAXSUM_STATS_ONLY(++valueChanges_i[thread];)
+      }
+
+   } // for loop
+
+   return updateCount;
+
+} // function updateVars
+
+/**
+ * Runs the max-sum algorithm on this graph until convergence, or
+ * until a maximum number of iterations.
+ * @param[in] maxIterations maximum number of iterations to perform.
+ * @param[in] threshold maxnorm change below which messages are taken
+ * to have converged.
+ * @returns the number of iterations performed.
+ */
+int FlatFactorGraph::optimise(int maxIterations, ValType threshold)
+{
+   int iterationCount = 0;
+   while(iterationCount<maxIterations)
+   {
+      ++iterationCount;
+
+      //************************************************************************
+      // Update all messages. If nothing has changed significantly, then
+      // we've converged, so we can stop.
+      //************************************************************************
+      int numOfUpdates = updateFac2VarMsgs(threshold);
+      numOfUpdates += updateVar2FacMsgs(threshold);
+
+      if(0==numOfUpdates)
+      {
+         break;
+      }
+
+   } // while loop
+
+   return iterationCount;
+
+} // function optimise
+
+/**
+ * Resets the statistics returned by ::maxResidual() and ::noValueChanges().
+ */
+void FlatFactorGraph::resetStats()
+{
+   std::fill(residuals_i.begin(),residuals_i.end(),ValType(0));
+   std::fill(valueChanges_i.begin(),valueChanges_i.end(),0);
+}
+
+/**
+ * Returns the largest maxnorm change in any message since the last call to
+ * ::resetStats().
+ */
+ValType FlatFactorGraph::maxResidual() const
+{
+   ValType result = 0;
+   for(std::size_t t=0; t<residuals_i.size(); ++t)
+   {
+      result = std::max(result,residuals_i[t]);
+   }
+   return result;
+}
+
+/**
+ * Returns the number of variable value changes since the last call to
+ * ::resetStats().
+ */
+int FlatFactorGraph::noValueChanges() const
+{
+   int result = 0;
+   for(std::size_t t=0; t<valueChanges_i.size(); ++t)
+   {
+      result += valueChanges_i[t];
+   }
+   return result;
+}
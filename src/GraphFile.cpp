@@ -0,0 +1,603 @@
+/**
+ * @file GraphFile.cpp
+ * Implements the maxsum::saveGraph functions and maxsum::MappedGraph class.
+ * @see GraphFile.h
+ */
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <maxsum/GraphFile.h>
+
+using namespace maxsum;
+
+namespace
+{
+   /**
+    * Unsigned integer type used for ids and counts in graph files.
+    */
+   typedef unsigned int Word_m;
+
+   /**
+    * Unsigned integer type used for byte offsets in graph files.
+    */
+   typedef unsigned long long Offset_m;
+
+   /**
+    * Identifies a graph file.
+    */
+   const char MAGIC_M[8] = { 'M','A','X','S','U','M','G','\0' };
+
+   /**
+    * Version of the file format written by this library.
+    */
+   const Word_m VERSION_M = 1;
+
+   /**
+    * Written as a number to check that files are read in the same byte
+    * order as they are written.
+    */
+   const Word_m BYTE_ORDER_M = 0x01020304;
+
+   /**
+    * Flag set in FileHeader_m::flags if the file contains messages.
+    */
+   const Word_m HAS_MESSAGES_M = 1;
+
+   /**
+    * Alignment of every table in a graph file, in bytes.
+    */
+   const Offset_m ALIGNMENT_M = 16;
+
+   /**
+    * Header at the start of every graph file.
+    */
+   struct FileHeader_m
+   {
+      char magic[8];       ///< always MAGIC_M
+      Word_m version;      ///< format version
+      Word_m byteOrder;    ///< always BYTE_ORDER_M
+      Word_m valTypeSize;  ///< sizeof(ValType) used by the writer
+      Word_m flags;        ///< HAS_MESSAGES_M or 0
+      Offset_m noVars;     ///< number of VarRecord_m entries
+      Offset_m noFactors;  ///< number of FactorRecord_m entries
+      Offset_m noEdges;    ///< number of EdgeRecord_m entries
+      Offset_m varOffset;  ///< offset of the variable records
+      Offset_m factorOffset; ///< offset of the factor records
+      Offset_m edgeOffset; ///< offset of the edge records
+   };
+
+   /**
+    * Record of a single variable.
+    */
+   struct VarRecord_m
+   {
+      Word_m id;     ///< the variable's id
+      Word_m size;   ///< the variable's domain size
+   };
+
+   /**
+    * Record of a single factor.
+    */
+   struct FactorRecord_m
+   {
+      Word_m id;              ///< the factor's id
+      Word_m noVars;          ///< number of variables in its domain
+      Offset_m domainOffset;  ///< offset of its sorted variable ids
+      Offset_m valueOffset;   ///< offset of its value table
+      Offset_m noValues;      ///< number of values in its table
+   };
+
+   /**
+    * Record of the messages along a single edge.
+    */
+   struct EdgeRecord_m
+   {
+      Word_m factor;       ///< the factor at one end of the edge
+      Word_m var;          ///< the variable at the other end
+      Offset_m f2vOffset;  ///< offset of the factor to variable message
+      Offset_m v2fOffset;  ///< offset of the variable to factor message
+   };
+
+   /**
+    * Rounds a byte offset up to the next aligned position.
+    */
+   Offset_m align_m(Offset_m offset)
+   {
+      return (offset+ALIGNMENT_M-1)/ALIGNMENT_M*ALIGNMENT_M;
+   }
+
+   /**
+    * Writes to a stream and keeps track of the current offset.
+    */
+   class Writer_m
+   {
+   private:
+
+      std::ostream& out_i; ///< the stream to write to
+      Offset_m pos_i;      ///< number of bytes written so far
+
+   public:
+
+      /**
+       * Constructs a writer for the specified stream.
+       */
+      explicit Writer_m(std::ostream& out) : out_i(out), pos_i(0) {}
+
+      /**
+       * Writes an array of bytes.
+       */
+      void write(const void* pData, std::size_t noBytes)
+      {
+         out_i.write(static_cast<const char*>(pData),noBytes);
+         pos_i += noBytes;
+      }
+
+      /**
+       * Writes zeros up to the next aligned position.
+       */
+      void pad()
+      {
+         static const char ZEROS[ALIGNMENT_M] = {0};
+         write(ZEROS,align_m(pos_i)-pos_i);
+      }
+
+      /**
+       * Returns the number of bytes written so far.
+       */
+      Offset_m pos() const { return pos_i; }
+
+   }; // class Writer_m
+
+} // module namespace
+
+/**
+ * Writes the factor graph of a controller to a stream in binary format.
+ * @param[out] out the stream to write to, which should be binary.
+ * @param[in] controller the controller whose factor graph is written.
+ * @param[in] withMessages true if the current messages should be saved.
+ * @throws maxsum::FileFormatException if the stream cannot be written.
+ */
+void maxsum::saveGraph
+(
+ std::ostream& out,
+ MaxSumController& controller,
+ bool withMessages
+)
+{
+   typedef MaxSumController::FactorMap::const_iterator FactorIt;
+
+   //***************************************************************************
+   // Structured factors are saved as dense tables.
+   //***************************************************************************
+   MaxSumController::FactorMap expanded;
+   if(!controller.structured_i.empty())
+   {
+      expanded = controller.factors_i;
+      controller.expandStructured(expanded);
+   }
+   const MaxSumController::FactorMap& factors =
+      controller.structured_i.empty() ? controller.factors_i : expanded;
+
+   //***************************************************************************
+   // Lay out the header and record tables
+   //***************************************************************************
+   FileHeader_m header;
+   std::memset(&header,0,sizeof(header));
+   std::memcpy(header.magic,MAGIC_M,sizeof(MAGIC_M));
+   header.version = VERSION_M;
+   header.byteOrder = BYTE_ORDER_M;
+   header.valTypeSize = sizeof(ValType);
+   header.flags = withMessages ? HAS_MESSAGES_M : 0;
+   header.noVars = controller.values_i.size();
+   header.noFactors = factors.size();
+   header.noEdges = withMessages ? controller.noEdges() : 0;
+   header.varOffset = align_m(sizeof(header));
+   header.factorOffset =
+      align_m(header.varOffset + header.noVars*sizeof(VarRecord_m));
+   header.edgeOffset =
+      align_m(header.factorOffset + header.noFactors*sizeof(FactorRecord_m));
+
+   //***************************************************************************
+   // Lay out the data for each factor and edge, which follows the records.
+   //***************************************************************************
+   Offset_m pos =
+      align_m(header.edgeOffset + header.noEdges*sizeof(EdgeRecord_m));
+
+   std::vector<FactorRecord_m> factorRecords;
+   factorRecords.reserve(factors.size());
+   for(FactorIt it=factors.begin(); it!=factors.end(); ++it)
+   {
+      FactorRecord_m record;
+      record.id = it->first;
+      record.noVars = it->second.noVars();
+      record.domainOffset = pos;
+      pos = align_m(pos + record.noVars*sizeof(Word_m));
+      record.valueOffset = pos;
+      record.noValues = it->second.domainSize();
+      pos = align_m(pos + record.noValues*sizeof(ValType));
+      factorRecords.push_back(record);
+   }
+
+   std::vector<EdgeRecord_m> edgeRecords;
+   if(withMessages)
+   {
+      edgeRecords.reserve(header.noEdges);
+      for(FactorIt it=factors.begin(); it!=factors.end(); ++it)
+      {
+         for(DiscreteFunction::VarIterator v=it->second.varBegin();
+               v!=it->second.varEnd(); ++v)
+         {
+            const Offset_m msgBytes = getDomainSize(*v)*sizeof(ValType);
+            EdgeRecord_m record;
+            record.factor = it->first;
+            record.var = *v;
+            record.f2vOffset = pos;
+            pos = align_m(pos + msgBytes);
+            record.v2fOffset = pos;
+            pos = align_m(pos + msgBytes);
+            edgeRecords.push_back(record);
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Write the header and records
+   //***************************************************************************
+   Writer_m writer(out);
+   writer.write(&header,sizeof(header));
+   writer.pad();
+
+   for(MaxSumController::ConstValueIterator it=controller.valBegin();
+         it!=controller.valEnd(); ++it)
+   {
+      VarRecord_m record;
+      record.id = it->first;
+      record.size = getDomainSize(it->first);
+      writer.write(&record,sizeof(record));
+   }
+   writer.pad();
+
+   if(!factorRecords.empty())
+   {
+      writer.write(&factorRecords[0],
+            factorRecords.size()*sizeof(FactorRecord_m));
+   }
+   writer.pad();
+
+   if(!edgeRecords.empty())
+   {
+      writer.write(&edgeRecords[0],edgeRecords.size()*sizeof(EdgeRecord_m));
+   }
+   writer.pad();
+
+   //***************************************************************************
+   // Write the domain and values of each factor, then each pair of messages,
+   // in the same order as they were laid out above.
+   //***************************************************************************
+   std::vector<Word_m> domain;
+   for(FactorIt it=factors.begin(); it!=factors.end(); ++it)
+   {
+      domain.assign(it->second.varBegin(),it->second.varEnd());
+      if(!domain.empty())
+      {
+         writer.write(&domain[0],domain.size()*sizeof(Word_m));
+      }
+      writer.pad();
+      writer.write(&it->second(0),it->second.domainSize()*sizeof(ValType));
+      writer.pad();
+   }
+
+   const util::F2VPostOffice& fac2varMsgs = controller.fac2varMsgs_i;
+   const util::V2FPostOffice& var2facMsgs = controller.var2facMsgs_i;
+   for(std::vector<EdgeRecord_m>::const_iterator it=edgeRecords.begin();
+         it!=edgeRecords.end(); ++it)
+   {
+      const DiscreteFunction& f2v =
+         *fac2varMsgs.curOutMsgs(it->factor)[it->var];
+      const DiscreteFunction& v2f =
+         *var2facMsgs.curOutMsgs(it->var)[it->factor];
+      writer.write(&f2v(0),f2v.domainSize()*sizeof(ValType));
+      writer.pad();
+      writer.write(&v2f(0),v2f.domainSize()*sizeof(ValType));
+      writer.pad();
+   }
+
+   if(!out)
+   {
+      throw FileFormatException("maxsum::saveGraph",
+            "Failed to write factor graph.");
+   }
+
+} // function saveGraph
+
+/**
+ * Writes the factor graph of a controller to a file in binary format.
+ * @param[in] path the name of the file to write.
+ * @param[in] controller the controller whose factor graph is written.
+ * @param[in] withMessages true if the current messages should be saved.
+ * @throws maxsum::FileFormatException if the file cannot be written.
+ */
+void maxsum::saveGraph
+(
+ const std::string& path,
+ MaxSumController& controller,
+ bool withMessages
+)
+{
+   std::ofstream out(path.c_str(),std::ios::out|std::ios::binary);
+   if(!out)
+   {
+      throw FileFormatException("maxsum::saveGraph",
+            "Failed to open " + path + " for writing.");
+   }
+   saveGraph(out,controller,withMessages);
+   out.close();
+   if(!out)
+   {
+      throw FileFormatException("maxsum::saveGraph",
+            "Failed to close " + path + ".");
+   }
+
+} // function saveGraph
+
+/**
+ * Maps a factor graph file into memory.
+ * @param[in] path the name of the file.
+ * @throws maxsum::FileFormatException if the file cannot be mapped, or
+ * was not written by a compatible version of maxsum::saveGraph.
+ */
+MappedGraph::MappedGraph(const std::string& path) : pData_i(0), size_i(0)
+{
+   //***************************************************************************
+   // Map the whole file. The mapping stays valid after the file is closed.
+   //***************************************************************************
+   const int fd = ::open(path.c_str(),O_RDONLY);
+   if(0>fd)
+   {
+      throw FileFormatException("MappedGraph::MappedGraph",
+            "Failed to open " + path + ".");
+   }
+
+   struct stat info;
+   if( (0!=::fstat(fd,&info)) ||
+       (static_cast<std::size_t>(info.st_size) < sizeof(FileHeader_m)) )
+   {
+      ::close(fd);
+      throw FileFormatException("MappedGraph::MappedGraph",
+            path + " is too short to be a factor graph file.");
+   }
+
+   void* pMap = ::mmap(0,info.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+   ::close(fd);
+   if(MAP_FAILED==pMap)
+   {
+      throw FileFormatException("MappedGraph::MappedGraph",
+            "Failed to map " + path + ".");
+   }
+   pData_i = static_cast<char*>(pMap);
+   size_i = info.st_size;
+
+   //***************************************************************************
+   // Check the header and that every record table is inside the file.
+   // Individual records are checked when they are used.
+   //***************************************************************************
+   const FileHeader_m& header = *reinterpret_cast<FileHeader_m*>(pData_i);
+   const char* problem = 0;
+   if(0!=std::memcmp(header.magic,MAGIC_M,sizeof(MAGIC_M)))
+   {
+      problem = " is not a factor graph file.";
+   }
+   else if(VERSION_M!=header.version)
+   {
+      problem = " has an unsupported version.";
+   }
+   else if( (BYTE_ORDER_M!=header.byteOrder) ||
+            (sizeof(ValType)!=header.valTypeSize) )
+   {
+      problem = " was written with a different byte order or ValType.";
+   }
+   else if( (header.noVars > size_i/sizeof(VarRecord_m)) ||
+            (header.noFactors > size_i/sizeof(FactorRecord_m)) ||
+            (header.noEdges > size_i/sizeof(EdgeRecord_m)) ||
+            (size_i < header.varOffset+header.noVars*sizeof(VarRecord_m)) ||
+            (size_i < header.factorOffset +
+               header.noFactors*sizeof(FactorRecord_m)) ||
+            (size_i < header.edgeOffset+header.noEdges*sizeof(EdgeRecord_m)) ||
+            (0!=header.varOffset%ALIGNMENT_M) ||
+            (0!=header.factorOffset%ALIGNMENT_M) ||
+            (0!=header.edgeOffset%ALIGNMENT_M) )
+   {
+      problem = " is truncated or corrupt.";
+   }
+
+   if(0!=problem)
+   {
+      ::munmap(pData_i,size_i);
+      throw FileFormatException("MappedGraph::MappedGraph",path + problem);
+   }
+
+} // MappedGraph constructor
+
+/**
+ * Unmaps the file.
+ */
+MappedGraph::~MappedGraph()
+{
+   ::munmap(pData_i,size_i);
+}
+
+/**
+ * Returns a pointer to a checked position in the file.
+ * @param[in] offset the byte offset from the start of the file.
+ * @param[in] noBytes the number of bytes that must follow it.
+ * @throws maxsum::FileFormatException if this range is not in the file.
+ */
+char* MappedGraph::at(unsigned long long offset, unsigned long long noBytes)
+   const
+{
+   if( (offset > size_i) || (noBytes > size_i-offset) ||
+       (0!=offset%ALIGNMENT_M) )
+   {
+      throw FileFormatException("MappedGraph::at",
+            "Record refers to data outside the file.");
+   }
+   return pData_i+offset;
+}
+
+/**
+ * Returns the number of variables in the file.
+ */
+std::size_t MappedGraph::noVars() const
+{
+   return reinterpret_cast<const FileHeader_m*>(pData_i)->noVars;
+}
+
+/**
+ * Returns the number of factors in the file.
+ */
+std::size_t MappedGraph::noFactors() const
+{
+   return reinterpret_cast<const FileHeader_m*>(pData_i)->noFactors;
+}
+
+/**
+ * Returns true if the file contains messages.
+ */
+bool MappedGraph::hasMessages() const
+{
+   const FileHeader_m& header = *reinterpret_cast<const FileHeader_m*>(pData_i);
+   return 0!=(header.flags & HAS_MESSAGES_M);
+}
+
+/**
+ * Registers the domain size of every variable in the file.
+ * @throws maxsum::InconsistentDomainException if any variable is
+ * already registered with a different domain size.
+ */
+void MappedGraph::registerVariables() const
+{
+   const FileHeader_m& header = *reinterpret_cast<const FileHeader_m*>(pData_i);
+   const VarRecord_m* pVars =
+      reinterpret_cast<const VarRecord_m*>(pData_i+header.varOffset);
+   for(Offset_m k=0; k<header.noVars; ++k)
+   {
+      registerVariable(pVars[k].id,pVars[k].size);
+   }
+
+} // function registerVariables
+
+/**
+ * Returns the id of the kth factor in the file.
+ * @param[in] k the position of the factor, in the range [0,noFactors()).
+ * @throws maxsum::OutOfRangeException if k is out of range.
+ */
+FactorID MappedGraph::factorID(std::size_t k) const
+{
+   const FileHeader_m& header = *reinterpret_cast<const FileHeader_m*>(pData_i);
+   if(header.noFactors<=k)
+   {
+      throw OutOfRangeException("MappedGraph::factorID",
+            "Factor index out of range.");
+   }
+   return reinterpret_cast<const FactorRecord_m*>
+      (pData_i+header.factorOffset)[k].id;
+
+} // function factorID
+
+/**
+ * Returns the kth factor in the file, whose values are borrowed from
+ * the mapping.
+ * @param[in] k the position of the factor, in the range [0,noFactors()).
+ * @throws maxsum::OutOfRangeException if k is out of range.
+ * @throws maxsum::FileFormatException if the factor record is invalid.
+ */
+DiscreteFunction MappedGraph::factor(std::size_t k) const
+{
+   const FileHeader_m& header = *reinterpret_cast<const FileHeader_m*>(pData_i);
+   if(header.noFactors<=k)
+   {
+      throw OutOfRangeException("MappedGraph::factor",
+            "Factor index out of range.");
+   }
+   const FactorRecord_m& record = reinterpret_cast<const FactorRecord_m*>
+      (pData_i+header.factorOffset)[k];
+
+   const Word_m* pDomain = reinterpret_cast<const Word_m*>
+      (at(record.domainOffset,record.noVars*sizeof(Word_m)));
+   ValType* pValues = reinterpret_cast<ValType*>
+      (at(record.valueOffset,record.noValues*sizeof(ValType)));
+
+   try
+   {
+      return DiscreteFunction(pDomain,pDomain+record.noVars,pValues,
+            record.noValues);
+   }
+   catch(BadDomainException& e)
+   {
+      throw FileFormatException("MappedGraph::factor",
+            "Factor domain does not match its value table.");
+   }
+
+} // function factor
+
+/**
+ * Registers every variable, and moves every factor into a controller,
+ * without copying their value tables. If the file contains messages,
+ * they are copied into the controller.
+ * @param[in,out] controller the controller to load into.
+ * @throws maxsum::FileFormatException if the file is invalid.
+ */
+void MappedGraph::load(MaxSumController& controller) const
+{
+   registerVariables();
+   const std::size_t noFac = noFactors();
+   for(std::size_t k=0; k<noFac; ++k)
+   {
+      controller.setFactor(factorID(k),factor(k));
+   }
+
+   if(!hasMessages())
+   {
+      return;
+   }
+
+   //***************************************************************************
+   // Restore both the current and previous messages along each edge, so
+   // that the next update only reports a change if the new message really
+   // differs from the saved one.
+   //***************************************************************************
+   const FileHeader_m& header = *reinterpret_cast<const FileHeader_m*>(pData_i);
+   const EdgeRecord_m* pEdges =
+      reinterpret_cast<const EdgeRecord_m*>(pData_i+header.edgeOffset);
+   for(Offset_m k=0; k<header.noEdges; ++k)
+   {
+      const EdgeRecord_m& edge = pEdges[k];
+      if(!controller.hasEdge(edge.factor,edge.var))
+      {
+         throw FileFormatException("MappedGraph::load",
+               "Saved message does not belong to an edge.");
+      }
+
+      const ValIndex size = getDomainSize(edge.var);
+      const ValType* pF2V = reinterpret_cast<const ValType*>
+         (at(edge.f2vOffset,size*sizeof(ValType)));
+      const ValType* pV2F = reinterpret_cast<const ValType*>
+         (at(edge.v2fOffset,size*sizeof(ValType)));
+
+      DiscreteFunction* msgs[] = {
+         controller.fac2varMsgs_i.curOutMsgs(edge.factor)[edge.var],
+         controller.fac2varMsgs_i.prevOutMsgs(edge.factor)[edge.var],
+         controller.var2facMsgs_i.curOutMsgs(edge.var)[edge.factor],
+         controller.var2facMsgs_i.prevOutMsgs(edge.var)[edge.factor] };
+      for(int m=0; m<4; ++m)
+      {
+         const ValType* pSrc = (2>m) ? pF2V : pV2F;
+         std::copy(pSrc,pSrc+size,&(*msgs[m])(0));
+      }
+   }
+
+} // function load
@@ -6,10 +6,27 @@
  */
 
 #include <maxsum/MaxSumController.h>
+#include <algorithm>
+#include <utility>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <set>
 
 using namespace maxsum;
 
+/**
+ * Default maximum maxnorm allowed between the old and new values
+ * of a message, before it is assumed to have converged. For single
+ * precision values, this is raised to stay above rounding error.
+ */
+#ifdef MAXSUM_FLOAT_VALUES
+const ValType MaxSumController::DEFAULT_MAXNORM_THRESHOLD=0.00001f;
+#else
+const ValType MaxSumController::DEFAULT_MAXNORM_THRESHOLD=0.0000001;
+#endif
+
 namespace
 {
 #ifndef MAXSUM_VERBOSE
@@ -76,6 +93,421 @@ namespace
 
 #endif // IF MAXSUM_VERBOSE
 
+   /**
+    * Returns the stride of a variable in the value table of a function, or
+    * 0 if the variable is not in the function's domain.
+    * @param[in] fun the function whose value table we want to index.
+    * @param[in] var the variable whose stride we want.
+    */
+   ValIndex varStride_m(const DiscreteFunction& fun, VarID var)
+   {
+      ValIndex stride = 1;
+      DiscreteFunction::SizeIterator sIt = fun.sizeBegin();
+      for(DiscreteFunction::VarIterator vIt=fun.varBegin();
+            vIt!=fun.varEnd(); ++vIt, ++sIt)
+      {
+         if(*vIt==var)
+         {
+            return stride;
+         }
+         stride *= *sIt;
+      }
+      return 0;
+
+   } // function varStride_m
+
+   /**
+    * Sets the values of one function equal to those of another, reusing
+    * the existing storage if both functions have the same domain.
+    * @param[in] inFun the function to copy.
+    * @param[out] outFun the function in which to store the copy.
+    */
+   void copyValues_m(const DiscreteFunction& inFun, DiscreteFunction& outFun)
+   {
+      if(!sameDomain(inFun,outFun))
+      {
+         outFun = inFun;
+         return;
+      }
+
+      const ValType* pIn = &inFun(0);
+      std::copy(pIn,pIn+inFun.domainSize(),&outFun(0));
+
+   } // function copyValues_m
+
+   /**
+    * Adds a single variable message to a value table with the same domain
+    * as a factor, which must include the message's variable. Unlike
+    * DiscreteFunction::operator+=, this works directly on the value table,
+    * and so never allocates memory.
+    * @param[in] factor function whose domain defines the table's layout.
+    * @param[in,out] pTotal the value table to add to.
+    * @param[in] msg the message to add.
+    */
+   void addMsg_m
+   (
+    const DiscreteFunction& factor,
+    ValType* pTotal,
+    const DiscreteFunction& msg
+   )
+   {
+      //************************************************************************
+      // Fall back to the general case for anything but single variable
+      // messages.
+      //************************************************************************
+      const ValIndex N = factor.domainSize();
+      const ValIndex stride = (1==msg.noVars()) ?
+         varStride_m(factor,*msg.varBegin()) : 0;
+
+      if(0==stride)
+      {
+         DiscreteFunction total(factor.varBegin(),factor.varEnd(),pTotal,N);
+         total += msg;
+         return;
+      }
+
+      //************************************************************************
+      // Each message value applies to a run of stride consecutive elements,
+      // which repeats every stride*size elements.
+      //************************************************************************
+      const ValIndex size = msg.domainSize();
+      const ValIndex block = stride*size;
+      const ValType* pMsg = &msg(0);
+      for(ValIndex base=0; base<N; base+=block)
+      {
+         for(ValIndex x=0; x<size; ++x)
+         {
+            const ValType val = pMsg[x];
+            ValType* pRun = pTotal + base + x*stride;
+            for(ValIndex t=0; t<stride; ++t)
+            {
+               pRun[t] += val;
+            }
+         }
+      }
+
+   } // function addMsg_m
+
+   /**
+    * Max marginalises the sum of a factor and all its input messages but one
+    * onto the variable of the remaining input message. This is equivalent to
+    * <code>maxMarginal(total-in,out)</code>, but is calculated without any
+    * temporary functions. This works because the remaining input message is
+    * constant over each slice of the total that is maximised.
+    * @param[in] factor function whose domain defines the total's layout.
+    * @param[in] pTotal the sum of the factor and all its input messages.
+    * @param[in] in the input message to exclude.
+    * @param[out] out the function in which to store the result.
+    * @param[in] prev the previous value of <code>out</code>.
+    * @returns the maxnorm of the difference between <code>out</code> and
+    * <code>prev</code>
+    */
+   ValType maxMarginalMinus_m
+   (
+    const DiscreteFunction& factor,
+    const ValType* pTotal,
+    const DiscreteFunction& in,
+    DiscreteFunction& out,
+    const DiscreteFunction& prev
+   )
+   {
+      //************************************************************************
+      // Fall back to the general case for anything but single variable
+      // messages.
+      //************************************************************************
+      const ValIndex N = factor.domainSize();
+      const ValIndex stride = ( (1==out.noVars()) && sameDomain(in,out) ) ?
+         varStride_m(factor,*out.varBegin()) : 0;
+
+      if(0==stride)
+      {
+         //*********************************************************************
+         // The total is shared by the factor's other outgoing messages, so
+         // the input is subtracted from an owned copy.
+         //*********************************************************************
+         DiscreteFunction sumOfOthers(factor.varBegin(),factor.varEnd());
+         std::copy(pTotal,pTotal+N,&sumOfOthers(0));
+         sumOfOthers -= in;
+         maxMarginal(sumOfOthers,out);
+         DiscreteFunction msgDiff(out);
+         msgDiff -= prev;
+         return msgDiff.maxnorm();
+      }
+
+      //************************************************************************
+      // Maximise each slice of the total, viewing it as a 3-D table whose
+      // middle axis is the message variable.
+      //************************************************************************
+      const ValIndex size = out.domainSize();
+      ValType* pOut = &out(0);
+      DomainMap::maxOntoAxis(pTotal,stride,size,N/(stride*size),pOut);
+
+      //************************************************************************
+      // Subtract the excluded input, and measure the change from the previous
+      // message.
+      //************************************************************************
+      const ValType* pIn = &in(0);
+      const ValType* pPrev = &prev(0);
+      ValType diff = 0;
+      for(ValIndex x=0; x<size; ++x)
+      {
+         pOut[x] -= pIn[x];
+         diff = std::max(diff,ValType(std::fabs(pOut[x]-pPrev[x])));
+      }
+      return diff;
+
+   } // function maxMarginalMinus_m
+
+   /**
+    * Returns the maxnorm of the difference between two messages with the
+    * same domain.
+    * @param[in] msg the new message.
+    * @param[in] prev the previous value of the message.
+    */
+   ValType maxnormDiff_m(const DiscreteFunction& msg,
+         const DiscreteFunction& prev)
+   {
+      const ValType* pMsg = &msg(0);
+      const ValType* pPrev = &prev(0);
+      ValType diff = 0;
+      for(ValIndex x=0; x<msg.domainSize(); ++x)
+      {
+         diff = std::max(diff,ValType(std::fabs(pMsg[x]-pPrev[x])));
+      }
+      return diff;
+
+   } // function maxnormDiff_m
+
+   /**
+    * Damps a message by moving it only part of the way from its previous
+    * value towards its new value.
+    * @param[in,out] msg the new message, which is replaced by the damped
+    * message.
+    * @param[in] prev the previous value of the message.
+    * @param[in] damping the weight given to the previous value.
+    * @returns the maxnorm of the difference between the damped message and
+    * <code>prev</code>
+    */
+   ValType dampMsg_m
+   (
+    DiscreteFunction& msg,
+    const DiscreteFunction& prev,
+    ValType damping
+   )
+   {
+      ValType* pMsg = &msg(0);
+      const ValType* pPrev = &prev(0);
+      ValType diff = 0;
+      for(ValIndex x=0; x<msg.domainSize(); ++x)
+      {
+         pMsg[x] = (1-damping)*pMsg[x] + damping*pPrev[x];
+         diff = std::max(diff,ValType(std::fabs(pMsg[x]-pPrev[x])));
+      }
+      return diff;
+
+   } // function dampMsg_m
+
+   /**
+    * Scheduler that ignores every node pushed onto it. This is used to
+    * update nodes without notifying their neighbours.
+    */
+   class NullScheduler_m : public Scheduler
+   {
+   public:
+
+      /**
+       * Ignores a node.
+       */
+      virtual void push(const Node&, ValType) {}
+
+      /**
+       * Never called, because this scheduler is always empty.
+       */
+      virtual Node pop()
+      {
+         return Node::factor(0);
+      }
+
+      /**
+       * Returns true, because nothing is ever scheduled.
+       */
+      virtual bool empty() const
+      {
+         return true;
+      }
+
+      /**
+       * Does nothing.
+       */
+      virtual void clear() {}
+
+      /**
+       * Returns a new copy of this scheduler.
+       */
+      virtual Scheduler* clone() const
+      {
+         return new NullScheduler_m();
+      }
+
+   }; // class NullScheduler_m
+
+   /**
+    * Provides the initial message for a new factor to variable edge, which
+    * is zero over the variable's domain.
+    */
+   struct FacToVarMsg_m
+   {
+      DiscreteFunction operator()(FactorID, VarID var) const
+      {
+         return DiscreteFunction(var,0);
+      }
+   };
+
+   /**
+    * Provides the initial message for a new variable to factor edge, which
+    * is zero over the variable's domain.
+    */
+   struct VarToFacMsg_m
+   {
+      DiscreteFunction operator()(VarID var, FactorID) const
+      {
+         return DiscreteFunction(var,0);
+      }
+   };
+
+   /**
+    * Returns a function that borrows the value table of another, over a
+    * specified domain. Borrowed tables are shared by the controller, and
+    * are never written through the borrowing function, because
+    * MaxSumController::unshareFactor() replaces it first.
+    * @param[in] begin the start of the sorted domain.
+    * @param[in] end the end of the sorted domain.
+    * @param[in] table the function whose values are borrowed, whose
+    * domain has the same size.
+    */
+   template<class VarIt> DiscreteFunction borrowTable_m
+   (
+    VarIt begin,
+    VarIt end,
+    const DiscreteFunction& table
+   )
+   {
+      return DiscreteFunction(begin,end,const_cast<ValType*>(&table(0)),
+            table.domainSize());
+
+   } // function borrowTable_m
+
+   /**
+    * Returns a function that borrows the value table of another, over the
+    * same domain.
+    * @param[in] table the function whose values are borrowed.
+    */
+   DiscreteFunction borrowTable_m(const DiscreteFunction& table)
+   {
+      return borrowTable_m(table.varBegin(),table.varEnd(),table);
+
+   } // function borrowTable_m
+
+   /**
+    * Copies a table into a new domain, in which each of its variables is
+    * replaced by another, possibly in a different order.
+    * @param[in] table the table to copy.
+    * @param[in] vars the variable that replaces each of the table's
+    * variables, with the same domain size.
+    * @param[in] order the position in <code>vars</code> of each variable in
+    * the result, in ascending order of variable.
+    * @returns a function over the variables in <code>vars</code>, whose
+    * value for each assignment is the table's value for the same
+    * assignment to the replaced variables.
+    */
+   DiscreteFunction permuteTable_m
+   (
+    const DiscreteFunction& table,
+    const std::vector<VarID>& vars,
+    const std::vector<int>& order
+   )
+   {
+      //************************************************************************
+      // Find the stride in the table of each variable in the result.
+      //************************************************************************
+      const int noVars = table.noVars();
+      std::vector<ValIndex> tableStrides(noVars);
+      ValIndex stride = 1;
+      for(int k=0; k<noVars; ++k)
+      {
+         tableStrides[k] = stride;
+         stride *= table.sizeBegin()[k];
+      }
+
+      std::vector<VarID> resultVars(noVars);
+      std::vector<ValIndex> sizes(noVars);
+      std::vector<ValIndex> strides(noVars);
+      for(int j=0; j<noVars; ++j)
+      {
+         resultVars[j] = vars[order[j]];
+         sizes[j] = table.sizeBegin()[order[j]];
+         strides[j] = tableStrides[order[j]];
+      }
+
+      //************************************************************************
+      // Visit the result in order, stepping through the table like an
+      // odometer.
+      //************************************************************************
+      DiscreteFunction result(resultVars.begin(),resultVars.end());
+      std::vector<ValIndex> count(noVars,0);
+      ValIndex pos = 0;
+      for(ValIndex k=0; k<result.domainSize(); ++k)
+      {
+         result(k) = table(pos);
+         for(int j=0; j<noVars; ++j)
+         {
+            pos += strides[j];
+            if(sizes[j] > ++count[j])
+            {
+               break;
+            }
+            pos -= count[j]*strides[j];
+            count[j] = 0;
+         }
+      }
+      return result;
+
+   } // function permuteTable_m
+
+   /**
+    * Reordered copy of a shared table, which keeps the original alive.
+    */
+   struct PermutedTable_m
+   {
+      /**
+       * The table from which this copy was made.
+       */
+      MaxSumController::SharedTable original;
+
+      /**
+       * The reordered copy.
+       */
+      DiscreteFunction table;
+   };
+
+#ifdef MAXSUM_STATS
+
+   /**
+    * Returns the number of seconds since a specified time, and resets the
+    * time to now.
+    * @param[in,out] start the start time.
+    */
+   double lapSeconds_m(MaxSumController::Clock::time_point& start)
+   {
+      const MaxSumController::Clock::time_point now =
+         MaxSumController::Clock::now();
+      const double seconds = std::chrono::duration<double>(now-start).count();
+      start = now;
+      return seconds;
+   }
+
+#endif
+
 } // module namespace
 
 /**
@@ -106,7 +538,8 @@ std::ostream& maxsum::operator<<(std::ostream& out,
    for(F2VPostOffice::SenderIt it=controller.fac2varMsgs_i.senderBegin();
          it!=controller.fac2varMsgs_i.senderEnd(); ++it)
    {
-      F2VPostOffice::OutMsgMap msgs = controller.fac2varMsgs_i.curOutMsgs(*it);
+      const F2VPostOffice& fac2varMsgs = controller.fac2varMsgs_i;
+      F2VPostOffice::OutMsgMap msgs = fac2varMsgs.curOutMsgs(*it);
       for(F2VPostOffice::OutMsgIt k=msgs.begin(); k!=msgs.end(); ++k)
       {
          out << "F" << *it << "->V" << k->first << ": ";
@@ -122,7 +555,8 @@ std::ostream& maxsum::operator<<(std::ostream& out,
    for(V2FPostOffice::SenderIt it=controller.var2facMsgs_i.senderBegin();
          it!=controller.var2facMsgs_i.senderEnd(); ++it)
    {
-      V2FPostOffice::OutMsgMap msgs = controller.var2facMsgs_i.curOutMsgs(*it);
+      const V2FPostOffice& var2facMsgs = controller.var2facMsgs_i;
+      V2FPostOffice::OutMsgMap msgs = var2facMsgs.curOutMsgs(*it);
       for(F2VPostOffice::OutMsgIt k=msgs.begin(); k!=msgs.end(); ++k)
       {
          out << "V" << *it << "->F" << k->first << ": ";
@@ -146,6 +580,35 @@ std::ostream& maxsum::operator<<(std::ostream& out,
 
 } // maxsum::operator<<
 
+/**
+ * Returns the total value for a specified factor.
+ * The total value is the factor plus the sum of all its received messages,
+ * which is calculated from the current messages.
+ * @returns the total value for this factor.
+ * @throws maxsum::NoSuchElementException if the specified factor is not a
+ * (dense) factor known to this maxsum::MaxSumController.
+ */
+const DiscreteFunction& MaxSumController::getTotalValue(FactorID fac) const
+{
+   FactorMap::const_iterator pos = factors_i.find(fac);
+   if(factors_i.end()==pos)
+   {
+      throw new NoSuchElementException
+         ("MaxSumController::getTotalValue()",
+          "No such factor in factor graph.");
+   }
+
+   DiscreteFunction& total = factorTotalValue_i[fac];
+   copyValues_m(pos->second,total);
+   util::V2FPostOffice::InMsgMap inMsgs = var2facMsgs_i.curInMsgs(fac);
+   for(util::V2FPostOffice::InMsgIt it=inMsgs.begin(); it!=inMsgs.end(); ++it)
+   {
+      addMsg_m(total,&total(0),*(it->second));
+   }
+   return total;
+
+} // function getTotalValue
+
 /**
  * Accessor method for factor function.
  * @param[in] id the unique identifier of the desired factor.
@@ -159,137 +622,494 @@ std::ostream& maxsum::operator<<(std::ostream& out,
 void MaxSumController::setFactor(FactorID id, const DiscreteFunction& factor)
 {
    //***************************************************************************
-   // Set the specified factor. (Note: oldValue is created automatically if
-   // necessary).
+   // Copy the factor first, so that it is safe to pass one of our own
+   // factors, and then move the copy into place.
    //***************************************************************************
-   DiscreteFunction& oldValue = factors_i[id];
+   setFactor(id,DiscreteFunction(factor));
+
+} // function setFactor
+
+/**
+ * Accessor method for factor function, which takes ownership of the factor's
+ * value table rather than copying it.
+ * @param[in] id the unique identifier of the desired factor.
+ * @param[in,out] factor the function representing this factor.
+ * @post \c factor is moved into this maxsum::MaxSumController and used to
+ * form part of a factor graph, and is left as the constant function 0.
+ * @post Any previous value of the specified factor is overwritten.
+ */
+void MaxSumController::setFactor(FactorID id, DiscreteFunction&& factor)
+{
+   setFactorDomain(id,factor.varBegin(),factor.varEnd());
 
    //***************************************************************************
-   // If this factor is currently related to any variables that it is no
-   // longer related to, delete the appropriate edges.
+   // Set the specified factor to its new value. A factor that borrows a
+   // shared table is replaced, rather than assigned, so that its new values
+   // are not written into the shared table.
    //***************************************************************************
-   std::vector<VarID> toRemove(oldValue.noVars());
-   std::set_difference(oldValue.varBegin(),oldValue.varEnd(),
-         factor.varBegin(),factor.varEnd(),toRemove.begin());
-
-   for(std::vector<VarID>::const_iterator it=toRemove.begin();
-         it!=toRemove.end(); ++it)
+   structured_i.erase(id);
+   if(0!=sharedTables_i.erase(id))
    {
-      //************************************************************************
-      // Remove the redundant edges from the postoffice graphs
-      //************************************************************************
-      fac2varMsgs_i.removeEdge(id,*it);
-      var2facMsgs_i.removeEdge(*it,id);
+      factors_i.erase(id);
+   }
+   factors_i[id] = std::move(factor);
 
-      //************************************************************************
-      // If the variable is no longer related to any factors, then we remove
-      // it from the value list.
-      //************************************************************************
-      if(!var2facMsgs_i.hasSender(*it))
+} // function setFactor
+
+/**
+ * Sets a factor that borrows its values from a shared table.
+ * @param[in] id the unique identifier of the factor.
+ * @param[in] table the shared table.
+ * @param[in] vars the variable bound to each variable of the table.
+ * @throws maxsum::BadDomainException if the bound variables are not
+ * distinct, or do not match the table's domain.
+ * @see MaxSumController::setFactor(FactorID,const SharedTable&,VarIt,VarIt)
+ */
+void MaxSumController::setSharedFactor
+(
+ FactorID id,
+ const SharedTable& table,
+ const std::vector<VarID>& vars
+)
+{
+   //***************************************************************************
+   // Check that each bound variable has the same domain size as the table
+   // variable it replaces.
+   //***************************************************************************
+   const int noVars = vars.size();
+   if( !table || (table->noVars()!=noVars) )
+   {
+      throw BadDomainException("MaxSumController::setFactor",
+            "Bound variables do not match shared table domain.");
+   }
+   for(int k=0; k<noVars; ++k)
+   {
+      if(getDomainSize(vars[k])!=table->sizeBegin()[k])
       {
-         values_i.erase(*it);
+         throw BadDomainException("MaxSumController::setFactor",
+               "Bound variable domain size does not match shared table.");
       }
-
-   } // for loop
+   }
 
    //***************************************************************************
-   // For each variable in this factor's domain
+   // Sort the bound variables, remembering the table variable that each
+   // one replaces.
    //***************************************************************************
-   for(DiscreteFunction::VarIterator it=factor.varBegin();
-         it!=factor.varEnd(); ++it)
+   std::vector<int> order(noVars);
+   bool isSorted = true;
+   for(int k=0; k<noVars; ++k)
    {
-      //************************************************************************
-      // Initialise input and output messages between the factor and
-      // the current variable
-      //************************************************************************
-      DiscreteFunction msgTemplate(*it,0);
-      fac2varMsgs_i.addEdge(id,*it,msgTemplate);
-      var2facMsgs_i.addEdge(*it,id,msgTemplate);
+      order[k] = k;
+      isSorted = isSorted && ( (0==k) || (vars[k-1]<vars[k]) );
+   }
+   std::vector<VarID> sortedVars(vars);
+   if(!isSorted)
+   {
+      std::sort(order.begin(),order.end(),
+            [&vars](int a, int b) { return vars[a]<vars[b]; });
+      for(int j=0; j<noVars; ++j)
+      {
+         sortedVars[j] = vars[order[j]];
+         if( (0<j) && (sortedVars[j-1]==sortedVars[j]) )
+         {
+            throw BadDomainException("MaxSumController::setFactor",
+                  "Bound variables must be distinct.");
+         }
+      }
+   }
 
-      //************************************************************************
-      // Touch the variable to ensure that it is in the value list.
-      //************************************************************************
-      ValueMap::iterator pos = values_i.find(*it);
-      if(values_i.end()==pos)
+   //***************************************************************************
+   // If the variables are bound in a different order, the factor reads a
+   // reordered copy of the table, which is shared with every other factor
+   // that binds the same table in the same order. Expired copies are
+   // forgotten whenever a new one is made.
+   //***************************************************************************
+   SharedTable source = table;
+   if(!isSorted)
+   {
+      std::weak_ptr<const DiscreteFunction>& cached =
+         permutedTables_i[PermutationKey(table.get(),order)];
+      source = cached.lock();
+      if(!source)
       {
-         values_i[*it]=0;
+         std::shared_ptr<PermutedTable_m> pCopy =
+            std::make_shared<PermutedTable_m>();
+         pCopy->original = table;
+         pCopy->table = permuteTable_m(*table,vars,order);
+         source = SharedTable(pCopy,&pCopy->table);
+         cached = source;
+
+         for(PermutedTableMap::iterator it=permutedTables_i.begin();
+               it!=permutedTables_i.end(); )
+         {
+            if(it->second.expired())
+            {
+               permutedTables_i.erase(it++);
+            }
+            else
+            {
+               ++it;
+            }
+         }
       }
+   }
 
-   } // for loop
+   //***************************************************************************
+   // Replace any previous value of the factor with a view of the table.
+   //***************************************************************************
+   setFactorDomain(id,sortedVars.data(),sortedVars.data()+noVars);
+   structured_i.erase(id);
+   factors_i.erase(id);
+   factors_i.emplace(id,borrowTable_m(sortedVars.begin(),sortedVars.end(),
+            *source));
+   sharedTables_i[id] = source;
+
+} // function setSharedFactor
 
+/**
+ * Sets a factor that is defined by its structure, rather than a dense table.
+ * @param[in] id the unique identifier of the desired factor.
+ * @param[in] factor the structured factor. This controller keeps its own
+ * copy.
+ * @post Any previous value of the specified factor is overwritten.
+ */
+void MaxSumController::setFactor(FactorID id, const StructuredFactor& factor)
+{
    //***************************************************************************
-   // Set the specified factor to its new value.
+   // Copy the factor first, so that it is safe to pass one of our own
+   // factors.
    //***************************************************************************
-   factors_i[id] = factor;
+   std::shared_ptr<const StructuredFactor> pCopy(factor.clone());
+   setFactorDomain(id,pCopy->varBegin(),pCopy->varEnd());
 
    //***************************************************************************
-   // Tell everyone to recheck their mail. Telling everyone to recheck is the
-   // safest option, because the factor graph may have changed.
+   // Set the specified factor to its new value. Structured factors have no
+   // total value.
    //***************************************************************************
-   var2facMsgs_i.notifyAll();
+   factors_i.erase(id);
+   sharedTables_i.erase(id);
+   factorTotalValue_i.erase(id);
+   structured_i[id] = pCopy;
 
 } // function setFactor
 
 /**
- * Removes the specified factor from this controller's factor graph.
- * In addition, any variables that were previously only connected to this
- * factor, will also be removed from the factor graph. Notice that this
- * does not require the remaining nodes to form a connected graph, but
- * it does mean that variables or factors connect exist in isolation.
- * For example, although every variable and factor must have at least one
- * edge, two variable-factor graph pairs may exist without any edges
- * between the pairs.
- * @param[in] id the id of the factor to remove from the graph.
- * @post If the specified factor was previously in the factor graph,
- * it will be removed by this function.
- * @post Any variables that were previously only connected to this
- * factor, will also be removed from the factor graph.
+ * Sets many factors at once.
+ * @param[in] factors the factors to set, indexed by their unique identifiers.
+ * @see MaxSumController::setFactors(FactorMap&&)
  */
-void MaxSumController::removeFactor(FactorID id)
+void MaxSumController::setFactors(const FactorMap& factors)
 {
    //***************************************************************************
-   // If the specified factor is not in the factor graph, then we are done.
+   // Copy the factors first, so that it is safe to pass our own factors.
    //***************************************************************************
-   FactorMap::iterator facPos = factors_i.find(id);
-   if(factors_i.end()==facPos)
+   setFactors(FactorMap(factors));
+
+} // function setFactors
+
+/**
+ * Sets many factors at once, taking ownership of their value tables.
+ * Factors that are already in the graph may change their domain, so are
+ * replaced one at a time by ::setFactor(). The edges for every new factor
+ * are collected and added to each post office in a single call, and each
+ * affected node is notified once.
+ * @param[in,out] factors the factors to set, indexed by their unique
+ * identifiers.
+ */
+void MaxSumController::setFactors(FactorMap&& factors)
+{
+   //***************************************************************************
+   // Count the edges, so that every list can be allocated once.
+   //***************************************************************************
+   std::size_t noEdges = 0;
+   for(FactorMap::const_iterator it=factors.begin(); it!=factors.end(); ++it)
    {
-      return;
+      noEdges += it->second.noVars();
    }
-   DiscreteFunction& factor = facPos->second;
+
+   std::vector<std::pair<FactorID,VarID> > fac2varEdges;
+   std::vector<std::pair<VarID,FactorID> > var2facEdges;
+   std::vector<VarID> vars;
+   std::vector<FactorMap::iterator> newFactors;
+   fac2varEdges.reserve(noEdges);
+   var2facEdges.reserve(noEdges);
+   vars.reserve(noEdges);
+   newFactors.reserve(factors.size());
 
    //***************************************************************************
-   // Otherwise, for each variable in this factor's domain
+   // Collect the edges of each new factor, and replace existing factors.
    //***************************************************************************
-   for(DiscreteFunction::VarIterator it=factor.varBegin();
-         it!=factor.varEnd(); ++it)
+   for(FactorMap::iterator it=factors.begin(); it!=factors.end(); ++it)
    {
-      //************************************************************************
-      // Delete the input and output messages.
-      //************************************************************************
-      fac2varMsgs_i.removeEdge(id,*it);
-      var2facMsgs_i.removeEdge(*it,id);
+      const FactorID id = it->first;
+      if(hasFactor(id))
+      {
+         setFactor(id,std::move(it->second));
+         continue;
+      }
+
+      for(DiscreteFunction::VarIterator v=it->second.varBegin();
+            v!=it->second.varEnd(); ++v)
+      {
+         fac2varEdges.push_back(std::make_pair(id,*v));
+         var2facEdges.push_back(std::make_pair(*v,id));
+         vars.push_back(*v);
+      }
+      newFactors.push_back(it);
+   }
+
+   if(newFactors.empty())
+   {
+      return;
+   }
+
+   //***************************************************************************
+   // Add every new edge to both post offices.
+   //***************************************************************************
+   fac2varMsgs_i.addEdges(std::move(fac2varEdges),FacToVarMsg_m());
+   var2facMsgs_i.addEdges(std::move(var2facEdges),VarToFacMsg_m());
+
+   //***************************************************************************
+   // Touch each variable once, in order, to ensure that it is in the value
+   // list, and notify it so that it sends a message along its new edges.
+   //***************************************************************************
+   std::sort(vars.begin(),vars.end());
+   vars.erase(std::unique(vars.begin(),vars.end()),vars.end());
+
+   ValueMap::iterator valHint = values_i.begin();
+   for(std::vector<VarID>::const_iterator it=vars.begin();
+         it!=vars.end(); ++it)
+   {
+      valHint = values_i.insert(valHint,ValueMap::value_type(*it,0));
+      ++valHint;
+      fac2varMsgs_i.notify(*it);
+   }
+
+   //***************************************************************************
+   // Move the new factors into place, in order, and tell each one to check
+   // its mail.
+   //***************************************************************************
+   FactorMap::iterator facHint = factors_i.begin();
+   for(std::vector<FactorMap::iterator>::const_iterator it=newFactors.begin();
+         it!=newFactors.end(); ++it)
+   {
+      const FactorID id = (*it)->first;
+      facHint = factors_i.emplace_hint(facHint,id,std::move((*it)->second));
+      ++facHint;
+      var2facMsgs_i.notify(id);
+   }
+
+   //***************************************************************************
+   // The factor graph has changed, so any compiled copy is now invalid.
+   //***************************************************************************
+   compiled_i = false;
+   recompile_i = false;
+   treeOrderValid_i = false;
+   flatGraph_i.clear();
+
+} // function setFactors
+
+/**
+ * Updates the edges of the factor graph for a new factor domain.
+ * Edges to variables that are no longer in the factor's domain are removed,
+ * and edges to new variables are added.
+ * @param[in] id the factor whose domain is changing.
+ * @param[in] begin start of the new sorted domain.
+ * @param[in] end end of the new sorted domain.
+ */
+void MaxSumController::setFactorDomain
+(
+ FactorID id,
+ const VarID* begin,
+ const VarID* end
+)
+{
+   //***************************************************************************
+   // Find the factor's current domain, if it has one.
+   //***************************************************************************
+   const VarID* oldBegin = 0;
+   const VarID* oldEnd = 0;
+   FactorMap::const_iterator facPos = factors_i.find(id);
+   StructuredMap::const_iterator structPos = structured_i.find(id);
+   if(factors_i.end()!=facPos)
+   {
+      oldBegin = facPos->second.varBegin();
+      oldEnd = facPos->second.varEnd();
+   }
+   else if(structured_i.end()!=structPos)
+   {
+      oldBegin = structPos->second->varBegin();
+      oldEnd = structPos->second->varEnd();
+   }
+
+   //***************************************************************************
+   // If this factor is currently related to any variables that it is no
+   // longer related to, delete the appropriate edges.
+   //***************************************************************************
+   std::vector<VarID> toRemove(oldEnd-oldBegin);
+   toRemove.erase(std::set_difference(oldBegin,oldEnd,begin,end,
+            toRemove.begin()),toRemove.end());
+
+   for(std::vector<VarID>::const_iterator it=toRemove.begin();
+         it!=toRemove.end(); ++it)
+   {
+      //************************************************************************
+      // Remove the redundant edges from the postoffice graphs
+      //************************************************************************
+      fac2varMsgs_i.removeEdge(id,*it);
+      var2facMsgs_i.removeEdge(*it,id);
 
       //************************************************************************
       // If the variable is no longer related to any factors, then we remove
-      // it from the value list.
+      // it from the value list. Otherwise, it has lost an input, so it needs
+      // to recheck its mail.
       //************************************************************************
       if(!var2facMsgs_i.hasSender(*it))
       {
          values_i.erase(*it);
       }
+      else
+      {
+         fac2varMsgs_i.notify(*it);
+      }
+
+   } // for loop
+
+   //***************************************************************************
+   // For each variable in this factor's domain
+   //***************************************************************************
+   for(const VarID* it=begin; it!=end; ++it)
+   {
+      //************************************************************************
+      // Initialise input and output messages between the factor and
+      // the current variable
+      //************************************************************************
+      DiscreteFunction msgTemplate(*it,0);
+      fac2varMsgs_i.addEdge(id,*it,msgTemplate);
+      var2facMsgs_i.addEdge(*it,id,msgTemplate);
+
+      //************************************************************************
+      // The variable needs to recheck its mail, so that it sends a message
+      // along any new edge.
+      //************************************************************************
+      fac2varMsgs_i.notify(*it);
+
+      //************************************************************************
+      // Touch the variable to ensure that it is in the value list.
+      //************************************************************************
+      ValueMap::iterator pos = values_i.find(*it);
+      if(values_i.end()==pos)
+      {
+         values_i[*it]=0;
+      }
 
    } // for loop
 
    //***************************************************************************
-   // Finally, we delete the factor from the factors_i map
+   // The factor graph may have changed, so any compiled copy is now invalid.
+   //***************************************************************************
+   compiled_i = false;
+   recompile_i = false;
+   treeOrderValid_i = false;
+   flatGraph_i.clear();
+
+   //***************************************************************************
+   // Tell the factor to recheck its mail. Together with the variables
+   // notified above, this covers everything affected by the change. Any
+   // further changes will propagate as normal when messages are updated.
+   //***************************************************************************
+   var2facMsgs_i.notify(id);
+
+} // function setFactorDomain
+
+/**
+ * Removes the specified factor from this controller's factor graph.
+ * In addition, any variables that were previously only connected to this
+ * factor, will also be removed from the factor graph. Notice that this
+ * does not require the remaining nodes to form a connected graph, but
+ * it does mean that variables or factors connect exist in isolation.
+ * For example, although every variable and factor must have at least one
+ * edge, two variable-factor graph pairs may exist without any edges
+ * between the pairs.
+ * @param[in] id the id of the factor to remove from the graph.
+ * @post If the specified factor was previously in the factor graph,
+ * it will be removed by this function.
+ * @post Any variables that were previously only connected to this
+ * factor, will also be removed from the factor graph.
+ */
+void MaxSumController::removeFactor(FactorID id)
+{
+   //***************************************************************************
+   // If the specified factor is not in the factor graph, then we are done.
+   //***************************************************************************
+   FactorMap::iterator facPos = factors_i.find(id);
+   StructuredMap::iterator structPos = structured_i.find(id);
+   const VarID* begin = 0;
+   const VarID* end = 0;
+   if(factors_i.end()!=facPos)
+   {
+      begin = facPos->second.varBegin();
+      end = facPos->second.varEnd();
+   }
+   else if(structured_i.end()!=structPos)
+   {
+      begin = structPos->second->varBegin();
+      end = structPos->second->varEnd();
+   }
+   else
+   {
+      return;
+   }
+
+   //***************************************************************************
+   // Otherwise, for each variable in this factor's domain
    //***************************************************************************
-   factors_i.erase(facPos);
+   for(const VarID* it=begin; it!=end; ++it)
+   {
+      //************************************************************************
+      // Delete the input and output messages.
+      //************************************************************************
+      fac2varMsgs_i.removeEdge(id,*it);
+      var2facMsgs_i.removeEdge(*it,id);
+
+      //************************************************************************
+      // If the variable is no longer related to any factors, then we remove
+      // it from the value list.
+      //************************************************************************
+      if(!var2facMsgs_i.hasSender(*it))
+      {
+         values_i.erase(*it);
+      }
+
+      //************************************************************************
+      // Otherwise, the variable has lost an input, so tell it to recheck
+      // its mail. Other factors and variables will be notified as normal
+      // if this changes any of the variable's output messages.
+      //************************************************************************
+      else
+      {
+         fac2varMsgs_i.notify(*it);
+      }
+
+   } // for loop
 
    //***************************************************************************
-   // Tell all factors and variables to recheck their mail.
+   // Finally, we delete the factor from the factors_i or structured_i map
    //***************************************************************************
-   var2facMsgs_i.notifyAll();
-   fac2varMsgs_i.notifyAll();
+   if(factors_i.end()!=facPos)
+   {
+      factors_i.erase(facPos);
+      sharedTables_i.erase(id);
+   }
+   else
+   {
+      structured_i.erase(structPos);
+   }
+   factorTotalValue_i.erase(id);
+   compiled_i = false;
+   recompile_i = false;
+   treeOrderValid_i = false;
+   flatGraph_i.clear();
 
 } // function removeFactor
 
@@ -305,12 +1125,111 @@ void MaxSumController::removeFactor(FactorID id)
    // Clear all data structures.
    //***************************************************************************
    factors_i.clear();
+   sharedTables_i.clear();
+   permutedTables_i.clear();
+   structured_i.clear();
    values_i.clear();
    fac2varMsgs_i.clear();
    var2facMsgs_i.clear();
+   flatGraph_i.clear();
+   compiled_i = false;
+   recompile_i = false;
+   treeOrderValid_i = false;
 
 } // function clear
 
+/**
+ * Returns a new copy of this controller, which is owned by the caller, and
+ * shares its factor tables and messages with this controller until either
+ * of them modifies them.
+ * @see MaxSumController.h
+ */
+MaxSumController* MaxSumController::fork()
+{
+   MaxSumController* pFork = new MaxSumController(maxIterations_i,
+         maxNormThreshold_i,damping_i,freezeAfter_i);
+
+   //***************************************************************************
+   // Share each factor table that is too large to store inline, by moving
+   // it into a shared table that both controllers borrow. Smaller tables
+   // are copied with their factors, which is no more expensive, and ensures
+   // that copying a shared table never writes into it in place.
+   //***************************************************************************
+   for(FactorMap::iterator it=factors_i.begin(); it!=factors_i.end(); ++it)
+   {
+      DiscreteFunction& fun = it->second;
+      if(DiscreteFunction::INLINE_VALUES >= std::size_t(fun.domainSize()))
+      {
+         pFork->factors_i.emplace_hint(pFork->factors_i.end(),it->first,fun);
+         continue;
+      }
+
+      SharedTable& pTable = sharedTables_i[it->first];
+      if(!pTable)
+      {
+         pTable = std::make_shared<DiscreteFunction>(std::move(fun));
+         fun = borrowTable_m(*pTable);
+      }
+      pFork->factors_i.emplace_hint(pFork->factors_i.end(),it->first,
+            borrowTable_m(fun));
+      pFork->sharedTables_i.emplace_hint(pFork->sharedTables_i.end(),
+            it->first,pTable);
+   }
+
+   //***************************************************************************
+   // Share the messages, and copy everything else, apart from the compiled
+   // graph and cached total values.
+   //***************************************************************************
+   fac2varMsgs_i.fork(pFork->fac2varMsgs_i);
+   var2facMsgs_i.fork(pFork->var2facMsgs_i);
+   pFork->permutedTables_i = permutedTables_i;
+   pFork->structured_i = structured_i;
+   pFork->values_i = values_i;
+   pFork->history_i = history_i;
+   pFork->msgCount_i = msgCount_i;
+   pFork->pruneDomains_i = pruneDomains_i;
+   if(0!=scheduler_i)
+   {
+      pFork->scheduler_i = scheduler_i->clone();
+   }
+   pFork->treeSchedule_i = treeSchedule_i;
+   pFork->treeOrderValid_i = treeOrderValid_i;
+   pFork->treeOrder_i = treeOrder_i;
+   pFork->treeBounds_i = treeBounds_i;
+   pFork->snapshot_i = getValueSnapshot();
+   pFork->pObserver_i = pObserver_i;
+   return pFork;
+
+} // function fork
+
+/**
+ * Gives a factor its own copy of its table, if it is shared with other
+ * factors, a fork of this controller, or a controller it was forked from.
+ * @param[in,out] pos the position of the factor in factors_i, which is
+ * updated if the factor is replaced.
+ */
+void MaxSumController::unshareFactor(FactorMap::iterator& pos)
+{
+   SharedTableMap::iterator tablePos = sharedTables_i.find(pos->first);
+   if(sharedTables_i.end()==tablePos)
+   {
+      return;
+   }
+
+   //***************************************************************************
+   // Shared tables are immutable, and may be bound to different variables,
+   // so the factor always gets a copy of the values it currently borrows.
+   // The factor is replaced, rather than assigned, because assigning a
+   // function with the same domain to a borrowed table writes into it.
+   //***************************************************************************
+   const FactorID id = pos->first;
+   DiscreteFunction copy(pos->second);
+   factors_i.erase(pos++);
+   pos = factors_i.emplace_hint(pos,id,std::move(copy));
+   sharedTables_i.erase(tablePos);
+
+} // function unshareFactor
+
 /**
  * Infer the factor graph from the given factor domains.
  * This function populates all member variables of MaxSumController by
@@ -357,178 +1276,333 @@ void MaxSumController::inferGraph()
 } // inferGraph
 
 /**
- * Updates factor to variable messages.
- * This function only needs to update messages that have changed
- * significantly since the last iteration. A significant change
- * is one which exceeds the maxNormThreshold_i or results in a
- * change in variable assignment.
- * @returns the number of updated messages.
+ * Adds a dense copy of every structured factor to a factor map.
+ * @param[in,out] factors the map to add to.
  */
-int MaxSumController::updateFac2VarMsgs()
+void MaxSumController::expandStructured(FactorMap& factors) const
+{
+   for(StructuredMap::const_iterator it=structured_i.begin();
+         it!=structured_i.end(); ++it)
+   {
+      it->second->expand(factors[it->first]);
+   }
+
+} // function expandStructured
+
+/**
+ * Updates all output messages of a single factor.
+ * @param[in] fac the factor to update.
+ * @param[in] pScheduler if not null, each variable whose input message has
+ * changed is pushed onto this scheduler. Otherwise, it is notified through
+ * the factor to variable post office.
+ */
+void MaxSumController::updateFactor(FactorID fac, Scheduler* pScheduler)
 {
    using namespace util;
+
    //***************************************************************************
-   // For each factor with a non-empty inbox
+   // Swap the old messages with the new ones, so that the new ones become
+   // old, and the old ones become new. We can then overwrite the old ones.
+   // Swapping like this prevents us having to create lots of temporary
+   // objects, by reusing the old ones that we no longer need.
    //***************************************************************************
-   while(var2facMsgs_i.newMail())
+   fac2varMsgs_i.swapOutBoxes(fac);
+
+   V2FPostOffice::InMsgMap curInMsgs = var2facMsgs_i.curInMsgs(fac);
+   F2VPostOffice::OutMsgMap curOutMsgs = fac2varMsgs_i.curOutMsgs(fac);
+   F2VPostOffice::OutMsgMap prevOutMsgs = fac2varMsgs_i.prevOutMsgs(fac);
+   const DiscreteFunction* pFactor = 0;
+   ValType* pTotal = 0;
+
+   //***************************************************************************
+   // Structured factors calculate all their output messages at once,
+   // directly from their input messages.
+   //***************************************************************************
+   StructuredMap::const_iterator structPos = structured_i.find(fac);
+   if(structured_i.end()!=structPos)
    {
-      //************************************************************************
-      // Get the next factor that has new mail.
-      //************************************************************************
-      FactorID fac = var2facMsgs_i.popNotice();
+      const StructuredFactor& factor = *structPos->second;
+      inScratch_i.clear();
+      outScratch_i.clear();
+      for(StructuredFactor::VarIterator it=factor.varBegin();
+            it!=factor.varEnd(); ++it)
+      {
+         inScratch_i.push_back(&(*curInMsgs[*it])(0));
+         outScratch_i.push_back(&(*curOutMsgs[*it])(0));
+      }
+      factor.maxMarginals(inScratch_i,outScratch_i);
+   }
 
-      //************************************************************************
-      // Swap the old messages with the new ones, so that the new ones become
-      // old, and the old ones become new. We can then overwrite the old ones.
-      // Swapping like this prevents us having to create lots of temporary
-      // objects, by reusing the old ones that we no longer need.
-      //************************************************************************
-      fac2varMsgs_i.swapOutBoxes(fac);
+   //***************************************************************************
+   // Otherwise, calculate the total sum of this factor and all its input
+   // messages. The sum is stored in scratch space shared by all factors,
+   // which only grows until it fits the largest one.
+   //***************************************************************************
+   else
+   {
+      pFactor = &factors_i[fac];
+      const ValIndex N = pFactor->domainSize();
+      if(static_cast<ValIndex>(totalScratch_i.size()) < N)
+      {
+         totalScratch_i.resize(N);
+      }
+      pTotal = totalScratch_i.data();
+      const ValType* pIn = &(*pFactor)(0);
+      std::copy(pIn,pIn+N,pTotal);
 
-      //************************************************************************
-      // Calculate the total sum of this factor and all its input messages
-      //************************************************************************
-      DiscreteFunction& msgSum = factorTotalValue_i[fac];
-      msgSum = factors_i[fac];
-      V2FPostOffice::InMsgMap curInMsgs = var2facMsgs_i.curInMsgs(fac);
       typedef V2FPostOffice::InMsgIt InMsgIt;
       for(InMsgIt it=curInMsgs.begin(); it!=curInMsgs.end(); ++it)
       {
-         msgSum += *(it->second);
+         addMsg_m(*pFactor,pTotal,*(it->second));
       }
+   }
 
+   //***************************************************************************
+   // Update the output messages for each connected neighbour
+   //***************************************************************************
+   typedef F2VPostOffice::OutMsgIt OutMsgIt;
+   for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+   {
       //************************************************************************
-      // Update the output messages for each connected neighbour
+      // Calculate the updated message for the current neighbour by
+      // subtracting the neighbour's last message from the message sum, and
+      // max marginalising.
       //************************************************************************
-      F2VPostOffice::OutMsgMap curOutMsgs = fac2varMsgs_i.curOutMsgs(fac);
-      F2VPostOffice::OutMsgMap prevOutMsgs = fac2varMsgs_i.prevOutMsgs(fac);
-      typedef F2VPostOffice::OutMsgIt OutMsgIt;
-      for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+      DiscreteFunction& prevOutMsg = *prevOutMsgs[it->first];
+      DiscreteFunction& curOutMsg = *(it->second);
+      DiscreteFunction& curInMsg = *curInMsgs[it->first];
+      ValType msgDiff = (0==pFactor) ? maxnormDiff_m(curOutMsg,prevOutMsg) :
+         maxMarginalMinus_m(*pFactor,pTotal,curInMsg,curOutMsg,prevOutMsg);
+      if(0<damping_i)
       {
-         //*********************************************************************
-         // Calculate the updated message for the current neighbour by
-         // subtracting the neighbour's last message from the message sum, and
-         // max marginalising.
-         //*********************************************************************
-         DiscreteFunction sumOfOthers(msgSum);
-         DiscreteFunction& prevOutMsg = *prevOutMsgs[it->first];
-         DiscreteFunction& curOutMsg = *(it->second);
-         DiscreteFunction& curInMsg = *curInMsgs[it->first];
-         sumOfOthers -= curInMsg;
-         maxMarginal(sumOfOthers,curOutMsg);
+         msgDiff = dampMsg_m(curOutMsg,prevOutMsg,damping_i);
+      }
+      ++msgCount_i;
+      MAXSUM_STATS_ONLY
+      (
+         ++stats_i.fac2varUpdates;
+         stats_i.maxResidual = std::max(stats_i.maxResidual,msgDiff);
+      )
 
-         //*********************************************************************
-         // If the max norm threshold has been passed, tell the current 
-         // neighbour that they have mail.
-         //*********************************************************************
-         DiscreteFunction msgDiff(curOutMsg);
-         msgDiff -= prevOutMsg;
-         if(msgDiff.maxnorm() > maxNormThreshold_i)
+      //************************************************************************
+      // If the max norm threshold has been passed, tell the current 
+      // neighbour that they have mail.
+      //************************************************************************
+      if(msgDiff > maxNormThreshold_i)
+      {
+         if(0!=pScheduler)
+         {
+            pScheduler->push(Scheduler::Node::variable(it->first),msgDiff);
+         }
+         else
          {
             fac2varMsgs_i.notify(it->first);
          }
+      }
 
-      } // for loop
-
-   } // while loop
-
-   //***************************************************************************
-   // Return the number of updated factor to variable messages
-   //***************************************************************************
-   return fac2varMsgs_i.noticeCount();
+   } // for loop
 
-} // updateFac2VarMsgs
+} // updateFactor
 
 /**
- * Updates variable to factor messages.
- * This function only needs to update messages that have changed
- * significantly since the last iteration. A significant change
- * is one which exceeds the maxNormThreshold_i or results in a
- * change in variable assignment.
+ * Updates all output messages of a single variable, and its value.
+ * @param[in] var the variable to update.
+ * @param[in] pScheduler if not null, each factor whose input message has
+ * changed is pushed onto this scheduler. Otherwise, it is notified through
+ * the variable to factor post office.
  * @post Each message is normalised so that the sum of its values is 0.
- * @returns the number of updated messages.
  */
-int MaxSumController::updateVar2FacMsgs()
+void MaxSumController::updateVariable(VarID var, Scheduler* pScheduler)
 {
    using namespace util;
+
    //***************************************************************************
-   // For each variable with a non-empty inbox
+   // Frozen variables keep their current value and output messages.
    //***************************************************************************
-   while(fac2varMsgs_i.newMail())
+   if(0<freezeAfter_i)
    {
-      //************************************************************************
-      // Get the next variable that has new mail.
-      //************************************************************************
-      VarID var = fac2varMsgs_i.popNotice();
-
-      //************************************************************************
-      // Swap the old messages with the new ones, so that the new ones become
-      // old, and the old ones become new. We can then overwrite the old ones.
-      // Swapping like this prevents us having to create lots of temporary
-      // objects, by reusing the old ones that we no longer need.
-      //************************************************************************
-      var2facMsgs_i.swapOutBoxes(var);
-
-      //************************************************************************
-      // Calculate the total sum of all input messages
-      //************************************************************************
-      DiscreteFunction msgSum(&var,(&var)+1,0);
-      F2VPostOffice::InMsgMap curInMsgs = fac2varMsgs_i.curInMsgs(var);
-      typedef F2VPostOffice::InMsgIt InMsgIt;
-      for(InMsgIt it=curInMsgs.begin(); it!=curInMsgs.end(); ++it)
+      std::map<VarID,ValueHistory>::const_iterator pos = history_i.find(var);
+      if( (history_i.end()!=pos) && (freezeAfter_i<=pos->second.flips) )
       {
-         msgSum += *(it->second);
+         return;
       }
+   }
+
+   //***************************************************************************
+   // Swap the old messages with the new ones, so that the new ones become
+   // old, and the old ones become new. We can then overwrite the old ones.
+   // Swapping like this prevents us having to create lots of temporary
+   // objects, by reusing the old ones that we no longer need.
+   //***************************************************************************
+   var2facMsgs_i.swapOutBoxes(var);
 
+   //***************************************************************************
+   // Calculate the total sum of all input messages. The sum is stored in
+   // reusable scratch space, so that we don't need to allocate a new
+   // function for each variable.
+   //***************************************************************************
+   F2VPostOffice::InMsgMap curInMsgs = fac2varMsgs_i.curInMsgs(var);
+   typedef F2VPostOffice::InMsgIt InMsgIt;
+   if(curInMsgs.begin()==curInMsgs.end())
+   {
+      return;
+   }
+
+   const ValIndex size = curInMsgs.begin()->second->domainSize();
+   sumScratch_i.assign(size,0);
+   for(InMsgIt it=curInMsgs.begin(); it!=curInMsgs.end(); ++it)
+   {
+      const ValType* pIn = &(*(it->second))(0);
+      for(ValIndex x=0; x<size; ++x)
+      {
+         sumScratch_i[x] += pIn[x];
+      }
+   }
+
+   //***************************************************************************
+   // Update the output messages for each connected neighbour
+   //***************************************************************************
+   V2FPostOffice::OutMsgMap curOutMsgs = var2facMsgs_i.curOutMsgs(var);
+   V2FPostOffice::OutMsgMap prevOutMsgs = var2facMsgs_i.prevOutMsgs(var);
+   typedef V2FPostOffice::OutMsgIt OutMsgIt;
+   ValType maxDiff = 0;
+   for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+   {
       //************************************************************************
-      // Update the output messages for each connected neighbour
+      // Calculate the updated message for the current neighbour by
+      // subtracting the neighbour's last message from the message sum,
+      // and normalising the result so that its values sum to zero.
       //************************************************************************
-      V2FPostOffice::OutMsgMap curOutMsgs = var2facMsgs_i.curOutMsgs(var);
-      V2FPostOffice::OutMsgMap prevOutMsgs = var2facMsgs_i.prevOutMsgs(var);
-      typedef V2FPostOffice::OutMsgIt OutMsgIt;
-      for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+      const ValType* pPrev = &(*prevOutMsgs[it->first])(0);
+      const ValType* pIn = &(*curInMsgs[it->first])(0);
+      ValType* pOut = &(*(it->second))(0);
+
+      ValType mean = 0;
+      for(ValIndex x=0; x<size; ++x)
       {
-         //*********************************************************************
-         // Calculate the updated message for the current neighbour subtracting
-         // the neighbour's last message from the message sum.
-         //*********************************************************************
-         DiscreteFunction& prevOutMsg = *prevOutMsgs[it->first];
-         DiscreteFunction& curOutMsg = *(it->second);
-         DiscreteFunction& curInMsg = *curInMsgs[it->first];
-         curOutMsg = msgSum;
-         curOutMsg -= curInMsg;
+         pOut[x] = sumScratch_i[x] - pIn[x];
+         mean += pOut[x];
+      }
+      mean /= size;
 
-         //*********************************************************************
-         // Normalise the current output message
-         //*********************************************************************
-         curOutMsg -= curOutMsg.mean();
+      ValType msgDiff = 0;
+      for(ValIndex x=0; x<size; ++x)
+      {
+         pOut[x] -= mean;
+         msgDiff = std::max(msgDiff,ValType(std::fabs(pOut[x]-pPrev[x])));
+      }
+      maxDiff = std::max(maxDiff,msgDiff);
+      ++msgCount_i;
+      MAXSUM_STATS_ONLY(++stats_i.var2facUpdates;)
 
-         //*********************************************************************
-         // If the max norm threshold has been passed, tell the current 
-         // neighbour that they have mail.
-         //*********************************************************************
-         DiscreteFunction msgDiff(curOutMsg);
-         msgDiff -= prevOutMsg;
-         if(msgDiff.maxnorm() > maxNormThreshold_i)
+      //************************************************************************
+      // If the max norm threshold has been passed, tell the current 
+      // neighbour that they have mail.
+      //************************************************************************
+      if(msgDiff > maxNormThreshold_i)
+      {
+         if(0!=pScheduler)
+         {
+            pScheduler->push(Scheduler::Node::factor(it->first),msgDiff);
+         }
+         else
          {
             var2facMsgs_i.notify(it->first);
          }
+      }
 
-      } // for loop
+   } // for loop
 
-      //************************************************************************
-      // If the optimal value for this variable has changed, update its value,
-      // and tell all neighbours to check their mail.
-      //************************************************************************
-      ValIndex& curValue = values_i[var];
-      ValIndex bestValue = msgSum.argmax();
-      if(bestValue != curValue)
+   //***************************************************************************
+   // If the optimal value for this variable has changed, update its value,
+   // and tell its neighbours to check their mail.
+   //***************************************************************************
+   ValIndex& curValue = values_i[var];
+   ValIndex bestValue = 0;
+   for(ValIndex x=1; x<size; ++x)
+   {
+      if(sumScratch_i[x] > sumScratch_i[bestValue])
       {
-         curValue = bestValue;
-         var2facMsgs_i.notifyAll();
+         bestValue = x;
       }
+   }
 
-   } // while loop
+   MAXSUM_STATS_ONLY
+   (
+      stats_i.maxResidual = std::max(stats_i.maxResidual,maxDiff);
+   )
+
+   if(bestValue != curValue)
+   {
+      if(0<freezeAfter_i)
+      {
+         ValueHistory& history = history_i[var];
+         if(bestValue==history.lastValue)
+         {
+            ++history.flips;
+         }
+         history.lastValue = curValue;
+      }
+      curValue = bestValue;
+      MAXSUM_STATS_ONLY(++stats_i.valueChanges;)
+      for(OutMsgIt it=curOutMsgs.begin(); it!=curOutMsgs.end(); ++it)
+      {
+         if(0!=pScheduler)
+         {
+            pScheduler->push(Scheduler::Node::factor(it->first),maxDiff);
+         }
+         else
+         {
+            var2facMsgs_i.notify(it->first);
+         }
+      }
+   }
+
+} // updateVariable
+
+/**
+ * Updates factor to variable messages.
+ * This function only needs to update messages that have changed
+ * significantly since the last iteration. A significant change
+ * is one which exceeds the maxNormThreshold_i or results in a
+ * change in variable assignment.
+ * @returns the number of updated messages.
+ */
+int MaxSumController::updateFac2VarMsgs()
+{
+   //***************************************************************************
+   // For each factor with a non-empty inbox
+   //***************************************************************************
+   while(var2facMsgs_i.newMail())
+   {
+      updateFactor(var2facMsgs_i.popNotice(),0);
+   }
+
+   //***************************************************************************
+   // Return the number of updated factor to variable messages
+   //***************************************************************************
+   return fac2varMsgs_i.noticeCount();
+
+} // updateFac2VarMsgs
+
+/**
+ * Updates variable to factor messages.
+ * This function only needs to update messages that have changed
+ * significantly since the last iteration. A significant change
+ * is one which exceeds the maxNormThreshold_i or results in a
+ * change in variable assignment.
+ * @post Each message is normalised so that the sum of its values is 0.
+ * @returns the number of updated messages.
+ */
+int MaxSumController::updateVar2FacMsgs()
+{
+   //***************************************************************************
+   // For each variable with a non-empty inbox
+   //***************************************************************************
+   while(fac2varMsgs_i.newMail())
+   {
+      updateVariable(fac2varMsgs_i.popNotice(),0);
+   }
 
    //***************************************************************************
    // Return the number of updated variable to factor messages
@@ -537,6 +1611,398 @@ int MaxSumController::updateVar2FacMsgs()
 
 } // updateVar2FacMsgs
 
+/**
+ * Runs the max-sum algorithm on the uncompiled factor graph, in the order
+ * chosen by this controller's scheduler.
+ * Each node that currently has new mail is scheduled first, ahead of any
+ * node scheduled while the algorithm runs. If the update limit is reached,
+ * any nodes still scheduled are returned to the post offices, so that the
+ * next call to ::optimise() carries on from where this one stopped.
+ * Every noNodes updates count as one iteration, after which the deadline
+ * and cancellation are checked, and the values are published if requested.
+ * @param[in] deadline time after which no further iterations are started.
+ * @param[in] publish true if the values should be published after each
+ * iteration.
+ * @returns the number of updates performed, divided by the number of
+ * nodes in the factor graph and rounded up. This is comparable to the
+ * number of iterations performed by the default schedule.
+ */
+int MaxSumController::optimiseScheduled(const Deadline& deadline, bool publish)
+{
+   //***************************************************************************
+   // An empty graph has nothing to schedule, and no nodes to count updates
+   // against.
+   //***************************************************************************
+   const long noNodes = static_cast<long>(noFactors()+values_i.size());
+   if(0==noNodes)
+   {
+      return 0;
+   }
+
+   Scheduler& scheduler = *scheduler_i;
+   scheduler.clear();
+
+   //***************************************************************************
+   // Schedule every node with new mail ahead of everything else.
+   //***************************************************************************
+   const ValType pending = std::numeric_limits<ValType>::max();
+   while(var2facMsgs_i.newMail())
+   {
+      scheduler.push(Scheduler::Node::factor(var2facMsgs_i.popNotice()),
+            pending);
+   }
+
+   while(fac2varMsgs_i.newMail())
+   {
+      scheduler.push(Scheduler::Node::variable(fac2varMsgs_i.popNotice()),
+            pending);
+   }
+
+   //***************************************************************************
+   // Update nodes in order until nothing is left to do, or we have done the
+   // same number of updates as the maximum number of flooding iterations.
+   //***************************************************************************
+   const long maxUpdates = noNodes*maxIterations_i;
+   long updateCount = 0;
+   MAXSUM_STATS_ONLY(beginStats(1);)
+   while(!scheduler.empty() && updateCount<maxUpdates)
+   {
+      const Scheduler::Node node = scheduler.pop();
+      MAXSUM_STATS_ONLY(Clock::time_point lap = Clock::now();)
+      if(node.isFactor)
+      {
+         updateFactor(node.id,scheduler_i);
+         MAXSUM_STATS_ONLY(stats_i.fac2varSeconds += lapSeconds_m(lap);)
+      }
+      else
+      {
+         updateVariable(node.id,scheduler_i);
+         MAXSUM_STATS_ONLY(stats_i.var2facSeconds += lapSeconds_m(lap);)
+      }
+      ++updateCount;
+
+      if(0==updateCount%noNodes)
+      {
+         MAXSUM_STATS_ONLY
+         (
+            endStats();
+            beginStats(static_cast<int>(updateCount/noNodes)+1);
+         )
+
+         if(publish)
+         {
+            publishValues(values_i);
+         }
+
+         if(stopRequested(deadline))
+         {
+            break;
+         }
+      }
+   }
+
+   MAXSUM_STATS_ONLY
+   (
+      if(0!=updateCount%noNodes)
+      {
+         endStats();
+      }
+   )
+
+   if(publish)
+   {
+      publishValues(values_i);
+   }
+
+   //***************************************************************************
+   // Hand back anything left over to the post offices.
+   //***************************************************************************
+   while(!scheduler.empty())
+   {
+      const Scheduler::Node node = scheduler.pop();
+      if(node.isFactor)
+      {
+         var2facMsgs_i.notify(node.id);
+      }
+      else
+      {
+         fac2varMsgs_i.notify(node.id);
+      }
+   }
+
+   return static_cast<int>((updateCount+noNodes-1)/noNodes);
+
+} // optimiseScheduled
+
+/**
+ * Finds the acyclic components of the factor graph, and stores them in
+ * treeOrder_i and treeBounds_i. A connected component is acyclic if and only
+ * if it has one fewer edge than it has nodes.
+ */
+void MaxSumController::buildTreeOrder()
+{
+   using namespace util;
+   treeOrder_i.clear();
+   treeBounds_i.clear();
+
+   //***************************************************************************
+   // Every component contains at least one factor, so we can find them all
+   // by searching from each factor not yet seen.
+   //***************************************************************************
+   std::vector<FactorID> roots;
+   for(FactorMap::const_iterator it=factors_i.begin();
+         it!=factors_i.end(); ++it)
+   {
+      roots.push_back(it->first);
+   }
+   for(StructuredMap::const_iterator it=structured_i.begin();
+         it!=structured_i.end(); ++it)
+   {
+      roots.push_back(it->first);
+   }
+
+   std::set<FactorID> seenFactors;
+   std::set<VarID> seenVars;
+   std::vector<Scheduler::Node> component;
+   for(std::vector<FactorID>::const_iterator rootIt=roots.begin();
+         rootIt!=roots.end(); ++rootIt)
+   {
+      if(!seenFactors.insert(*rootIt).second)
+      {
+         continue;
+      }
+
+      //************************************************************************
+      // Search the component breadth first, counting each edge once from
+      // its factor.
+      //************************************************************************
+      const F2VPostOffice& fac2varMsgs = fac2varMsgs_i;
+      const V2FPostOffice& var2facMsgs = var2facMsgs_i;
+      component.clear();
+      component.push_back(Scheduler::Node::factor(*rootIt));
+      std::size_t noEdges = 0;
+      for(std::size_t k=0; k<component.size(); ++k)
+      {
+         const Scheduler::Node node = component[k];
+         if(node.isFactor)
+         {
+            F2VPostOffice::OutMsgMap outMsgs = fac2varMsgs.curOutMsgs(node.id);
+            for(F2VPostOffice::OutMsgIt it=outMsgs.begin();
+                  it!=outMsgs.end(); ++it)
+            {
+               ++noEdges;
+               if(seenVars.insert(it->first).second)
+               {
+                  component.push_back(Scheduler::Node::variable(it->first));
+               }
+            }
+         }
+         else
+         {
+            V2FPostOffice::OutMsgMap outMsgs = var2facMsgs.curOutMsgs(node.id);
+            for(V2FPostOffice::OutMsgIt it=outMsgs.begin();
+                  it!=outMsgs.end(); ++it)
+            {
+               if(seenFactors.insert(it->first).second)
+               {
+                  component.push_back(Scheduler::Node::factor(it->first));
+               }
+            }
+         }
+      }
+
+      //************************************************************************
+      // Keep the component only if it is acyclic.
+      //************************************************************************
+      if(noEdges+1==component.size())
+      {
+         treeBounds_i.push_back(treeOrder_i.size());
+         treeOrder_i.insert(treeOrder_i.end(),component.begin(),
+               component.end());
+      }
+   }
+   treeBounds_i.push_back(treeOrder_i.size());
+   treeOrderValid_i = true;
+
+} // function buildTreeOrder
+
+/**
+ * Solves every acyclic component of the factor graph that has new mail, by
+ * updating its nodes once from the leaves to the root, and once from the
+ * root to the leaves. Afterwards, only nodes in loopy components have new
+ * mail.
+ * @returns the number of components updated.
+ */
+int MaxSumController::optimiseTrees()
+{
+   if(!treeOrderValid_i)
+   {
+      buildTreeOrder();
+   }
+
+   //***************************************************************************
+   // Collect every node with new mail.
+   //***************************************************************************
+   std::set<FactorID> facMail;
+   std::set<VarID> varMail;
+   while(var2facMsgs_i.newMail())
+   {
+      facMail.insert(var2facMsgs_i.popNotice());
+   }
+   while(fac2varMsgs_i.newMail())
+   {
+      varMail.insert(fac2varMsgs_i.popNotice());
+   }
+
+   //***************************************************************************
+   // Update each acyclic component with new mail. Neighbours are not
+   // notified of changes, because the order of the passes already ensures
+   // that every node sees the final value of each message it depends on.
+   //***************************************************************************
+   NullScheduler_m discard;
+   const ValType damping = damping_i;
+   damping_i = 0;
+   int noUpdated = 0;
+   for(std::size_t c=0; c+1<treeBounds_i.size(); ++c)
+   {
+      const int begin = treeBounds_i[c];
+      const int end = treeBounds_i[c+1];
+      bool hasMail = false;
+      for(int k=begin; k<end; ++k)
+      {
+         const Scheduler::Node& node = treeOrder_i[k];
+         const std::size_t erased = node.isFactor ?
+            facMail.erase(node.id) : varMail.erase(node.id);
+         hasMail = hasMail || (0<erased);
+      }
+
+      if(!hasMail)
+      {
+         continue;
+      }
+
+      //************************************************************************
+      // The passes count as one iteration, which is only reported if some
+      // component is actually updated.
+      //************************************************************************
+      if(0==noUpdated)
+      {
+         MAXSUM_STATS_ONLY(beginStats(1);)
+      }
+      ++noUpdated;
+
+      //************************************************************************
+      // Pass messages from the leaves up to the root, and then back down
+      // again. The root's last update in the first pass already uses all
+      // its final input messages, so it is not repeated.
+      //************************************************************************
+      for(int k=end-1; k>=begin; --k)
+      {
+         const Scheduler::Node& node = treeOrder_i[k];
+         if(node.isFactor)
+         {
+            updateFactor(node.id,&discard);
+         }
+         else
+         {
+            updateVariable(node.id,&discard);
+         }
+      }
+
+      for(int k=begin+1; k<end; ++k)
+      {
+         const Scheduler::Node& node = treeOrder_i[k];
+         if(node.isFactor)
+         {
+            updateFactor(node.id,&discard);
+         }
+         else
+         {
+            updateVariable(node.id,&discard);
+         }
+      }
+   }
+   damping_i = damping;
+
+   //***************************************************************************
+   // Hand back mail for loopy components to the post offices.
+   //***************************************************************************
+   for(std::set<FactorID>::const_iterator it=facMail.begin();
+         it!=facMail.end(); ++it)
+   {
+      var2facMsgs_i.notify(*it);
+   }
+   for(std::set<VarID>::const_iterator it=varMail.begin();
+         it!=varMail.end(); ++it)
+   {
+      fac2varMsgs_i.notify(*it);
+   }
+
+   if(0<noUpdated)
+   {
+      MAXSUM_STATS_ONLY(endStats();)
+   }
+   return noUpdated;
+
+} // function optimiseTrees
+
+/**
+ * Publishes a copy of a set of variable values, which can be safely read
+ * by other threads via ::getValueSnapshot().
+ * @param[in] values the values to publish.
+ */
+void MaxSumController::publishValues(const ValueMap& values)
+{
+   ValueSnapshot snapshot = std::make_shared<const ValueMap>(values);
+   std::atomic_store(&snapshot_i,snapshot);
+
+} // function publishValues
+
+/**
+ * Returns true if the current optimisation should stop, either because it
+ * has been cancelled, or because its deadline has passed.
+ * @param[in] deadline the deadline for the current optimisation.
+ */
+bool MaxSumController::stopRequested(const Deadline& deadline) const
+{
+   if(cancelled_i.load(std::memory_order_relaxed))
+   {
+      return true;
+   }
+   return (Deadline::max()!=deadline) && (Clock::now()>=deadline);
+
+} // function stopRequested
+
+/**
+ * Starts collecting statistics for a new iteration.
+ * @param[in] iteration the iteration number.
+ */
+void MaxSumController::beginStats(int iteration)
+{
+   //***************************************************************************
+   // The allocation count starts negative, so that adding the count at the
+   // end of the iteration leaves the number of allocations in between.
+   //***************************************************************************
+   stats_i = IterationStats();
+   stats_i.iteration = iteration;
+   stats_i.allocations = -util::allocationCount();
+
+} // function beginStats
+
+/**
+ * Reports the statistics for the current iteration to the observer, if
+ * there is one.
+ */
+void MaxSumController::endStats()
+{
+   stats_i.allocations += util::allocationCount();
+   if(0!=pObserver_i)
+   {
+      pObserver_i->iterationDone(stats_i);
+   }
+
+} // function endStats
+
 /**
  * Runs the max-sum algorithm to optimise the values for each variable.
  * @post maxsum::MaxSumController::getValue will return the optimal value
@@ -544,53 +2010,322 @@ int MaxSumController::updateVar2FacMsgs()
  */
 int MaxSumController::optimise()
 {
+   cancelled_i.store(false);
+   return runOptimise(Deadline::max(),false);
+
+} // optimise function
+
+/**
+ * Runs the max-sum algorithm until convergence, the maximum number of
+ * iterations, a deadline, or cancellation, whichever comes first.
+ * @param[in] deadline time after which no further iterations are started.
+ * @returns the number of max-sum iterations performed.
+ */
+int MaxSumController::optimise(const Deadline& deadline)
+{
+   cancelled_i.store(false);
+   return runOptimise(deadline,true);
+
+} // optimise function
+
+/**
+ * Runs ::optimise(const Deadline&) on a new thread.
+ * @param[in] deadline time after which no further iterations are started.
+ * @returns a future holding the number of max-sum iterations performed.
+ */
+std::future<int> MaxSumController::optimiseAsync(const Deadline& deadline)
+{
+   //***************************************************************************
+   // Reset cancellation here, rather than on the worker thread, so that
+   // cancel() takes effect even if it is called before the worker starts.
+   //***************************************************************************
+   cancelled_i.store(false);
+   return std::async(std::launch::async,
+         &MaxSumController::runOptimise,this,deadline,true);
+
+} // function optimiseAsync
+
+/**
+ * Runs the max-sum algorithm to optimise the values for each variable.
+ * @param[in] deadline time after which no further iterations are started.
+ * @param[in] publish true if the values should be published after each
+ * iteration, for ::getValueSnapshot().
+ * @returns the number of max-sum iterations performed.
+ */
+int MaxSumController::runOptimise(const Deadline& deadline, bool publish)
+{
+   msgCount_i = 0;
+   history_i.clear();
+
+   //***************************************************************************
+   // If the factor graph is compiled, then we use the compiled version
+   // of the algorithm instead. This is always the case for multiple threads,
+   // because only the compiled version can be run in parallel.
+   //***************************************************************************
+   if( (1<noThreads() && !compiled_i) || recompile_i )
+   {
+      compile();
+   }
+
+   if(compiled_i)
+   {
+      return optimiseCompiled(deadline,publish);
+   }
+
+   //***************************************************************************
+   // Solve any acyclic components exactly first, counting this as one
+   // iteration.
+   //***************************************************************************
+   int iterationCount = 0;
+   if(treeSchedule_i)
+   {
+      if(0<optimiseTrees())
+      {
+         ++iterationCount;
+         if(publish)
+         {
+            publishValues(values_i);
+         }
+      }
+   }
+
+   if(0!=scheduler_i)
+   {
+      return iterationCount + optimiseScheduled(deadline,publish);
+   }
+
    //***************************************************************************
    // While the algorithm has not converged, or the maximum number of
    // iterations has not been reached.
    //***************************************************************************
-   //std::cout << "OPTIMISING...\n";
-   int iterationCount = 0;
    while(iterationCount<maxIterations_i)
    {
       //************************************************************************
       // Update the number of iterations that we've performed
       //************************************************************************
       ++iterationCount;
-      //std::cout << "ITERATION: " << iterationCount << std::endl;
 
       //************************************************************************
-      // Update the factor to variable messages
+      // Update the factor to variable messages, followed by the variable to
+      // factor messages.
       //************************************************************************
-      //std::cout << "UPDATING FAC2VAR MESSAGES...\n";
+      MAXSUM_STATS_ONLY
+      (
+         beginStats(iterationCount);
+         Clock::time_point lap = Clock::now();
+      )
       int numOfUpdates = updateFac2VarMsgs();
-      //std::cout << *this << std::endl;
-      //int tmp = numOfUpdates;
-      //std::cout << "NUMBER OF FAC2VAR UPDATES: " << numOfUpdates << "\n";
-
-      //************************************************************************
-      // Update the variable to factor messages
-      //************************************************************************
-      //std::cout << "UPDATING VAR2FAC MESSAGES...\n";
+      MAXSUM_STATS_ONLY(stats_i.fac2varSeconds = lapSeconds_m(lap);)
       numOfUpdates += updateVar2FacMsgs();
-      //std::cout << *this << std::endl;
-      //std::cout << "NUMBER OF VAR2FAC UPDATES: " << numOfUpdates-tmp << "\n";
+      MAXSUM_STATS_ONLY
+      (
+         stats_i.var2facSeconds = lapSeconds_m(lap);
+         endStats();
+      )
+
+      if(publish)
+      {
+         publishValues(values_i);
+      }
 
       //************************************************************************
       // If there have been no message updates since the last iteration, then
-      // we've converged, so we can stop.
+      // we've converged, so we can stop. Otherwise, stop only if asked to.
       //************************************************************************
-      if(0==numOfUpdates)
+      if( (0==numOfUpdates) || stopRequested(deadline) )
       {
          break;
       }
 
    } // while loop
-   //std::cout << "DONE\n\n";
 
    //***************************************************************************
    // Return the number of iterations performed.
    //***************************************************************************
    return iterationCount;
 
-} // optimise function
+} // function runOptimise
+
+
+/**
+ * Freezes the current factor graph into a compiled form, which is
+ * stored in contiguous arrays rather than node based maps.
+ * Any messages and values from previous calls to optimise() are carried
+ * over into the compiled graph.
+ * @post isCompiled() returns true.
+ */
+void MaxSumController::compile()
+{
+   using namespace util;
+
+   //***************************************************************************
+   // The compiled graph only stores dense tables, so any structured factors
+   // must be expanded first.
+   //***************************************************************************
+   if(structured_i.empty())
+   {
+      flatGraph_i.build(factors_i,pruneDomains_i);
+   }
+   else
+   {
+      FactorMap expanded(factors_i);
+      expandStructured(expanded);
+      flatGraph_i.build(expanded,pruneDomains_i);
+   }
+
+   //***************************************************************************
+   // Warm start the compiled graph from the current variable values.
+   //***************************************************************************
+   for(int v=0; v<flatGraph_i.noVars(); ++v)
+   {
+      flatGraph_i.setValue(v,values_i[flatGraph_i.varId(v)]);
+   }
+
+   //***************************************************************************
+   // Copy across the current messages along each edge, for the values kept
+   // in the compiled graph. These are only read, so any messages shared
+   // with a fork stay shared.
+   //***************************************************************************
+   const F2VPostOffice& fac2varMsgs = fac2varMsgs_i;
+   for(int f=0; f<flatGraph_i.noFactors(); ++f)
+   {
+      FactorID fac = flatGraph_i.factorId(f);
+      F2VPostOffice::OutMsgMap f2vMsgs = fac2varMsgs.curOutMsgs(fac);
+      V2FPostOffice::InMsgMap v2fMsgs = var2facMsgs_i.curInMsgs(fac);
+
+      for(int e=flatGraph_i.edgeBegin(f); e<flatGraph_i.edgeEnd(f); ++e)
+      {
+         const int v = flatGraph_i.edgeVar(e);
+         VarID var = flatGraph_i.varId(v);
+         const DiscreteFunction& f2v = *f2vMsgs[var];
+         const DiscreteFunction& v2f = *v2fMsgs[var];
+         ValType* flatF2V = flatGraph_i.fac2varMsg(e);
+         ValType* flatV2F = flatGraph_i.var2facMsg(e);
+         for(ValIndex k=0; k<flatGraph_i.edgeSize(e); ++k)
+         {
+            flatF2V[k] = f2v(flatGraph_i.keptValue(v,k));
+            flatV2F[k] = v2f(flatGraph_i.keptValue(v,k));
+         }
+      }
+
+   } // for loop
+
+   compiled_i = true;
+   recompile_i = false;
+
+} // function compile
+
+/**
+ * Runs the max-sum algorithm on the compiled factor graph, and
+ * copies the results back into the values, messages and total values
+ * maintained by this controller.
+ * @param[in] deadline time after which no further iterations are started.
+ * @param[in] publish true if the values should be published after each
+ * iteration.
+ * @returns the number of max-sum iterations performed.
+ */
+int MaxSumController::optimiseCompiled(const Deadline& deadline, bool publish)
+{
+   using namespace util;
+   flatGraph_i.setDamping(damping_i);
+   flatGraph_i.setFreezeAfter(freezeAfter_i);
+
+   //***************************************************************************
+   // Without a deadline or publishing, the compiled graph can run the whole
+   // algorithm itself. Otherwise, we run one iteration at a time, so that
+   // we can check the deadline, and publish values, between iterations.
+   //***************************************************************************
+   int iterationCount = 0;
+   if( !publish && Deadline::max()==deadline
+       MAXSUM_STATS_ONLY(&& 0==pObserver_i) )
+   {
+      iterationCount = flatGraph_i.optimise(maxIterations_i,
+            maxNormThreshold_i);
+   }
+   else
+   {
+      while(iterationCount<maxIterations_i)
+      {
+         ++iterationCount;
+         MAXSUM_STATS_ONLY
+         (
+            beginStats(iterationCount);
+            flatGraph_i.resetStats();
+            Clock::time_point lap = Clock::now();
+         )
+         int numOfUpdates = flatGraph_i.updateFac2VarMsgs(maxNormThreshold_i);
+         MAXSUM_STATS_ONLY(stats_i.fac2varSeconds = lapSeconds_m(lap);)
+         numOfUpdates += flatGraph_i.updateVar2FacMsgs(maxNormThreshold_i);
+         MAXSUM_STATS_ONLY
+         (
+            stats_i.var2facSeconds = lapSeconds_m(lap);
+            stats_i.fac2varUpdates = flatGraph_i.noEdges();
+            stats_i.var2facUpdates = flatGraph_i.noEdges();
+            stats_i.maxResidual = flatGraph_i.maxResidual();
+            stats_i.valueChanges = flatGraph_i.noValueChanges();
+            endStats();
+         )
+
+         if(publish)
+         {
+            ValueMap snapshot(values_i);
+            ValueMap::iterator valIt = snapshot.begin();
+            for(int v=0; v<flatGraph_i.noVars(); ++v, ++valIt)
+            {
+               valIt->second = flatGraph_i.getValue(v);
+            }
+            publishValues(snapshot);
+         }
+
+         if( (0==numOfUpdates) || stopRequested(deadline) )
+         {
+            break;
+         }
+      }
+   }
+   msgCount_i = 2 * iterationCount * flatGraph_i.noEdges();
+
+   //***************************************************************************
+   // Copy back the variable values. Both the compiled graph and value map
+   // are sorted by variable id, so we can walk through them together.
+   //***************************************************************************
+   ValueMap::iterator valIt = values_i.begin();
+   for(int v=0; v<flatGraph_i.noVars(); ++v, ++valIt)
+   {
+      valIt->second = flatGraph_i.getValue(v);
+   }
+
+   //***************************************************************************
+   // Copy back the current messages for each factor. Values pruned from the
+   // compiled graph keep their previous messages, which are no longer up
+   // to date, as documented for setPruneDomains(). Variable to factor
+   // messages are written through the factors' inboxes, so any shared with
+   // a fork must be copied first.
+   //***************************************************************************
+   var2facMsgs_i.unshareAll();
+   for(int f=0; f<flatGraph_i.noFactors(); ++f)
+   {
+      FactorID fac = flatGraph_i.factorId(f);
+      F2VPostOffice::OutMsgMap f2vMsgs = fac2varMsgs_i.curOutMsgs(fac);
+      V2FPostOffice::InMsgMap v2fMsgs = var2facMsgs_i.curInMsgs(fac);
+
+      for(int e=flatGraph_i.edgeBegin(f); e<flatGraph_i.edgeEnd(f); ++e)
+      {
+         const int v = flatGraph_i.edgeVar(e);
+         VarID var = flatGraph_i.varId(v);
+         DiscreteFunction& f2v = *f2vMsgs[var];
+         DiscreteFunction& v2f = *v2fMsgs[var];
+         const ValType* flatF2V = flatGraph_i.fac2varMsg(e);
+         const ValType* flatV2F = flatGraph_i.var2facMsg(e);
+         for(ValIndex k=0; k<flatGraph_i.edgeSize(e); ++k)
+         {
+            f2v(flatGraph_i.keptValue(v,k)) = flatF2V[k];
+            v2f(flatGraph_i.keptValue(v,k)) = flatV2F[k];
+         }
+      }
+
+   } // for loop
+
+   return iterationCount;
 
+} // function optimiseCompiled
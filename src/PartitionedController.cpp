@@ -0,0 +1,654 @@
+/**
+ * @file PartitionedController.cpp
+ * Implements the maxsum::MaxSumShard and maxsum::PartitionedController
+ * classes, and the maxsum::partitionFactors function.
+ * @see PartitionedController.h
+ */
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <set>
+#include <maxsum/PartitionedController.h>
+
+using namespace maxsum;
+
+namespace
+{
+   /**
+    * Unsigned integer type used for ids and sizes in serialised batches.
+    */
+   typedef unsigned int Word_m;
+
+   /**
+    * Appends the raw bytes of an array to a batch.
+    * @param[in,out] batch the batch to append to.
+    * @param[in] pData pointer to the first element.
+    * @param[in] n the number of elements.
+    */
+   template<class T> void appendRaw_m
+   (
+    Transport::Batch& batch,
+    const T* pData,
+    std::size_t n
+   )
+   {
+      const char* pBytes = reinterpret_cast<const char*>(pData);
+      batch.insert(batch.end(),pBytes,pBytes+n*sizeof(T));
+   }
+
+   /**
+    * Reads an array of raw values from a batch.
+    * @param[in] batch the batch to read from.
+    * @param[in,out] pos position of the first byte to read, which is
+    * advanced past the array.
+    * @param[out] pData array in which to store the values.
+    * @param[in] n the number of elements.
+    * @throws maxsum::BadDomainException if the batch is too short.
+    */
+   template<class T> void readRaw_m
+   (
+    const Transport::Batch& batch,
+    std::size_t& pos,
+    T* pData,
+    std::size_t n
+   )
+   {
+      const std::size_t noBytes = n*sizeof(T);
+      if(batch.size() < pos+noBytes)
+      {
+         throw BadDomainException("MaxSumShard::receiveBoundary",
+               "Truncated message batch.");
+      }
+      if(0<noBytes)
+      {
+         std::memcpy(pData,&batch[pos],noBytes);
+      }
+      pos += noBytes;
+   }
+
+} // module namespace
+
+/**
+ * Assigns each factor in a factor graph to one of a number of shards.
+ * @param[in] factors the factor graph to partition.
+ * @param[in] noShards the number of shards.
+ * @param[out] partition map in which to store the shard of each factor.
+ * @post any previous contents of <code>partition</code> are destroyed.
+ */
+void maxsum::partitionFactors
+(
+ const MaxSumController::FactorMap& factors,
+ int noShards,
+ std::map<FactorID,int>& partition
+)
+{
+   typedef MaxSumController::FactorMap::const_iterator FactorIt;
+   partition.clear();
+   if(1>noShards)
+   {
+      noShards = 1;
+   }
+
+   //***************************************************************************
+   // Index the factors connected to each variable
+   //***************************************************************************
+   std::map<VarID,std::vector<FactorID> > varFactors;
+   for(FactorIt it=factors.begin(); it!=factors.end(); ++it)
+   {
+      for(DiscreteFunction::VarIterator v=it->second.varBegin();
+            v!=it->second.varEnd(); ++v)
+      {
+         varFactors[*v].push_back(it->first);
+      }
+   }
+
+   //***************************************************************************
+   // Visit factors in breadth first order, starting a new search from the
+   // first unvisited factor for each connected component.
+   //***************************************************************************
+   std::vector<FactorID> order;
+   order.reserve(factors.size());
+   std::set<FactorID> visited;
+   std::set<VarID> visitedVars;
+   for(FactorIt start=factors.begin(); start!=factors.end(); ++start)
+   {
+      if(!visited.insert(start->first).second)
+      {
+         continue;
+      }
+
+      std::deque<FactorID> queue(1,start->first);
+      while(!queue.empty())
+      {
+         const FactorID fac = queue.front();
+         queue.pop_front();
+         order.push_back(fac);
+
+         const DiscreteFunction& fun = factors.find(fac)->second;
+         for(DiscreteFunction::VarIterator v=fun.varBegin();
+               v!=fun.varEnd(); ++v)
+         {
+            if(!visitedVars.insert(*v).second)
+            {
+               continue;
+            }
+
+            const std::vector<FactorID>& next = varFactors[*v];
+            for(std::vector<FactorID>::const_iterator n=next.begin();
+                  n!=next.end(); ++n)
+            {
+               if(visited.insert(*n).second)
+               {
+                  queue.push_back(*n);
+               }
+            }
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Split the ordering into contiguous blocks of (nearly) equal size.
+   //***************************************************************************
+   const long noFactors = static_cast<long>(order.size());
+   for(long k=0; k<noFactors; ++k)
+   {
+      partition[order[k]] = static_cast<int>((k*noShards)/noFactors);
+   }
+
+} // function partitionFactors
+
+/**
+ * Constructs an empty shard.
+ * @param[in] shard the index of this shard.
+ * @param[in] localIterations number of local max-sum iterations to run
+ * in each round, before exchanging boundary messages.
+ * @param[in] maxnorm the maximum maxnorm change in a message, or proxy
+ * factor, before it is assumed to have converged.
+ */
+MaxSumShard::MaxSumShard(int shard, int localIterations, ValType maxnorm)
+   : shard_i(shard), controller_i(localIterations,maxnorm),
+     maxNormThreshold_i(maxnorm), boundary_i(), neighbours_i(),
+     nextProxy_i(std::numeric_limits<FactorID>::max()), localsDirty_i(false),
+     batch_i()
+{}
+
+/**
+ * Returns the boundary information for a variable, or null if it is
+ * not a boundary variable.
+ * @param[in] var the variable to look for.
+ */
+MaxSumShard::Boundary* MaxSumShard::findBoundary(VarID var)
+{
+   std::size_t lo = 0;
+   std::size_t hi = boundary_i.size();
+   while(lo<hi)
+   {
+      const std::size_t mid = (lo+hi)/2;
+      if(boundary_i[mid].var < var)
+      {
+         lo = mid+1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+
+   if( (boundary_i.size()==lo) || (boundary_i[lo].var!=var) )
+   {
+      return 0;
+   }
+   return &boundary_i[lo];
+
+} // function findBoundary
+
+/**
+ * Adds or replaces a local factor.
+ * @param[in] id the unique identifier of the factor.
+ * @param[in] factor the function representing the factor.
+ * @throws maxsum::OutOfRangeException if <code>id</code> is reserved
+ * for a proxy factor.
+ */
+void MaxSumShard::setFactor(FactorID id, const DiscreteFunction& factor)
+{
+   if(id > nextProxy_i)
+   {
+      throw OutOfRangeException("MaxSumShard::setFactor",
+            "Factor id is reserved for a boundary proxy.");
+   }
+   controller_i.setFactor(id,factor);
+   localsDirty_i = true;
+
+} // function setFactor
+
+/**
+ * Declares that a variable is shared with another shard.
+ * @param[in] var the boundary variable.
+ * @param[in] remote the other shard.
+ * @throws maxsum::UnknownVariableException if <code>var</code> is not
+ * registered.
+ * @throws maxsum::OutOfRangeException if the proxy factor id for
+ * <code>var</code> is already used by a local factor.
+ */
+void MaxSumShard::addBoundary(VarID var, int remote)
+{
+   //***************************************************************************
+   // Create a proxy factor if this is a new boundary variable
+   //***************************************************************************
+   Boundary* pBoundary = findBoundary(var);
+   if(0==pBoundary)
+   {
+      if(controller_i.hasFactor(nextProxy_i))
+      {
+         throw OutOfRangeException("MaxSumShard::addBoundary",
+               "Proxy factor id is already used by a local factor.");
+      }
+
+      Boundary boundary;
+      boundary.var = var;
+      boundary.proxy = nextProxy_i--;
+      boundary.received = DiscreteFunction(var,0);
+      boundary.sent = boundary.received;
+      controller_i.setFactor(boundary.proxy,boundary.received);
+
+      std::vector<Boundary>::iterator pos = boundary_i.begin();
+      while( (boundary_i.end()!=pos) && (pos->var < var) )
+      {
+         ++pos;
+      }
+      pBoundary = &*boundary_i.insert(pos,boundary);
+   }
+
+   //***************************************************************************
+   // Record the remote shard for this variable, and as a neighbour
+   //***************************************************************************
+   std::vector<int>& remotes = pBoundary->remotes;
+   if(remotes.end()==std::find(remotes.begin(),remotes.end(),remote))
+   {
+      remotes.insert(std::upper_bound(remotes.begin(),remotes.end(),remote),
+            remote);
+   }
+
+   if(!std::binary_search(neighbours_i.begin(),neighbours_i.end(),remote))
+   {
+      neighbours_i.insert(std::upper_bound(neighbours_i.begin(),
+               neighbours_i.end(),remote),remote);
+   }
+   localsDirty_i = true;
+
+} // function addBoundary
+
+/**
+ * Recalculates the local factors connected to each boundary variable.
+ */
+void MaxSumShard::updateLocals()
+{
+   for(std::vector<Boundary>::iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      it->locals.clear();
+   }
+
+   for(MaxSumController::ConstFactorIterator it=controller_i.factorBegin();
+         it!=controller_i.factorEnd(); ++it)
+   {
+      if(it->first > nextProxy_i)
+      {
+         continue; // skip proxy factors
+      }
+
+      for(DiscreteFunction::VarIterator v=it->second.varBegin();
+            v!=it->second.varEnd(); ++v)
+      {
+         Boundary* pBoundary = findBoundary(*v);
+         if(0!=pBoundary)
+         {
+            pBoundary->locals.push_back(it->first);
+         }
+      }
+   }
+   localsDirty_i = false;
+
+} // function updateLocals
+
+/**
+ * Runs the local max-sum iterations for one round.
+ * @returns the number of messages recomputed.
+ */
+int MaxSumShard::optimiseLocal()
+{
+   controller_i.optimise();
+   return controller_i.noRecomputedMsgs();
+
+} // function optimiseLocal
+
+/**
+ * Sends the sum of local messages for each boundary variable to the
+ * other shards that share it.
+ * @param[in] transport this shard's transport.
+ */
+void MaxSumShard::sendBoundary(Transport& transport)
+{
+   if(localsDirty_i)
+   {
+      updateLocals();
+   }
+
+   //***************************************************************************
+   // Sum the local messages for each boundary variable into its send buffer,
+   // which keeps its domain between rounds, so this does not allocate.
+   //***************************************************************************
+   for(std::vector<Boundary>::iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      DiscreteFunction& sum = it->sent;
+      sum.assignKeepDomain(0);
+      for(std::vector<FactorID>::const_iterator f=it->locals.begin();
+            f!=it->locals.end(); ++f)
+      {
+         sum += controller_i.getFac2VarMsg(*f,it->var);
+      }
+   }
+
+   //***************************************************************************
+   // Build and send a batch for each neighbour, consisting of a message
+   // count, followed by the variable id, size and values of each message.
+   //***************************************************************************
+   for(std::vector<int>::const_iterator r=neighbours_i.begin();
+         r!=neighbours_i.end(); ++r)
+   {
+      batch_i.clear();
+      Word_m count = 0;
+      appendRaw_m(batch_i,&count,1);
+      for(std::size_t k=0; k<boundary_i.size(); ++k)
+      {
+         const Boundary& boundary = boundary_i[k];
+         if(!std::binary_search(boundary.remotes.begin(),
+                  boundary.remotes.end(),*r))
+         {
+            continue;
+         }
+
+         const Word_m header[] = { boundary.var,
+            static_cast<Word_m>(boundary.sent.domainSize()) };
+         appendRaw_m(batch_i,header,2);
+         appendRaw_m(batch_i,&boundary.sent(0),boundary.sent.domainSize());
+         ++count;
+      }
+      std::memcpy(&batch_i[0],&count,sizeof(count));
+      transport.send(*r,batch_i);
+   }
+
+} // function sendBoundary
+
+/**
+ * Receives one batch from each neighbouring shard, and updates the
+ * proxy factors.
+ * @param[in] transport this shard's transport.
+ * @returns true if any proxy factor changed by more than the maxnorm
+ * threshold.
+ * @throws maxsum::BadDomainException if a received message does not
+ * belong to a boundary variable, or has the wrong size.
+ */
+bool MaxSumShard::receiveBoundary(Transport& transport)
+{
+   for(std::vector<Boundary>::iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      it->received.assignKeepDomain(0);
+   }
+
+   //***************************************************************************
+   // Accumulate the messages received from each neighbour
+   //***************************************************************************
+   for(std::vector<int>::const_iterator r=neighbours_i.begin();
+         r!=neighbours_i.end(); ++r)
+   {
+      transport.receive(*r,batch_i);
+      std::size_t pos = 0;
+      Word_m count = 0;
+      readRaw_m(batch_i,pos,&count,1);
+      for(Word_m k=0; k<count; ++k)
+      {
+         Word_m header[2];
+         readRaw_m(batch_i,pos,header,2);
+         Boundary* pBoundary = findBoundary(header[0]);
+         if( (0==pBoundary) ||
+             (static_cast<Word_m>(pBoundary->received.domainSize())!=header[1]) )
+         {
+            throw BadDomainException("MaxSumShard::receiveBoundary",
+                  "Received message for unknown or mismatched variable.");
+         }
+
+         DiscreteFunction& received = pBoundary->received;
+         for(ValIndex x=0; x<received.domainSize(); ++x)
+         {
+            ValType val;
+            readRaw_m(batch_i,pos,&val,1);
+            received(x) += val;
+         }
+      }
+   }
+
+   //***************************************************************************
+   // Update any proxy factor that has changed significantly
+   //***************************************************************************
+   bool changed = false;
+   for(std::vector<Boundary>::iterator it=boundary_i.begin();
+         it!=boundary_i.end(); ++it)
+   {
+      DiscreteFunction& proxy =
+         controller_i.getUnSafeWritableFactorHandle(it->proxy);
+      ValType diff = 0;
+      for(ValIndex x=0; x<proxy.domainSize(); ++x)
+      {
+         diff = std::max(diff,ValType(std::fabs(proxy(x)-it->received(x))));
+      }
+
+      if(diff > maxNormThreshold_i)
+      {
+         for(ValIndex x=0; x<proxy.domainSize(); ++x)
+         {
+            proxy(x) = it->received(x);
+         }
+         controller_i.notifyFactor(it->proxy);
+         changed = true;
+      }
+   }
+
+   return changed;
+
+} // function receiveBoundary
+
+/**
+ * Runs one complete round: local iterations, followed by sending and
+ * receiving boundary messages.
+ * @param[in] transport this shard's transport.
+ * @returns true if this shard has not converged.
+ */
+bool MaxSumShard::iterate(Transport& transport)
+{
+   bool active = 0<optimiseLocal();
+   sendBoundary(transport);
+   active = receiveBoundary(transport) || active;
+   return active;
+
+} // function iterate
+
+/**
+ * Constructs an empty controller.
+ * @param[in] noShards the number of shards.
+ * @param[in] maxIterations the maximum number of rounds.
+ * @param[in] maxnorm the maximum maxnorm change in a message before
+ * it is assumed to have converged.
+ */
+PartitionedController::PartitionedController
+(
+ int noShards,
+ int maxIterations,
+ ValType maxnorm
+)
+   : noShards_i(std::max(1,noShards)), maxIterations_i(maxIterations),
+     maxNormThreshold_i(maxnorm), factors_i(), partition_i(), shards_i()
+{}
+
+/**
+ * Adds or replaces a factor.
+ * @param[in] id the unique identifier of the factor.
+ * @param[in] factor the function representing the factor.
+ */
+void PartitionedController::setFactor(FactorID id, const DiscreteFunction& factor)
+{
+   factors_i[id] = factor;
+   shards_i.clear();
+
+} // function setFactor
+
+/**
+ * Splits the factor graph into shards.
+ */
+void PartitionedController::build()
+{
+   partitionFactors(factors_i,noShards_i,partition_i);
+
+   shards_i.clear();
+   shards_i.reserve(noShards_i);
+   for(int s=0; s<noShards_i; ++s)
+   {
+      shards_i.push_back(MaxSumShard(s,1,maxNormThreshold_i));
+   }
+
+   //***************************************************************************
+   // Add each factor to its shard, and record the shards of each variable
+   //***************************************************************************
+   std::map<VarID,std::set<int> > varShards;
+   for(MaxSumController::FactorMap::const_iterator it=factors_i.begin();
+         it!=factors_i.end(); ++it)
+   {
+      const int shard = partition_i[it->first];
+      shards_i[shard].setFactor(it->first,it->second);
+      for(DiscreteFunction::VarIterator v=it->second.varBegin();
+            v!=it->second.varEnd(); ++v)
+      {
+         varShards[*v].insert(shard);
+      }
+   }
+
+   //***************************************************************************
+   // Connect each variable shared between shards
+   //***************************************************************************
+   typedef std::map<VarID,std::set<int> >::const_iterator VarShardIt;
+   for(VarShardIt it=varShards.begin(); it!=varShards.end(); ++it)
+   {
+      const std::set<int>& shards = it->second;
+      for(std::set<int>::const_iterator s=shards.begin(); s!=shards.end(); ++s)
+      {
+         for(std::set<int>::const_iterator r=shards.begin();
+               r!=shards.end(); ++r)
+         {
+            if(*s!=*r)
+            {
+               shards_i[*s].addBoundary(it->first,*r);
+            }
+         }
+      }
+   }
+
+} // function build
+
+/**
+ * Runs max-sum until every shard has converged, or the maximum number
+ * of rounds.
+ * @returns the number of rounds performed.
+ */
+int PartitionedController::optimise()
+{
+   if(shards_i.empty())
+   {
+      build();
+   }
+
+   //***************************************************************************
+   // In each round, all shards run locally and send their boundary
+   // messages, before any shard receives, so that a single thread can run
+   // every shard without blocking.
+   //***************************************************************************
+   LocalTransport transport(noShards_i);
+   int roundCount = 0;
+   while(roundCount<maxIterations_i)
+   {
+      ++roundCount;
+      bool active = false;
+      for(int s=0; s<noShards_i; ++s)
+      {
+         active = (0<shards_i[s].optimiseLocal()) || active;
+         shards_i[s].sendBoundary(transport.endpoint(s));
+      }
+
+      for(int s=0; s<noShards_i; ++s)
+      {
+         active = shards_i[s].receiveBoundary(transport.endpoint(s)) || active;
+      }
+
+      if(!active)
+      {
+         break;
+      }
+   }
+
+   return roundCount;
+
+} // function optimise
+
+/**
+ * Returns the current value of a variable.
+ * @throws maxsum::NoSuchElementException if the variable is not in
+ * the domain of any factor, or the graph has not been optimised.
+ */
+ValIndex PartitionedController::getValue(VarID var) const
+{
+   for(std::vector<MaxSumShard>::const_iterator it=shards_i.begin();
+         it!=shards_i.end(); ++it)
+   {
+      if(it->controller().hasValue(var))
+      {
+         return static_cast<ValIndex>(it->controller().getValue(var));
+      }
+   }
+
+   throw NoSuchElementException("PartitionedController::getValue",
+         "No such variable in factor graph.");
+
+} // function getValue
+
+/**
+ * Returns the shard of a factor.
+ * @throws maxsum::NoSuchElementException if the factor is unknown.
+ */
+int PartitionedController::shardOf(FactorID id) const
+{
+   std::map<FactorID,int>::const_iterator pos = partition_i.find(id);
+   if(partition_i.end()==pos)
+   {
+      throw NoSuchElementException("PartitionedController::shardOf",
+            "No such factor in factor graph.");
+   }
+   return pos->second;
+
+} // function shardOf
+
+/**
+ * Returns the total number of boundary variables over all shards.
+ */
+int PartitionedController::noBoundaryVars() const
+{
+   int count = 0;
+   for(std::vector<MaxSumShard>::const_iterator it=shards_i.begin();
+         it!=shards_i.end(); ++it)
+   {
+      count += it->noBoundaryVars();
+   }
+   return count;
+
+} // function noBoundaryVars
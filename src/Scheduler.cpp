@@ -0,0 +1,72 @@
+/**
+ * @file Scheduler.cpp
+ * Implements the maxsum::ResidualScheduler class.
+ * @see Scheduler.h
+ */
+#include <maxsum/Scheduler.h>
+
+using namespace maxsum;
+
+/**
+ * Schedules a node, raising its residual if necessary.
+ * @param[in] node the node to schedule.
+ * @param[in] residual the maxnorm change in the received message.
+ */
+void ResidualScheduler::push(const Node& node, ValType residual)
+{
+   //***************************************************************************
+   // If the node is already scheduled with at least this residual, there is
+   // nothing to do. Otherwise, record its new residual and queue a new entry.
+   // Any existing entry becomes stale, and is skipped by pop().
+   //***************************************************************************
+   std::map<Node,ValType>::iterator pos = residuals_i.find(node);
+   if(residuals_i.end()!=pos)
+   {
+      if(residual <= pos->second)
+      {
+         return;
+      }
+      pos->second = residual;
+   }
+   else
+   {
+      residuals_i.insert(std::make_pair(node,residual));
+   }
+   queue_i.push(Entry(residual,node));
+
+} // function push
+
+/**
+ * Removes and returns the node with the largest residual.
+ * @pre this scheduler is not empty.
+ */
+Scheduler::Node ResidualScheduler::pop()
+{
+   //***************************************************************************
+   // Skip stale entries, which either belong to nodes that are no longer
+   // scheduled, or record a residual that has since been raised.
+   //***************************************************************************
+   while(true)
+   {
+      const Entry top = queue_i.top();
+      queue_i.pop();
+
+      std::map<Node,ValType>::iterator pos = residuals_i.find(top.second);
+      if( (residuals_i.end()!=pos) && (pos->second==top.first) )
+      {
+         residuals_i.erase(pos);
+         return top.second;
+      }
+   }
+
+} // function pop
+
+/**
+ * Removes all scheduled nodes.
+ */
+void ResidualScheduler::clear()
+{
+   queue_i = std::priority_queue<Entry,std::vector<Entry>,EntryLess>();
+   residuals_i.clear();
+
+} // function clear
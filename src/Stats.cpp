@@ -0,0 +1,32 @@
+/**
+ * @file Stats.cpp
+ * Implements the allocation counter used for maxsum::IterationStats.
+ * @see Stats.h
+ */
+#include <atomic>
+#include <maxsum/Stats.h>
+
+namespace
+{
+   /**
+    * Total number of allocations recorded so far.
+    */
+   std::atomic<long> allocationCount_m(0);
+
+} // module namespace
+
+/**
+ * Records one heap allocation for maxsum::DiscreteFunction storage.
+ */
+void maxsum::util::countAllocation()
+{
+   allocationCount_m.fetch_add(1,std::memory_order_relaxed);
+}
+
+/**
+ * Returns the total number of allocations recorded by countAllocation().
+ */
+long maxsum::util::allocationCount()
+{
+   return allocationCount_m.load(std::memory_order_relaxed);
+}
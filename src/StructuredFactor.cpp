@@ -0,0 +1,397 @@
+/**
+ * @file StructuredFactor.cpp
+ * Implements the maxsum::PottsFactor and maxsum::SparseFactor classes.
+ * @see StructuredFactor.h
+ */
+#include <limits>
+#include <maxsum/StructuredFactor.h>
+
+using namespace maxsum;
+
+namespace
+{
+   /**
+    * Finds the best and second best values of a message.
+    * @param[in] msg the message.
+    * @param[in] size the number of values in the message.
+    * @param[out] best the largest value.
+    * @param[out] arg the index of the first occurrence of the largest value.
+    * @param[out] second the largest value at any other index, or the lowest
+    * finite value if there is only one index.
+    */
+   void bestTwo_m
+   (
+    const ValType* msg,
+    ValIndex size,
+    ValType& best,
+    ValIndex& arg,
+    ValType& second
+   )
+   {
+      best = msg[0];
+      arg = 0;
+      second = -std::numeric_limits<ValType>::max();
+      for(ValIndex x=1; x<size; ++x)
+      {
+         if(msg[x] > best)
+         {
+            second = best;
+            best = msg[x];
+            arg = x;
+         }
+         else if(msg[x] > second)
+         {
+            second = msg[x];
+         }
+      }
+
+   } // function bestTwo_m
+
+   /**
+    * Sums the input messages at one joint assignment, excluding the message
+    * from one variable.
+    * @param[in] ind linear index of the assignment.
+    * @param[in] sizes domain size of each variable.
+    * @param[in] in the input message from each variable.
+    * @param[in] skip the variable whose message is excluded, or a negative
+    * number to include every message.
+    */
+   ValType sumMsgs_m
+   (
+    ValIndex ind,
+    const std::vector<ValIndex>& sizes,
+    const std::vector<const ValType*>& in,
+    int skip
+   )
+   {
+      ValType sum = 0;
+      for(int i=0; i<static_cast<int>(sizes.size()); ++i)
+      {
+         const ValIndex y = ind % sizes[i];
+         ind /= sizes[i];
+         if(i!=skip)
+         {
+            sum += in[i][y];
+         }
+      }
+      return sum;
+
+   } // function sumMsgs_m
+
+} // module namespace
+
+/**
+ * Checks that this factor's domain is valid.
+ * @throws BadDomainException if the domain is empty, or the variables do not
+ * all have the same domain size.
+ */
+void PottsFactor::checkDomain() const
+{
+   if(vars_i.empty())
+   {
+      throw BadDomainException("PottsFactor::PottsFactor",
+            "Potts factor must depend on at least one variable.");
+   }
+
+   for(std::size_t k=1; k<size_i.size(); ++k)
+   {
+      if(size_i[k]!=size_i[0])
+      {
+         throw BadDomainException("PottsFactor::PottsFactor",
+               "Potts factor variables must have equal domain sizes.");
+      }
+   }
+
+} // function checkDomain
+
+/**
+ * Computes the output messages of this factor.
+ * For each output variable k and value x, the best assignment either sets
+ * every variable to x, or is the best assignment in which at least one other
+ * variable differs from x. The latter is the best value of every other
+ * message, unless all of them are best at x, in which case it is cheapest
+ * to move the variable with the smallest gap to its second best value.
+ * @see StructuredFactor::maxMarginals()
+ */
+void PottsFactor::maxMarginals
+(
+ const std::vector<const ValType*>& in,
+ const std::vector<ValType*>& out
+) const
+{
+   const int n = vars_i.size();
+   const ValIndex d = size_i[0];
+
+   //***************************************************************************
+   // Summarise each input message by its best and second best values, and
+   // find the two variables with the smallest gap between them.
+   //***************************************************************************
+   std::vector<ValType> best(n);
+   std::vector<ValIndex> arg(n);
+   std::vector<int> noBestAt(d,0);
+   ValType bestSum = 0;
+   int minGapVar = 0;
+   ValType minGap = std::numeric_limits<ValType>::max();
+   ValType nextGap = std::numeric_limits<ValType>::max();
+   for(int i=0; i<n; ++i)
+   {
+      ValType second;
+      bestTwo_m(in[i],d,best[i],arg[i],second);
+      bestSum += best[i];
+      ++noBestAt[arg[i]];
+
+      const ValType gap = best[i] - second;
+      if(gap < minGap)
+      {
+         nextGap = minGap;
+         minGap = gap;
+         minGapVar = i;
+      }
+      else if(gap < nextGap)
+      {
+         nextGap = gap;
+      }
+   }
+
+   //***************************************************************************
+   // Sum the input messages for each value, as if all variables were equal.
+   //***************************************************************************
+   std::vector<ValType> equalSum(d,0);
+   for(int i=0; i<n; ++i)
+   {
+      for(ValIndex x=0; x<d; ++x)
+      {
+         equalSum[x] += in[i][x];
+      }
+   }
+
+   //***************************************************************************
+   // Calculate each output message
+   //***************************************************************************
+   for(int k=0; k<n; ++k)
+   {
+      const ValType othersBest = bestSum - best[k];
+      const ValType otherGap = (k==minGapVar) ? nextGap : minGap;
+      for(ValIndex x=0; x<d; ++x)
+      {
+         ValType result = weight_i + equalSum[x] - in[k][x];
+
+         //*********************************************************************
+         // If some other variable can differ from x, find the best such
+         // assignment. This is only impossible with one variable, or one
+         // value.
+         //*********************************************************************
+         if( (1<n) && (1<d) )
+         {
+            const int noOthersAtX = noBestAt[x] - (arg[k]==x ? 1 : 0);
+            ValType differ = othersBest;
+            if(n-1==noOthersAtX)
+            {
+               differ -= otherGap;
+            }
+            result = std::max(result,differ);
+         }
+         out[k][x] = result;
+      }
+   }
+
+} // function maxMarginals
+
+/**
+ * Expands this factor into a dense table.
+ * @see StructuredFactor::expand()
+ */
+void PottsFactor::expand(DiscreteFunction& out) const
+{
+   initDomain(out,0);
+
+   //***************************************************************************
+   // The assignment with every variable equal to x has linear index
+   // x*(1 + d + d^2 + ...).
+   //***************************************************************************
+   ValIndex step = 0;
+   ValIndex stride = 1;
+   for(std::size_t k=0; k<size_i.size(); ++k)
+   {
+      step += stride;
+      stride *= size_i[k];
+   }
+
+   for(ValIndex x=0; x<size_i[0]; ++x)
+   {
+      out(x*step) = weight_i;
+   }
+
+} // function expand
+
+/**
+ * Sets the value of this factor at one joint assignment.
+ * @param[in] ind linear index of the assignment.
+ * @param[in] val the new value.
+ * @throws OutOfRangeException if <code>ind</code> is not in the domain.
+ */
+void SparseFactor::set(ValIndex ind, ValType val)
+{
+   if( (0>ind) || (domainSize_i<=ind) )
+   {
+      throw OutOfRangeException("SparseFactor::set",
+            "Index is outside factor domain.");
+   }
+   entries_i[ind] = val;
+
+} // function set
+
+/**
+ * Sets the value of this factor at one joint assignment.
+ * @param[in] subInd the value of each variable, in domain order.
+ * @param[in] val the new value.
+ * @throws OutOfRangeException if <code>subInd</code> is not in the domain.
+ */
+void SparseFactor::set(const std::vector<ValIndex>& subInd, ValType val)
+{
+   if(subInd.size()!=size_i.size())
+   {
+      throw OutOfRangeException("SparseFactor::set",
+            "Wrong number of sub-indices for factor domain.");
+   }
+
+   ValIndex ind = 0;
+   ValIndex stride = 1;
+   for(std::size_t k=0; k<size_i.size(); ++k)
+   {
+      if( (0>subInd[k]) || (size_i[k]<=subInd[k]) )
+      {
+         throw OutOfRangeException("SparseFactor::set",
+               "Sub-index is outside factor domain.");
+      }
+      ind += subInd[k]*stride;
+      stride *= size_i[k];
+   }
+   entries_i[ind] = val;
+
+} // function set
+
+/**
+ * Computes the output messages of this factor.
+ * Each output value is the best of two candidates: the best stored
+ * assignment, and the best assignment with the default value. The latter is
+ * normally the best value of every other message, but if that assignment is
+ * stored with a lower value, the slice is scanned to find the best
+ * assignment that is not stored.
+ * @see StructuredFactor::maxMarginals()
+ */
+void SparseFactor::maxMarginals
+(
+ const std::vector<const ValType*>& in,
+ const std::vector<ValType*>& out
+) const
+{
+   const int n = vars_i.size();
+   const ValType lowest = -std::numeric_limits<ValType>::max();
+   for(int k=0; k<n; ++k)
+   {
+      std::fill(out[k],out[k]+size_i[k],lowest);
+   }
+
+   //***************************************************************************
+   // Each stored value contributes to one element of each output message.
+   //***************************************************************************
+   std::vector<ValIndex> sub(n);
+   for(EntryMap::const_iterator it=entries_i.begin(); it!=entries_i.end(); ++it)
+   {
+      ValIndex ind = it->first;
+      ValType total = it->second;
+      for(int i=0; i<n; ++i)
+      {
+         sub[i] = ind % size_i[i];
+         ind /= size_i[i];
+         total += in[i][sub[i]];
+      }
+
+      for(int k=0; k<n; ++k)
+      {
+         ValType& result = out[k][sub[k]];
+         result = std::max(result,total-in[k][sub[k]]);
+      }
+   }
+
+   //***************************************************************************
+   // Find the best value of each input message, and the assignment at which
+   // all of them are best.
+   //***************************************************************************
+   std::vector<ValType> best(n);
+   std::vector<ValIndex> stride(n);
+   ValType bestSum = 0;
+   ValIndex bestInd = 0;
+   for(int i=0; i<n; ++i)
+   {
+      ValType second;
+      ValIndex arg;
+      bestTwo_m(in[i],size_i[i],best[i],arg,second);
+      bestSum += best[i];
+      stride[i] = (0==i) ? 1 : stride[i-1]*size_i[i-1];
+      bestInd += arg*stride[i];
+      sub[i] = arg;
+   }
+
+   //***************************************************************************
+   // Consider the default value for each output message element.
+   //***************************************************************************
+   for(int k=0; k<n; ++k)
+   {
+      const ValIndex base = bestInd - sub[k]*stride[k];
+      for(ValIndex x=0; x<size_i[k]; ++x)
+      {
+         ValType& result = out[k][x];
+         EntryMap::const_iterator pos = entries_i.find(base + x*stride[k]);
+
+         //*********************************************************************
+         // If the best assignment is not stored, or is stored with a value
+         // at least as large as the default, then we already know the answer.
+         //*********************************************************************
+         if(entries_i.end()==pos)
+         {
+            result = std::max(result,default_i+bestSum-best[k]);
+            continue;
+         }
+         else if(pos->second >= default_i)
+         {
+            continue;
+         }
+
+         //*********************************************************************
+         // Otherwise, scan every unstored assignment with this value of x.
+         //*********************************************************************
+         const ValIndex block = stride[k]*size_i[k];
+         for(ValIndex outer=0; outer<domainSize_i; outer+=block)
+         {
+            for(ValIndex t=0; t<stride[k]; ++t)
+            {
+               const ValIndex ind = outer + x*stride[k] + t;
+               if(0==entries_i.count(ind))
+               {
+                  result = std::max(result,
+                        default_i+sumMsgs_m(ind,size_i,in,k));
+               }
+            }
+         }
+
+      } // inner for loop
+
+   } // outer for loop
+
+} // function maxMarginals
+
+/**
+ * Expands this factor into a dense table.
+ * @see StructuredFactor::expand()
+ */
+void SparseFactor::expand(DiscreteFunction& out) const
+{
+   initDomain(out,default_i);
+   for(EntryMap::const_iterator it=entries_i.begin(); it!=entries_i.end(); ++it)
+   {
+      out(it->first) = it->second;
+   }
+
+} // function expand
@@ -0,0 +1,184 @@
+/**
+ * @file ThreadPool.cpp
+ * Implementation of the maxsum::util::ThreadPool class.
+ * @see ThreadPool.h
+ */
+#include <maxsum/ThreadPool.h>
+
+using namespace maxsum::util;
+
+/**
+ * Constructs a new pool with the specified number of threads.
+ */
+ThreadPool::ThreadPool(int noThreads)
+   : noThreads_i(noThreads<1 ? 1 : noThreads), workers_i(), mutex_i(),
+     start_i(), done_i(), generation_i(0), pending_i(0), stop_i(false),
+     task_i(0), noItems_i(0)
+{
+   startWorkers();
+}
+
+/**
+ * Copy constructor starts a new pool of the same size.
+ */
+ThreadPool::ThreadPool(const ThreadPool& rhs)
+   : noThreads_i(rhs.noThreads_i), workers_i(), mutex_i(),
+     start_i(), done_i(), generation_i(0), pending_i(0), stop_i(false),
+     task_i(0), noItems_i(0)
+{
+   startWorkers();
+}
+
+/**
+ * Copy assignment restarts this pool with the same size as another.
+ */
+ThreadPool& ThreadPool::operator=(const ThreadPool& rhs)
+{
+   setNoThreads(rhs.noThreads_i);
+   return *this;
+}
+
+/**
+ * Stops all worker threads.
+ */
+ThreadPool::~ThreadPool()
+{
+   stopWorkers();
+}
+
+/**
+ * Changes the number of threads used by this pool.
+ */
+void ThreadPool::setNoThreads(int noThreads)
+{
+   if(noThreads<1)
+   {
+      noThreads = 1;
+   }
+
+   if(noThreads!=noThreads_i)
+   {
+      stopWorkers();
+      noThreads_i = noThreads;
+      startWorkers();
+   }
+}
+
+/**
+ * Starts the worker threads.
+ */
+void ThreadPool::startWorkers()
+{
+   stop_i = false;
+   workers_i.reserve(noThreads_i-1);
+   for(int t=1; t<noThreads_i; ++t)
+   {
+      workers_i.push_back
+         (std::thread(&ThreadPool::workerLoop,this,t,generation_i));
+   }
+}
+
+/**
+ * Stops and joins all worker threads.
+ */
+void ThreadPool::stopWorkers()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex_i);
+      stop_i = true;
+   }
+   start_i.notify_all();
+
+   for(std::vector<std::thread>::iterator it=workers_i.begin();
+         it!=workers_i.end(); ++it)
+   {
+      it->join();
+   }
+   workers_i.clear();
+}
+
+/**
+ * Main loop for each worker thread.
+ * @param[in] thread index of the worker thread.
+ * @param[in] seen the generation of the last task started before this
+ * thread was created.
+ */
+void ThreadPool::workerLoop(int thread, unsigned long seen)
+{
+   std::unique_lock<std::mutex> lock(mutex_i);
+   while(true)
+   {
+      //************************************************************************
+      // Wait for the next task, or for a request to stop
+      //************************************************************************
+      while(!stop_i && seen==generation_i)
+      {
+         start_i.wait(lock);
+      }
+
+      if(stop_i)
+      {
+         return;
+      }
+      seen = generation_i;
+
+      //************************************************************************
+      // Process this thread's block without holding the lock
+      //************************************************************************
+      Task* task = task_i;
+      const int noItems = noItems_i;
+      lock.unlock();
+      task->run(blockBegin(noItems,thread),blockBegin(noItems,thread+1),
+            thread);
+      lock.lock();
+
+      //************************************************************************
+      // Tell the calling thread if we're the last to finish
+      //************************************************************************
+      if(0==--pending_i)
+      {
+         done_i.notify_one();
+      }
+
+   } // while loop
+
+} // function workerLoop
+
+/**
+ * Runs a task over the items [0,noItems), and waits for it to finish.
+ * @param[in] noItems the number of items to process.
+ * @param[in] task the task to run.
+ */
+void ThreadPool::run(int noItems, Task& task)
+{
+   //***************************************************************************
+   // If there's only one thread, there's no need to synchronise
+   //***************************************************************************
+   if(1==noThreads_i)
+   {
+      task.run(0,noItems,0);
+      return;
+   }
+
+   //***************************************************************************
+   // Otherwise, hand the task to the workers, process the first block here,
+   // and then wait for the workers to finish.
+   //***************************************************************************
+   {
+      std::lock_guard<std::mutex> lock(mutex_i);
+      task_i = &task;
+      noItems_i = noItems;
+      pending_i = noThreads_i-1;
+      ++generation_i;
+   }
+   start_i.notify_all();
+
+   task.run(0,blockBegin(noItems,1),0);
+
+   std::unique_lock<std::mutex> lock(mutex_i);
+   while(0!=pending_i)
+   {
+      done_i.wait(lock);
+   }
+
+} // function run
@@ -0,0 +1,60 @@
+/**
+ * @file Transport.cpp
+ * Implements the maxsum::LocalTransport class.
+ * @see Transport.h
+ */
+#include <maxsum/Transport.h>
+
+using namespace maxsum;
+
+/**
+ * Constructs a transport between a specified number of shards.
+ * @param[in] noShards the number of shards.
+ */
+LocalTransport::LocalTransport(int noShards)
+   : noShards_i(noShards), channels_i(noShards*noShards), endpoints_i(),
+     mutex_i(), sent_i()
+{
+   endpoints_i.reserve(noShards);
+   for(int k=0; k<noShards; ++k)
+   {
+      endpoints_i.push_back(Endpoint(this,k));
+   }
+}
+
+/**
+ * Sends a batch to another shard.
+ * @param[in] dest the shard to send to.
+ * @param[in] batch the batch to send.
+ */
+void LocalTransport::Endpoint::send(int dest, const Batch& batch)
+{
+   {
+      std::lock_guard<std::mutex> lock(pOwner_i->mutex_i);
+      Channel& channel =
+         pOwner_i->channels_i[shard_i*pOwner_i->noShards_i+dest];
+      channel.batches.push_back(batch);
+   }
+   pOwner_i->sent_i.notify_all();
+
+} // function send
+
+/**
+ * Receives the next batch sent by another shard, waiting until one is
+ * available.
+ * @param[in] source the shard to receive from.
+ * @param[out] batch the received batch.
+ */
+void LocalTransport::Endpoint::receive(int source, Batch& batch)
+{
+   std::unique_lock<std::mutex> lock(pOwner_i->mutex_i);
+   Channel& channel =
+      pOwner_i->channels_i[source*pOwner_i->noShards_i+shard_i];
+   while(channel.batches.empty())
+   {
+      pOwner_i->sent_i.wait(lock);
+   }
+   batch.swap(channel.batches.front());
+   channel.batches.pop_front();
+
+} // function receive
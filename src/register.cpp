@@ -1,13 +1,27 @@
 /**
  * @file register.cpp
  * Implementation of functions in register.h
+ *
+ * The register is split into two parts. Variable ids below
+ * DENSE_LIMIT_M are stored in a dense array, which is allocated in chunks
+ * when first needed, so that contiguous ids are looked up by indexing
+ * alone. Any larger ids are stored in an open addressing hash table,
+ * which packs each id and domain size into a single word.
+ *
+ * Reads never take a lock. Entries are only ever added, and each is
+ * published by a single atomic store or compare and exchange, so a reader
+ * either sees a variable's complete entry, or no entry at all. Writes to the
+ * dense array are also lock free, while new entries in the hash table are
+ * serialised by a mutex, so that the table can be grown safely.
  * @see register.h
  * @author Luke Teacy
  */
 
-#include <map>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <vector>
 #include <maxsum/register.h>
 
 /**
@@ -15,12 +29,308 @@
  */
 namespace
 {
+   using maxsum::VarID;
+   using maxsum::ValIndex;
 
    /**
-    * Hash map used to store registered variables are their domain size.
+    * Number of entries in each chunk of the dense array.
     */
-   std::map<maxsum::VarID,maxsum::ValIndex> varRegister_m;
+   const VarID CHUNK_SIZE_M = 4096;
 
+   /**
+    * Maximum number of chunks in the dense array.
+    */
+   const VarID NO_CHUNKS_M = 4096;
+
+   /**
+    * Variables with ids below this limit are stored in the dense array.
+    */
+   const VarID DENSE_LIMIT_M = CHUNK_SIZE_M * NO_CHUNKS_M;
+
+   /**
+    * Initial capacity of the hash table. Must be a power of 2.
+    */
+   const std::size_t INIT_SPARSE_CAPACITY_M = 64;
+
+   /**
+    * Type of each entry in the dense array. Unregistered variables have
+    * a size of 0, which is never a valid domain size.
+    */
+   typedef std::atomic<ValIndex> DenseEntry_m;
+
+   /**
+    * Dense array chunks, allocated on first use. Zero initialised before
+    * any dynamic initialisation, so safe to use from static constructors.
+    */
+   std::atomic<DenseEntry_m*> denseChunks_m[NO_CHUNKS_M];
+
+   /**
+    * Number of registered variables.
+    */
+   std::atomic<int> varCount_m(0);
+
+   /**
+    * Open addressing hash table used for variables with large ids.
+    * Each slot holds a variable id in its upper 32 bits, and its domain
+    * size in the lower 32 bits, or 0 if empty. Since domain sizes are
+    * never 0, no occupied slot is ever 0.
+    */
+   struct SparseTable_m
+   {
+      /**
+       * Number of slots, which is always a power of 2.
+       */
+      std::size_t capacity;
+
+      /**
+       * Number of occupied slots. Only accessed while holding sparseMutex_m.
+       */
+      std::size_t count;
+
+      /**
+       * The slots.
+       */
+      std::atomic<unsigned long long>* slots;
+
+      /**
+       * Constructs an empty table with a specified capacity.
+       */
+      explicit SparseTable_m(std::size_t cap)
+         : capacity(cap), count(0), slots(new std::atomic<unsigned long long>[cap])
+      {
+         for(std::size_t k=0; k<capacity; ++k)
+         {
+            slots[k].store(0,std::memory_order_relaxed);
+         }
+      }
+
+      /**
+       * Deallocates the slots.
+       */
+      ~SparseTable_m()
+      {
+         delete[] slots;
+      }
+
+      /**
+       * Returns the first slot to probe for a given variable.
+       */
+      std::size_t home(VarID var) const
+      {
+         return (static_cast<std::size_t>(var) * 2654435761u) & (capacity-1);
+      }
+
+      /**
+       * Returns the domain size stored for a variable, or 0 if not found.
+       */
+      ValIndex find(VarID var) const
+      {
+         for(std::size_t k=home(var); ; k=(k+1)&(capacity-1))
+         {
+            const unsigned long long slot =
+               slots[k].load(std::memory_order_acquire);
+            if(0==slot)
+            {
+               return 0;
+            }
+            if(static_cast<VarID>(slot>>32)==var)
+            {
+               return static_cast<ValIndex>(slot & 0xFFFFFFFFull);
+            }
+         }
+      }
+
+      /**
+       * Inserts a variable that is not already in this table.
+       * @pre the caller must hold sparseMutex_m, and count < capacity.
+       */
+      void insert(VarID var, ValIndex siz)
+      {
+         const unsigned long long slot =
+            (static_cast<unsigned long long>(var)<<32) |
+            static_cast<unsigned long long>(static_cast<unsigned int>(siz));
+
+         std::size_t k = home(var);
+         while(0!=slots[k].load(std::memory_order_relaxed))
+         {
+            k = (k+1)&(capacity-1);
+         }
+         slots[k].store(slot,std::memory_order_release);
+         ++count;
+      }
+
+   }; // struct SparseTable_m
+
+   /**
+    * The current hash table, or null if no sparse variables are registered.
+    */
+   std::atomic<SparseTable_m*> sparseTable_m(0);
+
+   /**
+    * Serialises insertions into the hash table.
+    */
+   std::mutex sparseMutex_m;
+
+   /**
+    * Owns every hash table ever allocated. Tables replaced by larger ones
+    * are kept until exit, because readers may still be probing them.
+    */
+   struct SparseTableList_m
+   {
+      std::vector<SparseTable_m*> tables;
+
+      ~SparseTableList_m()
+      {
+         for(std::size_t k=0; k<tables.size(); ++k)
+         {
+            delete tables[k];
+         }
+      }
+   };
+
+   /**
+    * Returns the list of hash tables. Only accessed while holding
+    * sparseMutex_m.
+    */
+   SparseTableList_m& sparseTables_m()
+   {
+      static SparseTableList_m tables;
+      return tables;
+   }
+
+   /**
+    * Looks up the domain size of a variable without taking any locks.
+    * @returns the variable's domain size, or 0 if it is not registered.
+    */
+   inline ValIndex lookup_m(VarID var)
+   {
+      if(DENSE_LIMIT_M > var)
+      {
+         const DenseEntry_m* chunk =
+            denseChunks_m[var/CHUNK_SIZE_M].load(std::memory_order_acquire);
+         if(0==chunk)
+         {
+            return 0;
+         }
+         return chunk[var%CHUNK_SIZE_M].load(std::memory_order_acquire);
+      }
+
+      const SparseTable_m* table = sparseTable_m.load(std::memory_order_acquire);
+      if(0==table)
+      {
+         return 0;
+      }
+      return table->find(var);
+
+   } // function lookup_m
+
+   /**
+    * Returns the dense array entry for a variable, allocating its chunk
+    * if necessary. If two threads allocate the same chunk concurrently,
+    * only one allocation is kept.
+    * @pre var < DENSE_LIMIT_M
+    */
+   DenseEntry_m& denseEntry_m(VarID var)
+   {
+      std::atomic<DenseEntry_m*>& chunkPtr = denseChunks_m[var/CHUNK_SIZE_M];
+      DenseEntry_m* chunk = chunkPtr.load(std::memory_order_acquire);
+      if(0==chunk)
+      {
+         DenseEntry_m* newChunk = new DenseEntry_m[CHUNK_SIZE_M];
+         for(VarID k=0; k<CHUNK_SIZE_M; ++k)
+         {
+            newChunk[k].store(0,std::memory_order_relaxed);
+         }
+
+         if(chunkPtr.compare_exchange_strong(chunk,newChunk,
+                  std::memory_order_acq_rel,std::memory_order_acquire))
+         {
+            chunk = newChunk;
+         }
+         else
+         {
+            delete[] newChunk; // chunk now holds the winning allocation
+         }
+      }
+      return chunk[var%CHUNK_SIZE_M];
+
+   } // function denseEntry_m
+
+   /**
+    * Adds a variable to the register, if it is not already registered.
+    * @returns the variable's registered domain size, which is different to
+    * siz if the variable was already registered with a different size.
+    */
+   ValIndex insert_m(VarID var, ValIndex siz)
+   {
+      //************************************************************************
+      // Variables in the dense array are added with a single compare and
+      // exchange, which fails if the variable is already registered.
+      //************************************************************************
+      if(DENSE_LIMIT_M > var)
+      {
+         ValIndex prev = 0;
+         if(denseEntry_m(var).compare_exchange_strong(prev,siz,
+                  std::memory_order_acq_rel,std::memory_order_acquire))
+         {
+            varCount_m.fetch_add(1,std::memory_order_relaxed);
+            return siz;
+         }
+         return prev;
+      }
+
+      //************************************************************************
+      // Otherwise, check again now that we hold the lock, in case another
+      // thread has registered this variable in the meantime.
+      //************************************************************************
+      std::lock_guard<std::mutex> lock(sparseMutex_m);
+      SparseTable_m* table = sparseTable_m.load(std::memory_order_relaxed);
+      if(0!=table)
+      {
+         const ValIndex prev = table->find(var);
+         if(0!=prev)
+         {
+            return prev;
+         }
+      }
+
+      //************************************************************************
+      // Keep the table at most half full, by copying all entries into a new
+      // table of twice the size. The old table is kept, because readers may
+      // still be using it.
+      //************************************************************************
+      if( (0==table) || (table->capacity <= 2*(table->count+1)) )
+      {
+         SparseTable_m* newTable =
+            new SparseTable_m(0==table ? INIT_SPARSE_CAPACITY_M :
+                  2*table->capacity);
+         sparseTables_m().tables.push_back(newTable);
+
+         if(0!=table)
+         {
+            for(std::size_t k=0; k<table->capacity; ++k)
+            {
+               const unsigned long long slot =
+                  table->slots[k].load(std::memory_order_relaxed);
+               if(0!=slot)
+               {
+                  newTable->insert(static_cast<VarID>(slot>>32),
+                        static_cast<ValIndex>(slot & 0xFFFFFFFFull));
+               }
+            }
+         }
+         table = newTable;
+      }
+
+      //************************************************************************
+      // Insert the new variable, and publish the table if it is new.
+      //************************************************************************
+      table->insert(var,siz);
+      sparseTable_m.store(table,std::memory_order_release);
+      varCount_m.fetch_add(1,std::memory_order_relaxed);
+      return siz;
+
+   } // function insert_m
 
 } // private namespace
 
@@ -30,7 +340,7 @@ namespace
  */
 bool maxsum::isRegistered(VarID var)
 {
-   return varRegister_m.end() != varRegister_m.find(var);
+   return 0 != lookup_m(var);
 }
 
 /**
@@ -44,22 +354,17 @@ maxsum::ValIndex maxsum::getDomainSize(VarID var)
    using namespace maxsum;
    
    //***************************************************************************
-   // Lookup var in the variable register
+   // Lookup var in the variable register, and if found, return its size.
    //***************************************************************************
-   typedef std::map<VarID,ValIndex>::const_iterator It;
-   It loc = varRegister_m.find(var);
-
-   //***************************************************************************
-   // If found, return its size.
-   //***************************************************************************
-   if(varRegister_m.end()!=loc)
+   const ValIndex siz = lookup_m(var);
+   if(0!=siz)
    {
-      return loc->second;
+      return siz;
    }
 
    //***************************************************************************
-   // Otherwise, if this variable is not found, return -1 to indicate that
-   // the variable is not yet registered.
+   // Otherwise, if this variable is not found, throw an exception to
+   // indicate that the variable is not yet registered.
    //***************************************************************************
    std::stringstream msg;
    msg << "Attempt to get domain size for unregistered variable: " <<  var;
@@ -73,14 +378,15 @@ maxsum::ValIndex maxsum::getDomainSize(VarID var)
  */
 int maxsum::getNumOfRegisteredVariables()
 {
-   return varRegister_m.size();
+   return varCount_m.load(std::memory_order_relaxed);
 }
 
 /**
  * Registers a variable with a specified domain size.
  * Put the specified variable in a global register, and stores its domain
  * size. Variables can be registered multiple times, but their domain size
- * must never change.
+ * must never change. This function may be called concurrently with any
+ * other function in register.h.
  * @throws InconsistentDomainException if this variable is already
  * registered, but with a different domain size.
  * @param var the unique id of this variable
@@ -108,34 +414,28 @@ void maxsum::registerVariable(VarID var, ValIndex siz)
    }
    
    //***************************************************************************
-   // Lookup var in the variable register
+   // Lookup var in the variable register, and add it if it's not already
+   // there. This is usually true for repeat registrations, which we check
+   // first without changing anything.
    //***************************************************************************
-   typedef std::map<VarID,ValIndex>::const_iterator It;
-   It loc = varRegister_m.find(var);
+   ValIndex registeredSiz = lookup_m(var);
+   if(0==registeredSiz)
+   {
+      registeredSiz = insert_m(var,siz);
+   }
 
    //***************************************************************************
-   // If found, check that its size is consistent. Otherwise throw an
-   // exception.
+   // Check that its size is consistent. Otherwise throw an exception.
    //***************************************************************************
-   if(varRegister_m.end()!=loc)
+   if(registeredSiz != siz)
    {
-      if(loc->second != siz)
-      {
-         std::stringstream msg;
+      std::stringstream msg;
 
-         msg << "Tried to register variable " << var << " again with "
-             << "inconsistent domain size.";
+      msg << "Tried to register variable " << var << " again with "
+          << "inconsistent domain size.";
 
-         throw InconsistentDomainException(functionName,msg.str());
-      }
+      throw InconsistentDomainException(functionName,msg.str());
    }
 
-   //***************************************************************************
-   // Otherwise, if this variable is not found, return -1 to indicate that
-   // the variable is not yet registered.
-   //***************************************************************************
-   varRegister_m[var] = siz;
-
 } // function registerVariable
 
-
@@ -0,0 +1,319 @@
+/**
+ * @file batchHarness.cpp
+ * Test harness for BatchSolver and solveBatch.
+ * Checks that solving a batch of graphs gives the same values as solving
+ * each graph separately with a compiled MaxSumController.
+ */
+
+#include "maxsum/common.h"
+#include "maxsum/BatchSolver.h"
+#include "maxsum/MaxSumController.h"
+#include "testUtils.h"
+#include <iostream>
+#include <cstdlib>
+using namespace maxsum;
+
+/**
+ * Number of colours used for each variable.
+ */
+const int NO_COLOURS_M = 3;
+
+/**
+ * Convenience typedef for a map of factors.
+ */
+typedef BatchSolver::FactorMap FactorMap_m;
+
+/**
+ * Fills the factors of a graph with new random values, without changing
+ * their domains.
+ * @param[in,out] factors the factors to fill.
+ */
+void randomiseValues_m(FactorMap_m& factors)
+{
+   for(FactorMap_m::iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      genColourUtil_m(it->second);
+   }
+
+} // function randomiseValues_m
+
+/**
+ * Solves a factor graph on its own with a compiled MaxSumController.
+ * @param[in] factors the factor graph to solve.
+ * @param[out] values the values found for each variable.
+ */
+void solveAlone_m(const FactorMap_m& factors, BatchSolver::ValueMap& values)
+{
+   MaxSumController controller;
+   for(FactorMap_m::const_iterator it=factors.begin();
+         it!=factors.end(); ++it)
+   {
+      controller.setFactor(it->first,it->second);
+   }
+   controller.compile();
+   controller.optimise();
+
+   values.clear();
+   for(MaxSumController::ConstValueIterator it=controller.valBegin();
+         it!=controller.valEnd(); ++it)
+   {
+      values[it->first] = it->second;
+   }
+
+} // function solveAlone_m
+
+/**
+ * Compares the values found for a graph in a batch with those found by
+ * solving it alone.
+ * @returns the number of failures
+ */
+int compareValues_m
+(
+ const BatchSolver::ValueMap& expected,
+ const BatchSolver::ValueMap& actual,
+ int instance
+)
+{
+   if(expected==actual)
+   {
+      return 0;
+   }
+
+   std::cout << "Values for instance " << instance << " differ from those"
+      " found by MaxSumController." << std::endl;
+   return 1;
+
+} // function compareValues_m
+
+/**
+ * Tests that a BatchSolver gives the same values for each instance as a
+ * compiled MaxSumController does on its own.
+ * @returns the number of failures
+ */
+int testBatch_m(int noFactors, int noInstances)
+{
+   int errorCount = 0;
+   try
+   {
+      FactorMap_m structure;
+      genRandomTree_m(noFactors,NO_COLOURS_M,structure);
+
+      BatchSolver batch(structure,noInstances);
+      if( (noFactors!=batch.noFactors()) || (noFactors!=batch.noVars()) ||
+          (noInstances!=batch.noInstances()) )
+      {
+         std::cout << "Wrong batch size." << std::endl;
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Instance 0 keeps the structure's values, the rest get new values.
+      //************************************************************************
+      std::vector<FactorMap_m> graphs(noInstances,structure);
+      for(int i=1; i<noInstances; ++i)
+      {
+         randomiseValues_m(graphs[i]);
+         batch.setFactors(i,graphs[i]);
+      }
+
+      if(MaxSumController::DEFAULT_MAX_ITERATIONS<=batch.optimise())
+      {
+         std::cout << "Batch did not converge." << std::endl;
+         ++errorCount;
+      }
+
+      for(int i=0; i<noInstances; ++i)
+      {
+         BatchSolver::ValueMap expected, actual;
+         solveAlone_m(graphs[i],expected);
+         batch.getValues(i,actual);
+         errorCount += compareValues_m(expected,actual,i);
+
+         if(batch.getValue(i,noFactors)!=expected[noFactors])
+         {
+            std::cout << "getValue disagrees with getValues." << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testBatch_m
+
+/**
+ * Tests that solveBatch gives the same values as solving each graph
+ * separately, when the graphs do not all have the same structure.
+ * @returns the number of failures
+ */
+int testSolveBatch_m()
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Interleave graphs with three different structures
+      //************************************************************************
+      FactorMap_m shapes[3];
+      for(int s=0; s<3; ++s)
+      {
+         genRandomTree_m(5+s*3,NO_COLOURS_M,shapes[s]);
+      }
+
+      std::vector<FactorMap_m> graphs;
+      for(int g=0; g<12; ++g)
+      {
+         graphs.push_back(shapes[g%3]);
+         randomiseValues_m(graphs.back());
+      }
+
+      std::vector<BatchSolver::ValueMap> values;
+      solveBatch(graphs,values);
+      if(graphs.size()!=values.size())
+      {
+         std::cout << "Wrong number of results from solveBatch." << std::endl;
+         return errorCount+1;
+      }
+
+      for(std::size_t g=0; g<graphs.size(); ++g)
+      {
+         BatchSolver::ValueMap expected;
+         solveAlone_m(graphs[g],expected);
+         errorCount += compareValues_m(expected,values[g],g);
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testSolveBatch_m
+
+/**
+ * Tests that invalid instances and factors throw exceptions.
+ * @returns the number of failures
+ */
+int testErrors_m()
+{
+   int errorCount = 0;
+   FactorMap_m structure;
+   genRandomTree_m(4,NO_COLOURS_M,structure);
+
+   try
+   {
+      BatchSolver empty(structure,0);
+      std::cout << "No exception for empty batch." << std::endl;
+      ++errorCount;
+   }
+   catch(OutOfRangeException& e) {}
+
+   //***************************************************************************
+   // A graph with no factors has nothing to solve, but is not an error
+   //***************************************************************************
+   BatchSolver nothing(FactorMap_m(),2);
+   if(0!=nothing.optimise())
+   {
+      std::cout << "Empty structure reported iterations." << std::endl;
+      ++errorCount;
+   }
+
+   BatchSolver batch(structure,2);
+   try
+   {
+      batch.getValue(2,1);
+      std::cout << "No exception for bad instance." << std::endl;
+      ++errorCount;
+   }
+   catch(OutOfRangeException& e) {}
+
+   try
+   {
+      batch.setFactor(0,1,DiscreteFunction(VarID(2),0));
+      std::cout << "No exception for bad factor domain." << std::endl;
+      ++errorCount;
+   }
+   catch(BadDomainException& e) {}
+
+   FactorMap_m other;
+   genRandomTree_m(5,NO_COLOURS_M,other);
+   if(batch.sameStructure(other) || !batch.sameStructure(structure))
+   {
+      std::cout << "sameStructure gave the wrong answer." << std::endl;
+      ++errorCount;
+   }
+
+   try
+   {
+      batch.setFactors(1,other);
+      std::cout << "No exception for bad graph structure." << std::endl;
+      ++errorCount;
+   }
+   catch(BadDomainException& e) {}
+
+   try
+   {
+      batch.getValue(0,99);
+      std::cout << "No exception for unknown variable." << std::endl;
+      ++errorCount;
+   }
+   catch(NoSuchElementException& e) {}
+
+   return errorCount;
+
+} // function testErrors_m
+
+int main()
+{
+   int errorCount = 0; // counts the number of failures
+   try
+   {
+      //************************************************************************
+      // Test batches of graphs with the same structure
+      //************************************************************************
+      std::cout << "Testing BatchSolver..." << std::endl;
+      errorCount += testBatch_m(1,3);
+      for(int trial=0; trial<5; ++trial)
+      {
+         errorCount += testBatch_m(10,1);
+         errorCount += testBatch_m(10,17);
+      }
+
+      //************************************************************************
+      // Test batches of graphs with different structures
+      //************************************************************************
+      std::cout << "Testing solveBatch..." << std::endl;
+      errorCount += testSolveBatch_m();
+
+      //************************************************************************
+      // Test error handling
+      //************************************************************************
+      std::cout << "Testing error handling..." << std::endl;
+      errorCount += testErrors_m();
+
+      std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "\nCaught unexpected exception in main: " << e.what();
+      std::cout << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
@@ -15,6 +15,19 @@
 
 using namespace maxsum;
 
+/**
+ * Visitor for DomainIterator::forEachInd() that records each visited index.
+ */
+struct IndCollector_m
+{
+   std::vector<ValIndex> inds;
+
+   void operator()(ValIndex k)
+   {
+      inds.push_back(k);
+   }
+};
+
 int testIterator
 (
  const std::vector<VarID>& vars,
@@ -88,9 +101,12 @@ int testIterator
    //***************************************************************************
    const int MAX_LOOPS = 150000; // used to avoid infinite loops
    int count = 0;
+   std::vector<ValIndex> visited;
    DomainIterator it(begin);
    for(; it.hasNext(); it++)
    {
+      visited.push_back(it.getInd());
+
       //************************************************************************
       // Check that indices are consistent
       //************************************************************************
@@ -200,6 +216,28 @@ int testIterator
       return 1;
    }
 
+   //***************************************************************************
+   // Check that the bulk visitor visits the same indices in the same order,
+   // both from the start, and from part way through the domain.
+   //***************************************************************************
+   for(int skip=0; skip<3; ++skip)
+   {
+      IndCollector_m collector;
+      DomainIterator bulk(begin);
+      for(int k=0; k<skip && bulk.hasNext(); ++k)
+      {
+         collector(bulk.getInd());
+         ++bulk;
+      }
+      bulk.forEachInd(collector);
+      if(bulk.hasNext() || (collector.inds!=visited))
+      {
+         std::cout << "forEachInd() visited different elements after "
+            << skip << " increments.\n";
+         return 1;
+      }
+   }
+
    //***************************************************************************
    // Check that we get the correct exceptions if we try to access the
    // iterator once we've reached the end of the domain.
@@ -0,0 +1,288 @@
+/**
+ * @file graphFileHarness.cpp
+ * Test harness for maxsum::saveGraph and maxsum::MappedGraph.
+ * Checks that factor graphs and messages survive a round trip through a
+ * binary file, and that loaded factors borrow their values from the mapping.
+ */
+
+#include "maxsum/common.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/GraphFile.h"
+#include "testUtils.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+using namespace maxsum;
+
+/**
+ * Name of the temporary file used by these tests.
+ */
+const char* const FILE_M = "graphFileHarness.tmp";
+
+/**
+ * Number of colours used for each variable.
+ */
+const int NO_COLOURS_M = 3;
+
+/**
+ * Generates a graph colouring problem on a ring, with one factor between
+ * each pair of neighbouring variables.
+ * @param[in] noFactors the number of factors.
+ * @param[out] controller controller in which to set the factors.
+ */
+void genRing_m(int noFactors, MaxSumController& controller)
+{
+   for(int k=1; k<=noFactors; ++k)
+   {
+      registerVariable(k,NO_COLOURS_M);
+   }
+
+   for(int k=1; k<=noFactors; ++k)
+   {
+      VarID vars[] = { static_cast<VarID>(k),
+         static_cast<VarID>(k%noFactors+1) };
+      DiscreteFunction curFactor(vars,vars+2);
+      genColourUtil_m(curFactor);
+      controller.setFactor(k,curFactor);
+   }
+
+} // function genRing_m
+
+/**
+ * Checks that two controllers have the same factors.
+ * @returns the number of failures
+ */
+int compareFactors_m(const MaxSumController& expected,
+      const MaxSumController& actual)
+{
+   int errorCount = 0;
+   if(expected.noFactors()!=actual.noFactors())
+   {
+      std::cout << "Expected " << expected.noFactors() << " factors but found "
+         << actual.noFactors() << std::endl;
+      ++errorCount;
+   }
+
+   for(MaxSumController::ConstFactorIterator it=expected.factorBegin();
+         it!=expected.factorEnd(); ++it)
+   {
+      if(!actual.hasFactor(it->first) ||
+         !(actual.getFactor(it->first)==it->second))
+      {
+         std::cout << "Factor " << it->first << " was not loaded correctly.\n";
+         ++errorCount;
+      }
+   }
+   return errorCount;
+
+} // function compareFactors_m
+
+/**
+ * Tests saving and loading a graph without messages.
+ * @returns the number of failures
+ */
+int testRoundTrip_m()
+{
+   int errorCount = 0;
+   MaxSumController original;
+   genRing_m(20,original);
+   saveGraph(FILE_M,original);
+
+   MappedGraph mapped(FILE_M);
+   if( (20!=mapped.noFactors()) || (20!=mapped.noVars()) ||
+       mapped.hasMessages() )
+   {
+      std::cout << "Wrong header: " << mapped.noFactors() << " factors, "
+         << mapped.noVars() << " variables." << std::endl;
+      ++errorCount;
+   }
+
+   MaxSumController loaded;
+   mapped.load(loaded);
+   errorCount += compareFactors_m(original,loaded);
+
+   //***************************************************************************
+   // Loaded factors should use the mapping in place, and changing them
+   // should not change the file.
+   //***************************************************************************
+   if(!loaded.getFactor(1).isBorrowed())
+   {
+      std::cout << "Loaded factor does not borrow its values." << std::endl;
+      ++errorCount;
+   }
+
+   loaded.getUnSafeWritableFactorHandle(1)(0) += 1;
+   MappedGraph remapped(FILE_M);
+   if(!(remapped.factor(0)==original.getFactor(1)))
+   {
+      std::cout << "Changing a loaded factor changed the file." << std::endl;
+      ++errorCount;
+   }
+   loaded.getUnSafeWritableFactorHandle(1)(0) -= 1;
+
+   //***************************************************************************
+   // Both controllers should now find the same solution.
+   //***************************************************************************
+   original.optimise();
+   loaded.optimise();
+   for(MaxSumController::ConstValueIterator it=original.valBegin();
+         it!=original.valEnd(); ++it)
+   {
+      if(loaded.getValue(it->first)!=it->second)
+      {
+         std::cout << "Loaded graph gives a different value for variable "
+            << it->first << std::endl;
+         ++errorCount;
+      }
+   }
+   return errorCount;
+
+} // function testRoundTrip_m
+
+/**
+ * Tests warm starting a controller from a checkpoint with messages.
+ * @returns the number of failures
+ */
+int testCheckpoint_m()
+{
+   int errorCount = 0;
+   MaxSumController original;
+   genRing_m(20,original);
+   const int coldIterations = original.optimise();
+   saveGraph(FILE_M,original,true);
+
+   MappedGraph mapped(FILE_M);
+   if(!mapped.hasMessages())
+   {
+      std::cout << "Checkpoint has no messages." << std::endl;
+      ++errorCount;
+   }
+
+   MaxSumController restored;
+   mapped.load(restored);
+
+   //***************************************************************************
+   // The first iteration confirms that the saved messages have converged,
+   // and the second propagates the variable values, which are not saved.
+   //***************************************************************************
+   const int warmIterations = restored.optimise();
+   if( (2<warmIterations) || (warmIterations>=coldIterations) )
+   {
+      std::cout << "Warm start took " << warmIterations << " iterations, "
+         "compared to " << coldIterations << " from cold." << std::endl;
+      ++errorCount;
+   }
+
+   for(MaxSumController::ConstValueIterator it=original.valBegin();
+         it!=original.valEnd(); ++it)
+   {
+      if(restored.getValue(it->first)!=it->second)
+      {
+         std::cout << "Restored controller gives a different value for "
+            "variable " << it->first << std::endl;
+         ++errorCount;
+      }
+   }
+   return errorCount;
+
+} // function testCheckpoint_m
+
+/**
+ * Tests that invalid files are rejected.
+ * @returns the number of failures
+ */
+int testBadFiles_m()
+{
+   int errorCount = 0;
+
+   //***************************************************************************
+   // Missing file and wrong magic number
+   //***************************************************************************
+   std::remove(FILE_M);
+   try
+   {
+      MappedGraph mapped(FILE_M);
+      std::cout << "No exception for missing file." << std::endl;
+      ++errorCount;
+   }
+   catch(FileFormatException& e) {}
+
+   {
+      std::ofstream out(FILE_M,std::ios::out|std::ios::binary);
+      for(int k=0; k<256; ++k)
+      {
+         out.put('x');
+      }
+   }
+   try
+   {
+      MappedGraph mapped(FILE_M);
+      std::cout << "No exception for bad magic number." << std::endl;
+      ++errorCount;
+   }
+   catch(FileFormatException& e) {}
+
+   //***************************************************************************
+   // Truncated file
+   //***************************************************************************
+   MaxSumController original;
+   genRing_m(5,original);
+   saveGraph(FILE_M,original);
+   std::ifstream in(FILE_M,std::ios::in|std::ios::binary);
+   std::string contents((std::istreambuf_iterator<char>(in)),
+         std::istreambuf_iterator<char>());
+   in.close();
+   {
+      std::ofstream out(FILE_M,std::ios::out|std::ios::binary);
+      out.write(contents.data(),contents.size()/2);
+   }
+
+   try
+   {
+      MappedGraph mapped(FILE_M);
+      MaxSumController loaded;
+      mapped.load(loaded);
+      std::cout << "No exception for truncated file." << std::endl;
+      ++errorCount;
+   }
+   catch(FileFormatException& e) {}
+
+   std::remove(FILE_M);
+   return errorCount;
+
+} // function testBadFiles_m
+
+int main()
+{
+   int errorCount = 0; // counts the number of failures
+   try
+   {
+      std::cout << "Testing round trip..." << std::endl;
+      errorCount += testRoundTrip_m();
+
+      std::cout << "Testing checkpoint..." << std::endl;
+      errorCount += testCheckpoint_m();
+
+      std::cout << "Testing bad files..." << std::endl;
+      errorCount += testBadFiles_m();
+
+      std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "\nCaught unexpected exception in main: " << e.what();
+      std::cout << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
@@ -0,0 +1,323 @@
+/**
+ * @file mapHarness.cpp
+ * Test harness for the maxsum::DomainMap class.
+ */
+#include <cstdlib>
+#include <limits>
+#include <bitset>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include "maxsum/DiscreteFunction.h"
+#include "maxsum/DomainMap.h"
+
+using namespace maxsum;
+
+/**
+ * Tests the mapping between an outer and inner function by comparing
+ * each DomainMap operation with the equivalent calculation using a
+ * maxsum::DomainIterator.
+ * @param[in] outer function with the outer domain.
+ * @param[in] inner function with the inner domain.
+ * @returns the number of errors.
+ */
+int testMapping(const DiscreteFunction& outer, const DiscreteFunction& inner)
+{
+   int errorCount = 0;
+   DomainMap map(outer,inner);
+
+   if(!map.matches(outer,inner))
+   {
+      std::cout << "map does not match its own domains\n";
+      ++errorCount;
+   }
+
+   if( (map.outerSize()!=outer.domainSize()) ||
+       (map.innerSize()!=inner.domainSize()) )
+   {
+      std::cout << "map has wrong domain sizes\n";
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Check that adding and subtracting matches the iterator version
+   //***************************************************************************
+   DiscreteFunction sum(outer);
+   DiscreteFunction diff(outer);
+   map.add(&sum(0),&inner(0));
+   map.subtract(&diff(0),&inner(0));
+
+   DiscreteFunction expanded(outer);
+   map.expand(&inner(0),&expanded(0));
+
+   for(DomainIterator it(outer); it.hasNext(); ++it)
+   {
+      const ValIndex k = it.getInd();
+      if(sum(k) != outer(k)+inner(it))
+      {
+         std::cout << "add is wrong at " << k << '\n';
+         ++errorCount;
+         break;
+      }
+
+      if(diff(k) != outer(k)-inner(it))
+      {
+         std::cout << "subtract is wrong at " << k << '\n';
+         ++errorCount;
+         break;
+      }
+
+      if(expanded(k) != inner(it))
+      {
+         std::cout << "expand is wrong at " << k << '\n';
+         ++errorCount;
+         break;
+      }
+   }
+
+   //***************************************************************************
+   // Check that the maximum marginal matches a brute force calculation
+   //***************************************************************************
+   DiscreteFunction result(inner);
+   DiscreteFunction expected(inner);
+   maxMarginal(outer,result,map);
+   for(ValIndex k=0; k<expected.domainSize(); ++k)
+   {
+      expected(k) = -std::numeric_limits<ValType>::max();
+   }
+   for(DomainIterator it(outer); it.hasNext(); ++it)
+   {
+      ValType& cur = expected(it);
+      cur = std::max(cur,outer(it.getInd()));
+   }
+
+   if(result != expected)
+   {
+      std::cout << "maxMarginal is wrong\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testMapping
+
+/**
+ * Tests DomainMap on every pair of functions over subsets of a fixed set
+ * of variables.
+ * @returns the number of errors.
+ */
+int testAllSubsets()
+{
+   //***************************************************************************
+   // Construct test functions for different subsets of variables, with
+   // random values.
+   //***************************************************************************
+   std::vector<DiscreteFunction> funcs;
+   VarID vars[] = {1,2,3,101,104};
+   for(unsigned long v = 0x0; v < 0x20; v++)
+   {
+      std::bitset<5> inDomain(v);
+      std::vector<VarID> selVars;
+      for(int k=0; k<5; k++)
+      {
+         if(inDomain[k])
+         {
+            selVars.push_back(vars[k]);
+         }
+      }
+
+      DiscreteFunction fun(selVars.begin(),selVars.end());
+      for(int k=0; k<fun.domainSize(); ++k)
+      {
+         fun(k) = static_cast<ValType>(rand() % 1000 - 500);
+      }
+      funcs.push_back(fun);
+   }
+
+   //***************************************************************************
+   // Test every pair of functions for which the domain of one is a
+   // subset of the other. Otherwise check that an exception is thrown.
+   //***************************************************************************
+   int errorCount = 0;
+   int testCount = 0;
+   for(unsigned long o = 0x0; o < funcs.size(); ++o)
+   {
+      for(unsigned long i = 0x0; i < funcs.size(); ++i)
+      {
+         if( (o & i) == i )
+         {
+            errorCount += testMapping(funcs[o],funcs[i]);
+            ++testCount;
+            continue;
+         }
+
+         try
+         {
+            DomainMap map(funcs[o],funcs[i]);
+            std::cout << "No exception for non-subset domain\n";
+            ++errorCount;
+         }
+         catch(BadDomainException& e) {}
+      }
+   }
+
+   std::cout << "Tested " << testCount << " mappings.\n";
+   return errorCount;
+
+} // function testAllSubsets
+
+/**
+ * Tests that contiguous dimensions are merged.
+ * @returns the number of errors.
+ */
+int testMerging()
+{
+   int errorCount = 0;
+   VarID abc[] = {1,2,3};
+   VarID ab[] = {1,2};
+   VarID c[] = {3};
+   DiscreteFunction fABC(abc,abc+3);
+   DiscreteFunction fAB(ab,ab+2);
+   DiscreteFunction fC(c,c+1);
+
+   if(1!=DomainMap(fABC,fABC).noDims())
+   {
+      std::cout << "Identical domains should map with one dimension\n";
+      ++errorCount;
+   }
+
+   if(2!=DomainMap(fABC,fAB).noDims())
+   {
+      std::cout << "Prefix domain should map with two dimensions\n";
+      ++errorCount;
+   }
+
+   if(2!=DomainMap(fABC,fC).noDims())
+   {
+      std::cout << "Suffix domain should map with two dimensions\n";
+      ++errorCount;
+   }
+
+   if(DomainMap(fABC,fAB).matches(fABC,fC))
+   {
+      std::cout << "Map should not match different domain\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testMerging
+
+/**
+ * Tests the 3-D max marginal kernels against brute force calculations,
+ * for tables with every combination of trivial and non-trivial axes.
+ * @returns the number of errors.
+ */
+int testAxisKernels()
+{
+   int errorCount = 0;
+   const ValIndex shapes[][3] = { {1,1,1}, {7,1,1}, {1,7,1}, {1,1,7},
+      {5,8,1}, {1,8,5}, {5,1,8}, {3,8,4}, {16,3,9} };
+   const int noShapes = sizeof(shapes)/sizeof(shapes[0]);
+
+   for(int s=0; s<noShapes; ++s)
+   {
+      const ValIndex n0 = shapes[s][0];
+      const ValIndex n1 = shapes[s][1];
+      const ValIndex n2 = shapes[s][2];
+      std::vector<ValType> in(n0*n1*n2);
+      for(std::size_t k=0; k<in.size(); ++k)
+      {
+         in[k] = static_cast<ValType>(rand() % 1000 - 500);
+      }
+
+      //************************************************************************
+      // Brute force results
+      //************************************************************************
+      const ValType lowest = -std::numeric_limits<ValType>::max();
+      std::vector<ValType> onto(n1,lowest);
+      std::vector<ValType> over(n0*n2,lowest);
+      for(ValIndex i=0; i<n0; ++i)
+      {
+         for(ValIndex j=0; j<n1; ++j)
+         {
+            for(ValIndex k=0; k<n2; ++k)
+            {
+               const ValType val = in[i+n0*(j+n1*k)];
+               onto[j] = std::max(onto[j],val);
+               over[i+n0*k] = std::max(over[i+n0*k],val);
+            }
+         }
+      }
+
+      //************************************************************************
+      // Compare with kernels
+      //************************************************************************
+      std::vector<ValType> ontoResult(n1);
+      std::vector<ValType> overResult(n0*n2);
+      DomainMap::maxOntoAxis(&in[0],n0,n1,n2,&ontoResult[0]);
+      DomainMap::maxOverAxis(&in[0],n0,n1,n2,&overResult[0]);
+
+      if(onto!=ontoResult)
+      {
+         std::cout << "maxOntoAxis is wrong for shape " << n0 << 'x' << n1;
+         std::cout << 'x' << n2 << '\n';
+         ++errorCount;
+      }
+
+      if(over!=overResult)
+      {
+         std::cout << "maxOverAxis is wrong for shape " << n0 << 'x' << n1;
+         std::cout << 'x' << n2 << '\n';
+         ++errorCount;
+      }
+   }
+
+   return errorCount;
+
+} // function testAxisKernels
+
+/**
+ * Main function for DomainMap test harness.
+ */
+int main()
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Register some variables for test purposes
+      //************************************************************************
+      VarID vars[] = {1,2,3,101,102,103,104};
+      ValIndex sizes[] = {15,5,5,10,3,2,6};
+      registerVariables(vars,vars+7,sizes,sizes+7);
+
+      std::cout << "******************************************\n";
+      std::cout << " Testing mappings between subdomains\n";
+      std::cout << "******************************************\n";
+      errorCount += testAllSubsets();
+
+      std::cout << "******************************************\n";
+      std::cout << " Testing dimension merging\n";
+      std::cout << "******************************************\n";
+      errorCount += testMerging();
+
+      std::cout << "******************************************\n";
+      std::cout << " Testing max marginal kernels\n";
+      std::cout << "******************************************\n";
+      errorCount += testAxisKernels();
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught exception: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   std::cout << "Number of failures: " << errorCount << std::endl;
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
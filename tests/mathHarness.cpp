@@ -529,6 +529,283 @@ int testMath()
 
 } // testMath
 
+/**
+ * Tests move construction, move assignment and the rvalue overloads of the
+ * arithmetic operators. Functions with large domains should hand over their
+ * value table, while the moved from function is left as the constant 0.
+ * @returns the number of errors.
+ */
+int testMoves()
+{
+   int errorCount = 0;
+
+   //***************************************************************************
+   // Construct a function large enough to store its values on the heap,
+   // and a small function whose values are stored inline.
+   //***************************************************************************
+   VarID bigVars[] = {1,2,3};
+   DiscreteFunction orig(bigVars,bigVars+3);
+   for(ValIndex k=0; k<orig.domainSize(); ++k)
+   {
+      orig(k) = static_cast<ValType>(k % 17 + 1);
+   }
+   DiscreteFunction small(3,2.5);
+
+   //***************************************************************************
+   // Check move construction and assignment
+   //***************************************************************************
+   DiscreteFunction big(orig);
+   const ValType* pTable = &big(0);
+   DiscreteFunction moved(std::move(big));
+   if( (&moved(0)!=pTable) || (moved!=orig) )
+   {
+      std::cout << "Move constructor did not transfer value table.\n";
+      ++errorCount;
+   }
+
+   if( (0!=big.noVars()) || (1!=big.domainSize()) || (0!=big(0)) )
+   {
+      std::cout << "Moved from function is not constant zero.\n";
+      ++errorCount;
+   }
+
+   DiscreteFunction assigned(small);
+   assigned = std::move(moved);
+   if( (&assigned(0)!=pTable) || (assigned!=orig) || (0!=moved.noVars()) )
+   {
+      std::cout << "Move assignment did not transfer value table.\n";
+      ++errorCount;
+   }
+
+   DiscreteFunction smallCopy(small);
+   DiscreteFunction smallMoved(std::move(smallCopy));
+   if( (smallMoved!=small) || (0!=smallCopy.noVars()) || (0!=smallCopy(0)) )
+   {
+      std::cout << "Move of inline function is wrong.\n";
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Check that arithmetic on temporaries reuses their storage and gives
+   // the same results as the copying operators.
+   //***************************************************************************
+   DiscreteFunction tmp(orig);
+   pTable = &tmp(0);
+   DiscreteFunction sum = std::move(tmp) + small + 1.0;
+   if( (&sum(0)!=pTable) || (sum!=orig+small+1.0) )
+   {
+      std::cout << "Addition did not reuse temporary.\n";
+      ++errorCount;
+   }
+
+   if( (4.0-DiscreteFunction(orig) != 4.0-orig) ||
+       (4.0/DiscreteFunction(orig) != 4.0/orig) ||
+       (4.0*DiscreteFunction(orig) != 4.0*orig) ||
+       (4.0+DiscreteFunction(orig) != 4.0+orig) ||
+       (-DiscreteFunction(orig) != -orig) ||
+       ((orig-small)*2.0/small != ((orig-small)*2.0)/small) )
+   {
+      std::cout << "Operators on temporaries give wrong results.\n";
+      ++errorCount;
+   }
+
+   DiscreteFunction negOrig = -orig;
+   if( (elementWiseOp<std::fabs>(DiscreteFunction(negOrig)) != orig) ||
+       (elementWiseOp<std::fabs>(negOrig) != orig) )
+   {
+      std::cout << "elementWiseOp on temporary gives wrong result.\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // testMoves
+
+/**
+ * Returns true if two functions have the same domain and exactly the same
+ * values.
+ */
+bool identical(const DiscreteFunction& f1, const DiscreteFunction& f2)
+{
+   if(!sameDomain(f1,f2))
+   {
+      return false;
+   }
+   for(ValIndex k=0; k<f1.domainSize(); ++k)
+   {
+      if(f1(k)!=f2(k))
+      {
+         return false;
+      }
+   }
+   return true;
+
+} // identical
+
+/**
+ * Tests that expressions built from the arithmetic operators and
+ * element-wise functions give exactly the same results as evaluating each
+ * operation separately, including when the result appears in its own
+ * expression, and that temporary functions are reused for the result.
+ * @returns the number of errors.
+ */
+int testExpressions()
+{
+   int errorCount = 0;
+
+   //***************************************************************************
+   // Create functions with overlapping domains, and positive values.
+   //***************************************************************************
+   VarID aVars[] = {1,2};
+   VarID bVars[] = {2,3};
+   VarID bigVars[] = {1,2,3,101};
+   DiscreteFunction a(aVars,aVars+2);
+   DiscreteFunction b(bVars,bVars+2);
+   DiscreteFunction c(VarID(101),0);
+   for(ValIndex k=0; k<a.domainSize(); ++k)
+   {
+      a(k) = static_cast<ValType>(k % 13 + 1);
+   }
+   for(ValIndex k=0; k<b.domainSize(); ++k)
+   {
+      b(k) = static_cast<ValType>(k % 7 + 2) / 4;
+   }
+   for(ValIndex k=0; k<c.domainSize(); ++k)
+   {
+      c(k) = static_cast<ValType>(k) - 5;
+   }
+
+   //***************************************************************************
+   // Check a fused expression against each operation in turn, and against
+   // the values calculated directly at each point in the union domain.
+   //***************************************************************************
+   DiscreteFunction fused = a + b - c*2.0;
+   DiscreteFunction stepwise(a);
+   stepwise += b;
+   DiscreteFunction c2(c);
+   c2 *= 2.0;
+   stepwise -= c2;
+   if(!identical(fused,stepwise))
+   {
+      std::cout << "Fused expression differs from separate operations.\n";
+      ++errorCount;
+   }
+
+   std::vector<VarID> domain(fused.varBegin(),fused.varEnd());
+   for(DomainIterator it(domain.begin(),domain.end()); it.hasNext(); ++it)
+   {
+      const ValType a_j = a(domain,it.getSubInd());
+      const ValType b_j = b(domain,it.getSubInd());
+      const ValType c_j = c(domain,it.getSubInd());
+      if(fused(it.getInd()) != a_j + b_j - c_j*2)
+      {
+         std::cout << "Wrong value for fused expression at index "
+            << it.getInd() << std::endl;
+         ++errorCount;
+         break;
+      }
+   }
+
+   //***************************************************************************
+   // Check element-wise functions inside expressions.
+   //***************************************************************************
+   DiscreteFunction ewFused = std::exp(a - b) / (1.0 + std::fabs(c));
+   DiscreteFunction diff(a);
+   diff -= b;
+   DiscreteFunction ewStep = elementWiseOp<std::exp>(diff);
+   DiscreteFunction absC(c);
+   for(ValIndex k=0; k<absC.domainSize(); ++k)
+   {
+      absC(k) = std::fabs(absC(k)) + 1;
+   }
+   ewStep /= absC;
+   if(!identical(ewFused,ewStep))
+   {
+      std::cout << "Element-wise functions differ in expressions.\n";
+      ++errorCount;
+   }
+
+   DiscreteFunction powFused = std::pow(a,b*0.5);
+   DiscreteFunction powStep(b);
+   powStep *= 0.5;
+   DiscreteFunction powBase(a);
+   powBase.expand(powStep);
+   powStep.expand(a);
+   for(ValIndex k=0; k<powStep.domainSize(); ++k)
+   {
+      powStep(k) = std::pow(powBase(k),powStep(k));
+   }
+   if(!identical(powFused,powStep))
+   {
+      std::cout << "Element-wise pow differs in expressions.\n";
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Check expressions that contain their own destination, both when the
+   // destination keeps its domain, and when it is expanded.
+   //***************************************************************************
+   DiscreteFunction same(fused);
+   same = same*0.5 + a;
+   DiscreteFunction sameStep(fused);
+   sameStep *= 0.5;
+   sameStep += a;
+   if(!identical(same,sameStep))
+   {
+      std::cout << "Expression assigned to one of its operands is wrong.\n";
+      ++errorCount;
+   }
+
+   DiscreteFunction grow(c);
+   grow = b*grow + a;
+   DiscreteFunction growStep(b);
+   growStep *= c;
+   growStep += a;
+   if(!identical(grow,growStep))
+   {
+      std::cout << "Expression that expands its operand is wrong.\n";
+      ++errorCount;
+   }
+
+   DiscreteFunction compound(c);
+   compound += a*b;
+   DiscreteFunction ab(a);
+   ab *= b;
+   DiscreteFunction compoundStep(c);
+   compoundStep += ab;
+   if(!identical(compound,compoundStep))
+   {
+      std::cout << "Compound assignment of expression is wrong.\n";
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Check that a temporary with the result's domain is reused, unless its
+   // values are borrowed.
+   //***************************************************************************
+   DiscreteFunction big(bigVars,bigVars+4,1.0);
+   const ValType* pTable = &big(0);
+   DiscreteFunction reused = std::exp(std::move(big)*0.5 + a) - c;
+   if(&reused(0)!=pTable)
+   {
+      std::cout << "Expression did not reuse temporary.\n";
+      ++errorCount;
+   }
+
+   std::vector<ValType> buffer(reused.domainSize(),3.0);
+   DiscreteFunction borrowed(reused.varBegin(),reused.varEnd(),
+         &buffer[0],buffer.size());
+   DiscreteFunction notReused = std::move(borrowed) + 1.0;
+   if( (&notReused(0)==&buffer[0]) || (3.0!=buffer[0]) || (4.0!=notReused(0)) )
+   {
+      std::cout << "Expression overwrote borrowed temporary.\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // testExpressions
+
 int main()
 {
    try
@@ -561,6 +838,25 @@ int main()
       {
          return EXIT_FAILURE;
       }
+
+      //************************************************************************
+      // Test move semantics
+      //************************************************************************
+      std::cout << "******************************************\n";
+      std::cout << " Test Move Semantics\n";
+      std::cout << "******************************************\n";
+      if(0!=testMoves())
+      {
+         return EXIT_FAILURE;
+      }
+
+      std::cout << "******************************************\n";
+      std::cout << " Test Expressions\n";
+      std::cout << "******************************************\n";
+      if(0!=testExpressions())
+      {
+         return EXIT_FAILURE;
+      }
    }
    catch(std::exception& e)
    {
@@ -10,9 +10,103 @@
 #include <ctime>
 #include <iomanip>
 #include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
 #include <set>
+#include <algorithm>
+#include <future>
+#include <thread>
 using namespace maxsum;
 
+/**
+ * Number of calls to the global operator new, used to check that max-sum
+ * iterations do not allocate any memory.
+ */
+long allocCount_m = 0;
+
+//******************************************************************************
+// The replacement allocation functions are kept out of line, so that GCC
+// does not inline a call to free() into code that it can see calling
+// operator new, and mistake the pair for mismatched allocation functions.
+//******************************************************************************
+#if defined(__GNUC__)
+#define NOINLINE_M __attribute__((noinline))
+#else
+#define NOINLINE_M
+#endif
+
+/**
+ * Allocates memory for the replacement operators new and new[], and counts
+ * the allocation.
+ */
+NOINLINE_M void* countedAlloc_m(std::size_t size)
+{
+   ++allocCount_m;
+   void* ptr = std::malloc(0==size ? 1 : size);
+   if(0==ptr)
+   {
+      throw std::bad_alloc();
+   }
+   return ptr;
+}
+
+/**
+ * Frees memory allocated by countedAlloc_m().
+ */
+NOINLINE_M void countedFree_m(void* ptr)
+{
+   std::free(ptr);
+}
+
+/**
+ * Replacement for global operator new, which counts every allocation.
+ */
+NOINLINE_M void* operator new(std::size_t size)
+{
+   return countedAlloc_m(size);
+}
+
+/**
+ * Replacement for global operator new[], which counts every allocation.
+ */
+NOINLINE_M void* operator new[](std::size_t size)
+{
+   return countedAlloc_m(size);
+}
+
+/**
+ * Replacement for global operator delete, to match operator new.
+ */
+NOINLINE_M void operator delete(void* ptr) noexcept
+{
+   countedFree_m(ptr);
+}
+
+/**
+ * Replacement for global operator delete[], to match operator new[].
+ */
+NOINLINE_M void operator delete[](void* ptr) noexcept
+{
+   countedFree_m(ptr);
+}
+
+/**
+ * Replacement for global sized operator delete, to match operator new.
+ */
+NOINLINE_M void operator delete(void* ptr, std::size_t) noexcept
+{
+   countedFree_m(ptr);
+}
+
+/**
+ * Replacement for global sized operator delete[], to match operator new[].
+ */
+NOINLINE_M void operator delete[](void* ptr, std::size_t) noexcept
+{
+   countedFree_m(ptr);
+}
+
 /**
  * Scale factor used to divid random numbers in [0,1] to generate
  * a small random utility bias.
@@ -632,101 +726,1874 @@ int testMaxSum_m(MaxSumController& controller, const FactorMap_m& factors)
 
 
 /**
- * Main function tests a maxsum controller on several factor graphs.
+ * Tests that a compiled MaxSumController produces the same results as an
+ * uncompiled controller for a given factor graph.
+ * @returns the number of failures
  */
-int main()
+int testCompiled_m(const FactorMap_m& factors)
 {
-   int errorCount = 0; // counts the number of failures
+   int errorCount = 0;
    try
    {
-      FactorMap_m factors; // Reusable FactorMap for storing current factors
-      MaxSumController controller; // MaxSumController for testing
+      //************************************************************************
+      // Create two controllers for the same factor graph, and compile one.
+      //************************************************************************
+      MaxSumController plain;
+      MaxSumController compiled;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         plain.setFactor(it->first,it->second);
+         compiled.setFactor(it->first,it->second);
+      }
+      compiled.compile();
+
+      if(!compiled.isCompiled() || plain.isCompiled())
+      {
+         std::cout << "Wrong compiled state reported.\n";
+         return ++errorCount;
+      }
+
+      errorCount += isConsistent_m(compiled,factors);
+
+      //************************************************************************
+      // Run both, and time the compiled version
+      //************************************************************************
+      plain.optimise();
+      std::cout << "Attempting to run compiled max-sum algorithm...";
       std::clock_t runtime = std::clock();
+      int iterationCount = compiled.optimise();
+      runtime = std::clock() - runtime;
+      std::cout << "DONE.\n";
+
+      double seconds = static_cast<double>(runtime) / CLOCKS_PER_SEC;
+      std::cout << "RUNTIME=" << seconds;
+      std::cout << " ITERATIONS=" << iterationCount << std::endl;
 
       //************************************************************************
-      // Test behaviour of an uninitialised controller
+      // Check that both controllers agree on all values
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on empty graph                               *\n";
-      std::cout << "********************************************************\n";
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
-      std::cout << std::endl;
+      for(MaxSumController::ConstValueIterator it=plain.valBegin();
+            it!=plain.valEnd(); ++it)
+      {
+         if(compiled.getValue(it->first)!=it->second)
+         {
+            std::cout << "Compiled value mismatch for variable: "
+               << it->first << '\n';
+            ++errorCount;
+         }
+      }
 
       //************************************************************************
-      // Test on singleton graph, containing only one factor and variable
+      // Check that both controllers agree on the total value of each factor.
+      // This only applies if max-sum has converged, since otherwise the
+      // totals depend on exactly which messages were sent in which order.
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on singleton graph                           *\n";
-      std::cout << "********************************************************\n";
-      genTreeGraph_m(1,1,factors);
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
-      std::cout << std::endl;
-   
+      bool converged =
+         iterationCount < MaxSumController::DEFAULT_MAX_ITERATIONS;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            converged && it!=factors.end(); ++it)
+      {
+         DiscreteFunction diff(compiled.getTotalValue(it->first));
+         diff -= plain.getTotalValue(it->first);
+         if(diff.maxnorm() > 0.0001)
+         {
+            std::cout << "Compiled total value mismatch for factor: "
+               << it->first << '\n';
+            ++errorCount;
+         }
+      }
+
       //************************************************************************
-      // Create a MaxSumController and test it on a line graph (i.e. tree graph
-      // with branching factor of 1.
+      // Total values are calculated on demand, so all should be available,
+      // and before optimisation they should equal the factors themselves.
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on line graph                                *\n";
-      std::cout << "********************************************************\n";
-      genTreeGraph_m(10,1,factors);
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
-      std::cout << std::endl;
+      FactorMap_m totals;
+      plain.getTotalValues(totals);
+      if(totals.size()!=factors.size())
+      {
+         std::cout << "Wrong number of total values: " << totals.size()
+            << '\n';
+         ++errorCount;
+      }
+
+      MaxSumController fresh;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         fresh.setFactor(it->first,it->second);
+      }
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(!equalWithinTolerance(fresh.getTotalValue(it->first),it->second))
+         {
+            std::cout << "Initial total value differs from factor.\n";
+            ++errorCount;
+         }
+      }
 
       //************************************************************************
-      // Test on ring with same number of factors
+      // Changing the graph should discard the compiled version
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on ring graph                                *\n";
-      std::cout << "********************************************************\n";
-      genRingGraph_m(10,factors);
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
-      std::cout << std::endl;
+      if(!factors.empty())
+      {
+         compiled.setFactor(factors.begin()->first,factors.begin()->second);
+         if(compiled.isCompiled())
+         {
+            std::cout << "Controller still compiled after setFactor.\n";
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
 
+   return errorCount;
+
+} // function testCompiled_m
+
+/**
+ * Tests that running a MaxSumController with multiple threads gives
+ * exactly the same results as a single thread.
+ * @returns the number of failures
+ */
+int testParallel_m(const FactorMap_m& factors, int noThreads)
+{
+   int errorCount = 0;
+   try
+   {
       //************************************************************************
-      // Test on tree with additional factors
+      // Create a serial and parallel controller for the same factor graph
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on tree graph                                *\n";
-      std::cout << "********************************************************\n";
-      genTreeGraph_m(4,2,factors);
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
-      std::cout << std::endl;
+      MaxSumController serial;
+      MaxSumController parallel;
+      parallel.setNoThreads(noThreads);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         serial.setFactor(it->first,it->second);
+         parallel.setFactor(it->first,it->second);
+      }
+      serial.compile();
 
       //************************************************************************
-      // Test removing factors from factor graph in various ways
+      // Run both, and time the parallel version
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing Factor removal                               *\n";
-      std::cout << "********************************************************\n";
-      errorCount += testRemoval_m(controller,factors);
-      std::cout << std::endl;
+      int serialCount = serial.optimise();
+      std::cout << "Attempting to run max-sum with " << noThreads
+         << " threads...";
+      std::clock_t runtime = std::clock();
+      int iterationCount = parallel.optimise();
+      runtime = std::clock() - runtime;
+      std::cout << "DONE.\n";
+
+      double seconds = static_cast<double>(runtime) / CLOCKS_PER_SEC;
+      std::cout << "RUNTIME=" << seconds;
+      std::cout << " ITERATIONS=" << iterationCount << std::endl;
+
+      if(serialCount!=iterationCount)
+      {
+         std::cout << "Parallel iteration count mismatch: " << serialCount
+            << "!=" << iterationCount << '\n';
+         ++errorCount;
+      }
 
       //************************************************************************
-      // Test on fully connected graph with last factors.
+      // Results should be identical, not just close
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on colourable fully connected graph          *\n";
-      std::cout << "********************************************************\n";
-      genFullGraph_m(NO_COLOURS,factors);
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
-      std::cout << std::endl;
+      for(MaxSumController::ConstValueIterator it=serial.valBegin();
+            it!=serial.valEnd(); ++it)
+      {
+         if(parallel.getValue(it->first)!=it->second)
+         {
+            std::cout << "Parallel value mismatch for variable: "
+               << it->first << '\n';
+            ++errorCount;
+         }
+      }
+
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         DiscreteFunction diff(parallel.getTotalValue(it->first));
+         diff -= serial.getTotalValue(it->first);
+         if(0!=diff.maxnorm())
+         {
+            std::cout << "Parallel total value mismatch for factor: "
+               << it->first << '\n';
+            ++errorCount;
+         }
+      }
 
       //************************************************************************
-      // Test on fully connected graph with last factors.
+      // Check that invalid thread counts are rejected
       //************************************************************************
-      std::cout << "********************************************************\n";
-      std::cout << "* Testing on non-colourable fully connected graph      *\n";
-      std::cout << "********************************************************\n";
-      genFullGraph_m(NO_COLOURS+2,factors);
-      printFactorMap(factors);
-      errorCount += testMaxSum_m(controller,factors);
+      bool caught = false;
+      try
+      {
+         parallel.setNoThreads(0);
+      }
+      catch(OutOfRangeException& e)
+      {
+         caught = true;
+      }
+
+      if(!caught || noThreads!=parallel.noThreads())
+      {
+         std::cout << "Invalid thread count not rejected.\n";
+         ++errorCount;
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testParallel_m
+
+/**
+ * Tests that, once max-sum has warmed up, further iterations do not
+ * allocate any memory.
+ * @returns the number of failures
+ */
+int testNoAllocation_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Run a few iterations to allocate all the memory we need
+      //************************************************************************
+      const int ITERATIONS = 10;
+      MaxSumController controller(ITERATIONS);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         controller.setFactor(it->first,it->second);
+      }
+      controller.optimise();
+      controller.optimise();
+
+      //************************************************************************
+      // Count allocations made by further iterations
+      //************************************************************************
+      long startCount = allocCount_m;
+      int iterationCount = controller.optimise();
+      long noAllocs = allocCount_m - startCount;
+
+      std::cout << "ITERATIONS=" << iterationCount;
+      std::cout << " ALLOCATIONS=" << noAllocs << std::endl;
+
+      if(0!=noAllocs)
+      {
+         std::cout << "Steady state max-sum iterations allocated memory.\n";
+         ++errorCount;
+      }
+
+      if(ITERATIONS!=iterationCount)
+      {
+         std::cout << "Allocation test graph converged too early.\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Small functions, such as messages, should be stored inline
+      //************************************************************************
+      const DiscreteFunction& factor = factors.begin()->second;
+      startCount = allocCount_m;
+      {
+         DiscreteFunction msg(*factor.varBegin(),1.0);
+         DiscreteFunction copy(msg);
+         copy += msg;
+         msg = copy;
+      }
+      noAllocs = allocCount_m - startCount;
+      if(0!=noAllocs)
+      {
+         std::cout << "Copying small functions allocated memory.\n";
+         ++errorCount;
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testNoAllocation_m
+
+/**
+ * Tests that re-optimising after a change is warm started from the previous
+ * messages, and only recomputes messages affected by the change.
+ * @param[in] factors a tree shaped factor graph.
+ * @param[in] changeID id of the factor to change.
+ * @returns the number of failures
+ */
+int testWarmStart_m(const FactorMap_m& factors, FactorID changeID)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Optimise the graph from cold
+      //************************************************************************
+      MaxSumController controller;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         controller.setFactor(it->first,it->second);
+      }
+      controller.optimise();
+      const int coldCount = controller.noRecomputedMsgs();
+
+      //************************************************************************
+      // Re-optimising without changes should not recompute anything
+      //************************************************************************
+      controller.optimise();
+      if(0!=controller.noRecomputedMsgs())
+      {
+         std::cout << "Unchanged graph recomputed ";
+         std::cout << controller.noRecomputedMsgs() << " messages.\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Adding a constant to a factor shouldn't change any normalised
+      // messages, so the change should not spread beyond its neighbours
+      //************************************************************************
+      DiscreteFunction& handle =
+         controller.getUnSafeWritableFactorHandle(changeID);
+      handle += 1;
+      controller.notifyFactor(changeID);
+      controller.optimise();
+      const int offsetCount = controller.noRecomputedMsgs();
+      int neighbourCount = handle.noVars();
+      for(DiscreteFunction::VarIterator v=handle.varBegin();
+            v!=handle.varEnd(); ++v)
+      {
+         for(FactorMap_m::const_iterator it=factors.begin();
+               it!=factors.end(); ++it)
+         {
+            if(std::binary_search(it->second.varBegin(),
+                     it->second.varEnd(),*v))
+            {
+               ++neighbourCount;
+            }
+         }
+      }
+
+      if(0>=offsetCount || neighbourCount<offsetCount)
+      {
+         std::cout << "Constant offset recomputed " << offsetCount;
+         std::cout << " messages, expected at most " << neighbourCount;
+         std::cout << std::endl;
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Replace the factor with a new one, and check that we get the same
+      // result as from a cold start, with less work.
+      //************************************************************************
+      FactorMap_m changed(factors);
+      genColourUtil_m(changed[changeID]);
+      controller.setFactor(changeID,changed[changeID]);
+      controller.optimise();
+      const int warmCount = controller.noRecomputedMsgs();
+
+      MaxSumController cold;
+      for(FactorMap_m::const_iterator it=changed.begin();
+            it!=changed.end(); ++it)
+      {
+         cold.setFactor(it->first,it->second);
+      }
+      cold.optimise();
+
+      std::cout << "COLD=" << coldCount << " OFFSET=" << offsetCount;
+      std::cout << " WARM=" << warmCount << std::endl;
+
+      if(0>=warmCount || coldCount<=warmCount)
+      {
+         std::cout << "Warm start recomputed " << warmCount;
+         std::cout << " messages compared to " << coldCount;
+         std::cout << " from cold." << std::endl;
+         ++errorCount;
+      }
+
+      for(MaxSumController::ConstValueIterator it=cold.valBegin();
+            it!=cold.valEnd(); ++it)
+      {
+         if(controller.getValue(it->first)!=it->second)
+         {
+            std::cout << "Warm start value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testWarmStart_m
+
+/**
+ * Tests that moving factors into a MaxSumController gives the same factor
+ * graph and results as copying them, and transfers heap allocated factor
+ * tables without copying.
+ * @returns the number of failures
+ */
+int testMoveFactor_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController copied;
+      MaxSumController moved;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         copied.setFactor(it->first,it->second);
+         DiscreteFunction tmp(it->second);
+         const ValType* pTable = &tmp(0);
+         const bool onHeap = DiscreteFunction::INLINE_VALUES <
+            static_cast<std::size_t>(tmp.domainSize());
+         moved.setFactor(it->first,std::move(tmp));
+
+         if(onHeap && (&moved.getFactor(it->first)(0)!=pTable))
+         {
+            std::cout << "Factor table was copied rather than moved.\n";
+            ++errorCount;
+         }
+
+         if( (0!=tmp.noVars()) ||
+             (moved.getFactor(it->first)!=it->second) )
+         {
+            std::cout << "Moved factor " << it->first << " is wrong.\n";
+            ++errorCount;
+         }
+      }
+
+      copied.optimise();
+      moved.optimise();
+      for(MaxSumController::ConstValueIterator it=copied.valBegin();
+            it!=copied.valEnd(); ++it)
+      {
+         if(moved.getValue(it->first)!=it->second)
+         {
+            std::cout << "Moved factor value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testMoveFactor_m
+
+/**
+ * Tests that setting factors in bulk gives the same factor graph and results
+ * as setting them one at a time, including when some factors are already
+ * in the graph with a different domain.
+ * @returns the number of failures
+ */
+int testSetFactors_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController single;
+      MaxSumController bulk;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         single.setFactor(it->first,it->second);
+      }
+
+      //************************************************************************
+      // Give the bulk controller a stale version of the first factor, which
+      // depends on one variable that no other factor uses.
+      //************************************************************************
+      FactorMap_m::const_iterator first = factors.begin();
+      std::vector<VarID> staleVars(first->second.varBegin(),
+            first->second.varEnd());
+      staleVars.push_back(VarID(999));
+      registerVariable(999,NO_COLOURS);
+      bulk.setFactor(first->first,
+            DiscreteFunction(staleVars.begin(),staleVars.end(),1));
+      bulk.setFactors(factors);
+
+      errorCount += isConsistent_m(bulk,factors);
+      if(bulk.noVars()!=single.noVars())
+      {
+         std::cout << "Bulk controller has " << bulk.noVars()
+            << " variables, rather than " << single.noVars() << std::endl;
+         ++errorCount;
+      }
+
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(bulk.getFactor(it->first)!=it->second)
+         {
+            std::cout << "Bulk factor " << it->first << " is wrong.\n";
+            ++errorCount;
+         }
+      }
+
+      //************************************************************************
+      // Setting the same factors again should change nothing.
+      //************************************************************************
+      single.optimise();
+      bulk.optimise();
+      bulk.setFactors(factors);
+      bulk.optimise();
+      for(MaxSumController::ConstValueIterator it=single.valBegin();
+            it!=single.valEnd(); ++it)
+      {
+         if(bulk.getValue(it->first)!=it->second)
+         {
+            std::cout << "Bulk factor value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testSetFactors_m
+
+/**
+ * Compares the values and factor to variable messages of two controllers
+ * with the same factor graph.
+ * @param[in] a the first controller.
+ * @param[in] b the second controller.
+ * @param[in] factors the factor graph of both controllers.
+ * @param[in] what description of the comparison, used in error messages.
+ * @returns the number of differences.
+ */
+int compareStates_m
+(
+ MaxSumController& a,
+ MaxSumController& b,
+ const FactorMap_m& factors,
+ const char* what
+)
+{
+   int errorCount = 0;
+   for(MaxSumController::ConstValueIterator it=a.valBegin();
+         it!=a.valEnd(); ++it)
+   {
+      if(b.getValue(it->first)!=it->second)
+      {
+         std::cout << what << ": value mismatch for var ";
+         std::cout << it->first << std::endl;
+         ++errorCount;
+      }
+   }
+
+   for(FactorMap_m::const_iterator it=factors.begin();
+         it!=factors.end(); ++it)
+   {
+      for(DiscreteFunction::VarIterator vIt=it->second.varBegin();
+            vIt!=it->second.varEnd(); ++vIt)
+      {
+         if(a.getFac2VarMsg(it->first,*vIt)!=b.getFac2VarMsg(it->first,*vIt))
+         {
+            std::cout << what << ": message mismatch from factor ";
+            std::cout << it->first << " to var " << *vIt << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   return errorCount;
+
+} // function compareStates_m
+
+/**
+ * Tests that a fork of a controller behaves exactly like a deep copy, and
+ * that neither the fork nor the original sees changes made to the other.
+ * @param[in] factors the factor graph to test.
+ * @returns the number of failures
+ */
+int testFork_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController original;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         original.setFactor(it->first,it->second);
+      }
+      original.optimise();
+
+      //************************************************************************
+      // A new fork should share the original's large factor tables, and
+      // have exactly the same state.
+      //************************************************************************
+      MaxSumController originalCopy(original);
+      MaxSumController forkCopy(original);
+      std::unique_ptr<MaxSumController> pFork(original.fork());
+      errorCount += compareStates_m(original,*pFork,factors,"New fork");
+
+      const FactorID first = factors.begin()->first;
+      const FactorID last = factors.rbegin()->first;
+      const bool isLarge = DiscreteFunction::INLINE_VALUES <
+         std::size_t(original.getFactor(first).domainSize());
+      if(isLarge!=(&original.getFactor(first)(0)==&pFork->getFactor(first)(0)))
+      {
+         std::cout << "Fork does not share exactly the large factor tables.\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Change the fork, and check that it behaves like a deep copy with
+      // the same changes.
+      //************************************************************************
+      pFork->getUnSafeWritableFactorHandle(first)(0) += 5;
+      pFork->notifyFactor(first);
+      pFork->setFactor(last,-factors.rbegin()->second);
+      forkCopy.getUnSafeWritableFactorHandle(first)(0) += 5;
+      forkCopy.notifyFactor(first);
+      forkCopy.setFactor(last,-factors.rbegin()->second);
+      if(&original.getFactor(first)(0)==&pFork->getFactor(first)(0))
+      {
+         std::cout << "Modified factor is still shared with fork.\n";
+         ++errorCount;
+      }
+
+      pFork->optimise();
+      forkCopy.optimise();
+      errorCount += compareStates_m(forkCopy,*pFork,factors,"Changed fork");
+
+      //************************************************************************
+      // The original should be unchanged, and should still behave like
+      // a deep copy when it is changed in turn, even after its fork has
+      // been forked and destroyed.
+      //************************************************************************
+      errorCount += compareStates_m(originalCopy,original,factors,"Original");
+      if(original.getFactor(first)!=factors.begin()->second)
+      {
+         std::cout << "Original factor was modified by its fork.\n";
+         ++errorCount;
+      }
+
+      std::unique_ptr<MaxSumController> pForkOfFork(pFork->fork());
+      pFork.reset();
+
+      original.getUnSafeWritableFactorHandle(first)(0) -= 5;
+      original.notifyFactor(first);
+      originalCopy.getUnSafeWritableFactorHandle(first)(0) -= 5;
+      originalCopy.notifyFactor(first);
+      original.optimise();
+      originalCopy.optimise();
+      errorCount += compareStates_m(originalCopy,original,factors,
+            "Changed original");
+
+      //************************************************************************
+      // A fork of a fork should still have its parent's state, and
+      // compiling it should not affect anyone else.
+      //************************************************************************
+      errorCount += compareStates_m(forkCopy,*pForkOfFork,factors,
+            "Fork of fork");
+      pForkOfFork->compile();
+      pForkOfFork->setFactor(first,factors.begin()->second);
+      forkCopy.setFactor(first,factors.begin()->second);
+      pForkOfFork->optimise();
+      forkCopy.optimise();
+      for(MaxSumController::ConstValueIterator it=forkCopy.valBegin();
+            it!=forkCopy.valEnd(); ++it)
+      {
+         if(pForkOfFork->getValue(it->first)!=it->second)
+         {
+            std::cout << "Compiled fork value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+      errorCount += compareStates_m(originalCopy,original,factors,
+            "Original after fork of fork");
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testFork_m
+
+/**
+ * Tests that factors bound to a shared table behave exactly like factors
+ * with their own copies of the same values, and that factors bound in the
+ * same order share the same memory. Each factor with the same number of
+ * variables as the first is bound to a copy of the first factor, with its
+ * variables in ascending order if its id is even, and descending order
+ * otherwise.
+ * @param[in] factors the factor graph whose structure is tested.
+ * @returns the number of failures
+ */
+int testSharedTables_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      const DiscreteFunction& first = factors.begin()->second;
+      MaxSumController::SharedTable pTable =
+         std::make_shared<DiscreteFunction>(first);
+      const ValType firstValue = (*pTable)(0);
+
+      //************************************************************************
+      // Set each factor in one controller from the shared table, and in the
+      // other from the values it should read from the table.
+      //************************************************************************
+      MaxSumController shared;
+      MaxSumController dense;
+      FactorMap_m expectedFactors;
+      std::map<bool,const ValType*> tableByOrder;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         if(it->second.noVars()!=pTable->noVars())
+         {
+            shared.setFactor(it->first,it->second);
+            dense.setFactor(it->first,it->second);
+            expectedFactors[it->first] = it->second;
+            continue;
+         }
+
+         const bool ascending = (0==it->first%2);
+         std::vector<VarID> bound(it->second.varBegin(),it->second.varEnd());
+         if(!ascending)
+         {
+            std::reverse(bound.begin(),bound.end());
+         }
+         shared.setFactor(it->first,pTable,bound.begin(),bound.end());
+
+         DiscreteFunction expected(it->second.varBegin(),it->second.varEnd());
+         for(DomainIterator dIt(expected); dIt.hasNext(); ++dIt)
+         {
+            std::map<VarID,ValIndex> vals;
+            for(int k=0; k<expected.noVars(); ++k)
+            {
+               vals[expected.varBegin()[k]] = dIt.getSubInd()[k];
+            }
+            std::map<VarID,ValIndex> tableVals;
+            for(int k=0; k<pTable->noVars(); ++k)
+            {
+               tableVals[pTable->varBegin()[k]] = vals[bound[k]];
+            }
+            expected(dIt.getInd()) = (*pTable)(tableVals);
+         }
+         dense.setFactor(it->first,expected);
+         expectedFactors[it->first] = expected;
+
+         if(shared.getFactor(it->first)!=expected)
+         {
+            std::cout << "Wrong values for shared factor " << it->first;
+            std::cout << std::endl;
+            ++errorCount;
+         }
+
+         const ValType* pValues = &shared.getFactor(it->first)(0);
+         if(0==tableByOrder.count(ascending))
+         {
+            tableByOrder[ascending] = pValues;
+         }
+         if(tableByOrder[ascending]!=pValues)
+         {
+            std::cout << "Factor " << it->first << " does not share its table.";
+            std::cout << std::endl;
+            ++errorCount;
+         }
+      }
+
+      if( (0!=tableByOrder.count(true)) &&
+          (&(*pTable)(0)!=tableByOrder[true]) )
+      {
+         std::cout << "Ascending factors do not read the shared table.\n";
+         ++errorCount;
+      }
+
+      shared.optimise();
+      dense.optimise();
+      errorCount += compareStates_m(dense,shared,expectedFactors,
+            "Shared tables");
+
+      //************************************************************************
+      // Changing a shared factor should give it its own copy, and leave the
+      // table unchanged.
+      //************************************************************************
+      const FactorID last = factors.rbegin()->first;
+      shared.getUnSafeWritableFactorHandle(last)(0) += 5;
+      shared.notifyFactor(last);
+      dense.getUnSafeWritableFactorHandle(last)(0) += 5;
+      dense.notifyFactor(last);
+      if(firstValue!=(*pTable)(0))
+      {
+         std::cout << "Shared table was modified through a factor.\n";
+         ++errorCount;
+      }
+      shared.optimise();
+      dense.optimise();
+      errorCount += compareStates_m(dense,shared,expectedFactors,
+            "Changed shared tables");
+
+      //************************************************************************
+      // Bad bindings should be rejected.
+      //************************************************************************
+      std::vector<VarID> repeated(pTable->noVars(),*first.varBegin());
+      try
+      {
+         shared.setFactor(last,pTable,repeated.begin(),repeated.end());
+         if(1<repeated.size())
+         {
+            std::cout << "No exception for repeated bound variables.\n";
+            ++errorCount;
+         }
+      }
+      catch(BadDomainException& e) {}
+
+      try
+      {
+         shared.setFactor(last,pTable,repeated.begin(),repeated.begin());
+         std::cout << "No exception for wrong number of bound variables.\n";
+         ++errorCount;
+      }
+      catch(BadDomainException& e) {}
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testSharedTables_m
+
+/**
+ * Tests that pruning dominated values from a compiled graph gives the same
+ * values as the uncompiled algorithm. Each variable is given a unary factor
+ * that heavily penalises its last value, so that this value is dominated.
+ * @param[in] factors an acyclic factor graph to test.
+ * @returns the number of failures
+ */
+int testPruning_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Add a penalty factor for each variable.
+      //************************************************************************
+      FactorMap_m penalised(factors);
+      MaxSumController plain;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         plain.setFactor(it->first,it->second);
+      }
+      for(MaxSumController::ConstValueIterator it=plain.valBegin();
+            it!=plain.valEnd(); ++it)
+      {
+         DiscreteFunction penalty(it->first,0);
+         penalty(NO_COLOURS-1) = -100;
+         penalised[10000+it->first] = penalty;
+      }
+
+      MaxSumController exact;
+      MaxSumController pruned;
+      pruned.setPruneDomains(true);
+      for(FactorMap_m::const_iterator it=penalised.begin();
+            it!=penalised.end(); ++it)
+      {
+         exact.setFactor(it->first,it->second);
+         pruned.setFactor(it->first,it->second);
+      }
+
+      //************************************************************************
+      // Check that the penalised values, and nothing else, are pruned
+      // when the graph is compiled.
+      //************************************************************************
+      if(0!=pruned.noPrunedValues())
+      {
+         std::cout << "Uncompiled controller reports pruned values.\n";
+         ++errorCount;
+      }
+
+      pruned.compile();
+      if(pruned.noPrunedValues()!=pruned.noVars())
+      {
+         std::cout << "Pruned " << pruned.noPrunedValues()
+            << " values, rather than " << pruned.noVars() << std::endl;
+         ++errorCount;
+      }
+
+      exact.optimise();
+      pruned.optimise();
+      for(MaxSumController::ConstValueIterator it=exact.valBegin();
+            it!=exact.valEnd(); ++it)
+      {
+         if(pruned.getValue(it->first)!=it->second)
+         {
+            std::cout << "Pruned value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+
+      //************************************************************************
+      // Lifting a penalty should recompile the graph, so that the results
+      // still agree.
+      //************************************************************************
+      const FactorID penaltyID = 10000+pruned.valBegin()->first;
+      exact.setFactor(penaltyID,DiscreteFunction(pruned.valBegin()->first,0));
+      pruned.getUnSafeWritableFactorHandle(penaltyID)(NO_COLOURS-1) = 0;
+      pruned.notifyFactor(penaltyID);
+      exact.optimise();
+      pruned.optimise();
+      for(MaxSumController::ConstValueIterator it=exact.valBegin();
+            it!=exact.valEnd(); ++it)
+      {
+         if(pruned.getValue(it->first)!=it->second)
+         {
+            std::cout << "Pruned value mismatch after change for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+
+      pruned.setPruneDomains(false);
+      if( !pruned.isCompiled() || (0!=pruned.noPrunedValues()) )
+      {
+         std::cout << "Disabling pruning did not restore full domains.\n";
+         ++errorCount;
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testPruning_m
+
+/**
+ * Tests that maxsum::ResidualScheduler pops nodes in order of their largest
+ * residual, and only pops each scheduled node once.
+ * @returns the number of failures
+ */
+int testResidualScheduler_m()
+{
+   int errorCount = 0;
+   ResidualScheduler scheduler;
+   scheduler.push(Scheduler::Node::factor(1),0.5);
+   scheduler.push(Scheduler::Node::variable(2),0.9);
+   scheduler.push(Scheduler::Node::factor(1),0.7);
+   scheduler.push(Scheduler::Node::variable(3),0.1);
+   scheduler.push(Scheduler::Node::factor(1),0.2);
+   scheduler.push(Scheduler::Node::factor(4),0.7);
+
+   const Scheduler::Node expected[] = { Scheduler::Node::variable(2),
+      Scheduler::Node::factor(1), Scheduler::Node::factor(4),
+      Scheduler::Node::variable(3) };
+
+   for(int k=0; k<4; ++k)
+   {
+      if(scheduler.empty() || !(scheduler.pop()==expected[k]))
+      {
+         std::cout << "Residual scheduler popped wrong node at " << k << '\n';
+         ++errorCount;
+      }
+   }
+
+   if(!scheduler.empty())
+   {
+      std::cout << "Residual scheduler not empty after popping all nodes\n";
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testResidualScheduler_m
+
+/**
+ * Tests that residual scheduling converges to the same values as the
+ * default schedule.
+ * @param[in] factors the factor graph to optimise.
+ * @param[in] checkValues true if both schedules should give the same values.
+ * This is guaranteed for trees, but not for loopy graphs.
+ * @returns the number of failures
+ */
+int testResidual_m(const FactorMap_m& factors, bool checkValues)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController flooding;
+      MaxSumController residual;
+      residual.setScheduler(ResidualScheduler());
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         flooding.setFactor(it->first,it->second);
+         residual.setFactor(it->first,it->second);
+      }
+
+      int floodIterations = flooding.optimise();
+      int residualIterations = residual.optimise();
+      std::cout << "FLOODING MSGS=" << flooding.noRecomputedMsgs();
+      std::cout << " ITERATIONS=" << floodIterations;
+      std::cout << " RESIDUAL MSGS=" << residual.noRecomputedMsgs();
+      std::cout << " ITERATIONS=" << residualIterations << std::endl;
+
+      //************************************************************************
+      // A copy should keep its scheduler, and a converged graph should need
+      // no further work.
+      //************************************************************************
+      MaxSumController copy(residual);
+      if(!copy.hasScheduler())
+      {
+         std::cout << "Copied controller lost its scheduler.\n";
+         ++errorCount;
+      }
+
+      if(!checkValues)
+      {
+         return errorCount;
+      }
+
+      if(MaxSumController::DEFAULT_MAX_ITERATIONS <= residualIterations)
+      {
+         std::cout << "Residual schedule failed to converge.\n";
+         ++errorCount;
+      }
+
+      copy.optimise();
+      if(0!=copy.noRecomputedMsgs())
+      {
+         std::cout << "Converged residual schedule recomputed "
+            << copy.noRecomputedMsgs() << " messages.\n";
+         ++errorCount;
+      }
+
+      for(MaxSumController::ConstValueIterator it=flooding.valBegin();
+            it!=flooding.valEnd(); ++it)
+      {
+         if(residual.getValue(it->first)!=it->second)
+         {
+            std::cout << "Residual schedule value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testResidual_m
+
+/**
+ * Observer that records the statistics for every iteration.
+ */
+class RecordingObserver_m : public StatsObserver
+{
+public:
+
+   std::vector<IterationStats> stats; ///< statistics in order received
+
+   void iterationDone(const IterationStats& iterStats)
+   {
+      stats.push_back(iterStats);
+   }
+
+}; // class RecordingObserver_m
+
+/**
+ * Tests that per-iteration statistics are reported for the default,
+ * compiled and residual schedules, if statistics are enabled, and never
+ * reported otherwise.
+ * @param[in] factors the factor graph to test on.
+ * @returns the number of failures
+ */
+int testStats_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      for(int mode=0; mode<4; ++mode)
+      {
+         const char* MODE_NAMES[] = { "default", "compiled", "residual",
+            "tree" };
+         RecordingObserver_m observer;
+         MaxSumController controller;
+         controller.setObserver(&observer);
+         for(FactorMap_m::const_iterator it=factors.begin();
+               it!=factors.end(); ++it)
+         {
+            controller.setFactor(it->first,it->second);
+         }
+         if(1==mode)
+         {
+            controller.compile();
+         }
+         else if(2==mode)
+         {
+            controller.setScheduler(ResidualScheduler());
+         }
+         else if(3==mode)
+         {
+            controller.setTreeSchedule(true);
+         }
+
+         const int iterations = controller.optimise();
+
+#ifndef MAXSUM_STATS
+         if(!observer.stats.empty())
+         {
+            std::cout << "Observer called with statistics disabled.\n";
+            ++errorCount;
+         }
+         continue;
+#endif
+
+         //*********************************************************************
+         // There should be one report per iteration, in order, accounting for
+         // every recomputed message.
+         //*********************************************************************
+         if(static_cast<int>(observer.stats.size())!=iterations)
+         {
+            std::cout << MODE_NAMES[mode] << ": " << observer.stats.size()
+               << " reports for " << iterations << " iterations.\n";
+            ++errorCount;
+            continue;
+         }
+
+         int msgCount = 0;
+         int valueChanges = 0;
+         for(int k=0; k<iterations; ++k)
+         {
+            const IterationStats& iterStats = observer.stats[k];
+            msgCount += iterStats.fac2varUpdates + iterStats.var2facUpdates;
+            valueChanges += iterStats.valueChanges;
+            if( (k+1!=iterStats.iteration) || (0>iterStats.maxResidual) ||
+                (0>iterStats.fac2varSeconds) || (0>iterStats.var2facSeconds) )
+            {
+               std::cout << MODE_NAMES[mode] << ": bad report for iteration "
+                  << k+1 << std::endl;
+               ++errorCount;
+            }
+         }
+
+         if(msgCount!=controller.noRecomputedMsgs())
+         {
+            std::cout << MODE_NAMES[mode] << ": reported " << msgCount
+               << " messages, but recomputed "
+               << controller.noRecomputedMsgs() << std::endl;
+            ++errorCount;
+         }
+
+         if( (0==valueChanges) || (0>=observer.stats[0].maxResidual) )
+         {
+            std::cout << MODE_NAMES[mode] << ": no progress reported.\n";
+            ++errorCount;
+         }
+      }
+
+      //************************************************************************
+      // An empty graph should do nothing, and report nothing, with any
+      // schedule.
+      //************************************************************************
+      RecordingObserver_m observer;
+      MaxSumController empty;
+      empty.setObserver(&observer);
+      empty.setScheduler(ResidualScheduler());
+      empty.setTreeSchedule(true);
+      if( (0!=empty.optimise()) || !observer.stats.empty() )
+      {
+         std::cout << "Empty graph reported iterations.\n";
+         ++errorCount;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testStats_m
+
+/**
+ * Tests optimisation with a deadline, asynchronous optimisation, and
+ * cancellation.
+ * @param[in] tree a factor graph on which max-sum converges.
+ * @param[in] loopy a factor graph on which max-sum does not converge.
+ * @returns the number of failures
+ */
+int testAsync_m(const FactorMap_m& tree, const FactorMap_m& loopy)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // A deadline that has already passed allows exactly one iteration, for
+      // both the uncompiled and compiled algorithm.
+      //************************************************************************
+      for(int compiled=0; compiled<2; ++compiled)
+      {
+         MaxSumController controller;
+         for(FactorMap_m::const_iterator it=loopy.begin();
+               it!=loopy.end(); ++it)
+         {
+            controller.setFactor(it->first,it->second);
+         }
+         if(compiled)
+         {
+            controller.compile();
+         }
+
+         int iterations = controller.optimise(MaxSumController::Clock::now());
+         MaxSumController::ValueSnapshot snapshot =
+            controller.getValueSnapshot();
+         if( (1!=iterations) || !snapshot ||
+             (snapshot->size()!=controller.noVars()) )
+         {
+            std::cout << "Expired deadline ran " << iterations;
+            std::cout << " iterations, compiled=" << compiled << std::endl;
+            ++errorCount;
+            continue;
+         }
+
+         for(MaxSumController::ConstValueIterator it=controller.valBegin();
+               it!=controller.valEnd(); ++it)
+         {
+            if(snapshot->at(it->first)!=it->second)
+            {
+               std::cout << "Snapshot differs from value of var ";
+               std::cout << it->first << std::endl;
+               ++errorCount;
+               break;
+            }
+         }
+      }
+
+      //************************************************************************
+      // Asynchronous optimisation should give the same result as synchronous
+      // optimisation when it converges.
+      //************************************************************************
+      MaxSumController sync;
+      MaxSumController async;
+      for(FactorMap_m::const_iterator it=tree.begin(); it!=tree.end(); ++it)
+      {
+         sync.setFactor(it->first,it->second);
+         async.setFactor(it->first,it->second);
+      }
+      int syncIterations = sync.optimise();
+      std::future<int> result = async.optimiseAsync();
+      int asyncIterations = result.get();
+      if(syncIterations!=asyncIterations)
+      {
+         std::cout << "Asynchronous optimise ran " << asyncIterations;
+         std::cout << " iterations, compared to " << syncIterations << '\n';
+         ++errorCount;
+      }
+
+      for(MaxSumController::ConstValueIterator it=sync.valBegin();
+            it!=sync.valEnd(); ++it)
+      {
+         if(async.getValue(it->first)!=it->second)
+         {
+            std::cout << "Asynchronous value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+
+      //************************************************************************
+      // A loopy graph with no practical iteration limit only stops if it is
+      // cancelled. Values should be published while it is running.
+      //************************************************************************
+      const int LOTS = 100000000;
+      MaxSumController endless(LOTS,0);
+      for(FactorMap_m::const_iterator it=loopy.begin(); it!=loopy.end(); ++it)
+      {
+         endless.setFactor(it->first,it->second);
+      }
+      result = endless.optimiseAsync();
+      while(!endless.getValueSnapshot())
+      {
+         std::this_thread::yield();
+      }
+      endless.cancel();
+      int cancelledIterations = result.get();
+      if(LOTS<=cancelledIterations)
+      {
+         std::cout << "Cancelled optimisation did not stop.\n";
+         ++errorCount;
+      }
+      std::cout << "CANCELLED AFTER " << cancelledIterations;
+      std::cout << " ITERATIONS" << std::endl;
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testAsync_m
+
+/**
+ * Tests message damping and variable freezing on a loopy factor graph.
+ * Both should stop max-sum from oscillating until the iteration limit, and
+ * the compiled graph should agree with the uncompiled one.
+ * @returns the number of failures
+ */
+int testDamping_m(const FactorMap_m& factors)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Invalid options should be rejected.
+      //************************************************************************
+      const int MAX_IT = MaxSumController::DEFAULT_MAX_ITERATIONS;
+      const ValType MAX_NORM = MaxSumController::DEFAULT_MAXNORM_THRESHOLD;
+      const ValType badDamping[] = { -0.5, 1, 2 };
+      for(int k=0; k<3; ++k)
+      {
+         try
+         {
+            MaxSumController controller(MAX_IT,MAX_NORM,badDamping[k]);
+            std::cout << "No exception for damping " << badDamping[k] << '\n';
+            ++errorCount;
+         }
+         catch(OutOfRangeException& e) {}
+      }
+
+      try
+      {
+         MaxSumController controller(MAX_IT,MAX_NORM,0,-1);
+         std::cout << "No exception for negative freezeAfter\n";
+         ++errorCount;
+      }
+      catch(OutOfRangeException& e) {}
+
+      //************************************************************************
+      // Run each combination of options with and without compilation.
+      // Freezing should always make max-sum converge, while damping alone
+      // should converge whenever the undamped algorithm does.
+      //************************************************************************
+      bool undampedConverged = false;
+      const ValType damping[] = { 0, 0.5, 0, 0.5 };
+      const int freezeAfter[] = { 0, 0, 2, 2 };
+      for(int k=0; k<4; ++k)
+      {
+         MaxSumController plain(MAX_IT,MAX_NORM,damping[k],freezeAfter[k]);
+         for(FactorMap_m::const_iterator it=factors.begin();
+               it!=factors.end(); ++it)
+         {
+            plain.setFactor(it->first,it->second);
+         }
+         MaxSumController compiled(plain);
+         compiled.compile();
+
+         if( (damping[k]!=compiled.damping()) ||
+             (freezeAfter[k]!=compiled.freezeAfter()) )
+         {
+            std::cout << "Options not copied.\n";
+            ++errorCount;
+         }
+
+         const int plainIterations = plain.optimise();
+         const int compiledIterations = compiled.optimise();
+         std::cout << "DAMPING=" << damping[k] << " FREEZE_AFTER=";
+         std::cout << freezeAfter[k] << " ITERATIONS=" << plainIterations;
+         std::cout << " COMPILED_ITERATIONS=" << compiledIterations;
+         std::cout << " NUM_OF_CONFLICTS=" << noConflicts_m(plain).noConflicts;
+         std::cout << std::endl;
+
+         const bool converged =
+            (plainIterations<MAX_IT) && (compiledIterations<MAX_IT);
+         if(0==k)
+         {
+            undampedConverged = converged;
+         }
+         else if( !converged && (0<freezeAfter[k] || undampedConverged) )
+         {
+            std::cout << "Failed to converge.\n";
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testDamping_m
+
+/**
+ * Main function tests a maxsum controller on several factor graphs.
+ */
+/**
+ * Adds a copy of a factor graph to another, with every variable and factor
+ * id increased by a fixed offset, so that the two graphs are disconnected.
+ * @param[in] factors the graph to copy.
+ * @param[in] offset the amount to add to each id.
+ * @param[in,out] out the graph to add the copy to.
+ */
+void addOffsetGraph_m(const FactorMap_m& factors, int offset, FactorMap_m& out)
+{
+   for(FactorMap_m::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      std::vector<VarID> vars;
+      for(DiscreteFunction::VarIterator v=it->second.varBegin();
+            v!=it->second.varEnd(); ++v)
+      {
+         registerVariable(*v+offset,getDomainSize(*v));
+         vars.push_back(*v+offset);
+      }
+
+      DiscreteFunction copy(vars.begin(),vars.end(),0);
+      for(ValIndex k=0; k<copy.domainSize(); ++k)
+      {
+         copy(k) = it->second(k);
+      }
+      out[it->first+offset] = copy;
+   }
+
+} // function addOffsetGraph_m
+
+/**
+ * Tests that solving acyclic components exactly gives the same values as
+ * the default schedule. On acyclic graphs, this should also recompute fewer
+ * messages, and leave nothing to do when re-optimised.
+ * @param[in] factors the factor graph to test.
+ * @param[in] acyclic true if every component of the graph is acyclic.
+ * @returns the number of failures
+ */
+int testTreeSchedule_m(const FactorMap_m& factors, bool acyclic)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController flooding;
+      MaxSumController tree;
+      tree.setTreeSchedule(true);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         flooding.setFactor(it->first,it->second);
+         tree.setFactor(it->first,it->second);
+      }
+
+      const int floodIterations = flooding.optimise();
+      const int treeIterations = tree.optimise();
+      std::cout << "FLOODING MSGS=" << flooding.noRecomputedMsgs();
+      std::cout << " ITERATIONS=" << floodIterations;
+      std::cout << " TREE MSGS=" << tree.noRecomputedMsgs();
+      std::cout << " ITERATIONS=" << treeIterations << std::endl;
+
+      if(!MaxSumController(tree).treeSchedule())
+      {
+         std::cout << "Copied controller lost its tree schedule.\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // On acyclic graphs, the passes should be all that is needed.
+      //************************************************************************
+      if(acyclic)
+      {
+         if( (2<treeIterations) ||
+             (flooding.noRecomputedMsgs()<tree.noRecomputedMsgs()) )
+         {
+            std::cout << "Tree schedule did more work than expected.\n";
+            ++errorCount;
+         }
+
+         tree.optimise();
+         if(0!=tree.noRecomputedMsgs())
+         {
+            std::cout << "Solved tree recomputed " << tree.noRecomputedMsgs()
+               << " messages.\n";
+            ++errorCount;
+         }
+      }
+
+      //************************************************************************
+      // Change one factor, and check that both schedules still agree.
+      //************************************************************************
+      FactorMap_m::const_iterator last = --factors.end();
+      DiscreteFunction changed(last->second);
+      genColourUtil_m(changed);
+      flooding.setFactor(last->first,changed);
+      tree.setFactor(last->first,changed);
+      flooding.optimise();
+      tree.optimise();
+
+      for(MaxSumController::ConstValueIterator it=flooding.valBegin();
+            it!=flooding.valEnd(); ++it)
+      {
+         if(tree.getValue(it->first)!=it->second)
+         {
+            std::cout << "Tree schedule value mismatch for var ";
+            std::cout << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   //***************************************************************************
+   // Deal with any unexpected exceptions
+   //***************************************************************************
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what();
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testTreeSchedule_m
+
+int main()
+{
+   int errorCount = 0; // counts the number of failures
+   try
+   {
+      FactorMap_m factors; // Reusable FactorMap for storing current factors
+      MaxSumController controller; // MaxSumController for testing
+      std::clock_t runtime = std::clock();
+
+      //************************************************************************
+      // Test behaviour of an uninitialised controller
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on empty graph                               *\n";
+      std::cout << "********************************************************\n";
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test on singleton graph, containing only one factor and variable
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on singleton graph                           *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(1,1,factors);
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+   
+      //************************************************************************
+      // Create a MaxSumController and test it on a line graph (i.e. tree graph
+      // with branching factor of 1.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on line graph                                *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(10,1,factors);
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test on ring with same number of factors
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on ring graph                                *\n";
+      std::cout << "********************************************************\n";
+      genRingGraph_m(10,factors);
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test on tree with additional factors
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on tree graph                                *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(4,2,factors);
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test removing factors from factor graph in various ways
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing Factor removal                               *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testRemoval_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test on fully connected graph with last factors.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on colourable fully connected graph          *\n";
+      std::cout << "********************************************************\n";
+      genFullGraph_m(NO_COLOURS,factors);
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test on fully connected graph with last factors.
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing on non-colourable fully connected graph      *\n";
+      std::cout << "********************************************************\n";
+      genFullGraph_m(NO_COLOURS+2,factors);
+      printFactorMap(factors);
+      errorCount += testMaxSum_m(controller,factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test compiled factor graphs against uncompiled ones
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing compiled factor graphs                       *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(10,1,factors);
+      errorCount += testCompiled_m(factors);
+      genRingGraph_m(10,factors);
+      errorCount += testCompiled_m(factors);
+      genTreeGraph_m(4,2,factors);
+      errorCount += testCompiled_m(factors);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testCompiled_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test parallel message updates against serial ones
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing parallel message updates                     *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(10,1,factors);
+      errorCount += testParallel_m(factors,2);
+      genRingGraph_m(10,factors);
+      errorCount += testParallel_m(factors,3);
+      genTreeGraph_m(4,2,factors);
+      errorCount += testParallel_m(factors,4);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testParallel_m(factors,4);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test residual scheduling against the default schedule
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing residual scheduling                          *\n";
+      std::cout << "********************************************************\n";
+      errorCount += testResidualScheduler_m();
+      genTreeGraph_m(10,1,factors);
+      errorCount += testResidual_m(factors,true);
+      genTreeGraph_m(5,3,factors);
+      errorCount += testResidual_m(factors,true);
+      genRingGraph_m(10,factors);
+      errorCount += testResidual_m(factors,false);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testResidual_m(factors,false);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing exact schedule for acyclic components        *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(10,1,factors);
+      errorCount += testTreeSchedule_m(factors,true);
+      genTreeGraph_m(5,3,factors);
+      errorCount += testTreeSchedule_m(factors,true);
+      genRingGraph_m(10,factors);
+      errorCount += testTreeSchedule_m(factors,false);
+      {
+         FactorMap_m ring;
+         genRingGraph_m(10,ring);
+         genTreeGraph_m(4,2,factors);
+         addOffsetGraph_m(ring,1000,factors);
+         errorCount += testTreeSchedule_m(factors,false);
+      }
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing per-iteration statistics                     *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(5,3,factors);
+      errorCount += testStats_m(factors);
+      genRingGraph_m(10,factors);
+      errorCount += testStats_m(factors);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing damping and variable freezing                *\n";
+      std::cout << "********************************************************\n";
+      genRingGraph_m(10,factors);
+      errorCount += testDamping_m(factors);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testDamping_m(factors);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing deadlines and asynchronous optimisation      *\n";
+      std::cout << "********************************************************\n";
+      {
+         FactorMap_m loopy;
+         genTreeGraph_m(5,3,factors);
+         genRingGraph_m(10,loopy);
+         errorCount += testAsync_m(factors,loopy);
+      }
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test that steady state iterations do not allocate memory
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing steady state memory allocation               *\n";
+      std::cout << "********************************************************\n";
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testNoAllocation_m(factors);
+      std::cout << std::endl;
+
+      //************************************************************************
+      // Test that re-optimisation only recomputes affected messages
+      //************************************************************************
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing warm started re-optimisation                 *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(50,1,factors);
+      errorCount += testWarmStart_m(factors,50);
+      genTreeGraph_m(5,2,factors);
+      errorCount += testWarmStart_m(factors,1);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing factors moved into controller                *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(5,3,factors);
+      errorCount += testMoveFactor_m(factors);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testMoveFactor_m(factors);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing bulk factor construction                     *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(5,3,factors);
+      errorCount += testSetFactors_m(factors);
+      genRingGraph_m(10,factors);
+      errorCount += testSetFactors_m(factors);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testSetFactors_m(factors);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing dominated value pruning                      *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(5,3,factors);
+      errorCount += testPruning_m(factors);
+      genTreeGraph_m(10,1,factors);
+      errorCount += testPruning_m(factors);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing copy-on-write forks                          *\n";
+      std::cout << "********************************************************\n";
+      genTreeGraph_m(5,3,factors);
+      errorCount += testFork_m(factors);
+      genRingGraph_m(10,factors);
+      errorCount += testFork_m(factors);
+      genFullGraph_m(NO_COLOURS+2,factors);
+      errorCount += testFork_m(factors);
+      std::cout << std::endl;
+
+      std::cout << "********************************************************\n";
+      std::cout << "* Testing shared factor tables                         *\n";
+      std::cout << "********************************************************\n";
+      genRingGraph_m(10,factors);
+      errorCount += testSharedTables_m(factors);
+      genTreeGraph_m(5,3,factors);
+      errorCount += testSharedTables_m(factors);
       std::cout << std::endl;
 
       //************************************************************************
@@ -0,0 +1,373 @@
+/**
+ * @file partitionHarness.cpp
+ * Test harness for MaxSumShard and PartitionedController.
+ * Checks that partitioned max-sum gives the same results as MaxSumController
+ * on acyclic graph colouring problems.
+ */
+
+#include "maxsum/common.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/PartitionedController.h"
+#include "maxsum/Transport.h"
+#include "testUtils.h"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <thread>
+using namespace maxsum;
+
+/**
+ * Number of colours used for each variable.
+ */
+const int NO_COLOURS_M = 3;
+
+/**
+ * Convenience typedef for a map of factors.
+ */
+typedef MaxSumController::FactorMap FactorMap_m;
+
+/**
+ * Tests that maxsum::partitionFactors assigns every factor to a valid shard,
+ * and uses every shard when there are enough factors.
+ * @returns the number of failures
+ */
+int testPartition_m(const FactorMap_m& factors, int noShards)
+{
+   int errorCount = 0;
+   std::map<FactorID,int> partition;
+   partitionFactors(factors,noShards,partition);
+
+   if(partition.size()!=factors.size())
+   {
+      std::cout << "Partition has " << partition.size() << " factors but "
+         "graph has " << factors.size() << std::endl;
+      ++errorCount;
+   }
+
+   std::set<int> used;
+   for(FactorMap_m::const_iterator it=factors.begin(); it!=factors.end(); ++it)
+   {
+      std::map<FactorID,int>::const_iterator pos = partition.find(it->first);
+      if( (partition.end()==pos) || (0>pos->second) ||
+          (noShards<=pos->second) )
+      {
+         std::cout << "Factor " << it->first << " has no valid shard\n";
+         ++errorCount;
+         continue;
+      }
+      used.insert(pos->second);
+   }
+
+   if( (static_cast<int>(factors.size())>=noShards) &&
+       (static_cast<int>(used.size())!=noShards) )
+   {
+      std::cout << "Only " << used.size() << " of " << noShards
+         << " shards used." << std::endl;
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testPartition_m
+
+/**
+ * Tests that a PartitionedController gives the same values as a
+ * MaxSumController on an acyclic graph.
+ * @returns the number of failures
+ */
+int testPartitioned_m(const FactorMap_m& factors, int noShards)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController reference;
+      PartitionedController partitioned(noShards);
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         reference.setFactor(it->first,it->second);
+         partitioned.setFactor(it->first,it->second);
+      }
+      reference.optimise();
+      const int rounds = partitioned.optimise();
+
+      if(MaxSumController::DEFAULT_MAX_ITERATIONS<=rounds)
+      {
+         std::cout << "Partitioned controller did not converge with "
+            << noShards << " shards." << std::endl;
+         ++errorCount;
+      }
+
+      if( (1==noShards) != (0==partitioned.noBoundaryVars()) )
+      {
+         std::cout << "Wrong number of boundary variables for " << noShards
+            << " shards: " << partitioned.noBoundaryVars() << std::endl;
+         ++errorCount;
+      }
+
+      for(MaxSumController::ConstValueIterator it=reference.valBegin();
+            it!=reference.valEnd(); ++it)
+      {
+         if(partitioned.getValue(it->first)!=it->second)
+         {
+            std::cout << "Variable " << it->first << " is "
+               << partitioned.getValue(it->first) << " with " << noShards
+               << " shards, but " << it->second << " without." << std::endl;
+            ++errorCount;
+         }
+      }
+
+      try
+      {
+         partitioned.getValue(static_cast<VarID>(factors.size()+1));
+         std::cout << "No exception for unknown variable." << std::endl;
+         ++errorCount;
+      }
+      catch(NoSuchElementException& e) {}
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testPartitioned_m
+
+/**
+ * Tests MaxSumShard objects running on separate threads, connected by a
+ * LocalTransport, give the same values as a MaxSumController.
+ * @returns the number of failures
+ */
+int testThreadedShards_m(const FactorMap_m& factors, int noShards)
+{
+   int errorCount = 0;
+   try
+   {
+      //************************************************************************
+      // Build the shards by hand, as would be done in separate processes
+      //************************************************************************
+      std::map<FactorID,int> partition;
+      partitionFactors(factors,noShards,partition);
+
+      std::vector<MaxSumShard> shards;
+      std::map<VarID,std::set<int> > varShards;
+      for(int s=0; s<noShards; ++s)
+      {
+         shards.push_back(MaxSumShard(s));
+      }
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         const int s = partition[it->first];
+         shards[s].setFactor(it->first,it->second);
+         for(DiscreteFunction::VarIterator v=it->second.varBegin();
+               v!=it->second.varEnd(); ++v)
+         {
+            varShards[*v].insert(s);
+         }
+      }
+      for(std::map<VarID,std::set<int> >::const_iterator it=varShards.begin();
+            it!=varShards.end(); ++it)
+      {
+         for(std::set<int>::const_iterator s=it->second.begin();
+               s!=it->second.end(); ++s)
+         {
+            for(std::set<int>::const_iterator r=it->second.begin();
+                  r!=it->second.end(); ++r)
+            {
+               if(*s!=*r)
+               {
+                  shards[*s].addBoundary(it->first,*r);
+               }
+            }
+         }
+      }
+
+      //************************************************************************
+      // Run a fixed number of rounds on each shard in its own thread. This
+      // must be at least the diameter of the graph.
+      //************************************************************************
+      const int noRounds = 2*static_cast<int>(factors.size());
+      LocalTransport transport(noShards);
+      std::vector<std::thread> threads;
+      for(int s=0; s<noShards; ++s)
+      {
+         threads.push_back(std::thread([&shards,&transport,s,noRounds]()
+         {
+            for(int k=0; k<noRounds; ++k)
+            {
+               shards[s].iterate(transport.endpoint(s));
+            }
+         }));
+      }
+      for(int s=0; s<noShards; ++s)
+      {
+         threads[s].join();
+      }
+
+      //************************************************************************
+      // Compare the results with a single controller
+      //************************************************************************
+      MaxSumController reference;
+      for(FactorMap_m::const_iterator it=factors.begin();
+            it!=factors.end(); ++it)
+      {
+         reference.setFactor(it->first,it->second);
+      }
+      reference.optimise();
+
+      for(MaxSumController::ConstValueIterator it=reference.valBegin();
+            it!=reference.valEnd(); ++it)
+      {
+         const int s = *varShards[it->first].begin();
+         if(shards[s].controller().getValue(it->first)!=it->second)
+         {
+            std::cout << "Threaded shard " << s << " has wrong value for "
+               "variable " << it->first << std::endl;
+            ++errorCount;
+         }
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testThreadedShards_m
+
+/**
+ * Tests that receiving a malformed batch throws an exception.
+ * @returns the number of failures
+ */
+int testBadBatch_m()
+{
+   int errorCount = 0;
+   registerVariable(1,NO_COLOURS_M);
+   registerVariable(2,NO_COLOURS_M);
+
+   MaxSumShard shard(0);
+   shard.setFactor(1,DiscreteFunction(VarID(1),1));
+   shard.addBoundary(1,1);
+
+   if(1!=shard.noBoundaryVars())
+   {
+      std::cout << "Expected 1 boundary variable but found "
+         << shard.noBoundaryVars() << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Message for a variable that is not on the boundary
+   //***************************************************************************
+   LocalTransport transport(2);
+   unsigned int words[] = { 1, 2, NO_COLOURS_M };
+   Transport::Batch bad(sizeof(words)+NO_COLOURS_M*sizeof(ValType),0);
+   std::memcpy(&bad[0],words,sizeof(words));
+   transport.endpoint(1).send(0,bad);
+   try
+   {
+      shard.receiveBoundary(transport.endpoint(0));
+      std::cout << "No exception for unknown boundary variable." << std::endl;
+      ++errorCount;
+   }
+   catch(BadDomainException& e) {}
+
+   //***************************************************************************
+   // Truncated batch
+   //***************************************************************************
+   words[1] = 1;
+   Transport::Batch truncated(sizeof(words),0);
+   std::memcpy(&truncated[0],words,sizeof(words));
+   transport.endpoint(1).send(0,truncated);
+   try
+   {
+      shard.receiveBoundary(transport.endpoint(0));
+      std::cout << "No exception for truncated batch." << std::endl;
+      ++errorCount;
+   }
+   catch(BadDomainException& e) {}
+
+   //***************************************************************************
+   // Reserved factor id
+   //***************************************************************************
+   try
+   {
+      shard.setFactor(static_cast<FactorID>(-1),DiscreteFunction(VarID(2),1));
+      std::cout << "No exception for reserved factor id." << std::endl;
+      ++errorCount;
+   }
+   catch(OutOfRangeException& e) {}
+
+   return errorCount;
+
+} // function testBadBatch_m
+
+int main()
+{
+   int errorCount = 0; // counts the number of failures
+   try
+   {
+      FactorMap_m factors;
+
+      //************************************************************************
+      // Test partitioning
+      //************************************************************************
+      std::cout << "Testing partitionFactors..." << std::endl;
+      genRandomTree_m(40,NO_COLOURS_M,factors);
+      for(int noShards=1; noShards<=5; ++noShards)
+      {
+         errorCount += testPartition_m(factors,noShards);
+      }
+      errorCount += testPartition_m(FactorMap_m(),3);
+
+      //************************************************************************
+      // Test partitioned controller on acyclic graphs
+      //************************************************************************
+      std::cout << "Testing PartitionedController..." << std::endl;
+      for(int trial=0; trial<5; ++trial)
+      {
+         genRandomTree_m(30,NO_COLOURS_M,factors);
+         for(int noShards=1; noShards<=4; ++noShards)
+         {
+            errorCount += testPartitioned_m(factors,noShards);
+         }
+      }
+
+      //************************************************************************
+      // Test shards running in separate threads
+      //************************************************************************
+      std::cout << "Testing threaded MaxSumShards..." << std::endl;
+      genRandomTree_m(30,NO_COLOURS_M,factors);
+      errorCount += testThreadedShards_m(factors,3);
+
+      //************************************************************************
+      // Test error handling
+      //************************************************************************
+      std::cout << "Testing malformed batches..." << std::endl;
+      errorCount += testBadBatch_m();
+
+      std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "\nCaught unexpected exception in main: " << e.what();
+      std::cout << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
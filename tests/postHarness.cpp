@@ -450,6 +450,77 @@ bool testSwap(PostOffice_m& office)
 
 } // function testSwap
 
+/**
+ * Tests the message pool used to allocate messages.
+ */
+bool testMessagePool()
+{
+   //***************************************************************************
+   // Create a large number of objects, which should only need a few slabs
+   //***************************************************************************
+   const int NUM_OBJECTS = 1000;
+   MessagePool<DiscreteFunction> pool;
+   std::vector<DiscreteFunction*> objects;
+   for(int k=0; k<NUM_OBJECTS; ++k)
+   {
+      objects.push_back(pool.create(DiscreteFunction(k)));
+   }
+
+   if( (NUM_OBJECTS!=pool.size()) || (5<pool.noSlabs()) )
+   {
+      std::cout << "\nUnexpected pool size " << pool.size()
+         << " with " << pool.noSlabs() << " slabs.\n";
+      return false;
+   }
+
+   for(int k=0; k<NUM_OBJECTS; ++k)
+   {
+      if((*objects[k])(0)!=k)
+      {
+         std::cout << "\nPool object " << k << " has wrong value.\n";
+         return false;
+      }
+   }
+
+   //***************************************************************************
+   // Destroyed objects should be reused without allocating new slabs
+   //***************************************************************************
+   const int slabCount = pool.noSlabs();
+   std::set<DiscreteFunction*> freed;
+   for(int k=0; k<NUM_OBJECTS; k+=2)
+   {
+      freed.insert(objects[k]);
+      pool.destroy(objects[k]);
+   }
+
+   for(int k=0; k<NUM_OBJECTS; k+=2)
+   {
+      objects[k] = pool.create(DiscreteFunction(-k));
+      if(0==freed.count(objects[k]))
+      {
+         std::cout << "\nPool did not reuse freed object.\n";
+         return false;
+      }
+   }
+
+   if(slabCount!=pool.noSlabs())
+   {
+      std::cout << "\nPool allocated new slab despite free objects.\n";
+      return false;
+   }
+
+   //***************************************************************************
+   // Clean up
+   //***************************************************************************
+   for(int k=0; k<NUM_OBJECTS; ++k)
+   {
+      pool.destroy(objects[k]);
+   }
+
+   return 0==pool.size();
+
+} // function testMessagePool
+
 /**
  * Tests Notification functionality.
  */
@@ -913,6 +984,269 @@ bool isConsistent(const std::vector<Edge_m>& edges, PostOffice_m& office)
 
 } // function isConsistent
 
+/**
+ * Tests that notifications are deduplicated, and that notifications for
+ * unknown or removed receivers are ignored.
+ */
+bool testNoticeDedup(PostOffice_m& office)
+{
+   if(office.receiverBegin()==office.receiverEnd())
+   {
+      return true;
+   }
+   long receiver = *office.receiverBegin();
+
+   //***************************************************************************
+   // Notifying the same receiver repeatedly should only produce one notice
+   //***************************************************************************
+   office.notify(receiver);
+   office.notify(receiver);
+   office.notifyAll();
+   office.notify(receiver);
+   if(office.numOfReceivers()!=office.noticeCount())
+   {
+      std::cout << "\nDuplicate notices after repeated notification.\n";
+      return false;
+   }
+
+   std::set<long> popped;
+   while(office.newMail())
+   {
+      if(!popped.insert(office.popNotice()).second)
+      {
+         std::cout << "\nSame receiver popped twice.\n";
+         return false;
+      }
+   }
+
+   //***************************************************************************
+   // Unknown receivers should not be notified
+   //***************************************************************************
+   office.notify(-1);
+   if(office.newMail())
+   {
+      std::cout << "\nUnknown receiver was notified.\n";
+      return false;
+   }
+
+   //***************************************************************************
+   // Removing a notified receiver should remove its notice
+   //***************************************************************************
+   office.addEdge("dedup",-2);
+   office.notify(-2);
+   office.removeEdge("dedup",-2);
+   if(office.newMail() || 0!=office.noticeCount())
+   {
+      std::cout << "\nRemoved receiver still has notice.\n";
+      return false;
+   }
+
+   return true;
+
+} // function testNoticeDedup
+
+/**
+ * Tests that a copied PostOffice is consistent and shares no messages with
+ * its original.
+ */
+bool testCopy(const std::vector<Edge_m>& edges, PostOffice_m& office)
+{
+   PostOffice_m copy(office);
+   PostOffice_m assigned;
+   assigned.addEdge("z",99);
+   assigned = office;
+
+   if(!isConsistent(edges,copy) || !isConsistent(edges,assigned))
+   {
+      std::cout << "\nCopied PostOffice is inconsistent.\n";
+      return false;
+   }
+
+   for(std::vector<Edge_m>::const_iterator it=edges.begin();
+         it!=edges.end(); ++it)
+   {
+      DiscreteFunction* pOrig = office.curOutMsgs(it->sender)[it->receiver];
+      DiscreteFunction* pCopy = copy.curOutMsgs(it->sender)[it->receiver];
+      DiscreteFunction* pAssigned =
+         assigned.curOutMsgs(it->sender)[it->receiver];
+
+      if( (pOrig==pCopy) || (pOrig==pAssigned) )
+      {
+         std::cout << "\nCopied PostOffice shares messages with original.\n";
+         return false;
+      }
+
+      if( !(*pOrig==*pCopy) || !(*pOrig==*pAssigned) )
+      {
+         std::cout << "\nCopied message differs from original.\n";
+         return false;
+      }
+   }
+
+   //***************************************************************************
+   // Clearing the copies should leave the original intact
+   //***************************************************************************
+   copy.clear();
+   assigned.clear();
+   return isConsistent(edges,office) && checkInEqualsOut(office);
+
+} // function testCopy
+
+/**
+ * Checks that the current and previous messages of two post offices with
+ * the same edges are equal.
+ */
+bool sameMessages
+(
+ const std::vector<Edge_m>& edges,
+ const PostOffice_m& a,
+ const PostOffice_m& b
+)
+{
+   for(std::vector<Edge_m>::const_iterator it=edges.begin();
+         it!=edges.end(); ++it)
+   {
+      PostOffice_m::InMsgMap aCur = a.curInMsgs(it->receiver);
+      PostOffice_m::InMsgMap bCur = b.curInMsgs(it->receiver);
+      if( !(*a.curOutMsgs(it->sender)[it->receiver] ==
+               *b.curOutMsgs(it->sender)[it->receiver]) ||
+          !(*aCur[it->sender] == *bCur[it->sender]) )
+      {
+         return false;
+      }
+   }
+   return true;
+
+} // function sameMessages
+
+/**
+ * Tests that a forked PostOffice shares its messages with its original until
+ * either of them modifies them, and that neither sees the other's changes.
+ */
+bool testFork(const std::vector<Edge_m>& edges, PostOffice_m& office)
+{
+   PostOffice_m copy(office);
+   PostOffice_m fork;
+   fork.addEdge("z",99);
+   office.fork(fork);
+
+   //***************************************************************************
+   // Reading messages should not copy them.
+   //***************************************************************************
+   const PostOffice_m& constOffice = office;
+   const PostOffice_m& constFork = fork;
+   for(std::vector<Edge_m>::const_iterator it=edges.begin();
+         it!=edges.end(); ++it)
+   {
+      if(constOffice.curOutMsgs(it->sender)[it->receiver] !=
+            constFork.curOutMsgs(it->sender)[it->receiver])
+      {
+         std::cout << "\nForked PostOffice does not share messages.\n";
+         return false;
+      }
+   }
+
+   if( (office.numOfSharedSenders()!=office.numOfSenders()) ||
+       (fork.numOfSharedSenders()!=fork.numOfSenders()) )
+   {
+      std::cout << "\nWrong number of shared senders after fork.\n";
+      return false;
+   }
+
+   //***************************************************************************
+   // Accessing every outbox of the fork should give it its own copy of the
+   // same messages, and writing them should leave the original unchanged.
+   //***************************************************************************
+   if(!isConsistent(edges,fork) || !checkInEqualsOut(fork) || (0!=fork.numOfSharedSenders()) ||
+         !sameMessages(edges,copy,fork))
+   {
+      std::cout << "\nForked PostOffice did not copy shared messages.\n";
+      return false;
+   }
+
+   if(!fillOffice(fork) || !checkInEqualsOut(fork))
+   {
+      std::cout << "\nFailed to modify forked PostOffice.\n";
+      return false;
+   }
+
+   if(!sameMessages(edges,copy,office))
+   {
+      std::cout << "\nOriginal PostOffice was modified by its fork.\n";
+      return false;
+   }
+
+   //***************************************************************************
+   // Replacing an edge of a fork, and clearing it, should not affect the
+   // original either, which should then be able to take back its messages.
+   //***************************************************************************
+   PostOffice_m second;
+   office.fork(second);
+   second.removeEdge(edges.front().sender,edges.front().receiver);
+   second.addEdge(edges.front().sender,edges.front().receiver);
+   if(!isConsistent(edges,second) || !checkInEqualsOut(second))
+   {
+      std::cout << "\nFork with replaced edge is inconsistent.\n";
+      return false;
+   }
+   second.clear();
+
+   office.unshareAll();
+   return (0==office.numOfSharedSenders()) &&
+      sameMessages(edges,copy,office) && checkInEqualsOut(office);
+
+} // function testFork
+
+/**
+ * Provides the initial message for edges added by PostOffice::addEdges.
+ */
+struct EmptyMsg_m
+{
+   DiscreteFunction operator()(const std::string&, long) const
+   {
+      return DiscreteFunction();
+   }
+};
+
+/**
+ * Tests that adding edges in bulk gives the same post office as adding them
+ * one at a time, including when some edges already exist.
+ */
+bool testAddEdges(const std::vector<Edge_m>& edges)
+{
+   //***************************************************************************
+   // Add the first few edges one at a time, and then every edge in bulk,
+   // listing each edge twice and out of order.
+   //***************************************************************************
+   PostOffice_m office;
+   const std::size_t noSingle = edges.size()/3;
+   for(std::size_t k=0; k<noSingle; ++k)
+   {
+      office.addEdge(edges[k].sender,edges[k].receiver);
+   }
+
+   std::vector<std::pair<std::string,long> > bulk;
+   for(std::vector<Edge_m>::const_reverse_iterator it=edges.rbegin();
+         it!=edges.rend(); ++it)
+   {
+      bulk.push_back(std::make_pair(it->sender,it->receiver));
+      bulk.push_back(std::make_pair(it->sender,it->receiver));
+   }
+   office.addEdges(bulk,EmptyMsg_m());
+
+   if(!isConsistent(edges,office))
+   {
+      std::cout << "\nbulk edges are inconsistent.\n";
+      return false;
+   }
+
+   //***************************************************************************
+   // Messages and notices should work as normal on the new edges.
+   //***************************************************************************
+   return fillOffice(office) && testSwap(office) && testNotification(office);
+
+} // function testAddEdges
+
 int main()
 {
    int errorCount = 0;
@@ -988,6 +1322,20 @@ int main()
          ++errorCount;
       }
 
+      //************************************************************************
+      // Test that notifications are deduplicated
+      //************************************************************************
+      std::cout << "Trying to send duplicate notices...";
+      if(testNoticeDedup(postOffice))
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
+
       //************************************************************************
       // Ensure that duplicates change nothing
       //************************************************************************
@@ -1008,6 +1356,20 @@ int main()
          ++errorCount;
       }
 
+      //************************************************************************
+      // Check that edges can also be added in bulk
+      //************************************************************************
+      std::cout << "Registering edges in bulk...";
+      if(testAddEdges(edges))
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
+
       //************************************************************************
       // Check deletion works
       //************************************************************************
@@ -1059,6 +1421,66 @@ int main()
          std::cout << "FAILED\n";
          ++errorCount;
       }
+
+      //************************************************************************
+      // Swapping should still work after edges are added and removed
+      //************************************************************************
+      std::cout << "Trying to swap messages after changing edges...";
+      postOffice.addEdge("f",7);
+      postOffice.addEdge("a",7);
+      remainingEdges.push_back(Edge_m("f",7));
+      remainingEdges.push_back(Edge_m("a",7));
+      if(isConsistent(remainingEdges,postOffice) && testSwap(postOffice))
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Test copy construction and assignment
+      //************************************************************************
+      std::cout << "Trying to copy PostOffice...";
+      if(testCopy(remainingEdges,postOffice))
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Test forking, which shares messages until they are modified
+      //************************************************************************
+      std::cout << "Trying to fork PostOffice...";
+      if(testFork(remainingEdges,postOffice))
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
+
+      //************************************************************************
+      // Test message pool used by PostOffice
+      //************************************************************************
+      std::cout << "Trying to allocate messages from pool...";
+      if(testMessagePool())
+      {
+         std::cout << "OK\n";
+      }
+      else
+      {
+         std::cout << "FAILED\n";
+         ++errorCount;
+      }
    }
    //***************************************************************************
    // Catch any unexpected exceptions.
@@ -0,0 +1,377 @@
+/**
+ * @file structuredHarness.cpp
+ * Test harness for PottsFactor, SparseFactor and their use by
+ * MaxSumController. Checks that structured factors give the same messages
+ * and values as the equivalent dense factors.
+ */
+
+#include "maxsum/common.h"
+#include "maxsum/MaxSumController.h"
+#include "maxsum/StructuredFactor.h"
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <memory>
+using namespace maxsum;
+
+/**
+ * Number of values for each variable.
+ */
+const int NO_VALUES_M = 4;
+
+/**
+ * Returns a random value in [-1,1].
+ */
+ValType randVal_m()
+{
+   return 2 * static_cast<ValType>(std::rand()) / RAND_MAX - 1;
+}
+
+/**
+ * Compares the messages computed by a structured factor with those computed
+ * by max marginalising its dense expansion, for random input messages.
+ * @param[in] factor the factor to test.
+ * @param[in] name name of the factor used to report failures.
+ * @returns the number of failures
+ */
+int checkMaxMarginals_m(const StructuredFactor& factor, const char* name)
+{
+   int errorCount = 0;
+   const int n = factor.noVars();
+
+   //***************************************************************************
+   // Create random input messages, and space for the output messages.
+   //***************************************************************************
+   std::vector<DiscreteFunction> inMsgs, outMsgs;
+   std::vector<const ValType*> in;
+   std::vector<ValType*> out;
+   for(StructuredFactor::VarIterator it=factor.varBegin();
+         it!=factor.varEnd(); ++it)
+   {
+      inMsgs.push_back(DiscreteFunction(*it,0));
+      outMsgs.push_back(DiscreteFunction(*it,0));
+      for(ValIndex x=0; x<inMsgs.back().domainSize(); ++x)
+      {
+         inMsgs.back()(x) = randVal_m();
+      }
+   }
+   for(int k=0; k<n; ++k)
+   {
+      in.push_back(&inMsgs[k](0));
+      out.push_back(&outMsgs[k](0));
+   }
+   factor.maxMarginals(in,out);
+
+   //***************************************************************************
+   // Compare with the dense calculation.
+   //***************************************************************************
+   DiscreteFunction dense;
+   factor.expand(dense);
+   for(int k=0; k<n; ++k)
+   {
+      DiscreteFunction total(dense);
+      for(int j=0; j<n; ++j)
+      {
+         if(j!=k)
+         {
+            total += inMsgs[j];
+         }
+      }
+
+      DiscreteFunction expected(*(factor.varBegin()+k),0);
+      maxMarginal(total,expected);
+      if(!equalWithinTolerance(expected,outMsgs[k]))
+      {
+         std::cout << name << " message " << k << " of " << n
+            << " differs from dense calculation." << std::endl;
+         ++errorCount;
+      }
+   }
+
+   return errorCount;
+
+} // function checkMaxMarginals_m
+
+/**
+ * Tests Potts factor messages against their dense expansion.
+ * @returns the number of failures
+ */
+int testPotts_m()
+{
+   int errorCount = 0;
+   VarID vars[] = {1,2,3,4};
+   for(int n=1; n<=4; ++n)
+   {
+      for(int trial=0; trial<20; ++trial)
+      {
+         PottsFactor factor(vars,vars+n,2*randVal_m());
+         errorCount += checkMaxMarginals_m(factor,"Potts");
+      }
+   }
+
+   //***************************************************************************
+   // Check errors
+   //***************************************************************************
+   registerVariable(13,NO_VALUES_M+1);
+   VarID mixed[] = {1,13};
+   try
+   {
+      PottsFactor bad(mixed,mixed+2,1);
+      std::cout << "No exception for mixed Potts domain." << std::endl;
+      ++errorCount;
+   }
+   catch(BadDomainException& e) {}
+
+   try
+   {
+      PottsFactor bad(mixed,mixed,1);
+      std::cout << "No exception for empty Potts domain." << std::endl;
+      ++errorCount;
+   }
+   catch(BadDomainException& e) {}
+
+   return errorCount;
+
+} // function testPotts_m
+
+/**
+ * Tests sparse factor messages against their dense expansion.
+ * @returns the number of failures
+ */
+int testSparse_m()
+{
+   int errorCount = 0;
+   VarID vars[] = {1,2,3,13};
+   for(int n=1; n<=4; ++n)
+   {
+      for(int trial=0; trial<20; ++trial)
+      {
+         //*********************************************************************
+         // Alternate between stored values above and below the default. In
+         // the latter case, also store the best assignment, to force the
+         // default to be found by scanning.
+         //*********************************************************************
+         SparseFactor factor(vars,vars+n,0);
+         for(int k=0; k<5; ++k)
+         {
+            ValType val = randVal_m();
+            factor.set(std::rand()%factor.domainSize(),
+                  0==trial%2 ? std::fabs(val) : val);
+         }
+         errorCount += checkMaxMarginals_m(factor,"Sparse");
+      }
+
+      //************************************************************************
+      // Also check a completely filled sparse factor.
+      //************************************************************************
+      SparseFactor full(vars,vars+n,1);
+      for(ValIndex k=0; k<full.domainSize(); ++k)
+      {
+         full.set(k,randVal_m());
+      }
+      errorCount += checkMaxMarginals_m(full,"Full sparse");
+   }
+
+   //***************************************************************************
+   // Check values and errors
+   //***************************************************************************
+   SparseFactor factor(vars,vars+2,-1);
+   std::vector<ValIndex> sub(2,1);
+   factor.set(sub,5);
+   if( (5!=factor(1+NO_VALUES_M)) || (-1!=factor(0)) ||
+       (1!=factor.noEntries()) )
+   {
+      std::cout << "Sparse factor has wrong values." << std::endl;
+      ++errorCount;
+   }
+
+   try
+   {
+      factor.set(factor.domainSize(),1);
+      std::cout << "No exception for bad sparse index." << std::endl;
+      ++errorCount;
+   }
+   catch(OutOfRangeException& e) {}
+
+   try
+   {
+      sub[1] = NO_VALUES_M;
+      factor.set(sub,1);
+      std::cout << "No exception for bad sparse sub-index." << std::endl;
+      ++errorCount;
+   }
+   catch(OutOfRangeException& e) {}
+
+   return errorCount;
+
+} // function testSparse_m
+
+/**
+ * Tests that a controller gives the same values with structured factors as
+ * with their dense expansions, on a random tree with Potts factors between
+ * neighbouring variables and sparse factors on each variable.
+ * @param[in] noVars number of variables in the tree.
+ * @param[in] compiled true if the controllers should be compiled.
+ * @returns the number of failures
+ */
+int testController_m(int noVars, bool compiled)
+{
+   int errorCount = 0;
+   try
+   {
+      MaxSumController structured, dense;
+      const VarID base = 100;
+      for(int k=0; k<noVars; ++k)
+      {
+         registerVariable(base+k,NO_VALUES_M);
+      }
+
+      for(int k=0; k<noVars; ++k)
+      {
+         //*********************************************************************
+         // Unary bias as a sparse factor
+         //*********************************************************************
+         VarID var = base+k;
+         SparseFactor bias(&var,&var+1,0);
+         bias.set(std::rand()%NO_VALUES_M,randVal_m());
+         bias.set(std::rand()%NO_VALUES_M,randVal_m());
+         DiscreteFunction denseBias;
+         bias.expand(denseBias);
+         structured.setFactor(2*k,bias);
+         dense.setFactor(2*k,denseBias);
+
+         //*********************************************************************
+         // Repulsive Potts factor with a previous variable
+         //*********************************************************************
+         if(0<k)
+         {
+            VarID edge[] = { var, base + std::rand()%k };
+            PottsFactor potts(edge,edge+2,-1);
+            DiscreteFunction densePotts;
+            potts.expand(densePotts);
+            structured.setFactor(2*k+1,potts);
+            dense.setFactor(2*k+1,densePotts);
+         }
+      }
+
+      if( (structured.noFactors()!=dense.noFactors()) ||
+          (structured.noEdges()!=dense.noEdges()) ||
+          (structured.noStructuredFactors()!=structured.noFactors()) )
+      {
+         std::cout << "Structured controller has wrong size." << std::endl;
+         ++errorCount;
+      }
+
+      if(compiled)
+      {
+         structured.compile();
+         dense.compile();
+      }
+      structured.optimise();
+      dense.optimise();
+
+      for(MaxSumController::ConstValueIterator it=dense.valBegin();
+            it!=dense.valEnd(); ++it)
+      {
+         if(structured.getValue(it->first)!=it->second)
+         {
+            std::cout << "Variable " << it->first << " has value "
+               << structured.getValue(it->first) << " with structured factors"
+               " but " << it->second << " with dense factors." << std::endl;
+            ++errorCount;
+         }
+      }
+
+      //************************************************************************
+      // Check access to structured factors
+      //************************************************************************
+      if(!structured.isStructured(0) ||
+         (0!=structured.getStructuredFactor(0).noVars()-1))
+      {
+         std::cout << "Cannot access structured factor." << std::endl;
+         ++errorCount;
+      }
+
+      try
+      {
+         structured.getFactor(0);
+         std::cout << "getFactor returned a structured factor." << std::endl;
+         ++errorCount;
+      }
+      catch(NoSuchElementException* e)
+      {
+         delete e;
+      }
+
+      //************************************************************************
+      // Replace a structured factor with a dense one, and remove another.
+      //************************************************************************
+      structured.setFactor(0,dense.getFactor(0));
+      structured.removeFactor(2);
+      if( structured.isStructured(0) || !structured.hasFactor(0) ||
+          structured.hasFactor(2) ||
+          (dense.noFactors()-1!=structured.noFactors()) )
+      {
+         std::cout << "Wrong factors after replacement." << std::endl;
+         ++errorCount;
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught unexpected exception: " << e.what() << std::endl;
+      ++errorCount;
+   }
+
+   return errorCount;
+
+} // function testController_m
+
+int main()
+{
+   int errorCount = 0; // counts the number of failures
+   try
+   {
+      for(VarID var=1; var<=4; ++var)
+      {
+         registerVariable(var,NO_VALUES_M);
+      }
+
+      //************************************************************************
+      // Test messages of each type of structured factor
+      //************************************************************************
+      std::cout << "Testing PottsFactor..." << std::endl;
+      errorCount += testPotts_m();
+
+      std::cout << "Testing SparseFactor..." << std::endl;
+      errorCount += testSparse_m();
+
+      //************************************************************************
+      // Test structured factors in a controller
+      //************************************************************************
+      std::cout << "Testing MaxSumController with structured factors..."
+         << std::endl;
+      for(int trial=0; trial<5; ++trial)
+      {
+         errorCount += testController_m(20,false);
+         errorCount += testController_m(20,true);
+      }
+
+      std::cout << "NUMBER OF ERRORS: " << errorCount << std::endl;
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "\nCaught unexpected exception in main: " << e.what();
+      std::cout << std::endl;
+      ++errorCount;
+   }
+
+   //***************************************************************************
+   // Return success if all tests in this harness have passed.
+   //***************************************************************************
+   if(0==errorCount)
+   {
+      return EXIT_SUCCESS;
+   }
+   return EXIT_FAILURE;
+
+} // function main
@@ -0,0 +1,73 @@
+/**
+ * @file testUtils.h
+ * Graph colouring problem generators shared by the test harnesses and
+ * benchmarks.
+ */
+#ifndef MAXSUM_TEST_UTILS_H
+#define MAXSUM_TEST_UTILS_H
+
+#include "maxsum/common.h"
+#include "maxsum/DiscreteFunction.h"
+#include "maxsum/DomainIterator.h"
+#include "maxsum/register.h"
+#include <cstdlib>
+#include <map>
+#include <set>
+
+namespace maxsum
+{
+   /**
+    * Fills a factor with graph colouring utilities: a small random bias,
+    * minus the number of variables sharing a value.
+    * @param[in,out] factor the factor to fill, without changing its domain.
+    */
+   inline void genColourUtil_m(DiscreteFunction& factor)
+   {
+      for(DomainIterator it(factor); it.hasNext(); ++it)
+      {
+         std::set<ValIndex> unique(it.getSubInd().begin(),it.getSubInd().end());
+         ValType util = static_cast<ValType>(std::rand()) / RAND_MAX / 10;
+         util -= static_cast<ValType>(it.getSubInd().size()-unique.size());
+         factor(it) = util;
+      }
+
+   } // function genColourUtil_m
+
+   /**
+    * Generates a random tree graph colouring problem. Factor 1 depends only
+    * on variable 1, and each factor k>1 depends on variable k and one of the
+    * variables of the previous factors.
+    * @param[in] noFactors the number of factors to generate.
+    * @param[in] noColours the number of colours for each variable.
+    * @param[out] factors map in which to store the generated factors.
+    * @post any previous contents of <code>factors</code> will be destroyed.
+    */
+   inline void genRandomTree_m
+   (
+    int noFactors,
+    ValIndex noColours,
+    std::map<FactorID,DiscreteFunction>& factors
+   )
+   {
+      factors.clear();
+      for(int k=1; k<=noFactors; ++k)
+      {
+         registerVariable(k,noColours);
+      }
+
+      for(int k=1; k<=noFactors; ++k)
+      {
+         DiscreteFunction curFactor(static_cast<VarID>(k),0);
+         if(1<k)
+         {
+            curFactor.expand(1+std::rand()%(k-1));
+         }
+         genColourUtil_m(curFactor);
+         factors[k] = curFactor;
+      }
+
+   } // function genRandomTree_m
+
+} // namespace maxsum
+
+#endif // MAXSUM_TEST_UTILS_H
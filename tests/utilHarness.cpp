@@ -1,4 +1,6 @@
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -6,9 +8,11 @@
 #include <vector>
 #include <list>
 #include <queue>
+#include <thread>
 #include "maxsum/register.h"
 #include "maxsum/common.h"
 #include "maxsum/DiscreteFunction.h"
+#include "maxsum/SmallVector.h"
 
 namespace
 {
@@ -574,6 +578,270 @@ int testRegister()
 
 } // function testRegister
 
+/**
+ * Registers variables from several threads at once, while other threads
+ * look them up, and checks that every variable ends up registered exactly
+ * once with the right size.
+ * @returns 0 on success, or a positive number on failure.
+ */
+int testConcurrentRegister()
+{
+   using namespace maxsum;
+
+   //***************************************************************************
+   // Each thread registers an overlapping range of dense and sparse ids.
+   // Sparse ids are large enough to be stored in the hash table.
+   //***************************************************************************
+   const int NO_THREADS = 4;
+   const VarID NO_VARS = 2000;
+   const VarID DENSE_BASE = 1000;
+   const VarID SPARSE_BASE = 0x80000000u;
+   const int startCount = getNumOfRegisteredVariables();
+   std::atomic<int> failures(0);
+
+   std::vector<std::thread> threads;
+   for(int t=0; t<NO_THREADS; ++t)
+   {
+      threads.push_back(std::thread([=,&failures]()
+      {
+         try
+         {
+            for(VarID k=t*NO_VARS/NO_THREADS; k<NO_VARS; ++k)
+            {
+               registerVariable(DENSE_BASE+k,2+k%7);
+               registerVariable(SPARSE_BASE+k*7919,2+k%5);
+               if( (getDomainSize(DENSE_BASE+k)!=static_cast<ValIndex>(2+k%7))
+                  || (getDomainSize(SPARSE_BASE+k*7919)!=
+                     static_cast<ValIndex>(2+k%5)) )
+               {
+                  ++failures;
+               }
+            }
+         }
+         catch(std::exception& e)
+         {
+            ++failures;
+         }
+      }));
+   }
+
+   for(int t=0; t<NO_THREADS; ++t)
+   {
+      threads[t].join();
+   }
+
+   if(0!=failures)
+   {
+      std::cout << "Concurrent registration failed " << failures << " times\n";
+      return 16;
+   }
+
+   //***************************************************************************
+   // Check the final state of the register
+   //***************************************************************************
+   if(getNumOfRegisteredVariables()!=startCount+2*static_cast<int>(NO_VARS))
+   {
+      std::cout << "Incorrect number of registered variables after "
+         "concurrent registration: " << getNumOfRegisteredVariables();
+      std::cout << std::endl;
+      return 17;
+   }
+
+   for(VarID k=0; k<NO_VARS; ++k)
+   {
+      if( (getDomainSize(DENSE_BASE+k)!=static_cast<ValIndex>(2+k%7)) ||
+          (getDomainSize(SPARSE_BASE+k*7919)!=static_cast<ValIndex>(2+k%5)) )
+      {
+         std::cout << "Wrong domain size after concurrent registration\n";
+         return 18;
+      }
+   }
+
+   try
+   {
+      registerVariable(SPARSE_BASE+7919,100);
+      std::cout << "Domain size of sparse variable cannot change" << std::endl;
+      return 19;
+   }
+   catch(InconsistentDomainException e) { /* this should happen */ }
+
+   try
+   {
+      getDomainSize(SPARSE_BASE+1);
+      std::cout << "Missing UnknownVariableException for sparse id\n";
+      return 20;
+   }
+   catch(UnknownVariableException e) { /* this should happen */ }
+
+   std::cout << "Concurrent registration tests all passed.\n";
+   return 0;
+
+} // function testConcurrentRegister
+
+/**
+ * Tests the maxsum::util::SmallVector class, both while its elements are
+ * stored inline, and after they have moved to the heap.
+ * @returns 0 on success, or a positive number on failure.
+ */
+int testSmallVector()
+{
+   using namespace maxsum::util;
+   typedef SmallVector<int,4> Vec;
+
+   //***************************************************************************
+   // Check inline storage
+   //***************************************************************************
+   Vec a(3,7);
+   if( (3!=a.size()) || !a.isInline() || (7!=a[2]) )
+   {
+      std::cout << "SmallVector should store 3 elements inline.\n";
+      return 21;
+   }
+
+   //***************************************************************************
+   // Growing past the inline capacity should keep existing elements
+   //***************************************************************************
+   for(int k=0; k<10; ++k)
+   {
+      a.push_back(k);
+   }
+
+   if( (13!=a.size()) || a.isInline() || (7!=a[0]) || (9!=a[12]) )
+   {
+      std::cout << "SmallVector lost elements when moving to the heap.\n";
+      return 22;
+   }
+
+   //***************************************************************************
+   // Copies and swaps should work in any combination of storage types
+   //***************************************************************************
+   Vec b(a);
+   Vec c(2,1);
+   std::vector<int> expectA(a.begin(),a.end());
+   std::vector<int> expectC(c.begin(),c.end());
+   a.swap(c);
+   if(!std::equal(expectA.begin(),expectA.end(),c.begin()) ||
+      !std::equal(expectC.begin(),expectC.end(),a.begin()) ||
+      (expectA.size()!=c.size()) || (expectC.size()!=a.size()))
+   {
+      std::cout << "SmallVector swap between inline and heap failed.\n";
+      return 23;
+   }
+
+   b.swap(c);
+   if( (13!=b.size()) || (13!=c.size()) || (b[12]!=c[12]) )
+   {
+      std::cout << "SmallVector swap between heap arrays failed.\n";
+      return 24;
+   }
+
+   c = a;
+   c.clear();
+   if( !c.empty() || !c.isInline() || (2!=a.size()) )
+   {
+      std::cout << "SmallVector clear failed.\n";
+      return 25;
+   }
+
+   int range[] = {5,4,3,2,1};
+   Vec d(range,range+5);
+   d.resize(2);
+   if( (2!=d.size()) || (4!=d[1]) )
+   {
+      std::cout << "SmallVector resize failed.\n";
+      return 26;
+   }
+
+   //***************************************************************************
+   // Check borrowed storage is used in place, moved by pointer, and copied
+   // to the heap when it grows.
+   //***************************************************************************
+   Vec e;
+   e.borrow(range,5);
+   e[0] = 7;
+   Vec f(std::move(e));
+   if( (7!=range[0]) || !f.isBorrowed() || (range!=f.data()) ||
+       e.isBorrowed() || !e.empty() )
+   {
+      std::cout << "SmallVector borrow failed.\n";
+      return 27;
+   }
+
+   f.push_back(0);
+   f[1] = 9;
+   if( f.isBorrowed() || (6!=f.size()) || (4!=range[1]) || (7!=f[0]) )
+   {
+      std::cout << "SmallVector failed to copy borrowed array on growth.\n";
+      return 28;
+   }
+
+   //***************************************************************************
+   // Changing the size of a borrowed array, by assignment, resizing or
+   // swapping, should copy it rather than write into it.
+   //***************************************************************************
+   int source[] = {1,2,3,4,5};
+   Vec g;
+   g.borrow(source,5);
+   g.assign(Vec::size_type(2),0);
+   Vec h;
+   h.borrow(source,5);
+   h.resize(3);
+   h[0] = 0;
+   Vec i(1,0);
+   Vec j;
+   j.borrow(source,5);
+   i.swap(j);
+   i[0] = 0;
+   if( g.isBorrowed() || h.isBorrowed() || (2!=h[1]) || !i.isBorrowed() ||
+       (source!=i.data()) || (1!=j.size()) || (0!=j[0]) )
+   {
+      std::cout << "SmallVector kept borrowing after a change of size.\n";
+      return 29;
+   }
+   i[0] = 1;
+   if( (1!=source[0]) || (2!=source[1]) || (5!=source[4]) )
+   {
+      std::cout << "SmallVector wrote into a borrowed array.\n";
+      return 30;
+   }
+
+   //***************************************************************************
+   // A borrowed function should stop borrowing when it is assigned a scalar
+   // or a function with a different domain, but not otherwise.
+   //***************************************************************************
+   const maxsum::VarID vars[] = {9001,9002};
+   maxsum::registerVariable(vars[0],2);
+   maxsum::registerVariable(vars[1],3);
+   maxsum::ValType values[] = {1,2,3,4,5,6};
+   maxsum::DiscreteFunction borrowed(vars,vars+2,values,6);
+   borrowed = 7;
+   if( borrowed.isBorrowed() || (7!=borrowed(0)) || (1!=values[0]) )
+   {
+      std::cout << "Scalar assignment wrote into a borrowed array.\n";
+      return 31;
+   }
+
+   maxsum::DiscreteFunction other(vars,vars+2,values,6);
+   other = maxsum::DiscreteFunction(vars[1],2);
+   if( other.isBorrowed() || (3!=other.domainSize()) || (1!=values[0]) )
+   {
+      std::cout << "Assignment of a new domain wrote into a borrowed array.\n";
+      return 32;
+   }
+
+   maxsum::DiscreteFunction same(vars,vars+2,values,6);
+   same = maxsum::DiscreteFunction(vars,vars+2,8);
+   if( !same.isBorrowed() || (8!=values[5]) )
+   {
+      std::cout << "Assignment of the same domain stopped borrowing.\n";
+      return 33;
+   }
+
+   std::cout << "SmallVector tests all passed.\n";
+   return 0;
+
+} // function testSmallVector
+
 int main()
 {
    //***************************************************************************
@@ -600,5 +868,29 @@ int main()
       return exitValue;
    }
 
+   //***************************************************************************
+   // Test concurrent use of the variable register
+   //***************************************************************************
+   std::cout << "***************************************" << std::endl;
+   std::cout << "Test Concurrent Variable Register" << std::endl;
+   std::cout << "***************************************" << std::endl;
+   exitValue = testConcurrentRegister();
+   if(0!=exitValue)
+   {
+      return exitValue;
+   }
+
+   //***************************************************************************
+   // Test small buffer container
+   //***************************************************************************
+   std::cout << "***************************************" << std::endl;
+   std::cout << "Test SmallVector" << std::endl;
+   std::cout << "***************************************" << std::endl;
+   exitValue = testSmallVector();
+   if(0!=exitValue)
+   {
+      return exitValue;
+   }
+
 } // function main
 